@@ -52,7 +52,7 @@ cd_iccdump_print_file (const gchar *filename, GError **error)
 	/* load the profile */
 	icc = cd_icc_new ();
 	file = g_file_new_for_path (filename);
-	if (!cd_icc_load_file (icc, file, CD_ICC_LOAD_FLAGS_NONE, NULL, error))
+	if (!cd_icc_load_file (icc, file, CD_ICC_LOAD_FLAGS_MAPPED, NULL, error))
 		return FALSE;
 
 	/* dump it to text on the console */
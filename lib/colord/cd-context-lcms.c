@@ -135,22 +135,35 @@ cmsPluginParametricCurves cd_icc_lcms_plugins = {
 };
 
 /**
- * cd_context_lcms_new:
+ * cd_context_lcms_new_full:
+ * @plugin: (nullable): plugins that have to be registered when creating
+ * the context, e.g. a memory handler
  *
  * Return value: (transfer full): A new LCMS context
  **/
 gpointer
-cd_context_lcms_new (void)
+cd_context_lcms_new_full (gpointer plugin)
 {
 	cmsContext ctx;
 	GError **error_ctx;
 	error_ctx = g_new0 (GError *, 1);
-	ctx = cmsCreateContext (NULL, error_ctx);
+	ctx = cmsCreateContext (plugin, error_ctx);
 	cmsSetLogErrorHandlerTHR (ctx, cd_context_lcms2_error_cb);
 	cmsPluginTHR (ctx, &cd_icc_lcms_plugins);
 	return ctx;
 }
 
+/**
+ * cd_context_lcms_new:
+ *
+ * Return value: (transfer full): A new LCMS context
+ **/
+gpointer
+cd_context_lcms_new (void)
+{
+	return cd_context_lcms_new_full (NULL);
+}
+
 /**
  * cd_context_lcms_free:
  **/
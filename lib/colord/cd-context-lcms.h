@@ -30,6 +30,7 @@
 #include <glib.h>
 
 gpointer	 cd_context_lcms_new		(void);
+gpointer	 cd_context_lcms_new_full	(gpointer	 plugin);
 void		 cd_context_lcms_free		(gpointer	 ctx);
 void		 cd_context_lcms_error_clear	(gpointer	 ctx);
 gboolean	 cd_context_lcms_error_check	(gpointer	 ctx,
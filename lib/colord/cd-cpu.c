@@ -0,0 +1,307 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2026 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/**
+ * SECTION:cd-cpu
+ * @short_description: Works out how many worker threads are useful
+ *
+ * The topology is probed once per process and honours the affinity mask,
+ * any cgroup v2 CPU quota and SMT siblings, which share the execution
+ * units the transforms are limited by.
+ */
+
+#define _GNU_SOURCE
+
+#include "config.h"
+
+#include <errno.h>
+#include <gio/gio.h>
+#include <glib.h>
+#ifdef HAVE_SCHED_GETAFFINITY
+#include <sched.h>
+#endif
+
+#include "cd-cpu.h"
+
+/* nodes above this are folded into the last one */
+#define CD_CPU_NODES_MAX	64
+
+typedef struct {
+	guint			 n_threads;
+	guint			 n_nodes;
+#ifdef HAVE_SCHED_GETAFFINITY
+	cpu_set_t		 nodes[CD_CPU_NODES_MAX];
+#endif
+} CdCpuTopology;
+
+static CdCpuTopology cpu_topology = { 0 };
+
+/* parses a cgroup v2 "cpu.max" value like "150000 100000" */
+static guint
+cd_cpu_get_cgroup_quota_for_path (const gchar *path)
+{
+	guint64 period;
+	guint64 quota;
+	g_autofree gchar *data = NULL;
+	g_autofree gchar *fn = NULL;
+	g_auto(GStrv) split = NULL;
+
+	fn = g_build_filename ("/sys/fs/cgroup", path, "cpu.max", NULL);
+	if (!g_file_get_contents (fn, &data, NULL, NULL))
+		return G_MAXUINT;
+	split = g_strsplit_set (g_strstrip (data), " ", -1);
+	if (g_strv_length (split) != 2 || g_strcmp0 (split[0], "max") == 0)
+		return G_MAXUINT;
+	quota = g_ascii_strtoull (split[0], NULL, 10);
+	period = g_ascii_strtoull (split[1], NULL, 10);
+	if (quota == 0 || period == 0)
+		return G_MAXUINT;
+
+	/* a quota of 1.5 CPUs can still keep two threads busy */
+	return MAX ((quota + period - 1) / period, 1);
+}
+
+/* the most restrictive quota of our cgroup and all of its parents */
+static guint
+cd_cpu_get_cgroup_quota (void)
+{
+	guint quota = G_MAXUINT;
+	g_autofree gchar *data = NULL;
+	g_autofree gchar *path = NULL;
+	g_auto(GStrv) lines = NULL;
+	guint i;
+
+	if (!g_file_get_contents ("/proc/self/cgroup", &data, NULL, NULL))
+		return G_MAXUINT;
+	lines = g_strsplit (data, "\n", -1);
+	for (i = 0; lines[i] != NULL; i++) {
+		if (g_str_has_prefix (lines[i], "0::")) {
+			path = g_strdup (lines[i] + 3);
+			break;
+		}
+	}
+	if (path == NULL)
+		return G_MAXUINT;
+	while (TRUE) {
+		g_autofree gchar *parent = NULL;
+		quota = MIN (quota, cd_cpu_get_cgroup_quota_for_path (path));
+		if (g_strcmp0 (path, "/") == 0 || path[0] == '\0')
+			break;
+		parent = g_path_get_dirname (path);
+		if (g_strcmp0 (parent, path) == 0)
+			break;
+		g_free (path);
+		path = g_steal_pointer (&parent);
+	}
+	return quota;
+}
+
+#ifdef HAVE_SCHED_GETAFFINITY
+/* parses a kernel CPU list like "0-3,8-11" */
+static gboolean
+cd_cpu_parse_list (const gchar *str, cpu_set_t *set)
+{
+	guint i;
+	g_auto(GStrv) ranges = NULL;
+
+	CPU_ZERO (set);
+	ranges = g_strsplit (str, ",", -1);
+	for (i = 0; ranges[i] != NULL; i++) {
+		gchar *endptr = NULL;
+		guint64 first;
+		guint64 j;
+		guint64 last;
+
+		g_strstrip (ranges[i]);
+		if (ranges[i][0] == '\0')
+			continue;
+		first = g_ascii_strtoull (ranges[i], &endptr, 10);
+		if (endptr == ranges[i])
+			return FALSE;
+		last = first;
+		if (*endptr == '-')
+			last = g_ascii_strtoull (endptr + 1, NULL, 10);
+		if (last < first || last >= CPU_SETSIZE)
+			return FALSE;
+		for (j = first; j <= last; j++)
+			CPU_SET (j, set);
+	}
+	return TRUE;
+}
+
+/* counts the physical cores, as SMT siblings share one list */
+static guint
+cd_cpu_get_n_cores (const cpu_set_t *affinity)
+{
+	guint i;
+	g_autoptr(GHashTable) cores = NULL;
+
+	cores = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	for (i = 0; i < CPU_SETSIZE; i++) {
+		gchar *data = NULL;
+		g_autofree gchar *fn = NULL;
+
+		if (!CPU_ISSET (i, affinity))
+			continue;
+		fn = g_strdup_printf ("/sys/devices/system/cpu/cpu%u/topology/thread_siblings_list", i);
+		if (!g_file_get_contents (fn, &data, NULL, NULL))
+			return 0;
+		g_hash_table_add (cores, g_strstrip (data));
+	}
+	return g_hash_table_size (cores);
+}
+
+/* finds the NUMA nodes that have at least one CPU we can run on */
+static void
+cd_cpu_probe_nodes (CdCpuTopology *topology, const cpu_set_t *affinity)
+{
+	const gchar *name;
+	g_autoptr(GDir) dir = NULL;
+
+	/* node numbers can have holes */
+	dir = g_dir_open ("/sys/devices/system/node", 0, NULL);
+	if (dir == NULL)
+		return;
+	while ((name = g_dir_read_name (dir)) != NULL) {
+		cpu_set_t set;
+		g_autofree gchar *data = NULL;
+		g_autofree gchar *fn = NULL;
+
+		if (!g_str_has_prefix (name, "node") ||
+		    !g_ascii_isdigit (name[4]))
+			continue;
+		fn = g_build_filename ("/sys/devices/system/node",
+				       name, "cpulist", NULL);
+		if (!g_file_get_contents (fn, &data, NULL, NULL))
+			continue;
+		if (!cd_cpu_parse_list (data, &set))
+			continue;
+		CPU_AND (&set, &set, affinity);
+		if (CPU_COUNT (&set) == 0)
+			continue;
+		if (topology->n_nodes == CD_CPU_NODES_MAX) {
+			cpu_set_t *last = &topology->nodes[CD_CPU_NODES_MAX - 1];
+			CPU_OR (last, last, &set);
+			continue;
+		}
+		topology->nodes[topology->n_nodes++] = set;
+	}
+}
+#endif
+
+static void
+cd_cpu_probe (CdCpuTopology *topology)
+{
+	guint n_cores = 0;
+	guint quota;
+#ifdef HAVE_SCHED_GETAFFINITY
+	cpu_set_t affinity;
+
+	/* only count the CPUs we are allowed to run on */
+	if (sched_getaffinity (0, sizeof (affinity), &affinity) == 0) {
+		n_cores = cd_cpu_get_n_cores (&affinity);
+		if (n_cores == 0)
+			n_cores = CPU_COUNT (&affinity);
+		cd_cpu_probe_nodes (topology, &affinity);
+	}
+#endif
+	if (n_cores == 0)
+		n_cores = g_get_num_processors ();
+
+	/* containers often have fewer CPUs than are visible */
+	quota = cd_cpu_get_cgroup_quota ();
+	topology->n_threads = CLAMP (MIN (n_cores, quota), 1, G_MAXINT);
+	if (topology->n_nodes == 0)
+		topology->n_nodes = 1;
+	g_debug ("using %u threads over %u NUMA nodes",
+		 topology->n_threads, topology->n_nodes);
+}
+
+static CdCpuTopology *
+cd_cpu_get_topology (void)
+{
+	static gsize once = 0;
+
+	if (g_once_init_enter (&once)) {
+		cd_cpu_probe (&cpu_topology);
+		g_once_init_leave (&once, 1);
+	}
+	return &cpu_topology;
+}
+
+/**
+ * cd_cpu_get_n_threads:
+ *
+ * Gets the number of threads that can usefully run at the same time.
+ *
+ * Return value: a number of threads, never zero
+ **/
+guint
+cd_cpu_get_n_threads (void)
+{
+	return cd_cpu_get_topology ()->n_threads;
+}
+
+/**
+ * cd_cpu_get_n_nodes:
+ *
+ * Gets the number of NUMA nodes the process can run on.
+ *
+ * Return value: a number of nodes, never zero
+ **/
+guint
+cd_cpu_get_n_nodes (void)
+{
+	return cd_cpu_get_topology ()->n_nodes;
+}
+
+/**
+ * cd_cpu_bind_to_node:
+ * @node: a node number, less than cd_cpu_get_n_nodes()
+ * @error: A #GError or %NULL
+ *
+ * Restricts the calling thread to the CPUs of a NUMA node so that memory
+ * it touches first is allocated locally.
+ *
+ * Return value: %TRUE for success
+ **/
+gboolean
+cd_cpu_bind_to_node (guint node, GError **error)
+{
+	CdCpuTopology *topology = cd_cpu_get_topology ();
+
+	g_return_val_if_fail (node < topology->n_nodes, FALSE);
+
+#ifdef HAVE_SCHED_GETAFFINITY
+	/* only one node is the same as not binding at all */
+	if (topology->n_nodes == 1)
+		return TRUE;
+	if (sched_setaffinity (0, sizeof (cpu_set_t), &topology->nodes[node]) < 0) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     g_io_error_from_errno (errno),
+			     "failed to bind to node %u: %s",
+			     node, g_strerror (errno));
+		return FALSE;
+	}
+#endif
+	return TRUE;
+}
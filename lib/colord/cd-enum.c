@@ -113,6 +113,18 @@ static const CdEnumMatch enum_pixel_format[] = {
 	{CD_PIXEL_FORMAT_ARGB32,			"argb32"},
 	{CD_PIXEL_FORMAT_RGB24,				"rgb24"},
 	{CD_PIXEL_FORMAT_CMYK32,			"cmyk32"},
+	{CD_PIXEL_FORMAT_RGB48,				"rgb48"},
+	{CD_PIXEL_FORMAT_RGBA64,			"rgba64"},
+	{CD_PIXEL_FORMAT_RGB48_HALF,			"rgb48-half"},
+	{CD_PIXEL_FORMAT_RGBA64_HALF,			"rgba64-half"},
+	{CD_PIXEL_FORMAT_RGB96_FLOAT,			"rgb96-float"},
+	{CD_PIXEL_FORMAT_RGBA128_FLOAT,			"rgba128-float"},
+	{CD_PIXEL_FORMAT_RGB24_PLANAR,			"rgb24-planar"},
+	{CD_PIXEL_FORMAT_RGBA32_PLANAR,			"rgba32-planar"},
+	{CD_PIXEL_FORMAT_RGB48_PLANAR,			"rgb48-planar"},
+	{CD_PIXEL_FORMAT_RGBA64_PLANAR,			"rgba64-planar"},
+	{CD_PIXEL_FORMAT_RGB96_FLOAT_PLANAR,		"rgb96-float-planar"},
+	{CD_PIXEL_FORMAT_RGBA128_FLOAT_PLANAR,		"rgba128-float-planar"},
 	{0, NULL}
 };
 
@@ -112,6 +112,18 @@ typedef guint32 CdPixelFormat;
 #define	CD_PIXEL_FORMAT_CMYK32		0x00060021	/* Since: 1.0.0 */
 #define	CD_PIXEL_FORMAT_BGRA32		0x00044499	/* Since: 1.0.0 */
 #define	CD_PIXEL_FORMAT_RGBA32		0x00040099	/* Since: 1.1.8 */
+#define	CD_PIXEL_FORMAT_RGB48		0x0004001a	/* Since: 1.4.9 */
+#define	CD_PIXEL_FORMAT_RGBA64		0x0004009a	/* Since: 1.4.9 */
+#define	CD_PIXEL_FORMAT_RGB48_HALF	0x0044001a	/* Since: 1.4.9 */
+#define	CD_PIXEL_FORMAT_RGBA64_HALF	0x0044009a	/* Since: 1.4.9 */
+#define	CD_PIXEL_FORMAT_RGB96_FLOAT	0x0044001c	/* Since: 1.4.9 */
+#define	CD_PIXEL_FORMAT_RGBA128_FLOAT	0x0044009c	/* Since: 1.4.9 */
+#define	CD_PIXEL_FORMAT_RGB24_PLANAR	0x00041019	/* Since: 1.4.9 */
+#define	CD_PIXEL_FORMAT_RGBA32_PLANAR	0x00041099	/* Since: 1.4.9 */
+#define	CD_PIXEL_FORMAT_RGB48_PLANAR	0x0004101a	/* Since: 1.4.9 */
+#define	CD_PIXEL_FORMAT_RGBA64_PLANAR	0x0004109a	/* Since: 1.4.9 */
+#define	CD_PIXEL_FORMAT_RGB96_FLOAT_PLANAR	0x0044101c	/* Since: 1.4.9 */
+#define	CD_PIXEL_FORMAT_RGBA128_FLOAT_PLANAR	0x0044109c	/* Since: 1.4.9 */
 
 /**
  * CdColorspace:
@@ -0,0 +1,234 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2026 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/**
+ * SECTION:cd-hash
+ * @short_description: A fast non-cryptographic digest
+ *
+ * This is the XXH64 algorithm, which is a lot faster than MD5 and good enough
+ * to spot duplicate profiles. It can be fed incrementally so that it can be
+ * run over data as it is being read. It is not suitable for anything where
+ * the input might be chosen to collide.
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <string.h>
+
+#include "cd-hash.h"
+
+#define CD_HASH_PRIME1		G_GUINT64_CONSTANT(0x9e3779b185ebca87)
+#define CD_HASH_PRIME2		G_GUINT64_CONSTANT(0xc2b2ae3d27d4eb4f)
+#define CD_HASH_PRIME3		G_GUINT64_CONSTANT(0x165667b19e3779f9)
+#define CD_HASH_PRIME4		G_GUINT64_CONSTANT(0x85ebca77c2b2ae63)
+#define CD_HASH_PRIME5		G_GUINT64_CONSTANT(0x27d4eb2f165667c5)
+
+static inline guint64
+cd_hash_rotl (guint64 value, guint bits)
+{
+	return (value << bits) | (value >> (64 - bits));
+}
+
+static inline guint64
+cd_hash_read64 (const guint8 *data)
+{
+	guint64 value;
+	memcpy (&value, data, sizeof(value));
+	return GUINT64_FROM_LE (value);
+}
+
+static inline guint32
+cd_hash_read32 (const guint8 *data)
+{
+	guint32 value;
+	memcpy (&value, data, sizeof(value));
+	return GUINT32_FROM_LE (value);
+}
+
+static inline guint64
+cd_hash_round (guint64 acc, guint64 input)
+{
+	acc += input * CD_HASH_PRIME2;
+	acc = cd_hash_rotl (acc, 31);
+	return acc * CD_HASH_PRIME1;
+}
+
+static inline guint64
+cd_hash_merge_round (guint64 acc, guint64 value)
+{
+	acc ^= cd_hash_round (0, value);
+	return acc * CD_HASH_PRIME1 + CD_HASH_PRIME4;
+}
+
+/* consumes whole 32 byte stripes, returning the number of bytes used */
+static gsize
+cd_hash_consume (CdHash *hash, const guint8 *data, gsize len)
+{
+	gsize i;
+	for (i = 0; i + 32 <= len; i += 32) {
+		hash->acc[0] = cd_hash_round (hash->acc[0], cd_hash_read64 (data + i));
+		hash->acc[1] = cd_hash_round (hash->acc[1], cd_hash_read64 (data + i + 8));
+		hash->acc[2] = cd_hash_round (hash->acc[2], cd_hash_read64 (data + i + 16));
+		hash->acc[3] = cd_hash_round (hash->acc[3], cd_hash_read64 (data + i + 24));
+	}
+	return i;
+}
+
+/**
+ * cd_hash_init:
+ * @hash: a #CdHash
+ *
+ * Resets the digest state.
+ **/
+void
+cd_hash_init (CdHash *hash)
+{
+	memset (hash, 0, sizeof(CdHash));
+	hash->acc[0] = CD_HASH_PRIME1 + CD_HASH_PRIME2;
+	hash->acc[1] = CD_HASH_PRIME2;
+	hash->acc[2] = 0;
+	hash->acc[3] = -CD_HASH_PRIME1;
+}
+
+/**
+ * cd_hash_update:
+ * @hash: a #CdHash
+ * @data: (array length=len): data to add
+ * @len: size of @data
+ *
+ * Adds data to the digest, which may be split at any boundary.
+ **/
+void
+cd_hash_update (CdHash *hash, const guint8 *data, gsize len)
+{
+	gsize used;
+
+	hash->total_len += len;
+
+	/* not enough to fill the stripe */
+	if (hash->mem_len + len < 32) {
+		memcpy (hash->mem + hash->mem_len, data, len);
+		hash->mem_len += len;
+		return;
+	}
+
+	/* finish the partial stripe from last time */
+	if (hash->mem_len > 0) {
+		gsize fill = 32 - hash->mem_len;
+		memcpy (hash->mem + hash->mem_len, data, fill);
+		cd_hash_consume (hash, hash->mem, 32);
+		data += fill;
+		len -= fill;
+		hash->mem_len = 0;
+	}
+
+	/* keep anything left over */
+	used = cd_hash_consume (hash, data, len);
+	memcpy (hash->mem, data + used, len - used);
+	hash->mem_len = len - used;
+}
+
+/**
+ * cd_hash_finish:
+ * @hash: a #CdHash
+ *
+ * Gets the digest of all the data added so far. More data can still be
+ * added afterwards.
+ *
+ * Return value: the 64 bit digest
+ **/
+guint64
+cd_hash_finish (const CdHash *hash)
+{
+	const guint8 *p = hash->mem;
+	const guint8 *end = hash->mem + hash->mem_len;
+	guint64 h;
+
+	if (hash->total_len >= 32) {
+		h = cd_hash_rotl (hash->acc[0], 1) +
+		    cd_hash_rotl (hash->acc[1], 7) +
+		    cd_hash_rotl (hash->acc[2], 12) +
+		    cd_hash_rotl (hash->acc[3], 18);
+		h = cd_hash_merge_round (h, hash->acc[0]);
+		h = cd_hash_merge_round (h, hash->acc[1]);
+		h = cd_hash_merge_round (h, hash->acc[2]);
+		h = cd_hash_merge_round (h, hash->acc[3]);
+	} else {
+		h = CD_HASH_PRIME5;
+	}
+	h += hash->total_len;
+
+	/* the tail */
+	for (; p + 8 <= end; p += 8) {
+		h ^= cd_hash_round (0, cd_hash_read64 (p));
+		h = cd_hash_rotl (h, 27) * CD_HASH_PRIME1 + CD_HASH_PRIME4;
+	}
+	if (p + 4 <= end) {
+		h ^= (guint64) cd_hash_read32 (p) * CD_HASH_PRIME1;
+		h = cd_hash_rotl (h, 23) * CD_HASH_PRIME2 + CD_HASH_PRIME3;
+		p += 4;
+	}
+	for (; p < end; p++) {
+		h ^= (*p) * CD_HASH_PRIME5;
+		h = cd_hash_rotl (h, 11) * CD_HASH_PRIME1;
+	}
+
+	/* avalanche */
+	h ^= h >> 33;
+	h *= CD_HASH_PRIME2;
+	h ^= h >> 29;
+	h *= CD_HASH_PRIME3;
+	h ^= h >> 32;
+	return h;
+}
+
+/**
+ * cd_hash_to_string:
+ * @value: a digest
+ *
+ * Formats the digest in the same way as the XXH64 tools.
+ *
+ * Return value: a 16 character hex string
+ **/
+gchar *
+cd_hash_to_string (guint64 value)
+{
+	return g_strdup_printf ("%016" G_GINT64_MODIFIER "x", value);
+}
+
+/**
+ * cd_hash_compute_for_data:
+ * @data: (array length=len): data to digest
+ * @len: size of @data
+ *
+ * Computes the digest of a buffer in one go.
+ *
+ * Return value: a 16 character hex string
+ **/
+gchar *
+cd_hash_compute_for_data (const guint8 *data, gsize len)
+{
+	CdHash hash;
+	cd_hash_init (&hash);
+	cd_hash_update (&hash, data, len);
+	return cd_hash_to_string (cd_hash_finish (&hash));
+}
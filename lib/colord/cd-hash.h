@@ -0,0 +1,51 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2026 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#if !defined (CD_COMPILATION)
+#error "You cannot include this file externaly"
+#endif
+
+#ifndef __CD_HASH_H
+#define __CD_HASH_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct {
+	guint64			 acc[4];
+	guint64			 total_len;
+	guint8			 mem[32];
+	guint			 mem_len;
+} CdHash;
+
+void		 cd_hash_init			(CdHash		*hash);
+void		 cd_hash_update			(CdHash		*hash,
+						 const guint8	*data,
+						 gsize		 len);
+guint64		 cd_hash_finish			(const CdHash	*hash);
+gchar		*cd_hash_to_string		(guint64	 value);
+gchar		*cd_hash_compute_for_data	(const guint8	*data,
+						 gsize		 len);
+
+G_END_DECLS
+
+#endif /* __CD_HASH_H */
@@ -0,0 +1,52 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2026 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#if !defined (CD_COMPILATION)
+#error "You cannot include this file externaly"
+#endif
+
+#ifndef __CD_ICC_PRIVATE_H
+#define __CD_ICC_PRIVATE_H
+
+#include <glib.h>
+
+#include "cd-icc.h"
+
+G_BEGIN_DECLS
+
+/* checksum, kind, colorspace, version, created, description, metadata,
+ * tags, warnings, can-delete */
+#define CD_ICC_SUMMARY_FORMAT		"(suudxsa{ss}asaub)"
+#define CD_ICC_SUMMARY_FORMAT_BUILD	"(suudxsa{ss}^asaub)"
+#define CD_ICC_SUMMARY_FORMAT_PARSE	"(&suudx&sa{ss}^asaub)"
+
+GVariant	*cd_icc_get_summary		(CdIcc		*icc);
+gboolean	 cd_icc_load_summary		(CdIcc		*icc,
+						 const gchar	*filename,
+						 guint32	 size,
+						 gint64		 mtime,
+						 GVariant	*summary,
+						 GError		**error);
+guint		 cd_icc_get_generation		(CdIcc		*icc);
+
+G_END_DECLS
+
+#endif /* __CD_ICC_PRIVATE_H */
@@ -26,9 +26,16 @@
 
 #include "config.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
 #include <glib-object.h>
+#include <glib/gstdio.h>
 #include <gio/gio.h>
 
+#include "cd-cpu.h"
+#include "cd-icc-private.h"
 #include "cd-icc-store.h"
 
 static void	cd_icc_store_finalize	(GObject	*object);
@@ -38,14 +45,24 @@ static void	cd_icc_store_finalize	(GObject	*object);
 typedef struct
 {
 	CdIccLoadFlags		 load_flags;
-	GPtrArray		*directory_array;
+	GHashTable		*directories;	/* path:CdIccStoreDirHelper */
 	GPtrArray		*icc_array;
+	GHashTable		*icc_by_filename;	/* filename:CdIcc */
+	GHashTable		*icc_by_checksum;	/* checksum:CdIcc */
+	GHashTable		*icc_by_fast_checksum;	/* fast-checksum:CdIcc */
+	GSequence		*filenames;	/* sorted, for prefix removal */
 	GResource		*cache;
+	gchar			*index_filename;
+	gpointer		 index;		/* CdIccStoreIndex, or NULL */
+	guint			 monitor_delay;	/* ms */
+	guint			 monitor_id;
+	GHashTable		*monitor_events; /* path:GFileMonitorEvent */
 } CdIccStorePrivate;
 
 enum {
 	SIGNAL_ADDED,
 	SIGNAL_REMOVED,
+	SIGNAL_CHANGED,
 	SIGNAL_LAST
 };
 
@@ -54,6 +71,21 @@ static guint signals[SIGNAL_LAST] = { 0 };
 G_DEFINE_TYPE_WITH_PRIVATE (CdIccStore, cd_icc_store, G_TYPE_OBJECT)
 
 #define CD_ICC_STORE_MAX_RECURSION_LEVELS	  2
+#define CD_ICC_STORE_MONITOR_DELAY_DEFAULT	250	/* ms */
+
+/* every profile has this signature in the 128 byte header */
+#define CD_ICC_STORE_HEADER_SIZE		128
+#define CD_ICC_STORE_MAGIC_OFFSET		36
+#define CD_ICC_STORE_MAGIC			"acsp"
+
+/* what is needed to find profiles and look them up in the index */
+#define CD_ICC_STORE_FILE_ATTRIBUTES		G_FILE_ATTRIBUTE_STANDARD_NAME "," \
+						G_FILE_ATTRIBUTE_STANDARD_TYPE "," \
+						G_FILE_ATTRIBUTE_STANDARD_SIZE "," \
+						G_FILE_ATTRIBUTE_UNIX_DEVICE "," \
+						G_FILE_ATTRIBUTE_UNIX_INODE "," \
+						G_FILE_ATTRIBUTE_TIME_MODIFIED "," \
+						G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC
 
 static gboolean
 cd_icc_store_search_path (CdIccStore *store,
@@ -68,10 +100,13 @@ cd_icc_store_search_path_child (CdIccStore *store,
 				guint depth,
 				GCancellable *cancellable,
 				GError **error);
+static gboolean
+cd_icc_store_monitor_flush_cb (gpointer user_data);
 
 typedef struct {
 	gchar		*path;
 	GFileMonitor	*monitor;
+	guint		 depth;		/* below the search location */
 } CdIccStoreDirHelper;
 
 static void
@@ -83,6 +118,277 @@ cd_icc_store_helper_free (CdIccStoreDirHelper *helper)
 	g_free (helper);
 }
 
+/* the on-disk index maps each profile filename to the file identity it was
+ * read from and everything needed to register it, so that unchanged files
+ * do not have to be opened at all */
+#define CD_ICC_STORE_INDEX_VERSION	2
+#define CD_ICC_STORE_INDEX_KEY_FORMAT	"(tttx)"	/* device, inode, size, mtime */
+#define CD_ICC_STORE_INDEX_ENTRY_FORMAT	"(" CD_ICC_STORE_INDEX_KEY_FORMAT CD_ICC_SUMMARY_FORMAT ")"
+#define CD_ICC_STORE_INDEX_FORMAT	"(uua{s" CD_ICC_STORE_INDEX_ENTRY_FORMAT "})"
+
+typedef struct {
+	GMutex		 mutex;		/* protects everything below */
+	gchar		*filename;
+	CdIccLoadFlags	 load_flags;
+	GHashTable	*old;		/* filename:entry, from the file */
+	GHashTable	*entries;	/* filename:entry, seen this time */
+	GHashTable	*directories;	/* that have been searched */
+	guint		 searches;	/* in progress */
+	gboolean	 dirty;
+} CdIccStoreIndex;
+
+static void
+cd_icc_store_index_free (CdIccStoreIndex *index)
+{
+	g_mutex_clear (&index->mutex);
+	g_free (index->filename);
+	g_hash_table_unref (index->old);
+	g_hash_table_unref (index->entries);
+	g_hash_table_unref (index->directories);
+	g_free (index);
+}
+
+static CdIccStoreIndex *
+cd_icc_store_index_new (const gchar *filename, CdIccLoadFlags load_flags)
+{
+	CdIccStoreIndex *index;
+	GVariant *entry;
+	gchar *key;
+	guint32 index_load_flags;
+	guint32 version;
+	g_autoptr(GBytes) data = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GMappedFile) mapped_file = NULL;
+	g_autoptr(GVariant) root = NULL;
+	g_autoptr(GVariantIter) iter = NULL;
+
+	index = g_new0 (CdIccStoreIndex, 1);
+	g_mutex_init (&index->mutex);
+	index->filename = g_strdup (filename);
+	index->load_flags = load_flags;
+	index->old = g_hash_table_new_full (g_str_hash, g_str_equal,
+					    g_free, (GDestroyNotify) g_variant_unref);
+	index->entries = g_hash_table_new_full (g_str_hash, g_str_equal,
+						g_free, (GDestroyNotify) g_variant_unref);
+	index->directories = g_hash_table_new_full (g_str_hash, g_str_equal,
+						    g_free, NULL);
+
+	/* a missing or stale index just means everything gets parsed */
+	mapped_file = g_mapped_file_new (filename, FALSE, &error);
+	if (mapped_file == NULL) {
+		g_debug ("CdIccStore: no index loaded: %s", error->message);
+		return index;
+	}
+	data = g_mapped_file_get_bytes (mapped_file);
+	root = g_variant_new_from_bytes (G_VARIANT_TYPE (CD_ICC_STORE_INDEX_FORMAT),
+					 data, FALSE);
+	g_variant_ref_sink (root);
+	g_variant_get (root, "(uua{s" CD_ICC_STORE_INDEX_ENTRY_FORMAT "})",
+		       &version, &index_load_flags, &iter);
+	if (version != CD_ICC_STORE_INDEX_VERSION ||
+	    index_load_flags != (guint32) load_flags) {
+		g_debug ("CdIccStore: ignoring index %s as it is out of date",
+			 filename);
+		return index;
+	}
+	while (g_variant_iter_next (iter,
+				    "{s@" CD_ICC_STORE_INDEX_ENTRY_FORMAT "}",
+				    &key, &entry))
+		g_hash_table_insert (index->old, key, entry);
+	g_debug ("CdIccStore: loaded %u profiles from index %s",
+		 g_hash_table_size (index->old), filename);
+	return index;
+}
+
+/* returns NULL if the filesystem cannot identify the file */
+static GVariant *
+cd_icc_store_index_get_key (GFileInfo *info)
+{
+	if (!g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_UNIX_DEVICE) ||
+	    !g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_UNIX_INODE) ||
+	    !g_file_info_has_attribute (info, G_FILE_ATTRIBUTE_TIME_MODIFIED))
+		return NULL;
+	return g_variant_ref_sink (g_variant_new (CD_ICC_STORE_INDEX_KEY_FORMAT,
+		(guint64) g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_UNIX_DEVICE),
+		g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_UNIX_INODE),
+		(guint64) g_file_info_get_size (info),
+		(gint64) g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED) * G_USEC_PER_SEC +
+		g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC)));
+}
+
+/* the index is only saved when no search is in progress, as another
+ * search may not have got to all of the files in its directories yet */
+static void
+cd_icc_store_index_search_begin (CdIccStoreIndex *index)
+{
+	g_mutex_lock (&index->mutex);
+	index->searches++;
+	g_mutex_unlock (&index->mutex);
+}
+
+static void
+cd_icc_store_index_search_end (CdIccStoreIndex *index)
+{
+	g_mutex_lock (&index->mutex);
+	index->searches--;
+	g_mutex_unlock (&index->mutex);
+}
+
+static void
+cd_icc_store_index_add_directory (CdIccStoreIndex *index, const gchar *path)
+{
+	g_mutex_lock (&index->mutex);
+	g_hash_table_add (index->directories, g_strdup (path));
+	g_mutex_unlock (&index->mutex);
+}
+
+/* this is safe to call from any thread */
+static gboolean
+cd_icc_store_index_contains (CdIccStoreIndex *index,
+			     const gchar *filename,
+			     GVariant *key)
+{
+	GVariant *entry;
+	gboolean ret = FALSE;
+
+	g_mutex_lock (&index->mutex);
+	entry = g_hash_table_lookup (index->old, filename);
+	if (entry != NULL) {
+		g_autoptr(GVariant) entry_key = g_variant_get_child_value (entry, 0);
+		ret = g_variant_equal (entry_key, key);
+	}
+	g_mutex_unlock (&index->mutex);
+	return ret;
+}
+
+/* this is safe to call from any thread */
+static CdIcc *
+cd_icc_store_index_lookup (CdIccStoreIndex *index,
+			   const gchar *filename,
+			   GVariant *key)
+{
+	GVariant *entry;
+	gint64 mtime;
+	guint64 size;
+	g_autoptr(CdIcc) icc = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GVariant) entry_key = NULL;
+	g_autoptr(GVariant) summary = NULL;
+
+	g_mutex_lock (&index->mutex);
+	entry = g_hash_table_lookup (index->old, filename);
+	if (entry != NULL)
+		g_variant_ref (entry);
+	g_mutex_unlock (&index->mutex);
+	if (entry == NULL)
+		return NULL;
+
+	/* the file has been changed or replaced */
+	entry_key = g_variant_get_child_value (entry, 0);
+	if (!g_variant_equal (entry_key, key)) {
+		g_variant_unref (entry);
+		return NULL;
+	}
+	g_variant_get_child (key, 2, "t", &size);
+	g_variant_get_child (key, 3, "x", &mtime);
+	summary = g_variant_get_child_value (entry, 1);
+	icc = cd_icc_new ();
+	if (!cd_icc_load_summary (icc, filename, size, mtime, summary, &error)) {
+		g_warning ("CdIccStore: failed to use index for %s: %s",
+			   filename, error->message);
+		g_variant_unref (entry);
+		return NULL;
+	}
+
+	/* keep the entry for next time */
+	g_mutex_lock (&index->mutex);
+	g_hash_table_insert (index->entries, g_strdup (filename), entry);
+	g_mutex_unlock (&index->mutex);
+	return g_steal_pointer (&icc);
+}
+
+/* this is safe to call from any thread */
+static void
+cd_icc_store_index_add (CdIccStoreIndex *index,
+			const gchar *filename,
+			GVariant *key,
+			CdIcc *icc)
+{
+	GVariant *entry;
+
+	entry = g_variant_new ("(@" CD_ICC_STORE_INDEX_KEY_FORMAT
+			       "@" CD_ICC_SUMMARY_FORMAT ")",
+			       key, cd_icc_get_summary (icc));
+	g_mutex_lock (&index->mutex);
+	g_hash_table_insert (index->entries,
+			     g_strdup (filename),
+			     g_variant_ref_sink (entry));
+	index->dirty = TRUE;
+	g_mutex_unlock (&index->mutex);
+}
+
+static void
+cd_icc_store_index_remove (CdIccStoreIndex *index, const gchar *filename)
+{
+	g_mutex_lock (&index->mutex);
+	if (g_hash_table_remove (index->entries, filename))
+		index->dirty = TRUE;
+	g_mutex_unlock (&index->mutex);
+}
+
+static gboolean
+cd_icc_store_index_save (CdIccStoreIndex *index, GError **error)
+{
+	GHashTableIter iter;
+	GVariantBuilder builder;
+	gboolean changed;
+	gpointer key;
+	gpointer value;
+	g_autoptr(GVariant) root = NULL;
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&index->mutex);
+
+	/* the last search to finish saves everything */
+	if (index->searches > 0)
+		return TRUE;
+
+	/* only write what was found this time, keeping the entries for
+	 * directories that have not been searched yet */
+	changed = index->dirty;
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{s" CD_ICC_STORE_INDEX_ENTRY_FORMAT "}"));
+	g_hash_table_iter_init (&iter, index->old);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		g_autofree gchar *dirname = NULL;
+		if (g_hash_table_contains (index->entries, key))
+			continue;
+		dirname = g_path_get_dirname (key);
+		if (g_hash_table_contains (index->directories, dirname)) {
+			g_hash_table_iter_remove (&iter);
+			changed = TRUE;
+			continue;
+		}
+		g_variant_builder_add (&builder, "{s@" CD_ICC_STORE_INDEX_ENTRY_FORMAT "}",
+				       key, value);
+	}
+	if (!changed)
+		return TRUE;
+	g_hash_table_iter_init (&iter, index->entries);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		g_variant_builder_add (&builder, "{s@" CD_ICC_STORE_INDEX_ENTRY_FORMAT "}",
+				       key, value);
+	}
+	root = g_variant_ref_sink (g_variant_new ("(uua{s" CD_ICC_STORE_INDEX_ENTRY_FORMAT "})",
+						  (guint32) CD_ICC_STORE_INDEX_VERSION,
+						  (guint32) index->load_flags,
+						  &builder));
+	if (!g_file_set_contents (index->filename,
+				  g_variant_get_data (root),
+				  (gssize) g_variant_get_size (root),
+				  error))
+		return FALSE;
+	index->dirty = FALSE;
+	return TRUE;
+}
+
 /**
  * cd_icc_store_find_by_filename:
  * @store: a #CdIccStore instance.
@@ -99,18 +405,14 @@ cd_icc_store_find_by_filename (CdIccStore *store, const gchar *filename)
 {
 	CdIccStorePrivate *priv = GET_PRIVATE (store);
 	CdIcc *tmp;
-	guint i;
-	GPtrArray *array = priv->icc_array;
 
 	g_return_val_if_fail (CD_IS_ICC_STORE (store), NULL);
 	g_return_val_if_fail (filename != NULL, NULL);
 
-	for (i = 0; i < array->len; i++) {
-		tmp = g_ptr_array_index (array, i);
-		if (g_strcmp0 (filename, cd_icc_get_filename (tmp)) == 0)
-			return g_object_ref (tmp);
-	}
-	return NULL;
+	tmp = g_hash_table_lookup (priv->icc_by_filename, filename);
+	if (tmp == NULL)
+		return NULL;
+	return g_object_ref (tmp);
 }
 
 /**
@@ -129,34 +431,92 @@ cd_icc_store_find_by_checksum (CdIccStore *store, const gchar *checksum)
 {
 	CdIccStorePrivate *priv = GET_PRIVATE (store);
 	CdIcc *tmp;
-	guint i;
-	GPtrArray *array = priv->icc_array;
 
 	g_return_val_if_fail (CD_IS_ICC_STORE (store), NULL);
 	g_return_val_if_fail (checksum != NULL, NULL);
 
-	for (i = 0; i < array->len; i++) {
-		tmp = g_ptr_array_index (array, i);
-		if (g_strcmp0 (checksum, cd_icc_get_checksum (tmp)) == 0)
-			return g_object_ref (tmp);
-	}
-	return NULL;
+	tmp = g_hash_table_lookup (priv->icc_by_checksum, checksum);
+	if (tmp == NULL)
+		return NULL;
+	return g_object_ref (tmp);
+}
+
+/* only used for profiles without an embedded ID or fallback MD5 */
+static CdIcc *
+cd_icc_store_find_by_fast_checksum (CdIccStore *store, const gchar *fast_checksum)
+{
+	CdIccStorePrivate *priv = GET_PRIVATE (store);
+	CdIcc *tmp;
+
+	tmp = g_hash_table_lookup (priv->icc_by_fast_checksum, fast_checksum);
+	if (tmp == NULL)
+		return NULL;
+	return g_object_ref (tmp);
 }
 
 static CdIccStoreDirHelper *
 cd_icc_store_find_by_directory (CdIccStore *store, const gchar *path)
 {
 	CdIccStorePrivate *priv = GET_PRIVATE (store);
-	CdIccStoreDirHelper *tmp;
-	guint i;
-	GPtrArray *array = priv->directory_array;
+	return g_hash_table_lookup (priv->directories, path);
+}
+
+static gint
+cd_icc_store_filename_cmp (gconstpointer a, gconstpointer b, gpointer user_data)
+{
+	return g_strcmp0 (a, b);
+}
 
-	for (i = 0; i < array->len; i++) {
-		tmp = g_ptr_array_index (array, i);
-		if (g_strcmp0 (path, tmp->path) == 0)
-			return tmp;
+/* the lookup tables hold a reference so that a stale entry can never point
+ * at a freed object, even if the CdIcc is changed after being added */
+static void
+cd_icc_store_lookup_add (CdIccStore *store, CdIcc *icc)
+{
+	CdIccStorePrivate *priv = GET_PRIVATE (store);
+	const gchar *checksum = cd_icc_get_checksum (icc);
+	const gchar *fast_checksum = cd_icc_get_fast_checksum (icc);
+	const gchar *filename = cd_icc_get_filename (icc);
+
+	if (filename != NULL) {
+		g_hash_table_insert (priv->icc_by_filename,
+				     g_strdup (filename), g_object_ref (icc));
+		g_sequence_insert_sorted (priv->filenames, g_strdup (filename),
+					  cd_icc_store_filename_cmp, NULL);
+	}
+	if (checksum != NULL)
+		g_hash_table_insert (priv->icc_by_checksum,
+				     g_strdup (checksum), g_object_ref (icc));
+	if (fast_checksum != NULL) {
+		g_hash_table_insert (priv->icc_by_fast_checksum,
+				     g_strdup (fast_checksum), g_object_ref (icc));
 	}
-	return NULL;
+}
+
+/* only remove entries that point at this exact object */
+static void
+cd_icc_store_lookup_remove_key (GHashTable *hash, const gchar *key, CdIcc *icc)
+{
+	if (key == NULL)
+		return;
+	if (g_hash_table_lookup (hash, key) == icc)
+		g_hash_table_remove (hash, key);
+}
+
+static void
+cd_icc_store_lookup_remove (CdIccStore *store, CdIcc *icc, const gchar *filename)
+{
+	CdIccStorePrivate *priv = GET_PRIVATE (store);
+	GSequenceIter *iter;
+
+	cd_icc_store_lookup_remove_key (priv->icc_by_filename, filename, icc);
+	cd_icc_store_lookup_remove_key (priv->icc_by_checksum,
+					cd_icc_get_checksum (icc), icc);
+	cd_icc_store_lookup_remove_key (priv->icc_by_fast_checksum,
+					cd_icc_get_fast_checksum (icc), icc);
+	iter = g_sequence_lookup (priv->filenames, (gpointer) filename,
+				  cd_icc_store_filename_cmp, NULL);
+	if (iter != NULL)
+		g_sequence_remove (iter);
 }
 
 static gboolean
@@ -171,36 +531,73 @@ cd_icc_store_remove_icc (CdIccStore *store, const gchar *filename)
 		return FALSE;
 
 	/* we have a ref so we can emit the signal */
+	cd_icc_store_lookup_remove (store, icc, filename);
 	if (!g_ptr_array_remove (priv->icc_array, icc)) {
 		g_warning ("failed to remove %s", filename);
 		return FALSE;
 	}
 
+	/* do not keep the index entry */
+	if (priv->index != NULL)
+		cd_icc_store_index_remove (priv->index, filename);
+
 	/* emit a signal */
 	g_signal_emit (store, signals[SIGNAL_REMOVED], 0, icc);
 	return TRUE;
 }
 
-static gboolean
-cd_icc_store_add_icc (CdIccStore *store, GFile *file, GError **error)
+/* created when first needed so that it uses the final load flags */
+static CdIccStoreIndex *
+cd_icc_store_get_index (CdIccStore *store)
 {
 	CdIccStorePrivate *priv = GET_PRIVATE (store);
+	if (priv->index == NULL && priv->index_filename != NULL)
+		priv->index = cd_icc_store_index_new (priv->index_filename, priv->load_flags);
+	return priv->index;
+}
+
+static void
+cd_icc_store_save_index (CdIccStore *store)
+{
+	CdIccStorePrivate *priv = GET_PRIVATE (store);
+	g_autoptr(GError) error = NULL;
+	if (priv->index == NULL)
+		return;
+	if (!cd_icc_store_index_save (priv->index, &error))
+		g_warning ("CdIccStore: failed to save index: %s", error->message);
+}
+
+/* this does not touch the store so it is safe to call from any thread */
+static CdIcc *
+cd_icc_store_load_icc (GFile *file,
+		       GVariant *key,
+		       CdIccLoadFlags load_flags,
+		       GResource *cache,
+		       CdIccStoreIndex *index,
+		       GError **error)
+{
 	g_autoptr(GBytes) data = NULL;
 	g_autofree gchar *filename = NULL;
 	g_autoptr(CdIcc) icc = NULL;
-	g_autoptr(CdIcc) icc_tmp = NULL;
+
+	/* use the index if the file has not changed */
+	filename = g_file_get_path (file);
+	if (index != NULL && key != NULL) {
+		icc = cd_icc_store_index_lookup (index, filename, key);
+		if (icc != NULL)
+			return g_steal_pointer (&icc);
+	}
 
 	/* use the GResource cache if available */
 	icc = cd_icc_new ();
-	filename = g_file_get_path (file);
-	if (priv->cache != NULL) {
+	if (cache != NULL) {
 		if (g_str_has_prefix (filename, "/usr/share/color/icc/colord/")) {
 			g_autofree gchar *cache_key = NULL;
 			cache_key = g_build_filename ("/org/freedesktop/colord",
 						      "profiles",
 						      filename + 28,
 						      NULL);
-			data = g_resource_lookup_data (priv->cache,
+			data = g_resource_lookup_data (cache,
 						       cache_key,
 						       G_RESOURCE_LOOKUP_FLAGS_NONE,
 						       NULL);
@@ -218,79 +615,116 @@ cd_icc_store_add_icc (CdIccStore *store, GFile *file, GError **error)
 					g_bytes_get_size (data),
 					CD_ICC_LOAD_FLAGS_METADATA,
 					error)) {
-			return FALSE;
+			return NULL;
 		}
 	} else {
 		if (!cd_icc_load_file (icc,
 					file,
-					priv->load_flags,
+					load_flags,
 					NULL,
 					error)) {
-			return FALSE;
+			return NULL;
 		}
 	}
 
+	/* remember for next time */
+	if (index != NULL && key != NULL)
+		cd_icc_store_index_add (index, filename, key, icc);
+	return g_steal_pointer (&icc);
+}
+
+static gboolean
+cd_icc_store_add_loaded_icc (CdIccStore *store, CdIcc *icc)
+{
+	CdIccStorePrivate *priv = GET_PRIVATE (store);
+	g_autoptr(CdIcc) icc_tmp = NULL;
+
 	/* check it's not a duplicate */
-	icc_tmp = cd_icc_store_find_by_checksum (store, cd_icc_get_checksum (icc));
+	if (cd_icc_get_checksum (icc) != NULL) {
+		icc_tmp = cd_icc_store_find_by_checksum (store, cd_icc_get_checksum (icc));
+	} else if (cd_icc_get_fast_checksum (icc) != NULL) {
+		icc_tmp = cd_icc_store_find_by_fast_checksum (store,
+							      cd_icc_get_fast_checksum (icc));
+	}
 	if (icc_tmp != NULL) {
 		g_debug ("CdIccStore: Failed to add %s as profile %s "
 			 "already exists with the same checksum of %s",
-			 filename,
+			 cd_icc_get_filename (icc),
 			 cd_icc_get_filename (icc_tmp),
-			 cd_icc_get_checksum (icc_tmp));
-		return TRUE;
+			 cd_icc_get_checksum (icc_tmp) != NULL ?
+			 cd_icc_get_checksum (icc_tmp) :
+			 cd_icc_get_fast_checksum (icc_tmp));
+		return FALSE;
 	}
 
 	/* add to list */
 	g_ptr_array_add (priv->icc_array, g_object_ref (icc));
+	cd_icc_store_lookup_add (store, icc);
 
 	/* emit a signal */
 	g_signal_emit (store, signals[SIGNAL_ADDED], 0, icc);
 	return TRUE;
 }
 
-static void
-cd_icc_store_created_query_info_cb (GObject *source_object,
-				    GAsyncResult *res,
-				    gpointer user_data)
+static gboolean
+cd_icc_store_add_icc (CdIccStore *store, GFile *file, GVariant *key, GError **error)
 {
-	CdIccStore *store = CD_ICC_STORE (user_data);
-	GFile *file = G_FILE (source_object);
-	gboolean ret;
-	g_autoptr(GError) error = NULL;
-	g_autofree gchar *path = NULL;
-	g_autoptr(GFileInfo) info = NULL;
-	g_autoptr(GFile) parent = NULL;
+	CdIccStorePrivate *priv = GET_PRIVATE (store);
+	g_autoptr(CdIcc) icc = NULL;
 
-	info = g_file_query_info_finish (file, res, NULL);
-	if (info == NULL)
-		return;
-	parent = g_file_get_parent (file);
-	path = g_file_get_path (parent);
-	ret = cd_icc_store_search_path_child (store, path, info,
-					      0, NULL, &error);
-	if (!ret)
-		g_warning ("failed to search file: %s", error->message);
+	icc = cd_icc_store_load_icc (file, key, priv->load_flags, priv->cache,
+				     cd_icc_store_get_index (store), error);
+	if (icc == NULL)
+		return FALSE;
+	cd_icc_store_add_loaded_icc (store, icc);
+	return TRUE;
 }
 
 static void
 cd_icc_store_remove_from_prefix (CdIccStore *store, const gchar *prefix)
 {
 	CdIccStorePrivate *priv = GET_PRIVATE (store);
-	CdIcc *tmp;
-	const gchar *filename;
+	GSequenceIter *iter;
 	guint i;
-
-	for (i = 0; i < priv->icc_array->len; i++) {
-		tmp = g_ptr_array_index (priv->icc_array, i);
-		filename = cd_icc_get_filename (tmp);
-		if (g_str_has_prefix (filename, prefix)) {
-			g_debug ("auto-removed %s as path removed", prefix);
-			cd_icc_store_remove_icc (store, filename);
-		}
+	g_autofree gchar *prefix_dir = NULL;
+	g_autoptr(GPtrArray) filenames = g_ptr_array_new_with_free_func (g_free);
+
+	/* the matching filenames are all together in the sorted list, and
+	 * are copied as removing them changes the list */
+	prefix_dir = g_strconcat (prefix, G_DIR_SEPARATOR_S, NULL);
+	iter = g_sequence_search (priv->filenames, prefix_dir,
+				  cd_icc_store_filename_cmp, NULL);
+	while (!g_sequence_iter_is_end (iter)) {
+		const gchar *filename = g_sequence_get (iter);
+		if (!g_str_has_prefix (filename, prefix_dir))
+			break;
+		g_ptr_array_add (filenames, g_strdup (filename));
+		iter = g_sequence_iter_next (iter);
+	}
+	for (i = 0; i < filenames->len; i++) {
+		g_debug ("auto-removed %s as path removed", prefix);
+		cd_icc_store_remove_icc (store, g_ptr_array_index (filenames, i));
 	}
 }
 
+/* returns %TRUE if any profiles were removed */
+static gboolean
+cd_icc_store_remove_path (CdIccStore *store, const gchar *path)
+{
+	CdIccStorePrivate *priv = GET_PRIVATE (store);
+	guint len = priv->icc_array->len;
+
+	/* we can either have two things here, a directory or a file. We
+	 * can't query the file type as the inode doesn't exist anymore */
+	if (g_hash_table_contains (priv->icc_by_filename, path))
+		return cd_icc_store_remove_icc (store, path);
+
+	/* is a directory, urgh. Remove all ICCs there. */
+	cd_icc_store_remove_from_prefix (store, path);
+	g_hash_table_remove (priv->directories, path);
+	return priv->icc_array->len != len;
+}
+
 static void
 cd_icc_store_file_monitor_changed_cb (GFileMonitor *monitor,
 				      GFile *file,
@@ -299,33 +733,13 @@ cd_icc_store_file_monitor_changed_cb (GFileMonitor *monitor,
 				      CdIccStore *store)
 {
 	CdIccStorePrivate *priv = GET_PRIVATE (store);
-	CdIcc *tmp;
-	CdIccStoreDirHelper *helper;
 	g_autofree gchar *path = NULL;
 
-	/* icc was deleted */
-	if (event_type == G_FILE_MONITOR_EVENT_DELETED) {
-
-		/* we can either have two things here, a directory or a
-		 * file. We can't call g_file_query_info_async() as the
-		 * inode doesn't exist anymore */
-		path = g_file_get_path (file);
-		tmp = cd_icc_store_find_by_filename (store, path);
-		if (tmp != NULL) {
-			/* is a file */
-			cd_icc_store_remove_icc (store, path);
-			return;
-		}
-
-		/* is a directory, urgh. Remove all ICCs there. */
-		cd_icc_store_remove_from_prefix (store, path);
-		helper = cd_icc_store_find_by_directory (store, path);
-		if (helper != NULL) {
-			g_ptr_array_remove (priv->directory_array,
-					    helper);
-		}
+	/* only care about objects being created, changed or deleted */
+	if (event_type != G_FILE_MONITOR_EVENT_CREATED &&
+	    event_type != G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT &&
+	    event_type != G_FILE_MONITOR_EVENT_DELETED)
 		return;
-	}
 
 	/* ignore temp files */
 	path = g_file_get_path (file);
@@ -334,19 +748,98 @@ cd_icc_store_file_monitor_changed_cb (GFileMonitor *monitor,
 		return;
 	}
 
-	/* only care about created objects */
-	if (event_type == G_FILE_MONITOR_EVENT_CREATED) {
-		g_file_query_info_async (file,
-					 G_FILE_ATTRIBUTE_STANDARD_NAME ","
-					 G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE ","
-					 G_FILE_ATTRIBUTE_STANDARD_TYPE,
-					 G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
-					 G_PRIORITY_LOW,
-					 NULL,
-					 cd_icc_store_created_query_info_cb,
-					 store);
-		return;
+	/* the last event for each path wins */
+	g_hash_table_insert (priv->monitor_events,
+			     g_steal_pointer (&path),
+			     GUINT_TO_POINTER (event_type));
+	if (priv->monitor_id == 0) {
+		priv->monitor_id = g_timeout_add (priv->monitor_delay,
+						  cd_icc_store_monitor_flush_cb,
+						  store);
+	}
+}
+
+/* the monitor delivers events to the thread-default context it is created in,
+ * so this has to be called from the thread that owns the store */
+static gboolean
+cd_icc_store_add_directory_monitor (CdIccStore *store,
+				    const gchar *path,
+				    guint depth,
+				    GError **error)
+{
+	CdIccStorePrivate *priv = GET_PRIVATE (store);
+	CdIccStoreDirHelper *helper;
+	g_autoptr(GFile) file = NULL;
+
+	helper = cd_icc_store_find_by_directory (store, path);
+	if (helper != NULL)
+		return TRUE;
+	file = g_file_new_for_path (path);
+	helper = g_new0 (CdIccStoreDirHelper, 1);
+	helper->path = g_strdup (path);
+	helper->depth = depth;
+	helper->monitor = g_file_monitor_directory (file,
+						    G_FILE_MONITOR_NONE,
+						    NULL,
+						    error);
+	if (helper->monitor == NULL) {
+		cd_icc_store_helper_free (helper);
+		return FALSE;
 	}
+	g_signal_connect (helper->monitor, "changed",
+			  G_CALLBACK(cd_icc_store_file_monitor_changed_cb),
+			  store);
+	g_hash_table_insert (priv->directories, helper->path, helper);
+	return TRUE;
+}
+
+/* this only reads the profile signature rather than asking GIO to sniff the
+ * content type, which can read much more of the file and relies on the
+ * file extension being known to the MIME database; files that are in the
+ * index unchanged are known to be profiles and are not opened at all */
+static gboolean
+cd_icc_store_is_profile (const gchar *full_path,
+			 GFileInfo *info,
+			 CdIccStoreIndex *index,
+			 GVariant *key)
+{
+	gchar magic[4];
+	gint fd;
+	gssize len;
+
+	/* ignore temp files */
+	if (g_strrstr (full_path, ".goutputstream") != NULL) {
+		g_debug ("ignoring gvfs temporary file");
+		return FALSE;
+	}
+
+	/* only regular files large enough to have a header */
+	if (g_file_info_get_file_type (info) != G_FILE_TYPE_REGULAR) {
+		g_debug ("Ignoring %s as not a regular file", full_path);
+		return FALSE;
+	}
+	if (g_file_info_get_size (info) < CD_ICC_STORE_HEADER_SIZE) {
+		g_debug ("Ignoring %s as too small", full_path);
+		return FALSE;
+	}
+	if (index != NULL && key != NULL &&
+	    cd_icc_store_index_contains (index, full_path, key))
+		return TRUE;
+
+	/* check the signature */
+	fd = g_open (full_path, O_RDONLY | O_CLOEXEC, 0);
+	if (fd < 0) {
+		g_debug ("Failed to open %s: %s", full_path, g_strerror (errno));
+		return FALSE;
+	}
+	len = pread (fd, magic, sizeof (magic), CD_ICC_STORE_MAGIC_OFFSET);
+	close (fd);
+	if (len != sizeof (magic) ||
+	    memcmp (magic, CD_ICC_STORE_MAGIC, sizeof (magic)) != 0) {
+		g_debug ("Incorrect signature for %s", full_path);
+		return FALSE;
+	}
+	return TRUE;
 }
 
 static gboolean
@@ -358,9 +851,9 @@ cd_icc_store_search_path_child (CdIccStore *store,
 				GError **error)
 {
 	const gchar *name;
-	const gchar *type;
 	g_autofree gchar *full_path = NULL;
 	g_autoptr(GFile) file = NULL;
+	g_autoptr(GVariant) key = NULL;
 
 	/* further down the worm-hole */
 	name = g_file_info_get_name (info);
@@ -373,22 +866,15 @@ cd_icc_store_search_path_child (CdIccStore *store,
 						error);
 	}
 
-	/* ignore temp files */
-	if (g_strrstr (full_path, ".goutputstream") != NULL) {
-		g_debug ("ignoring gvfs temporary file");
-		return TRUE;
-	}
-
-	/* check type */
-	type = g_file_info_get_attribute_string (info, G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE);
-	if (g_strcmp0 (type, "application/vnd.iccprofile") != 0) {
-		g_debug ("Incorrect content type for %s, got %s", full_path, type);
+	/* ignore temp files and anything that is not a profile */
+	key = cd_icc_store_index_get_key (info);
+	if (!cd_icc_store_is_profile (full_path, info,
+				      cd_icc_store_get_index (store), key))
 		return TRUE;
-	}
 
 	/* is a file */
 	file = g_file_new_for_path (full_path);
-	return cd_icc_store_add_icc (store, file, error);
+	return cd_icc_store_add_icc (store, file, key, error);
 }
 
 static gboolean
@@ -399,7 +885,6 @@ cd_icc_store_search_path (CdIccStore *store,
 			  GError **error)
 {
 	CdIccStorePrivate *priv = GET_PRIVATE (store);
-	CdIccStoreDirHelper *helper;
 	GError *error_local = NULL;
 	gboolean ret = TRUE;
 	g_autoptr(GFileEnumerator) enumerator = NULL;
@@ -417,37 +902,20 @@ cd_icc_store_search_path (CdIccStore *store,
 	}
 
 	/* add an inotify watch if not already added */
-	file = g_file_new_for_path (path);
-	helper = cd_icc_store_find_by_directory (store, path);
-	if (helper == NULL) {
-		helper = g_new0 (CdIccStoreDirHelper, 1);
-		helper->path = g_strdup (path);
-		helper->monitor = g_file_monitor_directory (file,
-							    G_FILE_MONITOR_NONE,
-							    NULL,
-							    error);
-		if (helper->monitor == NULL) {
-			cd_icc_store_helper_free (helper);
-			return FALSE;
-		}
-		g_signal_connect (helper->monitor, "changed",
-				  G_CALLBACK(cd_icc_store_file_monitor_changed_cb),
-				  store);
-		g_ptr_array_add (priv->directory_array, helper);
-	}
+	if (!cd_icc_store_add_directory_monitor (store, path, depth, error))
+		return FALSE;
+	if (priv->index != NULL)
+		cd_icc_store_index_add_directory (priv->index, path);
 
 	/* get contents of directory */
+	file = g_file_new_for_path (path);
 	enumerator = g_file_enumerate_children (file,
-						G_FILE_ATTRIBUTE_STANDARD_NAME ","
-						G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE ","
-						G_FILE_ATTRIBUTE_STANDARD_TYPE,
+						CD_ICC_STORE_FILE_ATTRIBUTES,
 						G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
 						cancellable,
 						error);
 	if (enumerator == NULL) {
-		helper = cd_icc_store_find_by_directory (store, path);
-		if (helper != NULL)
-			g_ptr_array_remove (priv->directory_array, helper);
+		g_hash_table_remove (priv->directories, path);
 		return FALSE;
 	}
 
@@ -532,6 +1000,53 @@ cd_icc_store_set_cache (CdIccStore *store, GResource *cache)
 	priv->cache = g_resource_ref (cache);
 }
 
+/**
+ * cd_icc_store_set_monitor_delay:
+ * @store: a #CdIccStore instance.
+ * @delay: the time in ms
+ *
+ * Sets how long to collect changes from the directory monitors before
+ * processing them. All the files created, changed or deleted in this time
+ * are processed together on a worker thread, and ::changed is emitted once
+ * when the batch has been processed.
+ *
+ * Since: 1.4.9
+ **/
+void
+cd_icc_store_set_monitor_delay (CdIccStore *store, guint delay)
+{
+	CdIccStorePrivate *priv = GET_PRIVATE (store);
+	g_return_if_fail (CD_IS_ICC_STORE (store));
+	priv->monitor_delay = delay;
+}
+
+/**
+ * cd_icc_store_set_index_filename:
+ * @store: a #CdIccStore instance.
+ * @filename: (nullable): a writable filename, or %NULL
+ *
+ * Sets an optional file used to remember the profiles that have been found.
+ * Profiles that have not been changed since the index was written are then
+ * added without being opened, and are only read if something is required
+ * that was not saved in the index.
+ *
+ * The index is written once no search is in progress.
+ *
+ * Since: 1.4.9
+ **/
+void
+cd_icc_store_set_index_filename (CdIccStore *store, const gchar *filename)
+{
+	CdIccStorePrivate *priv = GET_PRIVATE (store);
+	g_return_if_fail (CD_IS_ICC_STORE (store));
+	if (priv->index != NULL) {
+		cd_icc_store_save_index (store);
+		g_clear_pointer (&priv->index, cd_icc_store_index_free);
+	}
+	g_free (priv->index_filename);
+	priv->index_filename = g_strdup (filename);
+}
+
 /**
  * cd_icc_store_get_all:
  * @store: a #CdIccStore instance.
@@ -550,6 +1065,32 @@ cd_icc_store_get_all (CdIccStore *store)
 	return g_ptr_array_ref (priv->icc_array);
 }
 
+static GPtrArray *
+cd_icc_store_get_locations (CdIccStoreSearchKind search_kind)
+{
+	GPtrArray *locations = g_ptr_array_new_with_free_func (g_free);
+	switch (search_kind) {
+	case CD_ICC_STORE_SEARCH_KIND_USER:
+		g_ptr_array_add (locations,
+				 g_build_filename (g_get_user_data_dir (), "icc", NULL));
+		g_ptr_array_add (locations,
+				 g_build_filename (g_get_home_dir (), ".color", "icc", NULL));
+		break;
+	case CD_ICC_STORE_SEARCH_KIND_MACHINE:
+		g_ptr_array_add (locations, g_strdup (CD_SYSTEM_PROFILES_DIR));
+		g_ptr_array_add (locations, g_strdup ("/var/lib/color/icc"));
+		break;
+	case CD_ICC_STORE_SEARCH_KIND_SYSTEM:
+		g_ptr_array_add (locations, g_strdup ("/usr/share/color/icc"));
+		g_ptr_array_add (locations, g_strdup ("/usr/local/share/color/icc"));
+		g_ptr_array_add (locations, g_strdup ("/Library/ColorSync/Profiles/Displays"));
+		break;
+	default:
+		break;
+	}
+	return locations;
+}
+
 /**
  * cd_icc_store_search_kind:
  * @store: a #CdIccStore instance.
@@ -579,26 +1120,7 @@ cd_icc_store_search_kind (CdIccStore *store,
 	g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
 
 	/* get the locations for each kind */
-	locations = g_ptr_array_new_with_free_func (g_free);
-	switch (search_kind) {
-	case CD_ICC_STORE_SEARCH_KIND_USER:
-		tmp = g_build_filename (g_get_user_data_dir (), "icc", NULL);
-		g_ptr_array_add (locations, tmp);
-		tmp = g_build_filename (g_get_home_dir (), ".color", "icc", NULL);
-		g_ptr_array_add (locations, tmp);
-		break;
-	case CD_ICC_STORE_SEARCH_KIND_MACHINE:
-		g_ptr_array_add (locations, g_strdup (CD_SYSTEM_PROFILES_DIR));
-		g_ptr_array_add (locations, g_strdup ("/var/lib/color/icc"));
-		break;
-	case CD_ICC_STORE_SEARCH_KIND_SYSTEM:
-		g_ptr_array_add (locations, g_strdup ("/usr/share/color/icc"));
-		g_ptr_array_add (locations, g_strdup ("/usr/local/share/color/icc"));
-		g_ptr_array_add (locations, g_strdup ("/Library/ColorSync/Profiles/Displays"));
-		break;
-	default:
-		break;
-	}
+	locations = cd_icc_store_get_locations (search_kind);
 
 	/* add any found locations */
 	for (i = 0; i < locations->len; i++) {
@@ -637,6 +1159,8 @@ cd_icc_store_search_location (CdIccStore *store,
 			      GCancellable *cancellable,
 			      GError **error)
 {
+	CdIccStoreIndex *index;
+	gboolean ret;
 	g_autoptr(GFile) file = NULL;
 
 	g_return_val_if_fail (CD_IS_ICC_STORE (store), FALSE);
@@ -656,7 +1180,633 @@ cd_icc_store_search_location (CdIccStore *store,
 	}
 
 	/* search all */
-	return cd_icc_store_search_path (store, location, 0, cancellable, error);
+	index = cd_icc_store_get_index (store);
+	if (index != NULL)
+		cd_icc_store_index_search_begin (index);
+	ret = cd_icc_store_search_path (store, location, 0, cancellable, error);
+	if (index != NULL)
+		cd_icc_store_index_search_end (index);
+	if (!ret)
+		return FALSE;
+	cd_icc_store_save_index (store);
+	return TRUE;
+}
+
+typedef struct {
+	gchar			*filename;
+	GVariant		*key;		/* or NULL */
+	guint			 depth;		/* only for directories */
+} CdIccStoreSearchItem;
+
+static void
+cd_icc_store_search_item_free (CdIccStoreSearchItem *item)
+{
+	g_free (item->filename);
+	if (item->key != NULL)
+		g_variant_unref (item->key);
+	g_free (item);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (CdIccStoreSearchItem, cd_icc_store_search_item_free)
+
+typedef struct {
+	CdIccStore		*store;
+	GPtrArray		*locations;	/* of gchar* */
+	GArray			*depths;	/* of guint, or %NULL for all 0 */
+	CdIccStoreSearchFlags	 search_flags;
+	CdIccLoadFlags		 load_flags;
+	GResource		*cache;
+	CdIccStoreIndex		*index;		/* owned by the store */
+	GThreadPool		*pool;
+	GMutex			 mutex;		/* protects everything below */
+	GCond			 cond;		/* signalled when dirs_watched changes */
+	GPtrArray		*pending_dirs;	/* of CdIccStoreSearchItem, to be watched */
+	GPtrArray		*pending_iccs;	/* of CdIcc, to be added */
+	guint			 dirs_requested;
+	guint			 dirs_watched;
+	gboolean		 flush_pending;
+	gboolean		 done;
+	guint			 n_added;	/* only used in the main context */
+	GError			*error;		/* the first failure */
+} CdIccStoreSearchHelper;
+
+static void
+cd_icc_store_search_helper_free (CdIccStoreSearchHelper *helper)
+{
+	g_object_unref (helper->store);
+	g_ptr_array_unref (helper->locations);
+	if (helper->depths != NULL)
+		g_array_unref (helper->depths);
+	if (helper->cache != NULL)
+		g_resource_unref (helper->cache);
+	g_mutex_clear (&helper->mutex);
+	g_cond_clear (&helper->cond);
+	g_ptr_array_unref (helper->pending_dirs);
+	g_ptr_array_unref (helper->pending_iccs);
+	if (helper->error != NULL)
+		g_error_free (helper->error);
+	g_free (helper);
+}
+
+static void
+cd_icc_store_search_set_error (CdIccStoreSearchHelper *helper, GError *error)
+{
+	g_mutex_lock (&helper->mutex);
+	if (helper->error == NULL)
+		helper->error = error;
+	else
+		g_error_free (error);
+	g_mutex_unlock (&helper->mutex);
+}
+
+static gboolean
+cd_icc_store_search_flush_cb (gpointer user_data)
+{
+	GTask *task = G_TASK (user_data);
+	CdIccStoreSearchHelper *helper = g_task_get_task_data (task);
+	CdIccStore *store = helper->store;
+	gboolean done;
+	guint i;
+	g_autoptr(GPtrArray) dirs = NULL;
+	g_autoptr(GPtrArray) iccs = NULL;
+
+	/* take everything the workers have produced so far */
+	g_mutex_lock (&helper->mutex);
+	dirs = helper->pending_dirs;
+	iccs = helper->pending_iccs;
+	helper->pending_dirs = g_ptr_array_new_with_free_func ((GDestroyNotify) cd_icc_store_search_item_free);
+	helper->pending_iccs = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+	helper->flush_pending = FALSE;
+	done = helper->done;
+	g_mutex_unlock (&helper->mutex);
+
+	/* watch the directories before announcing what is in them, and
+	 * wake up the worker waiting to enumerate them */
+	for (i = 0; i < dirs->len; i++) {
+		CdIccStoreSearchItem *item = g_ptr_array_index (dirs, i);
+		GError *error_local = NULL;
+		if (!cd_icc_store_add_directory_monitor (store,
+							 item->filename,
+							 item->depth,
+							 &error_local))
+			cd_icc_store_search_set_error (helper, error_local);
+	}
+	if (dirs->len > 0) {
+		g_mutex_lock (&helper->mutex);
+		helper->dirs_watched += dirs->len;
+		g_cond_broadcast (&helper->cond);
+		g_mutex_unlock (&helper->mutex);
+	}
+	for (i = 0; i < iccs->len; i++) {
+		if (cd_icc_store_add_loaded_icc (store, g_ptr_array_index (iccs, i)))
+			helper->n_added++;
+	}
+	if (!done)
+		return G_SOURCE_REMOVE;
+
+	/* the workers have all finished */
+	if (g_task_return_error_if_cancelled (task))
+		return G_SOURCE_REMOVE;
+	if (helper->error != NULL) {
+		g_task_return_error (task, g_steal_pointer (&helper->error));
+		return G_SOURCE_REMOVE;
+	}
+	g_task_return_boolean (task, TRUE);
+	return G_SOURCE_REMOVE;
+}
+
+/* must be called with the mutex held */
+static void
+cd_icc_store_search_schedule_flush (GTask *task)
+{
+	CdIccStoreSearchHelper *helper = g_task_get_task_data (task);
+	g_autoptr(GSource) source = NULL;
+
+	if (helper->flush_pending)
+		return;
+	helper->flush_pending = TRUE;
+	source = g_idle_source_new ();
+	g_source_set_callback (source,
+			       cd_icc_store_search_flush_cb,
+			       g_object_ref (task),
+			       (GDestroyNotify) g_object_unref);
+	g_source_attach (source, g_task_get_context (task));
+}
+
+static void
+cd_icc_store_search_parse_cb (gpointer data, gpointer user_data)
+{
+	GTask *task = G_TASK (user_data);
+	CdIccStoreSearchHelper *helper = g_task_get_task_data (task);
+	GError *error_local = NULL;
+	g_autoptr(CdIccStoreSearchItem) item = (CdIccStoreSearchItem *) data;
+	g_autoptr(CdIcc) icc = NULL;
+	g_autoptr(GFile) file = NULL;
+
+	if (g_cancellable_is_cancelled (g_task_get_cancellable (task)))
+		return;
+	file = g_file_new_for_path (item->filename);
+	icc = cd_icc_store_load_icc (file,
+				     item->key,
+				     helper->load_flags,
+				     helper->cache,
+				     helper->index,
+				     &error_local);
+	if (icc == NULL) {
+		cd_icc_store_search_set_error (helper, error_local);
+		return;
+	}
+
+	/* hand over to the main context in batches */
+	g_mutex_lock (&helper->mutex);
+	g_ptr_array_add (helper->pending_iccs, g_steal_pointer (&icc));
+	cd_icc_store_search_schedule_flush (task);
+	g_mutex_unlock (&helper->mutex);
+}
+
+/* returns %FALSE if the search cannot continue */
+static gboolean
+cd_icc_store_search_push_file (GTask *task, const gchar *filename, GFileInfo *info)
+{
+	CdIccStoreSearchHelper *helper = g_task_get_task_data (task);
+	CdIccStoreSearchItem *item;
+	GError *error_local = NULL;
+	g_autoptr(GVariant) key = NULL;
+
+	key = cd_icc_store_index_get_key (info);
+	if (!cd_icc_store_is_profile (filename, info, helper->index, key))
+		return TRUE;
+
+	/* parse on the pool */
+	item = g_new0 (CdIccStoreSearchItem, 1);
+	item->filename = g_strdup (filename);
+	item->key = g_steal_pointer (&key);
+	if (!g_thread_pool_push (helper->pool, item, &error_local)) {
+		cd_icc_store_search_item_free (item);
+		cd_icc_store_search_set_error (helper, error_local);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+static void
+cd_icc_store_search_scan (GTask *task, const gchar *path, guint depth)
+{
+	CdIccStoreSearchHelper *helper = g_task_get_task_data (task);
+	GCancellable *cancellable = g_task_get_cancellable (task);
+	CdIccStoreSearchItem *dir;
+	GError *error_local = NULL;
+	guint ticket;
+	g_autoptr(GFileEnumerator) enumerator = NULL;
+	g_autoptr(GFile) file = NULL;
+
+	/* check sanity */
+	if (depth > CD_ICC_STORE_MAX_RECURSION_LEVELS) {
+		cd_icc_store_search_set_error (helper,
+			g_error_new (CD_ICC_ERROR,
+				     CD_ICC_ERROR_FAILED_TO_OPEN,
+				     "cannot recurse more than %i levels deep",
+				     CD_ICC_STORE_MAX_RECURSION_LEVELS));
+		return;
+	}
+
+	/* get contents of directory */
+	file = g_file_new_for_path (path);
+	enumerator = g_file_enumerate_children (file,
+						CD_ICC_STORE_FILE_ATTRIBUTES,
+						G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+						cancellable,
+						&error_local);
+	if (enumerator == NULL) {
+		cd_icc_store_search_set_error (helper, error_local);
+		return;
+	}
+
+	/* the monitor is added on the main context, and has to exist before
+	 * the files are listed so that nothing created meanwhile is missed */
+	dir = g_new0 (CdIccStoreSearchItem, 1);
+	dir->filename = g_strdup (path);
+	dir->depth = depth;
+	g_mutex_lock (&helper->mutex);
+	g_ptr_array_add (helper->pending_dirs, dir);
+	ticket = ++helper->dirs_requested;
+	cd_icc_store_search_schedule_flush (task);
+	while (helper->dirs_watched < ticket)
+		g_cond_wait (&helper->cond, &helper->mutex);
+	g_mutex_unlock (&helper->mutex);
+	if (helper->index != NULL)
+		cd_icc_store_index_add_directory (helper->index, path);
+
+	/* get all the files */
+	while (TRUE) {
+		g_autoptr(GFileInfo) info = NULL;
+		g_autofree gchar *full_path = NULL;
+
+		info = g_file_enumerator_next_file (enumerator,
+						    cancellable,
+						    &error_local);
+		if (info == NULL && error_local != NULL) {
+			cd_icc_store_search_set_error (helper, error_local);
+			return;
+		}
+
+		/* special value, meaning "no more files to process" */
+		if (info == NULL)
+			break;
+
+		/* further down the worm-hole */
+		full_path = g_build_filename (path, g_file_info_get_name (info), NULL);
+		if (g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY) {
+			cd_icc_store_search_scan (task, full_path, depth + 1);
+			continue;
+		}
+		if (!cd_icc_store_search_push_file (task, full_path, info))
+			return;
+	}
+}
+
+static gpointer
+cd_icc_store_search_thread_cb (gpointer user_data)
+{
+	g_autoptr(GTask) task = G_TASK (user_data);
+	CdIccStoreSearchHelper *helper = g_task_get_task_data (task);
+	CdIccStoreSearchFlags search_flags = helper->search_flags;
+	GCancellable *cancellable = g_task_get_cancellable (task);
+	guint i;
+
+	for (i = 0; i < helper->locations->len; i++) {
+		const gchar *location = g_ptr_array_index (helper->locations, i);
+		guint depth = 0;
+		g_autoptr(GFile) file = g_file_new_for_path (location);
+		g_autoptr(GFileInfo) info = NULL;
+
+		/* does folder exist? locations may be symlinks to directories
+		 * but files are treated the same as when enumerating */
+		info = g_file_query_info (file,
+					  CD_ICC_STORE_FILE_ATTRIBUTES,
+					  G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+					  cancellable,
+					  NULL);
+		if (info != NULL &&
+		    g_file_info_get_file_type (info) == G_FILE_TYPE_SYMBOLIC_LINK) {
+			g_clear_object (&info);
+			info = g_file_query_info (file,
+						  CD_ICC_STORE_FILE_ATTRIBUTES,
+						  G_FILE_QUERY_INFO_NONE,
+						  cancellable,
+						  NULL);
+			if (info != NULL &&
+			    g_file_info_get_file_type (info) != G_FILE_TYPE_DIRECTORY)
+				continue;
+		}
+		if (info != NULL &&
+		    g_file_info_get_file_type (info) != G_FILE_TYPE_DIRECTORY) {
+			/* a single file, e.g. from the directory monitor */
+			if (!cd_icc_store_search_push_file (task, location, info))
+				break;
+			continue;
+		}
+		if (info == NULL) {
+			if ((search_flags & CD_ICC_STORE_SEARCH_FLAGS_CREATE_LOCATION) > 0) {
+				GError *error_local = NULL;
+				if (!g_file_make_directory_with_parents (file,
+									 cancellable,
+									 &error_local)) {
+					cd_icc_store_search_set_error (helper, error_local);
+					continue;
+				}
+			} else {
+				continue;
+			}
+		}
+		if (helper->depths != NULL)
+			depth = g_array_index (helper->depths, guint, i);
+		cd_icc_store_search_scan (task, location, depth);
+
+		/* only create the first location */
+		search_flags &= ~CD_ICC_STORE_SEARCH_FLAGS_CREATE_LOCATION;
+	}
+
+	/* wait for the parsers, then let the main context finish up */
+	g_thread_pool_free (helper->pool, FALSE, TRUE);
+	helper->pool = NULL;
+	if (helper->index != NULL)
+		cd_icc_store_index_search_end (helper->index);
+	if (helper->index != NULL &&
+	    !g_cancellable_is_cancelled (cancellable)) {
+		g_autoptr(GError) error_local = NULL;
+		if (!cd_icc_store_index_save (helper->index, &error_local))
+			g_warning ("CdIccStore: failed to save index: %s",
+				   error_local->message);
+	}
+	g_mutex_lock (&helper->mutex);
+	helper->done = TRUE;
+	cd_icc_store_search_schedule_flush (task);
+	g_mutex_unlock (&helper->mutex);
+	return NULL;
+}
+
+static void
+cd_icc_store_search_locations_async (CdIccStore *store,
+				     GPtrArray *locations,
+				     GArray *depths,
+				     CdIccStoreSearchFlags search_flags,
+				     GCancellable *cancellable,
+				     gpointer source_tag,
+				     GAsyncReadyCallback callback,
+				     gpointer user_data)
+{
+	CdIccStorePrivate *priv = GET_PRIVATE (store);
+	CdIccStoreSearchHelper *helper;
+	GError *error = NULL;
+	GThread *thread;
+	g_autoptr(GTask) task = NULL;
+
+	task = g_task_new (store, cancellable, callback, user_data);
+	g_task_set_source_tag (task, source_tag);
+	helper = g_new0 (CdIccStoreSearchHelper, 1);
+	helper->store = g_object_ref (store);
+	helper->locations = g_ptr_array_ref (locations);
+	if (depths != NULL)
+		helper->depths = g_array_ref (depths);
+	helper->search_flags = search_flags;
+	helper->load_flags = priv->load_flags;
+	if (priv->cache != NULL)
+		helper->cache = g_resource_ref (priv->cache);
+	helper->index = cd_icc_store_get_index (store);
+	g_mutex_init (&helper->mutex);
+	g_cond_init (&helper->cond);
+	helper->pending_dirs = g_ptr_array_new_with_free_func ((GDestroyNotify) cd_icc_store_search_item_free);
+	helper->pending_iccs = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+	g_task_set_task_data (task, helper, (GDestroyNotify) cd_icc_store_search_helper_free);
+
+	/* parse the profiles in parallel */
+	helper->pool = g_thread_pool_new (cd_icc_store_search_parse_cb,
+					  task,
+					  cd_cpu_get_n_threads (),
+					  FALSE,
+					  &error);
+	if (helper->pool == NULL) {
+		g_task_return_error (task, error);
+		return;
+	}
+
+	/* enumerate on a worker so the caller can get on with things */
+	if (helper->index != NULL)
+		cd_icc_store_index_search_begin (helper->index);
+	thread = g_thread_try_new ("cd-icc-store",
+				   cd_icc_store_search_thread_cb,
+				   g_object_ref (task),
+				   &error);
+	if (thread == NULL) {
+		if (helper->index != NULL)
+			cd_icc_store_index_search_end (helper->index);
+		g_thread_pool_free (helper->pool, TRUE, TRUE);
+		helper->pool = NULL;
+		g_object_unref (task);
+		g_task_return_error (task, error);
+		return;
+	}
+	g_thread_unref (thread);
+}
+
+static void
+cd_icc_store_monitor_search_cb (GObject *source_object,
+				GAsyncResult *res,
+				gpointer user_data)
+{
+	CdIccStore *store = CD_ICC_STORE (source_object);
+	CdIccStoreSearchHelper *helper = g_task_get_task_data (G_TASK (res));
+	gboolean removed = GPOINTER_TO_UINT (user_data);
+	g_autoptr(GError) error = NULL;
+
+	if (!g_task_propagate_boolean (G_TASK (res), &error))
+		g_warning ("failed to search file: %s", error->message);
+	if (removed || helper->n_added > 0)
+		g_signal_emit (store, signals[SIGNAL_CHANGED], 0);
+}
+
+static gboolean
+cd_icc_store_monitor_flush_cb (gpointer user_data)
+{
+	CdIccStore *store = CD_ICC_STORE (user_data);
+	CdIccStorePrivate *priv = GET_PRIVATE (store);
+	GHashTableIter iter;
+	gboolean removed = FALSE;
+	gpointer key;
+	gpointer value;
+	g_autoptr(GArray) depths = g_array_new (FALSE, FALSE, sizeof (guint));
+	g_autoptr(GHashTable) events = NULL;
+	g_autoptr(GPtrArray) locations = g_ptr_array_new_with_free_func (g_free);
+
+	/* take everything that arrived in the window */
+	priv->monitor_id = 0;
+	events = priv->monitor_events;
+	priv->monitor_events = g_hash_table_new_full (g_str_hash, g_str_equal,
+						      g_free, NULL);
+	g_debug ("CdIccStore: processing %u changed paths",
+		 g_hash_table_size (events));
+
+	/* removing is cheap, but anything else is parsed again as it may
+	 * have been replaced or modified */
+	g_hash_table_iter_init (&iter, events);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		CdIccStoreDirHelper *parent;
+		const gchar *path = key;
+		guint depth = 0;
+		g_autofree gchar *dirname = NULL;
+
+		if (GPOINTER_TO_UINT (value) == G_FILE_MONITOR_EVENT_DELETED) {
+			if (cd_icc_store_remove_path (store, path))
+				removed = TRUE;
+			continue;
+		}
+		if (g_hash_table_contains (priv->icc_by_filename, path) &&
+		    cd_icc_store_remove_icc (store, path))
+			removed = TRUE;
+		g_ptr_array_add (locations, g_strdup (path));
+
+		/* a new directory is one level below the one being watched */
+		dirname = g_path_get_dirname (path);
+		parent = cd_icc_store_find_by_directory (store, dirname);
+		if (parent != NULL)
+			depth = parent->depth + 1;
+		g_array_append_val (depths, depth);
+	}
+	if (locations->len == 0) {
+		if (removed)
+			g_signal_emit (store, signals[SIGNAL_CHANGED], 0);
+		return G_SOURCE_REMOVE;
+	}
+
+	/* parse the new files and scan any new directories on a worker */
+	cd_icc_store_search_locations_async (store, locations, depths,
+					     CD_ICC_STORE_SEARCH_FLAGS_NONE,
+					     NULL,
+					     cd_icc_store_monitor_flush_cb,
+					     cd_icc_store_monitor_search_cb,
+					     GUINT_TO_POINTER (removed));
+	return G_SOURCE_REMOVE;
+}
+
+/**
+ * cd_icc_store_search_kind_async:
+ * @store: a #CdIccStore instance.
+ * @search_kind: a #CdIccStoreSearchKind, e.g. %CD_ICC_STORE_SEARCH_KIND_USER
+ * @search_flags: a #CdIccStoreSearchFlags, e.g. %CD_ICC_STORE_SEARCH_FLAGS_CREATE_LOCATION
+ * @cancellable: A #GCancellable or %NULL
+ * @callback: the function to run on completion
+ * @user_data: the data to pass to @callback
+ *
+ * Adds a location to be watched for ICC profiles.
+ *
+ * The directories are enumerated and the profiles parsed on worker threads,
+ * and the ::added signal is emitted in batches from the thread-default main
+ * context as the profiles are found. Profiles that fail to parse do not stop
+ * the search, although the first error is returned when it has completed.
+ *
+ * Since: 1.4.9
+ **/
+void
+cd_icc_store_search_kind_async (CdIccStore *store,
+				CdIccStoreSearchKind search_kind,
+				CdIccStoreSearchFlags search_flags,
+				GCancellable *cancellable,
+				GAsyncReadyCallback callback,
+				gpointer user_data)
+{
+	g_autoptr(GPtrArray) locations = NULL;
+
+	g_return_if_fail (CD_IS_ICC_STORE (store));
+	g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+
+	locations = cd_icc_store_get_locations (search_kind);
+	cd_icc_store_search_locations_async (store, locations, NULL, search_flags,
+					     cancellable,
+					     cd_icc_store_search_kind_async,
+					     callback, user_data);
+}
+
+/**
+ * cd_icc_store_search_kind_finish:
+ * @store: a #CdIccStore instance.
+ * @res: the #GAsyncResult
+ * @error: A #GError or %NULL
+ *
+ * Gets the result from the asynchronous function.
+ *
+ * Return value: %TRUE for success
+ *
+ * Since: 1.4.9
+ **/
+gboolean
+cd_icc_store_search_kind_finish (CdIccStore *store,
+				 GAsyncResult *res,
+				 GError **error)
+{
+	g_return_val_if_fail (CD_IS_ICC_STORE (store), FALSE);
+	g_return_val_if_fail (g_task_is_valid (res, store), FALSE);
+	g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+	return g_task_propagate_boolean (G_TASK (res), error);
+}
+
+/**
+ * cd_icc_store_search_location_async:
+ * @store: a #CdIccStore instance.
+ * @location: a fully qualified path
+ * @search_flags: #CdIccStoreSearchFlags, e.g. %CD_ICC_STORE_SEARCH_FLAGS_CREATE_LOCATION
+ * @cancellable: A #GCancellable or %NULL
+ * @callback: the function to run on completion
+ * @user_data: the data to pass to @callback
+ *
+ * Adds a location to be watched for ICC profiles, in the same way as
+ * cd_icc_store_search_kind_async().
+ *
+ * Since: 1.4.9
+ **/
+void
+cd_icc_store_search_location_async (CdIccStore *store,
+				    const gchar *location,
+				    CdIccStoreSearchFlags search_flags,
+				    GCancellable *cancellable,
+				    GAsyncReadyCallback callback,
+				    gpointer user_data)
+{
+	g_autoptr(GPtrArray) locations = NULL;
+
+	g_return_if_fail (CD_IS_ICC_STORE (store));
+	g_return_if_fail (location != NULL);
+	g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+
+	locations = g_ptr_array_new_with_free_func (g_free);
+	g_ptr_array_add (locations, g_strdup (location));
+	cd_icc_store_search_locations_async (store, locations, NULL, search_flags,
+					     cancellable,
+					     cd_icc_store_search_location_async,
+					     callback, user_data);
+}
+
+/**
+ * cd_icc_store_search_location_finish:
+ * @store: a #CdIccStore instance.
+ * @res: the #GAsyncResult
+ * @error: A #GError or %NULL
+ *
+ * Gets the result from the asynchronous function.
+ *
+ * Return value: %TRUE for success
+ *
+ * Since: 1.4.9
+ **/
+gboolean
+cd_icc_store_search_location_finish (CdIccStore *store,
+				     GAsyncResult *res,
+				     GError **error)
+{
+	g_return_val_if_fail (CD_IS_ICC_STORE (store), FALSE);
+	g_return_val_if_fail (g_task_is_valid (res, store), FALSE);
+	g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+	return g_task_propagate_boolean (G_TASK (res), error);
 }
 
 static void
@@ -695,6 +1845,21 @@ cd_icc_store_class_init (CdIccStoreClass *klass)
 			      G_STRUCT_OFFSET (CdIccStoreClass, removed),
 			      NULL, NULL, g_cclosure_marshal_generic,
 			      G_TYPE_NONE, 1, CD_TYPE_ICC);
+	/**
+	 * CdIccStore::changed:
+	 * @profile: the #CdIccStore instance that emitted the signal
+	 *
+	 * The ::changed signal is emitted once after a batch of changes
+	 * from the directory monitors has been processed, after all the
+	 * ::added and ::removed signals for the batch.
+	 *
+	 * Since: 1.4.9
+	 **/
+	signals[SIGNAL_CHANGED] =
+		g_signal_new ("changed",
+			      G_TYPE_FROM_CLASS (object_class), G_SIGNAL_RUN_LAST,
+			      0, NULL, NULL, g_cclosure_marshal_generic,
+			      G_TYPE_NONE, 0);
 }
 
 static void
@@ -703,7 +1868,18 @@ cd_icc_store_init (CdIccStore *store)
 	CdIccStorePrivate *priv = GET_PRIVATE (store);
 	priv->load_flags = CD_ICC_LOAD_FLAGS_FALLBACK_MD5;
 	priv->icc_array = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
-	priv->directory_array = g_ptr_array_new_with_free_func ((GDestroyNotify) cd_icc_store_helper_free);
+	priv->icc_by_filename = g_hash_table_new_full (g_str_hash, g_str_equal,
+						       g_free, (GDestroyNotify) g_object_unref);
+	priv->icc_by_checksum = g_hash_table_new_full (g_str_hash, g_str_equal,
+						       g_free, (GDestroyNotify) g_object_unref);
+	priv->icc_by_fast_checksum = g_hash_table_new_full (g_str_hash, g_str_equal,
+							    g_free, (GDestroyNotify) g_object_unref);
+	priv->filenames = g_sequence_new (g_free);
+	priv->directories = g_hash_table_new_full (g_str_hash, g_str_equal,
+						   NULL, (GDestroyNotify) cd_icc_store_helper_free);
+	priv->monitor_delay = CD_ICC_STORE_MONITOR_DELAY_DEFAULT;
+	priv->monitor_events = g_hash_table_new_full (g_str_hash, g_str_equal,
+						      g_free, NULL);
 }
 
 static void
@@ -713,9 +1889,21 @@ cd_icc_store_finalize (GObject *object)
 	CdIccStorePrivate *priv = GET_PRIVATE (store);
 
 	g_ptr_array_unref (priv->icc_array);
-	g_ptr_array_unref (priv->directory_array);
+	g_hash_table_unref (priv->icc_by_filename);
+	g_hash_table_unref (priv->icc_by_checksum);
+	g_hash_table_unref (priv->icc_by_fast_checksum);
+	g_sequence_free (priv->filenames);
+	g_hash_table_unref (priv->directories);
+	if (priv->monitor_id != 0)
+		g_source_remove (priv->monitor_id);
+	g_hash_table_unref (priv->monitor_events);
 	if (priv->cache != NULL)
 		g_resource_unref (priv->cache);
+	if (priv->index != NULL) {
+		cd_icc_store_save_index (store);
+		cd_icc_store_index_free (priv->index);
+	}
+	g_free (priv->index_filename);
 
 	G_OBJECT_CLASS (cd_icc_store_parent_class)->finalize (object);
 }
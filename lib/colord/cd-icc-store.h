@@ -87,11 +87,33 @@ gboolean	 cd_icc_store_search_kind	(CdIccStore	*store,
 						 CdIccStoreSearchFlags search_flags,
 						 GCancellable	*cancellable,
 						 GError		**error);
+void		 cd_icc_store_search_location_async (CdIccStore	*store,
+						 const gchar	*location,
+						 CdIccStoreSearchFlags search_flags,
+						 GCancellable	*cancellable,
+						 GAsyncReadyCallback callback,
+						 gpointer	 user_data);
+gboolean	 cd_icc_store_search_location_finish (CdIccStore *store,
+						 GAsyncResult	*res,
+						 GError		**error);
+void		 cd_icc_store_search_kind_async	(CdIccStore	*store,
+						 CdIccStoreSearchKind search_kind,
+						 CdIccStoreSearchFlags search_flags,
+						 GCancellable	*cancellable,
+						 GAsyncReadyCallback callback,
+						 gpointer	 user_data);
+gboolean	 cd_icc_store_search_kind_finish (CdIccStore	*store,
+						 GAsyncResult	*res,
+						 GError		**error);
 void		 cd_icc_store_set_load_flags	(CdIccStore	*store,
 						 CdIccLoadFlags	 load_flags);
 CdIccLoadFlags	 cd_icc_store_get_load_flags	(CdIccStore	*store);
 void		 cd_icc_store_set_cache		(CdIccStore	*store,
 						 GResource	*cache);
+void		 cd_icc_store_set_index_filename (CdIccStore	*store,
+						 const gchar	*filename);
+void		 cd_icc_store_set_monitor_delay	(CdIccStore	*store,
+						 guint		 delay);
 GPtrArray	*cd_icc_store_get_all		(CdIccStore	*store);
 CdIcc		*cd_icc_store_find_by_filename	(CdIccStore	*store,
 						 const gchar	*filename);
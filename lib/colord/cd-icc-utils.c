@@ -31,43 +31,100 @@
 
 #include <glib-object.h>
 #include <lcms2.h>
+#include <math.h>
 
+#include "cd-cpu.h"
+#include "cd-icc-private.h"
 #include "cd-icc-utils.h"
 
+/* nodes per side of the final sampling cube */
+#define CD_ICC_UTILS_COVERAGE_CUBE_SIZE		33
+
+/* don't bother spinning up a thread for fewer nodes than this */
+#define CD_ICC_UTILS_COVERAGE_TILE_MIN		4096
+
+/* results are keyed by "checksum#gen:checksum_reference#gen:tolerance" */
+#define CD_ICC_UTILS_COVERAGE_CACHE_MAX		1024
+
+static GMutex		 coverage_cache_mutex;
+static GHashTable	*coverage_cache = NULL;
+
+/* protects the pending count of every caller waiting on the pool */
+static GMutex		 coverage_pool_mutex;
+static GCond		 coverage_pool_cond;
+
 typedef struct {
-	guint			 idx;
-	cmsFloat32Number	*data;
-} CdIccUtilsGamutCheckHelper;
-
-static cmsInt32Number
-cd_icc_utils_get_coverage_sample_cb (const cmsFloat32Number in[],
-				     cmsFloat32Number out[],
-				     void *user_data)
+	cmsHTRANSFORM		 transform;
+	const cmsFloat32Number	*in;
+	cmsFloat32Number	*out;
+	guint			 len;
+	guint			*pending;	/* tiles the caller is waiting for */
+} CdIccUtilsCoverageTile;
+
+static void
+cd_icc_utils_coverage_tile_cb (gpointer data, gpointer user_data)
 {
-	CdIccUtilsGamutCheckHelper *helper = (CdIccUtilsGamutCheckHelper *) user_data;
-	helper->data[helper->idx++] = in[0];
-	helper->data[helper->idx++] = in[1];
-	helper->data[helper->idx++] = in[2];
-	return 1;
+	CdIccUtilsCoverageTile *tile = (CdIccUtilsCoverageTile *) data;
+	cmsDoTransform (tile->transform, tile->in, tile->out, tile->len);
+
+	/* there may be more than one caller waiting */
+	g_mutex_lock (&coverage_pool_mutex);
+	if (--(*tile->pending) == 0)
+		g_cond_broadcast (&coverage_pool_cond);
+	g_mutex_unlock (&coverage_pool_mutex);
+}
+
+/* the worker threads are shared by every caller and kept around */
+static GThreadPool *
+cd_icc_utils_get_coverage_pool (void)
+{
+	static gsize pool = 0;
+	if (g_once_init_enter (&pool)) {
+		GThreadPool *tmp;
+		tmp = g_thread_pool_new (cd_icc_utils_coverage_tile_cb,
+					 NULL,
+					 (gint) cd_cpu_get_n_threads (),
+					 FALSE,
+					 NULL);
+		g_once_init_leave (&pool, (gsize) tmp);
+	}
+	return (GThreadPool *) pool;
 }
 
 static gboolean
 cd_icc_utils_get_coverage_calc (CdIcc *icc,
 				CdIcc *icc_reference,
+				guint cube_size,
 				gdouble *coverage,
 				GError **error)
 {
-	const guint cube_size = 33;
 	cmsHPROFILE profile_null = NULL;
 	cmsHTRANSFORM transform = NULL;
-	cmsUInt32Number dimensions[] = { cube_size, cube_size, cube_size };
-	CdIccUtilsGamutCheckHelper helper;
 	gboolean ret = TRUE;
 	guint cnt = 0;
 	guint data_len = cube_size * cube_size * cube_size;
 	guint i;
+	guint n_tiles;
+	guint r, g, b;
+	guint pending;
+	guint tile_len;
+	g_autofree cmsFloat32Number *axis = NULL;
 	g_autofree cmsFloat32Number *data = NULL;
+	g_autofree cmsFloat32Number *result = NULL;
 	g_autofree cmsUInt16Number *alarm_codes = NULL;
+	g_autofree CdIccUtilsCoverageTile *tiles = NULL;
+
+	/* either profile may have been loaded without parsing the tags */
+	if (cd_icc_get_handle (icc) == NULL ||
+	    cd_icc_get_handle (icc_reference) == NULL) {
+		g_set_error (error,
+			     CD_ICC_ERROR,
+			     CD_ICC_ERROR_FAILED_TO_PARSE,
+			     "Failed to load %s or %s",
+			     cd_icc_get_filename (icc),
+			     cd_icc_get_filename (icc_reference));
+		return FALSE;
+	}
 
 	/* create a proofing transform with gamut check */
 	profile_null = cmsCreateNULLProfileTHR (cd_icc_get_context (icc));
@@ -97,27 +154,58 @@ cd_icc_utils_get_coverage_calc (CdIcc *icc,
 	alarm_codes[0] = 0xffff;
 	cmsSetAlarmCodesTHR(cd_icc_get_context (icc), alarm_codes);
 
-	/* slice profile in regular intervals */
-	data = g_new0 (cmsFloat32Number, data_len * 3);
-	helper.data = data;
-	helper.idx = 0;
-	ret = cmsSliceSpaceFloat (3, dimensions,
-				  cd_icc_utils_get_coverage_sample_cb,
-				  &helper);
-	if (!ret) {
-		g_set_error_literal (error,
-				     CD_ICC_ERROR,
-				     CD_ICC_ERROR_INTERNAL,
-				     "Failed to slice data");
-		goto out;
+	/* generate the nodes of the cube in regular intervals, quantized
+	 * in the same way as cmsSliceSpaceFloat() */
+	axis = g_new (cmsFloat32Number, cube_size);
+	for (i = 0; i < cube_size; i++) {
+		gdouble tmp = floor (((gdouble) i * 65535.f / (cube_size - 1)) + 0.5f);
+		axis[i] = (cmsFloat32Number) (tmp / 65535.f);
+	}
+	data = g_new (cmsFloat32Number, data_len * 3);
+	result = g_new (cmsFloat32Number, data_len);
+	for (r = 0, i = 0; r < cube_size; r++) {
+		for (g = 0; g < cube_size; g++) {
+			for (b = 0; b < cube_size; b++) {
+				data[i++] = axis[r];
+				data[i++] = axis[g];
+				data[i++] = axis[b];
+			}
+		}
 	}
 
-	/* transform each one of those nodes across the proofing transform */
-	cmsDoTransform (transform, helper.data, helper.data, data_len);
+	/* split the cube into contiguous tiles, one per thread; the
+	 * proofing transform is read-only once created so they can share it */
+	n_tiles = MIN (cd_cpu_get_n_threads (),
+		       data_len / CD_ICC_UTILS_COVERAGE_TILE_MIN);
+	n_tiles = MAX (n_tiles, 1);
+	tile_len = (data_len + n_tiles - 1) / n_tiles;
+	tiles = g_new0 (CdIccUtilsCoverageTile, n_tiles);
+	for (i = 0; i < n_tiles; i++) {
+		guint offset = i * tile_len;
+		tiles[i].transform = transform;
+		tiles[i].in = data + (offset * 3);
+		tiles[i].out = result + offset;
+		tiles[i].len = MIN (tile_len, data_len - offset);
+		tiles[i].pending = &pending;
+	}
+
+	/* transform each one of those nodes across the proofing transform,
+	 * doing the last tile in this thread and any the pool could not take */
+	pending = n_tiles;
+	for (i = 0; i + 1 < n_tiles; i++) {
+		if (!g_thread_pool_push (cd_icc_utils_get_coverage_pool (),
+					 &tiles[i], NULL))
+			cd_icc_utils_coverage_tile_cb (&tiles[i], NULL);
+	}
+	cd_icc_utils_coverage_tile_cb (&tiles[n_tiles - 1], NULL);
+	g_mutex_lock (&coverage_pool_mutex);
+	while (pending > 0)
+		g_cond_wait (&coverage_pool_cond, &coverage_pool_mutex);
+	g_mutex_unlock (&coverage_pool_mutex);
 
 	/* count the nodes that gives you zero and divide by total number */
 	for (i = 0; i < data_len; i++) {
-		if (helper.data[i] == 0.0)
+		if (result[i] == 0.0)
 			cnt++;
 	}
 
@@ -131,49 +219,180 @@ out:
 	return ret;
 }
 
+static gboolean
+cd_icc_utils_get_coverage_refine (CdIcc *icc,
+				  CdIcc *icc_reference,
+				  gdouble tolerance,
+				  gdouble *coverage,
+				  GError **error)
+{
+	const guint cube_sizes[] = { 9, 17, CD_ICC_UTILS_COVERAGE_CUBE_SIZE, 0 };
+	gdouble coverage_last = -1.f;
+	gdouble coverage_tmp = 0.f;
+	guint i;
+
+	/* no tolerance, so only the full cube will do */
+	if (tolerance <= 0.f) {
+		return cd_icc_utils_get_coverage_calc (icc,
+						       icc_reference,
+						       CD_ICC_UTILS_COVERAGE_CUBE_SIZE,
+						       coverage,
+						       error);
+	}
+
+	/* each lattice contains the nodes of the coarser one, so stop as
+	 * soon as doubling the resolution moves the result less than the
+	 * tolerance */
+	for (i = 0; cube_sizes[i] != 0; i++) {
+		if (!cd_icc_utils_get_coverage_calc (icc,
+						     icc_reference,
+						     cube_sizes[i],
+						     &coverage_tmp,
+						     error))
+			return FALSE;
+		if (coverage_last >= 0.f &&
+		    ABS (coverage_tmp - coverage_last) <= tolerance)
+			break;
+		coverage_last = coverage_tmp;
+	}
+
+	/* success */
+	if (coverage != NULL)
+		*coverage = coverage_tmp;
+	return TRUE;
+}
+
+static gchar *
+cd_icc_utils_get_coverage_cache_key (CdIcc *icc,
+				     CdIcc *icc_reference,
+				     gdouble tolerance)
+{
+	const gchar *checksum = cd_icc_get_checksum (icc);
+	const gchar *checksum_reference = cd_icc_get_checksum (icc_reference);
+
+	/* profiles built in memory have nothing stable to key on */
+	if (checksum == NULL || checksum_reference == NULL)
+		return NULL;
+
+	/* the checksum is stale once the profile has been edited */
+	return g_strdup_printf ("%s#%u:%s#%u:%.6f",
+				checksum, cd_icc_get_generation (icc),
+				checksum_reference, cd_icc_get_generation (icc_reference),
+				MAX (tolerance, 0.f));
+}
+
 /**
- * cd_icc_utils_get_coverage:
+ * cd_icc_utils_get_coverage_full:
  * @icc: The profile to test
  * @icc_reference: The reference profile, e.g. sRGB
+ * @tolerance: The acceptable error in the result, or 0 for the full cube
  * @coverage: The coverage of @icc on @icc_reference
  * @error: A #GError, or %NULL
  *
  * Gets the gamut coverage of two profiles where 0.5 would mean the gamut is
  * half the size, and 2.0 would indicate the gamut is twice the size.
  *
+ * When @tolerance is non-zero the profiles are first compared using a coarse
+ * lattice which is only refined while the result keeps moving by more than
+ * @tolerance. Results for profiles loaded from data are cached using the
+ * profile checksums, so repeated queries for the same pair are cheap until
+ * either profile is modified.
+ *
  * Return value: TRUE for success
+ *
+ * Since: 1.4.9
  **/
 gboolean
-cd_icc_utils_get_coverage (CdIcc *icc,
-			   CdIcc *icc_reference,
-			   gdouble *coverage,
-			   GError **error)
+cd_icc_utils_get_coverage_full (CdIcc *icc,
+				CdIcc *icc_reference,
+				gdouble tolerance,
+				gdouble *coverage,
+				GError **error)
 {
 	gdouble coverage_tmp;
+	gpointer cached;
+	g_autofree gchar *key = NULL;
+
+	g_return_val_if_fail (CD_IS_ICC (icc), FALSE);
+	g_return_val_if_fail (CD_IS_ICC (icc_reference), FALSE);
+
+	/* already calculated for this pair */
+	key = cd_icc_utils_get_coverage_cache_key (icc, icc_reference, tolerance);
+	if (key != NULL) {
+		g_mutex_lock (&coverage_cache_mutex);
+		cached = coverage_cache != NULL ?
+			 g_hash_table_lookup (coverage_cache, key) : NULL;
+		if (cached != NULL)
+			coverage_tmp = *((gdouble *) cached);
+		g_mutex_unlock (&coverage_cache_mutex);
+		if (cached != NULL)
+			goto out;
+	}
 
 	/* first see if icc has a smaller gamut volume to the reference */
-	if (!cd_icc_utils_get_coverage_calc (icc,
-					     icc_reference,
-					     &coverage_tmp,
-					     error))
+	if (!cd_icc_utils_get_coverage_refine (icc,
+					       icc_reference,
+					       tolerance,
+					       &coverage_tmp,
+					       error))
 		return FALSE;
 
 	/* now try the other way around */
 	if (coverage_tmp >= 1.0f) {
-		if (!cd_icc_utils_get_coverage_calc (icc_reference,
-						     icc,
-						     &coverage_tmp,
-						     error))
+		if (!cd_icc_utils_get_coverage_refine (icc_reference,
+						       icc,
+						       tolerance,
+						       &coverage_tmp,
+						       error))
 			return FALSE;
 		coverage_tmp = 1 / coverage_tmp;
 	}
 
+	/* save for next time */
+	if (key != NULL) {
+		g_mutex_lock (&coverage_cache_mutex);
+		if (coverage_cache == NULL) {
+			coverage_cache = g_hash_table_new_full (g_str_hash,
+								g_str_equal,
+								g_free,
+								g_free);
+		}
+		if (g_hash_table_size (coverage_cache) >= CD_ICC_UTILS_COVERAGE_CACHE_MAX)
+			g_hash_table_remove_all (coverage_cache);
+		cached = g_new (gdouble, 1);
+		*((gdouble *) cached) = coverage_tmp;
+		g_hash_table_insert (coverage_cache, g_strdup (key), cached);
+		g_mutex_unlock (&coverage_cache_mutex);
+	}
+out:
 	/* success */
 	if (coverage != NULL)
 		*coverage = coverage_tmp;
 	return TRUE;
 }
 
+/**
+ * cd_icc_utils_get_coverage:
+ * @icc: The profile to test
+ * @icc_reference: The reference profile, e.g. sRGB
+ * @coverage: The coverage of @icc on @icc_reference
+ * @error: A #GError, or %NULL
+ *
+ * Gets the gamut coverage of two profiles where 0.5 would mean the gamut is
+ * half the size, and 2.0 would indicate the gamut is twice the size.
+ *
+ * Return value: TRUE for success
+ **/
+gboolean
+cd_icc_utils_get_coverage (CdIcc *icc,
+			   CdIcc *icc_reference,
+			   gdouble *coverage,
+			   GError **error)
+{
+	return cd_icc_utils_get_coverage_full (icc, icc_reference, 0.f,
+					       coverage, error);
+}
+
 /**
  * cd_icc_utils_get_chroma_matrix:
  * @icc: The profile to use.
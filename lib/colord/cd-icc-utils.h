@@ -38,6 +38,11 @@ gboolean	 cd_icc_utils_get_coverage		(CdIcc		*icc,
 							 CdIcc		*icc_reference,
 							 gdouble	*coverage,
 							 GError		**error);
+gboolean	 cd_icc_utils_get_coverage_full		(CdIcc		*icc,
+							 CdIcc		*icc_reference,
+							 gdouble	 tolerance,
+							 gdouble	*coverage,
+							 GError		**error);
 
 gboolean	cd_icc_utils_get_adaptation_matrix (CdIcc		*icc,
 						    CdIcc		*icc_reference,
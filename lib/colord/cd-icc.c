@@ -25,6 +25,8 @@
  * @short_description: An object to read and write a binary ICC profile
  */
 
+#define _GNU_SOURCE
+
 #include "config.h"
 
 #include <glib.h>
@@ -35,10 +37,15 @@
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <math.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "cd-context-lcms.h"
+#include "cd-hash.h"
 #include "cd-icc.h"
+#include "cd-icc-private.h"
 
 static void	cd_icc_class_init	(CdIccClass	*klass);
 static void	cd_icc_init		(CdIcc		*icc);
@@ -68,21 +75,42 @@ typedef struct
 	cmsHPROFILE		 lcms_profile;
 	gboolean		 can_delete;
 	gchar			*checksum;
+	gchar			*fast_checksum;	/* XXH64 of the data, or %NULL */
 	gchar			*filename;
 	gchar			*characterization_data;
 	gdouble			 version;
 	GHashTable		*mluc_data[CD_MLUC_LAST]; /* key is 'en_GB' or '' for default */
 	GHashTable		*metadata;
+	gboolean		 metadata_pending; /* dict not yet decoded */
 	gint64			 creation_time;
+	gint64			 creation_time_summary; /* or -1 */
 	guint32			 size;
-	GPtrArray		*named_colors;
+	GBytes			*data;		/* mapped file, or %NULL */
+	gboolean		 data_deferred;	/* read filename when needed */
+	gint64			 data_mtime;	/* us, when deferred */
+	gchar			**tags;		/* from a summary, or %NULL */
+	GPtrArray		*named_colors;	/* of CdColorSwatch, built on demand */
+	GStringChunk		*named_color_names;
+	GArray			*named_color_values; /* of CdIccNamedColor */
+	GHashTable		*named_color_hash; /* name to index + 1 */
+	guint			*named_color_kdtree; /* indexes, or %NULL */
 	guint			 temperature;
+	cmsHPROFILE		 profile_lab;	/* shared D50 Lab v2, or %NULL */
+	cmsHPROFILE		 profile_xyz;	/* shared XYZ, or %NULL */
+	GArray			*warnings;	/* cached, or %NULL */
+	gchar			*warnings_checksum;
+	guint			 generation;	/* 0 if unchanged since loaded */
 	CdColorXYZ		 white;
 	CdColorXYZ		 red;
 	CdColorXYZ		 green;
 	CdColorXYZ		 blue;
 } CdIccPrivate;
 
+typedef struct {
+	const gchar		*name;	/* owned by named_color_names */
+	CdColorLab		 value;
+} CdIccNamedColor;
+
 G_DEFINE_TYPE_WITH_PRIVATE (CdIcc, cd_icc, G_TYPE_OBJECT)
 
 enum {
@@ -158,18 +186,491 @@ cd_icc_uint32_to_str (guint32 id, gchar *str)
 	str[4] = '\0';
 }
 
+/* reads from the bytes in-place rather than copying them like
+ * cmsOpenProfileFromMemTHR() does, so that only the tags lcms actually
+ * reads are ever copied from the page cache */
+typedef struct {
+	GBytes		*bytes;
+	const guint8	*data;
+	gsize		 size;
+} CdIccBytesStream;
+
+static cmsUInt32Number
+cd_icc_bytes_io_read (cmsIOHANDLER *io,
+		      void *buffer,
+		      cmsUInt32Number size,
+		      cmsUInt32Number count)
+{
+	CdIccBytesStream *stream = (CdIccBytesStream *) io->stream;
+	gsize len = (gsize) size * count;
+
+	if (io->UsedSpace + len > stream->size) {
+		cmsSignalError (io->ContextID, cmsERROR_READ,
+				"Read from memory error. Got %u bytes, block should be of %u bytes",
+				(cmsUInt32Number) len,
+				(cmsUInt32Number) (stream->size - io->UsedSpace));
+		return 0;
+	}
+	memcpy (buffer, stream->data + io->UsedSpace, len);
+	io->UsedSpace += len;
+	return count;
+}
+
+static cmsBool
+cd_icc_bytes_io_seek (cmsIOHANDLER *io, cmsUInt32Number offset)
+{
+	CdIccBytesStream *stream = (CdIccBytesStream *) io->stream;
+	if (offset > stream->size) {
+		cmsSignalError (io->ContextID, cmsERROR_SEEK,
+				"Too few data; probably corrupted profile");
+		return FALSE;
+	}
+	io->UsedSpace = offset;
+	return TRUE;
+}
+
+static cmsUInt32Number
+cd_icc_bytes_io_tell (cmsIOHANDLER *io)
+{
+	return io->UsedSpace;
+}
+
+static cmsBool
+cd_icc_bytes_io_write (cmsIOHANDLER *io, cmsUInt32Number size, const void *buffer)
+{
+	return FALSE;
+}
+
+static cmsBool
+cd_icc_bytes_io_close (cmsIOHANDLER *io)
+{
+	CdIccBytesStream *stream = (CdIccBytesStream *) io->stream;
+	g_bytes_unref (stream->bytes);
+	g_free (stream);
+	g_free (io);
+	return TRUE;
+}
+
+static cmsIOHANDLER *
+cd_icc_bytes_io_new (cmsContext context_lcms, GBytes *bytes)
+{
+	CdIccBytesStream *stream = g_new0 (CdIccBytesStream, 1);
+	cmsIOHANDLER *io = g_new0 (cmsIOHANDLER, 1);
+
+	stream->bytes = g_bytes_ref (bytes);
+	stream->data = g_bytes_get_data (bytes, &stream->size);
+	io->stream = stream;
+	io->ContextID = context_lcms;
+	io->ReportedSize = (cmsUInt32Number) stream->size;
+	g_strlcpy (io->PhysicalFile, "**mapped**", sizeof (io->PhysicalFile));
+	io->Read = cd_icc_bytes_io_read;
+	io->Seek = cd_icc_bytes_io_seek;
+	io->Close = cd_icc_bytes_io_close;
+	io->Tell = cd_icc_bytes_io_tell;
+	io->Write = cd_icc_bytes_io_write;
+	return io;
+}
+
+/* profiles loaded from a summary are only read when something is
+ * needed that the summary does not have, and only if the file is still
+ * the one the summary was made from */
+static GBytes *
+cd_icc_ensure_data (CdIcc *icc, GError **error)
+{
+	CdIccPrivate *priv = GET_PRIVATE (icc);
+	gint fd;
+	gsize offset = 0;
+	gint64 mtime;
+	struct stat st;
+	g_autofree guint8 *data = NULL;
+
+	if (priv->data != NULL)
+		return priv->data;
+	if (!priv->data_deferred) {
+		g_set_error_literal (error,
+				     CD_ICC_ERROR,
+				     CD_ICC_ERROR_NO_DATA,
+				     "no profile data");
+		return NULL;
+	}
+	priv->data_deferred = FALSE;
+
+	fd = g_open (priv->filename, O_RDONLY | O_CLOEXEC, 0);
+	if (fd < 0) {
+		g_set_error (error,
+			     CD_ICC_ERROR,
+			     CD_ICC_ERROR_FAILED_TO_OPEN,
+			     "failed to open %s: %s",
+			     priv->filename, g_strerror (errno));
+		return NULL;
+	}
+	if (fstat (fd, &st) < 0) {
+		g_set_error (error,
+			     CD_ICC_ERROR,
+			     CD_ICC_ERROR_FAILED_TO_OPEN,
+			     "failed to stat %s: %s",
+			     priv->filename, g_strerror (errno));
+		close (fd);
+		return NULL;
+	}
+	mtime = (gint64) st.st_mtim.tv_sec * G_USEC_PER_SEC + st.st_mtim.tv_nsec / 1000;
+	if (st.st_size != (goffset) priv->size || mtime != priv->data_mtime) {
+		g_set_error (error,
+			     CD_ICC_ERROR,
+			     CD_ICC_ERROR_FAILED_TO_OPEN,
+			     "%s has changed since it was added",
+			     priv->filename);
+		close (fd);
+		return NULL;
+	}
+	data = g_malloc (priv->size);
+	while (offset < priv->size) {
+		gssize len = read (fd, data + offset, priv->size - offset);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len <= 0) {
+			g_set_error (error,
+				     CD_ICC_ERROR,
+				     CD_ICC_ERROR_FAILED_TO_OPEN,
+				     "failed to read %s: %s",
+				     priv->filename,
+				     len < 0 ? g_strerror (errno) : "file truncated");
+			close (fd);
+			return NULL;
+		}
+		offset += (gsize) len;
+	}
+	close (fd);
+	priv->data = g_bytes_new_take (g_steal_pointer (&data), priv->size);
+	return priv->data;
+}
+
+static gboolean
+cd_icc_is_loaded (CdIcc *icc)
+{
+	CdIccPrivate *priv = GET_PRIVATE (icc);
+	return priv->lcms_profile != NULL || priv->data != NULL || priv->data_deferred;
+}
+
+/* with %CD_ICC_LOAD_FLAGS_HEADER_ONLY the lcms profile is only created
+ * the first time that it is needed, which can fail */
+static cmsHPROFILE
+cd_icc_ensure_profile (CdIcc *icc, GError **error)
+{
+	CdIccPrivate *priv = GET_PRIVATE (icc);
+
+	if (priv->lcms_profile != NULL)
+		return priv->lcms_profile;
+	if (cd_icc_ensure_data (icc, error) == NULL)
+		return NULL;
+	priv->lcms_profile = cmsOpenProfileFromIOhandlerTHR (priv->context_lcms,
+							     cd_icc_bytes_io_new (priv->context_lcms,
+										  priv->data));
+	if (priv->lcms_profile == NULL) {
+		cd_context_lcms_error_clear (priv->context_lcms);
+		g_set_error (error,
+			     CD_ICC_ERROR,
+			     CD_ICC_ERROR_FAILED_TO_PARSE,
+			     "failed to load %s",
+			     priv->filename != NULL ? priv->filename : "profile");
+		return NULL;
+	}
+	return priv->lcms_profile;
+}
+
+/* the Lab and XYZ profiles are shared by all the transforms and checks
+ * using the context, and are not created until first used */
+static cmsHPROFILE
+cd_icc_get_profile_lab (CdIcc *icc)
+{
+	CdIccPrivate *priv = GET_PRIVATE (icc);
+	if (priv->profile_lab == NULL)
+		priv->profile_lab = cmsCreateLab2ProfileTHR (priv->context_lcms, cmsD50_xyY ());
+	return priv->profile_lab;
+}
+
+static cmsHPROFILE
+cd_icc_get_profile_xyz (CdIcc *icc)
+{
+	CdIccPrivate *priv = GET_PRIVATE (icc);
+	if (priv->profile_xyz == NULL)
+		priv->profile_xyz = cmsCreateXYZProfileTHR (priv->context_lcms);
+	return priv->profile_xyz;
+}
+
+/* called when the lcms profile is modified */
+static void
+cd_icc_invalidate_warnings (CdIcc *icc)
+{
+	CdIccPrivate *priv = GET_PRIVATE (icc);
+	g_clear_pointer (&priv->warnings, g_array_unref);
+	g_clear_pointer (&priv->warnings_checksum, g_free);
+}
+
+/* the checksum is only valid for the data that was loaded, so anything
+ * caching results by checksum also has to use the generation */
+static void
+cd_icc_invalidate_generation (CdIcc *icc)
+{
+	CdIccPrivate *priv = GET_PRIVATE (icc);
+	static gint generation_last = 0;
+	priv->generation = (guint) g_atomic_int_add (&generation_last, 1) + 1;
+}
+
+/* called when a tag is added, changed or removed */
+static void
+cd_icc_invalidate_tags (CdIcc *icc)
+{
+	CdIccPrivate *priv = GET_PRIVATE (icc);
+	g_clear_pointer (&priv->tags, g_strfreev);
+	cd_icc_invalidate_warnings (icc);
+	cd_icc_invalidate_generation (icc);
+}
+
+/* the header and tag table are parsed directly for HEADER_ONLY */
+#define CD_ICC_HEADER_SIZE		128
+#define CD_ICC_TAG_ENTRY_SIZE		12
+#define CD_ICC_MAX_TAGS			100	/* MAX_TABLE_TAG in lcms */
+
+static guint32
+cd_icc_header_get_uint32 (const guint8 *data)
+{
+	return ((guint32) data[0] << 24) | ((guint32) data[1] << 16) |
+	       ((guint32) data[2] << 8) | (guint32) data[3];
+}
+
+static guint16
+cd_icc_header_get_uint16 (const guint8 *data)
+{
+	return (guint16) ((data[0] << 8) | data[1]);
+}
+
+/* returns the offset of the tag, checking it lies inside the data */
+static const guint8 *
+cd_icc_header_find_tag (GBytes *bytes, guint32 sig, guint32 *tag_size)
+{
+	const guint8 *data;
+	gsize data_len;
+	guint32 number_tags;
+	guint32 i;
+
+	data = g_bytes_get_data (bytes, &data_len);
+	if (data_len < CD_ICC_HEADER_SIZE + 4)
+		return NULL;
+	number_tags = cd_icc_header_get_uint32 (data + CD_ICC_HEADER_SIZE);
+	if (number_tags > (data_len - CD_ICC_HEADER_SIZE - 4) / CD_ICC_TAG_ENTRY_SIZE)
+		return NULL;
+	for (i = 0; i < number_tags; i++) {
+		const guint8 *entry = data + CD_ICC_HEADER_SIZE + 4 + i * CD_ICC_TAG_ENTRY_SIZE;
+		guint32 offset;
+		guint32 size;
+
+		if (cd_icc_header_get_uint32 (entry) != sig)
+			continue;
+		offset = cd_icc_header_get_uint32 (entry + 4);
+		size = cd_icc_header_get_uint32 (entry + 8);
+		if (offset > data_len || size > data_len - offset || size < 8)
+			return NULL;
+		*tag_size = size;
+		return data + offset;
+	}
+	return NULL;
+}
+
+/* converts big endian UTF-16 as used in the mluc and dict types */
+static gchar *
+cd_icc_header_utf16_to_utf8 (const guint8 *data, guint32 len)
+{
+	guint32 i;
+	guint32 n_chars = len / 2;
+	g_autofree gunichar2 *tmp = NULL;
+
+	tmp = g_new (gunichar2, n_chars + 1);
+	for (i = 0; i < n_chars; i++)
+		tmp[i] = cd_icc_header_get_uint16 (data + i * 2);
+	tmp[n_chars] = 0;
+	return g_utf16_to_utf8 (tmp, n_chars, NULL, NULL, NULL);
+}
+
+/* decodes the default translation of a text tag, which is what
+ * cmsMLUgetWide() returns for "en_US", or %NULL if the type is unknown */
+static gchar *
+cd_icc_header_decode_text (const guint8 *tag, guint32 tag_size)
+{
+	guint32 type = cd_icc_header_get_uint32 (tag);
+
+	/* v2 textType and textDescriptionType, where lcms only uses
+	 * the ASCII part */
+	if (type == cmsSigTextType || type == cmsSigTextDescriptionType) {
+		const guint8 *text = tag + 8;
+		guint32 i;
+		guint32 len = tag_size - 8;
+		GString *str;
+
+		if (type == cmsSigTextDescriptionType) {
+			if (tag_size < 12)
+				return NULL;
+			len = cd_icc_header_get_uint32 (tag + 8);
+			if (len > tag_size - 12)
+				return NULL;
+			text = tag + 12;
+		}
+		str = g_string_sized_new (len);
+		for (i = 0; i < len && text[i] != '\0'; i++)
+			g_string_append_unichar (str, text[i]);
+		return g_string_free (str, FALSE);
+	}
+
+	/* v4 multiLocalizedUnicodeType */
+	if (type == cmsSigMultiLocalizedUnicodeType) {
+		const guint8 *best = NULL;
+		guint32 i;
+		guint32 len;
+		guint32 number_records;
+		guint32 offset;
+		guint32 record_size;
+
+		if (tag_size < 16)
+			return NULL;
+		number_records = cd_icc_header_get_uint32 (tag + 8);
+		record_size = cd_icc_header_get_uint32 (tag + 12);
+		if (record_size < 12 ||
+		    number_records > (tag_size - 16) / record_size)
+			return NULL;
+
+		/* prefer en_US, then any English, then the first entry */
+		for (i = 0; i < number_records; i++) {
+			const guint8 *record = tag + 16 + i * record_size;
+			if (memcmp (record, "enUS", 4) == 0) {
+				best = record;
+				break;
+			}
+			if (best == NULL || (memcmp (record, "en", 2) == 0 &&
+					     memcmp (best, "en", 2) != 0))
+				best = record;
+		}
+		if (best == NULL)
+			return NULL;
+		len = cd_icc_header_get_uint32 (best + 4);
+		offset = cd_icc_header_get_uint32 (best + 8);
+		if (offset > tag_size || len > tag_size - offset)
+			return NULL;
+		return cd_icc_header_utf16_to_utf8 (tag + offset, len);
+	}
+	return NULL;
+}
+
+/* checks the dict tag, and also decodes it into the metadata table
+ * when @decode is set */
+static gboolean
+cd_icc_header_parse_metadata (CdIcc *icc, gboolean decode, GError **error)
+{
+	CdIccPrivate *priv = GET_PRIVATE (icc);
+	const guint8 *tag;
+	guint32 i;
+	guint32 number_records;
+	guint32 record_size;
+	guint32 tag_size = 0;
+
+	/* no data is okay */
+	tag = cd_icc_header_find_tag (priv->data, cmsSigMetaTag, &tag_size);
+	if (tag == NULL)
+		return TRUE;
+	if (tag_size < 16 || cd_icc_header_get_uint32 (tag) != cmsSigDictType) {
+		g_set_error_literal (error,
+				     CD_ICC_ERROR,
+				     CD_ICC_ERROR_CORRUPTION_DETECTED,
+				     "Invalid dict tag");
+		return FALSE;
+	}
+	number_records = cd_icc_header_get_uint32 (tag + 8);
+	record_size = cd_icc_header_get_uint32 (tag + 12);
+	if ((record_size != 16 && record_size != 24 && record_size != 32) ||
+	    number_records > (tag_size - 16) / record_size) {
+		g_set_error_literal (error,
+				     CD_ICC_ERROR,
+				     CD_ICC_ERROR_CORRUPTION_DETECTED,
+				     "Invalid dict records");
+		return FALSE;
+	}
+	for (i = 0; i < number_records; i++) {
+		const guint8 *record = tag + 16 + i * record_size;
+		guint32 name_offset = cd_icc_header_get_uint32 (record);
+		guint32 name_size = cd_icc_header_get_uint32 (record + 4);
+		guint32 value_offset = cd_icc_header_get_uint32 (record + 8);
+		guint32 value_size = cd_icc_header_get_uint32 (record + 12);
+		g_autofree gchar *name = NULL;
+		g_autofree gchar *value = NULL;
+
+		if (name_offset > tag_size || name_size > tag_size - name_offset ||
+		    value_offset > tag_size || value_size > tag_size - value_offset) {
+			g_set_error_literal (error,
+					     CD_ICC_ERROR,
+					     CD_ICC_ERROR_CORRUPTION_DETECTED,
+					     "Invalid offset in dict");
+			return FALSE;
+		}
+		if (name_offset == 0) {
+			g_set_error_literal (error,
+					     CD_ICC_ERROR,
+					     CD_ICC_ERROR_CORRUPTION_DETECTED,
+					     "Invalid name in dict");
+			return FALSE;
+		}
+		if (!decode)
+			continue;
+		name = cd_icc_header_utf16_to_utf8 (tag + name_offset, name_size);
+		if (value_offset != 0)
+			value = cd_icc_header_utf16_to_utf8 (tag + value_offset, value_size);
+		else
+			value = g_strdup ("");
+		if (name == NULL || value == NULL) {
+			g_set_error_literal (error,
+					     CD_ICC_ERROR,
+					     CD_ICC_ERROR_CORRUPTION_DETECTED,
+					     "Could not convert entry in dict");
+			return FALSE;
+		}
+		g_hash_table_insert (priv->metadata,
+				     g_steal_pointer (&name),
+				     g_steal_pointer (&value));
+	}
+	return TRUE;
+}
+
+/* does the same as cmsGetHeaderCreationDateTime() */
+static gboolean
+cd_icc_header_get_created (GBytes *bytes, struct tm *created)
+{
+	const guint8 *data = g_bytes_get_data (bytes, NULL);
+
+	memset (created, 0, sizeof (struct tm));
+	created->tm_year = cd_icc_header_get_uint16 (data + 24) - 1900;
+	created->tm_mon = cd_icc_header_get_uint16 (data + 26) - 1;
+	created->tm_mday = cd_icc_header_get_uint16 (data + 28);
+	created->tm_hour = cd_icc_header_get_uint16 (data + 30);
+	created->tm_min = cd_icc_header_get_uint16 (data + 32);
+	created->tm_sec = cd_icc_header_get_uint16 (data + 34);
+	return TRUE;
+}
+
 static gpointer
 cd_icc_read_tag (CdIcc *icc, cmsTagSignature sig, GError **error)
 {
 	CdIccPrivate *priv = GET_PRIVATE (icc);
+	cmsHPROFILE lcms_profile;
 	gchar sig_string[5];
 	gpointer tmp;
 
+	lcms_profile = cd_icc_ensure_profile (icc, error);
+	if (lcms_profile == NULL)
+		return NULL;
+
 	/* ensure context error is not present to aid debugging */
 	cd_context_lcms_error_clear (priv->context_lcms);
 
 	/* read raw value */
-	tmp = cmsReadTag (priv->lcms_profile, sig);
+	tmp = cmsReadTag (lcms_profile, sig);
 	if (tmp != NULL)
 		return tmp;
 
@@ -190,13 +691,19 @@ static gboolean
 cd_icc_write_tag (CdIcc *icc, cmsTagSignature sig, gpointer data, GError **error)
 {
 	CdIccPrivate *priv = GET_PRIVATE (icc);
+	cmsHPROFILE lcms_profile;
 	gchar sig_string[5];
 
+	lcms_profile = cd_icc_ensure_profile (icc, error);
+	if (lcms_profile == NULL)
+		return FALSE;
+
 	/* ensure context error is not present to aid debugging */
 	cd_context_lcms_error_clear (priv->context_lcms);
+	cd_icc_invalidate_tags (icc);
 
 	/* write raw value */
-	if (cmsWriteTag (priv->lcms_profile, sig, data))
+	if (cmsWriteTag (lcms_profile, sig, data))
 		return TRUE;
 
 	/* due to a bug in lcms2, writing with data==NULL returns FALSE
@@ -256,7 +763,7 @@ cd_icc_get_precooked_md5 (cmsHPROFILE lcms_profile)
 gchar *
 cd_icc_to_string (CdIcc *icc)
 {
-	CdIccPrivate *priv = GET_PRIVATE (icc);
+	cmsHPROFILE lcms_profile;
 	cmsInt32Number tag_size;
 	cmsTagSignature sig;
 	cmsTagSignature sig_link;
@@ -274,6 +781,14 @@ cd_icc_to_string (CdIcc *icc)
 
 	g_return_val_if_fail (CD_IS_ICC (icc), NULL);
 
+	lcms_profile = cd_icc_ensure_profile (icc, &error_local);
+	if (lcms_profile == NULL) {
+		gchar *tmp_str = g_strdup_printf ("icc:\nFailed to load: %s\n",
+						  error_local->message);
+		g_error_free (error_local);
+		return tmp_str;
+	}
+
 	/* setup error handler */
 
 	/* print header */
@@ -298,7 +813,7 @@ cd_icc_to_string (CdIcc *icc)
 
 	/* PCS */
 	g_string_append (str, "  Conn. Space\t= ");
-	switch (cmsGetPCS (priv->lcms_profile)) {
+	switch (cmsGetPCS (lcms_profile)) {
 	case cmsSigXYZData:
 		g_string_append (str, "xyz\n");
 		break;
@@ -321,7 +836,7 @@ cd_icc_to_string (CdIcc *icc)
 
 	/* profile use flags */
 	g_string_append (str, "  Flags\t\t= ");
-	tmp = cmsGetHeaderFlags (priv->lcms_profile);
+	tmp = cmsGetHeaderFlags (lcms_profile);
 	g_string_append (str, (tmp & cmsEmbeddedProfileTrue) > 0 ?
 				"Embedded profile" : "Not embedded profile");
 	g_string_append (str, ", ");
@@ -330,7 +845,7 @@ cd_icc_to_string (CdIcc *icc)
 	g_string_append (str, "\n");
 
 	/* header attributes */
-	cmsGetHeaderAttributes (priv->lcms_profile, &header_flags);
+	cmsGetHeaderAttributes (lcms_profile, &header_flags);
 	g_string_append (str, "  Dev. Attrbts\t= ");
 	g_string_append (str, (header_flags & cmsTransparency) > 0 ?
 				"transparency" : "reflective");
@@ -341,7 +856,7 @@ cd_icc_to_string (CdIcc *icc)
 
 	/* rendering intent */
 	g_string_append (str, "  Rndrng Intnt\t= ");
-	switch (cmsGetHeaderRenderingIntent (priv->lcms_profile)) {
+	switch (cmsGetHeaderRenderingIntent (lcms_profile)) {
 	case INTENT_PERCEPTUAL:
 		g_string_append (str, "perceptual\n");
 		break;
@@ -360,19 +875,19 @@ cd_icc_to_string (CdIcc *icc)
 	}
 
 	/* creator */
-	tmp = cmsGetHeaderCreator (priv->lcms_profile);
+	tmp = cmsGetHeaderCreator (lcms_profile);
 	cd_icc_uint32_to_str (GUINT32_FROM_BE (tmp), tag_str);
 	g_string_append_printf (str, "  Creator\t= %s\n", tag_str);
 
 	/* profile ID */
-	profile_id = cd_icc_get_precooked_md5 (priv->lcms_profile);
+	profile_id = cd_icc_get_precooked_md5 (lcms_profile);
 	g_string_append_printf (str, "  Profile ID\t= %s", profile_id);
 
 	/* print tags */
 	g_string_append (str, "\n");
-	number_tags = cmsGetTagCount (priv->lcms_profile);
+	number_tags = cmsGetTagCount (lcms_profile);
 	for (i = 0; i < number_tags; i++) {
-		sig = cmsGetTagSignature (priv->lcms_profile, i);
+		sig = cmsGetTagSignature (lcms_profile, i);
 
 		/* convert to text */
 		cd_icc_uint32_to_str (GUINT32_FROM_BE (sig), tag_str);
@@ -383,7 +898,7 @@ cd_icc_to_string (CdIcc *icc)
 					tag_str, (guint) sig);
 
 		/* is this linked to another data area? */
-		sig_link = cmsTagLinkedTo (priv->lcms_profile, sig);
+		sig_link = cmsTagLinkedTo (lcms_profile, sig);
 		if (sig_link != 0) {
 			cd_icc_uint32_to_str (GUINT32_FROM_BE (sig_link), tag_str);
 			g_string_append_printf (str, "  link\t'%s' [0x%x]\n", tag_str, sig_link);
@@ -391,13 +906,13 @@ cd_icc_to_string (CdIcc *icc)
 		}
 
 		/* get the tag type */
-		tag_size = cmsReadRawTag (priv->lcms_profile, sig, NULL, 0);
+		tag_size = cmsReadRawTag (lcms_profile, sig, NULL, 0);
 		if (tag_size == 0 || tag_size > 16 * 1024 * 1024) {
 			g_string_append_printf (str, "WARNING: Tag size impossible %i", tag_size);
 			continue;
 		}
 		g_string_append_printf (str, "  size\t%i\n", tag_size);
-		cmsReadRawTag (priv->lcms_profile, sig, &tmp, 4);
+		cmsReadRawTag (lcms_profile, sig, &tmp, 4);
 
 		cd_icc_uint32_to_str (tmp, tag_str);
 		tag_type = GUINT32_FROM_BE (tmp);
@@ -505,7 +1020,7 @@ cd_icc_to_string (CdIcc *icc)
 		case cmsSigViewingConditionsType:
 		{
 			cmsICCViewingConditions *v;
-			v = cmsReadTag(priv->lcms_profile, sig);
+			v = cmsReadTag(lcms_profile, sig);
 			if (v == NULL) {
 				g_warning ("cannot read view tag");
 				continue;
@@ -698,7 +1213,41 @@ cd_icc_get_tags (CdIcc *icc, GError **error)
 	guint32 i;
 	guint32 number_tags;
 
+	/* the list was saved in the summary */
+	if (priv->tags != NULL)
+		return g_strdupv (priv->tags);
+
 	tags = g_ptr_array_new ();
+
+	/* use the tag table directly if the profile has not been opened */
+	if (priv->lcms_profile == NULL) {
+		const guint8 *data;
+		gsize data_len;
+
+		if (cd_icc_ensure_data (icc, error) == NULL) {
+			g_ptr_array_unref (tags);
+			return NULL;
+		}
+
+		data = g_bytes_get_data (priv->data, &data_len);
+		number_tags = cd_icc_header_get_uint32 (data + CD_ICC_HEADER_SIZE);
+		if (number_tags > (data_len - CD_ICC_HEADER_SIZE - 4) / CD_ICC_TAG_ENTRY_SIZE) {
+			g_ptr_array_unref (tags);
+			g_set_error_literal (error,
+					     CD_ICC_ERROR,
+					     CD_ICC_ERROR_CORRUPTION_DETECTED,
+					     "Invalid tag count");
+			return NULL;
+		}
+		for (i = 0; i < number_tags; i++) {
+			tmp = g_new0 (gchar, 5);
+			memcpy (tmp, data + CD_ICC_HEADER_SIZE + 4 + i * CD_ICC_TAG_ENTRY_SIZE, 4);
+			g_ptr_array_add (tags, tmp);
+		}
+		g_ptr_array_add (tags, NULL);
+		return (gchar **) g_ptr_array_free (tags, FALSE);
+	}
+
 	number_tags = cmsGetTagCount (priv->lcms_profile);
 	for (i = 0; i < number_tags; i++) {
 		sig = cmsGetTagSignature (priv->lcms_profile, i);
@@ -736,11 +1285,15 @@ cd_icc_str_to_tag (const gchar *tag)
 GBytes *
 cd_icc_get_tag_data (CdIcc *icc, const gchar *tag, GError **error)
 {
-	CdIccPrivate *priv = GET_PRIVATE (icc);
+	cmsHPROFILE lcms_profile;
 	cmsInt32Number tag_size;
 	cmsTagSignature sig;
 	gchar *tmp;
 
+	lcms_profile = cd_icc_ensure_profile (icc, error);
+	if (lcms_profile == NULL)
+		return NULL;
+
 	/* read tag */
 	sig = cd_icc_str_to_tag (tag);
 	if (sig == 0) {
@@ -750,7 +1303,7 @@ cd_icc_get_tag_data (CdIcc *icc, const gchar *tag, GError **error)
 			     "Tag '%s' was not valid", tag);
 		return NULL;
 	}
-	tag_size = cmsReadRawTag (priv->lcms_profile, sig, NULL, 0);
+	tag_size = cmsReadRawTag (lcms_profile, sig, NULL, 0);
 	if (tag_size == 0 || tag_size > 16 * 1024 * 1024) {
 		g_set_error (error,
 			     CD_ICC_ERROR,
@@ -761,7 +1314,7 @@ cd_icc_get_tag_data (CdIcc *icc, const gchar *tag, GError **error)
 
 	/* return data */
 	tmp = g_new0 (gchar, tag_size);
-	cmsReadRawTag (priv->lcms_profile, sig, tmp, tag_size);
+	cmsReadRawTag (lcms_profile, sig, tmp, tag_size);
 	return g_bytes_new_with_free_func (tmp, tag_size, g_free, tmp);
 }
 
@@ -780,10 +1333,14 @@ cd_icc_get_tag_data (CdIcc *icc, const gchar *tag, GError **error)
 gboolean
 cd_icc_set_tag_data (CdIcc *icc, const gchar *tag, GBytes *data, GError **error)
 {
-	CdIccPrivate *priv = GET_PRIVATE (icc);
+	cmsHPROFILE lcms_profile;
 	cmsTagSignature sig;
 	gboolean ret;
 
+	lcms_profile = cd_icc_ensure_profile (icc, error);
+	if (lcms_profile == NULL)
+		return FALSE;
+
 	/* work around an LCMS API quirk in that you can't do cmsWriteRawTag()
 	 * if the tag already exists. Use the undocumented usage of
 	 * cmsWriteTag() to delete the tag first */
@@ -795,8 +1352,9 @@ cd_icc_set_tag_data (CdIcc *icc, const gchar *tag, GBytes *data, GError **error)
 			     "Tag '%s' was not valid", tag);
 		return FALSE;
 	}
-	cmsWriteTag (priv->lcms_profile, sig, NULL);
-	ret = cmsWriteRawTag (priv->lcms_profile,
+	cd_icc_invalidate_tags (icc);
+	cmsWriteTag (lcms_profile, sig, NULL);
+	ret = cmsWriteRawTag (lcms_profile,
 			      sig,
 			      g_bytes_get_data (data, NULL),
 			      g_bytes_get_size (data));
@@ -859,8 +1417,10 @@ cd_icc_calc_whitepoint (CdIcc *icc, GError **error)
 	guint8 data[3] = { 255, 255, 255 };
 
 	/* do Lab to RGB transform to get primaries */
-	profiles[0] = priv->lcms_profile;
-	profiles[1] = cmsCreateXYZProfileTHR (priv->context_lcms);
+	profiles[0] = cd_icc_ensure_profile (icc, error);
+	if (profiles[0] == NULL)
+		return FALSE;
+	profiles[1] = cd_icc_get_profile_xyz (icc);
 	transform = cmsCreateExtendedTransform (priv->context_lcms,
 						2,
 						profiles,
@@ -892,8 +1452,6 @@ cd_icc_calc_whitepoint (CdIcc *icc, GError **error)
 	if (temp_float > 0)
 		priv->temperature = (((guint) temp_float) / 100) * 100;
 out:
-	if (profiles[1] != NULL)
-		cmsCloseProfile (profiles[1]);
 	if (transform != NULL)
 		cmsDeleteTransform (transform);
 	return ret;
@@ -971,8 +1529,9 @@ cd_icc_load_primaries (CdIcc *icc, GError **error)
 		goto out;
 	}
 
-	/* get the illuminants by running it through the profile */
-	xyz_profile = cmsCreateXYZProfileTHR (priv->context_lcms);
+	/* get the illuminants by running it through the profile, which
+	 * cd_icc_calc_whitepoint() has already opened */
+	xyz_profile = cd_icc_get_profile_xyz (icc);
 	transform = cmsCreateTransformTHR (priv->context_lcms,
 					   priv->lcms_profile, TYPE_RGB_DBL,
 					   xyz_profile, TYPE_XYZ_DBL,
@@ -1006,8 +1565,6 @@ cd_icc_load_primaries (CdIcc *icc, GError **error)
 out:
 	if (transform != NULL)
 		cmsDeleteTransform (transform);
-	if (xyz_profile != NULL)
-		cmsCloseProfile (xyz_profile);
 	return ret;
 }
 
@@ -1083,19 +1640,87 @@ cd_icc_load_metadata (CdIcc *icc, GError **error)
 	return TRUE;
 }
 
+/* the dict is read by lcms at load time so corruption is still detected */
 static gboolean
-cd_icc_load (CdIcc *icc, CdIccLoadFlags flags, GError **error)
+cd_icc_check_metadata (CdIcc *icc, GError **error)
+{
+	GError *error_local = NULL;
+
+	if (cd_icc_read_tag (icc, cmsSigMetaTag, &error_local) != NULL)
+		return TRUE;
+
+	/* no data is okay */
+	if (g_error_matches (error_local, CD_ICC_ERROR, CD_ICC_ERROR_NO_DATA)) {
+		g_error_free (error_local);
+		return TRUE;
+	}
+	g_propagate_error (error, error_local);
+	return FALSE;
+}
+
+/* converts the dict entries to UTF-8 the first time they are needed */
+static void
+cd_icc_ensure_metadata (CdIcc *icc)
 {
 	CdIccPrivate *priv = GET_PRIVATE (icc);
-	cmsColorSpaceSignature colorspace;
-	cmsProfileClassSignature profile_class;
+	gboolean ret;
+	g_autoptr(GError) error_local = NULL;
+
+	if (!priv->metadata_pending)
+		return;
+	priv->metadata_pending = FALSE;
+	if (priv->lcms_profile == NULL && priv->data != NULL)
+		ret = cd_icc_header_parse_metadata (icc, TRUE, &error_local);
+	else
+		ret = cd_icc_load_metadata (icc, &error_local);
+	if (!ret)
+		g_warning ("failed to decode metadata: %s", error_local->message);
+}
+
+static gboolean
+cd_icc_load_header (CdIcc *icc, CdIccLoadFlags flags, GError **error)
+{
+	CdIccPrivate *priv = GET_PRIVATE (icc);
+	const guint8 *data;
+	gsize data_len;
+	guint32 colorspace;
+	guint32 number_tags;
+	guint32 profile_class;
 	guint i;
 
-	/* get version */
-	priv->version = cmsGetProfileVersion (priv->lcms_profile);
+	/* check the magic, as lcms has not done so */
+	data = g_bytes_get_data (priv->data, &data_len);
+	if (cd_icc_header_get_uint32 (data + 36) != cmsMagicNumber) {
+		g_set_error_literal (error,
+				     CD_ICC_ERROR,
+				     CD_ICC_ERROR_FAILED_TO_PARSE,
+				     "failed to load: not an ICC icc");
+		return FALSE;
+	}
+
+	/* lcms refuses to open profiles with a tag table it cannot read,
+	 * so fail here rather than when the profile is first used; tags
+	 * that point outside the data are just ignored by lcms */
+	number_tags = cd_icc_header_get_uint32 (data + CD_ICC_HEADER_SIZE);
+	if (number_tags > CD_ICC_MAX_TAGS ||
+	    number_tags > (data_len - CD_ICC_HEADER_SIZE - 4) / CD_ICC_TAG_ENTRY_SIZE) {
+		g_set_error (error,
+			     CD_ICC_ERROR,
+			     CD_ICC_ERROR_FAILED_TO_PARSE,
+			     "failed to load: invalid tag count %" G_GUINT32_FORMAT,
+			     number_tags);
+		return FALSE;
+	}
+
+	/* get version, which is BCD encoded; this is decoded in double
+	 * precision exactly as cmsGetProfileVersion() does */
+	priv->version = ((data[8] >> 4) * 1000 +
+			 (data[8] & 0x0f) * 100 +
+			 (data[9] >> 4) * 10 +
+			 (data[9] & 0x0f)) / 100.0;
 
 	/* convert profile kind */
-	profile_class = cmsGetDeviceClass (priv->lcms_profile);
+	profile_class = cd_icc_header_get_uint32 (data + 12);
 	for (i = 0; map_profile_kind[i].colord != CD_PROFILE_KIND_LAST; i++) {
 		if (map_profile_kind[i].lcms == profile_class) {
 			priv->kind = map_profile_kind[i].colord;
@@ -1104,7 +1729,7 @@ cd_icc_load (CdIcc *icc, CdIccLoadFlags flags, GError **error)
 	}
 
 	/* convert colorspace */
-	colorspace = cmsGetColorSpace (priv->lcms_profile);
+	colorspace = cd_icc_header_get_uint32 (data + 16);
 	for (i = 0; map_colorspace[i].colord != CD_COLORSPACE_LAST; i++) {
 		if (map_colorspace[i].lcms == colorspace) {
 			priv->colorspace = map_colorspace[i].colord;
@@ -1112,23 +1737,30 @@ cd_icc_load (CdIcc *icc, CdIccLoadFlags flags, GError **error)
 		}
 	}
 
-	/* read optional metadata? */
+	/* check optional metadata, which is decoded when required */
 	if ((flags & CD_ICC_LOAD_FLAGS_METADATA) > 0) {
-		if (!cd_icc_load_metadata (icc, error))
+		if (!cd_icc_header_parse_metadata (icc, FALSE, error))
 			return FALSE;
+		priv->metadata_pending = TRUE;
 	}
 
 	/* get precooked profile ID if one exists */
-	priv->checksum = cd_icc_get_precooked_md5 (priv->lcms_profile);
-
-	/* read default translations */
-	cd_icc_get_description (icc, NULL, NULL);
-	cd_icc_get_copyright (icc, NULL, NULL);
-	cd_icc_get_manufacturer (icc, NULL, NULL);
-	cd_icc_get_model (icc, NULL, NULL);
-	if ((flags & CD_ICC_LOAD_FLAGS_TRANSLATIONS) > 0) {
-		/* FIXME: get the locale list from LCMS */
+	for (i = 0; i < 16; i++) {
+		if (data[84 + i] != 0) {
+			priv->checksum = g_new0 (gchar, 32 + 1);
+			for (i = 0; i < 16; i++)
+				g_snprintf (priv->checksum + i * 2, 3, "%02x", data[84 + i]);
+			break;
+		}
 	}
+	return TRUE;
+}
+
+/* these always need the lcms profile */
+static gboolean
+cd_icc_load_optional (CdIcc *icc, CdIccLoadFlags flags, GError **error)
+{
+	CdIccPrivate *priv = GET_PRIVATE (icc);
 
 	/* read named colors if the client cares */
 	if ((flags & CD_ICC_LOAD_FLAGS_NAMED_COLORS) > 0) {
@@ -1151,32 +1783,113 @@ cd_icc_load (CdIcc *icc, CdIccLoadFlags flags, GError **error)
 	return TRUE;
 }
 
-/**
- * cd_icc_load_data:
- * @icc: a #CdIcc instance.
- * @data: (array length=data_len): binary data
- * @data_len: Length of @data
- * @flags: a set of #CdIccLoadFlags
- * @error: A #GError or %NULL
- *
- * Loads an ICC profile from raw byte data.
- *
- * Since: 0.1.32
- **/
-gboolean
-cd_icc_load_data (CdIcc *icc,
-		  const guint8 *data,
-		  gsize data_len,
-		  CdIccLoadFlags flags,
-		  GError **error)
+static gboolean
+cd_icc_load (CdIcc *icc, CdIccLoadFlags flags, GError **error)
 {
 	CdIccPrivate *priv = GET_PRIVATE (icc);
+	cmsColorSpaceSignature colorspace;
+	cmsProfileClassSignature profile_class;
+	guint i;
+
+	/* the lcms profile is only opened when something needs it */
+	if ((flags & CD_ICC_LOAD_FLAGS_HEADER_ONLY) > 0 &&
+	    priv->lcms_profile == NULL) {
+		if (!cd_icc_load_header (icc, flags, error))
+			return FALSE;
+		return cd_icc_load_optional (icc, flags, error);
+	}
+
+	/* get version */
+	priv->version = cmsGetProfileVersion (priv->lcms_profile);
+
+	/* convert profile kind */
+	profile_class = cmsGetDeviceClass (priv->lcms_profile);
+	for (i = 0; map_profile_kind[i].colord != CD_PROFILE_KIND_LAST; i++) {
+		if (map_profile_kind[i].lcms == profile_class) {
+			priv->kind = map_profile_kind[i].colord;
+			break;
+		}
+	}
+
+	/* convert colorspace */
+	colorspace = cmsGetColorSpace (priv->lcms_profile);
+	for (i = 0; map_colorspace[i].colord != CD_COLORSPACE_LAST; i++) {
+		if (map_colorspace[i].lcms == colorspace) {
+			priv->colorspace = map_colorspace[i].colord;
+			break;
+		}
+	}
+
+	/* check optional metadata, which is decoded when required */
+	if ((flags & CD_ICC_LOAD_FLAGS_METADATA) > 0) {
+		if (!cd_icc_check_metadata (icc, error))
+			return FALSE;
+		priv->metadata_pending = TRUE;
+	}
+
+	/* get precooked profile ID if one exists */
+	priv->checksum = cd_icc_get_precooked_md5 (priv->lcms_profile);
+
+	/* the default translations are read when first required */
+	if ((flags & CD_ICC_LOAD_FLAGS_TRANSLATIONS) > 0) {
+		/* FIXME: get the locale list from LCMS */
+	}
+
+	/* read the optional parts */
+	return cd_icc_load_optional (icc, flags, error);
+}
+
+/* digest in blocks so that the data is only pulled through the cache once
+ * when both the MD5 and the fast checksum are required */
+#define CD_ICC_CHECKSUM_BLOCK_SIZE	(64 * 1024)
+
+static void
+cd_icc_load_checksums (CdIcc *icc,
+		       const guint8 *data,
+		       gsize data_len,
+		       CdIccLoadFlags flags)
+{
+	CdIccPrivate *priv = GET_PRIVATE (icc);
+	CdHash hash;
+	gsize i;
+	g_autoptr(GChecksum) checksum = NULL;
+
+	if (priv->checksum == NULL &&
+	    (flags & CD_ICC_LOAD_FLAGS_FALLBACK_MD5) > 0)
+		checksum = g_checksum_new (G_CHECKSUM_MD5);
+	if ((flags & CD_ICC_LOAD_FLAGS_FAST_CHECKSUM) == 0 && checksum == NULL)
+		return;
+
+	cd_hash_init (&hash);
+	for (i = 0; i < data_len; i += CD_ICC_CHECKSUM_BLOCK_SIZE) {
+		gsize len = MIN (data_len - i, CD_ICC_CHECKSUM_BLOCK_SIZE);
+		if (checksum != NULL)
+			g_checksum_update (checksum, data + i, len);
+		if ((flags & CD_ICC_LOAD_FLAGS_FAST_CHECKSUM) > 0)
+			cd_hash_update (&hash, data + i, len);
+	}
+	if (checksum != NULL)
+		priv->checksum = g_strdup (g_checksum_get_string (checksum));
+	if ((flags & CD_ICC_LOAD_FLAGS_FAST_CHECKSUM) > 0)
+		priv->fast_checksum = cd_hash_to_string (cd_hash_finish (&hash));
+}
+
+/* the profile keeps a reference to @bytes for as long as it exists */
+static gboolean
+cd_icc_load_bytes (CdIcc *icc,
+		   GBytes *bytes,
+		   CdIccLoadFlags flags,
+		   GError **error)
+{
+	CdIccPrivate *priv = GET_PRIVATE (icc);
+	const guint8 *data;
+	gsize data_len;
 
-	g_return_val_if_fail (CD_IS_ICC (icc), FALSE);
-	g_return_val_if_fail (data != NULL, FALSE);
 	g_return_val_if_fail (priv->lcms_profile == NULL, FALSE);
+	g_return_val_if_fail (priv->data == NULL, FALSE);
 
 	/* ensure we have the header */
+	data = g_bytes_get_data (bytes, &data_len);
 	if (data_len < 0x84) {
 		g_set_error_literal (error,
 				     CD_ICC_ERROR,
@@ -1184,35 +1897,73 @@ cd_icc_load_data (CdIcc *icc,
 				     "icc was not valid (file size too small)");
 		return FALSE;
 	}
-
-	/* load icc into lcms */
-	priv->lcms_profile = cmsOpenProfileFromMemTHR (priv->context_lcms,
-						       data, data_len);
-	if (priv->lcms_profile == NULL) {
+	if (data_len > G_MAXUINT32) {
 		g_set_error_literal (error,
 				     CD_ICC_ERROR,
 				     CD_ICC_ERROR_FAILED_TO_PARSE,
-				     "failed to load: not an ICC icc");
+				     "icc was not valid (file size too large)");
 		return FALSE;
 	}
 
+	/* load icc into lcms, which owns the IO handler */
+	if ((flags & CD_ICC_LOAD_FLAGS_HEADER_ONLY) == 0) {
+		priv->lcms_profile = cmsOpenProfileFromIOhandlerTHR (priv->context_lcms,
+								     cd_icc_bytes_io_new (priv->context_lcms,
+											  bytes));
+		if (priv->lcms_profile == NULL) {
+			g_set_error_literal (error,
+					     CD_ICC_ERROR,
+					     CD_ICC_ERROR_FAILED_TO_PARSE,
+					     "failed to load: not an ICC icc");
+			return FALSE;
+		}
+	}
+
 	/* save length to avoid trusting the profile */
 	priv->size = data_len;
+	priv->data = g_bytes_ref (bytes);
 
 	/* load cached data */
 	if (!cd_icc_load (icc, flags, error))
 		return FALSE;
 
 	/* calculate the data MD5 if there was no embedded profile */
-	if (priv->checksum == NULL &&
-	    (flags & CD_ICC_LOAD_FLAGS_FALLBACK_MD5) > 0) {
-		priv->checksum = g_compute_checksum_for_data (G_CHECKSUM_MD5,
-							      (const guchar *) data,
-							      data_len);
-	}
+	cd_icc_load_checksums (icc, data, data_len, flags);
 	return TRUE;
 }
 
+/**
+ * cd_icc_load_data:
+ * @icc: a #CdIcc instance.
+ * @data: (array length=data_len): binary data
+ * @data_len: Length of @data
+ * @flags: a set of #CdIccLoadFlags
+ * @error: A #GError or %NULL
+ *
+ * Loads an ICC profile from raw byte data.
+ *
+ * Since: 0.1.32
+ **/
+gboolean
+cd_icc_load_data (CdIcc *icc,
+		  const guint8 *data,
+		  gsize data_len,
+		  CdIccLoadFlags flags,
+		  GError **error)
+{
+	CdIccPrivate *priv = GET_PRIVATE (icc);
+	g_autoptr(GBytes) bytes = NULL;
+
+	g_return_val_if_fail (CD_IS_ICC (icc), FALSE);
+	g_return_val_if_fail (data != NULL, FALSE);
+	g_return_val_if_fail (priv->lcms_profile == NULL, FALSE);
+	g_return_val_if_fail (priv->data == NULL, FALSE);
+
+	/* the caller owns @data, so take a copy */
+	bytes = g_bytes_new (data, data_len);
+	return cd_icc_load_bytes (icc, bytes, flags, error);
+}
+
 static gboolean
 cd_util_write_dict_entry (cmsHANDLE dict,
 			  const gchar *key,
@@ -1505,80 +2256,202 @@ cd_icc_save_file_mkdir_parents (GFile *file, GError **error)
 	return TRUE;
 }
 
-static GBytes *
-cd_icc_serialize_profile (CdIcc *icc, GError **error)
+/* lcms seeks backwards to fill in the tag directory, so the writers
+ * have to support overwriting what has already been written */
+typedef struct {
+	GByteArray	*buf;
+	gint		 fd;
+	goffset		 fd_offset;
+	gint		 fd_errno;
+	gsize		 pos;
+	gsize		 size;
+} CdIccWriteStream;
+
+static cmsUInt32Number
+cd_icc_write_io_read (cmsIOHANDLER *io,
+		      void *buffer,
+		      cmsUInt32Number size,
+		      cmsUInt32Number count)
+{
+	return 0;
+}
+
+static cmsBool
+cd_icc_write_io_seek (cmsIOHANDLER *io, cmsUInt32Number offset)
+{
+	CdIccWriteStream *stream = (CdIccWriteStream *) io->stream;
+	stream->pos = offset;
+	return TRUE;
+}
+
+static cmsUInt32Number
+cd_icc_write_io_tell (cmsIOHANDLER *io)
+{
+	CdIccWriteStream *stream = (CdIccWriteStream *) io->stream;
+	return (cmsUInt32Number) stream->pos;
+}
+
+static cmsBool
+cd_icc_write_io_write (cmsIOHANDLER *io, cmsUInt32Number size, const void *buffer)
+{
+	CdIccWriteStream *stream = (CdIccWriteStream *) io->stream;
+
+	/* sanity check to 16Mb */
+	if (stream->pos + size > 16 * 1024 * 1024)
+		return FALSE;
+
+	if (stream->buf != NULL) {
+		if (stream->pos + size > stream->buf->len)
+			g_byte_array_set_size (stream->buf, stream->pos + size);
+		memcpy (stream->buf->data + stream->pos, buffer, size);
+	} else {
+		const guint8 *data = buffer;
+		gsize written = 0;
+		while (written < size) {
+			gssize rc = pwrite (stream->fd,
+					    data + written,
+					    size - written,
+					    stream->fd_offset + stream->pos + written);
+			if (rc < 0 && errno == EINTR)
+				continue;
+			if (rc <= 0) {
+				stream->fd_errno = rc < 0 ? errno : EIO;
+				return FALSE;
+			}
+			written += rc;
+		}
+	}
+	stream->pos += size;
+	if (stream->pos > stream->size)
+		stream->size = stream->pos;
+	io->UsedSpace = stream->size;
+	return TRUE;
+}
+
+static cmsBool
+cd_icc_write_io_close (cmsIOHANDLER *io)
+{
+	g_free (io);
+	return TRUE;
+}
+
+static cmsIOHANDLER *
+cd_icc_write_io_new (cmsContext context_lcms, CdIccWriteStream *stream)
+{
+	cmsIOHANDLER *io = g_new0 (cmsIOHANDLER, 1);
+	io->stream = stream;
+	io->ContextID = context_lcms;
+	g_strlcpy (io->PhysicalFile, "**write**", sizeof (io->PhysicalFile));
+	io->Read = cd_icc_write_io_read;
+	io->Seek = cd_icc_write_io_seek;
+	io->Close = cd_icc_write_io_close;
+	io->Tell = cd_icc_write_io_tell;
+	io->Write = cd_icc_write_io_write;
+	return io;
+}
+
+static gboolean
+cd_icc_serialize_profile_to_stream (CdIcc *icc,
+				    CdIccWriteStream *stream,
+				    GError **error)
 {
 	CdIccPrivate *priv = GET_PRIVATE (icc);
-	cmsUInt32Number length = 0;
-	gboolean ret;
-	g_autofree gchar *data_tmp = NULL;
+	cmsHPROFILE lcms_profile;
+	cmsIOHANDLER *io;
+	cmsUInt32Number length;
 
-	/* get size of profile */
-	ret = cmsSaveProfileToMem (priv->lcms_profile,
-				   NULL, &length);
-	if (!ret) {
+	lcms_profile = cd_icc_ensure_profile (icc, error);
+	if (lcms_profile == NULL)
+		return FALSE;
+	io = cd_icc_write_io_new (priv->context_lcms, stream);
+	length = cmsSaveProfileToIOhandler (lcms_profile, io);
+	cmsCloseIOhandler (io);
+	if (stream->fd_errno != 0) {
+		g_set_error (error,
+			     CD_ICC_ERROR,
+			     CD_ICC_ERROR_FAILED_TO_SAVE,
+			     "failed to write ICC file: %s",
+			     g_strerror (stream->fd_errno));
+		return FALSE;
+	}
+	if (length == 0) {
 		g_set_error_literal (error,
 				     CD_ICC_ERROR,
 				     CD_ICC_ERROR_FAILED_TO_SAVE,
-				     "failed to dump ICC file");
+				     "failed to dump ICC file, limit is 16Mb");
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/* serializes once into a growable buffer which is not copied again */
+static GBytes *
+cd_icc_serialize_profile (CdIcc *icc, GError **error)
+{
+	CdIccPrivate *priv = GET_PRIVATE (icc);
+	CdIccWriteStream stream = { NULL, -1, 0, 0, 0, 0 };
+
+	stream.buf = g_byte_array_sized_new (priv->size > 0 ? priv->size : 4096);
+	if (!cd_icc_serialize_profile_to_stream (icc, &stream, error)) {
+		g_byte_array_unref (stream.buf);
 		return NULL;
 	}
+	return g_byte_array_free_to_bytes (stream.buf);
+}
 
-	/* sanity check to 16Mb */
-	if (length == 0 || length > 16 * 1024 * 1024) {
+/* writes to the fd as the profile is serialized */
+static gboolean
+cd_icc_serialize_profile_to_fd (CdIcc *icc, gint fd, GError **error)
+{
+	CdIccWriteStream stream = { NULL, fd, 0, 0, 0, 0 };
+
+	stream.fd_offset = lseek (fd, 0, SEEK_CUR);
+	if (stream.fd_offset < 0) {
 		g_set_error (error,
 			     CD_ICC_ERROR,
 			     CD_ICC_ERROR_FAILED_TO_SAVE,
-			     "failed to save ICC file, requested %u "
-			     "bytes and limit is 16Mb",
-			     length);
-		return NULL;
+			     "failed to get offset of fd %i: %s",
+			     fd, g_strerror (errno));
+		return FALSE;
 	}
+	if (!cd_icc_serialize_profile_to_stream (icc, &stream, error))
+		return FALSE;
 
-	/* allocate and get profile data */
-	data_tmp = g_new0 (gchar, length);
-	ret = cmsSaveProfileToMem (priv->lcms_profile,
-				   data_tmp, &length);
-	if (!ret) {
-		g_set_error_literal (error,
-				     CD_ICC_ERROR,
-				     CD_ICC_ERROR_FAILED_TO_SAVE,
-				     "failed to dump ICC file to memory");
-		return NULL;
+	/* leave the fd after the profile, as write() would */
+	if (lseek (fd, stream.fd_offset + stream.size, SEEK_SET) < 0) {
+		g_set_error (error,
+			     CD_ICC_ERROR,
+			     CD_ICC_ERROR_FAILED_TO_SAVE,
+			     "failed to seek fd %i: %s",
+			     fd, g_strerror (errno));
+		return FALSE;
 	}
-
-	/* success */
-	return g_bytes_new (data_tmp, length);
+	return TRUE;
 }
 
-/**
- * cd_icc_save_data:
- * @icc: a #CdIcc instance.
- * @flags: a set of #CdIccSaveFlags
- * @error: A #GError or %NULL
- *
- * Saves an ICC profile to an allocated memory location.
- *
- * Return vale: A #GBytes structure, or %NULL for error
- *
- * Since: 1.0.2
- **/
-GBytes *
-cd_icc_save_data (CdIcc *icc,
-		  CdIccSaveFlags flags,
-		  GError **error)
+/* writes all the cached data back into the lcms profile */
+static gboolean
+cd_icc_save_prepare (CdIcc *icc, CdIccSaveFlags flags, GError **error)
 {
 	CdIccPrivate *priv = GET_PRIVATE (icc);
 	cmsHANDLE dict = NULL;
 	const gchar *key;
 	const gchar *value;
 	gboolean ret = FALSE;
-	GBytes *data = NULL;
 	GList *l;
 	guint i;
 	g_autoptr(GList) md_keys = NULL;
 
-	g_return_val_if_fail (CD_IS_ICC (icc), NULL);
+	/* the profile may not have been opened yet */
+	if (cd_icc_ensure_profile (icc, error) == NULL)
+		return FALSE;
+
+	/* the default translations are only read when required, so make
+	 * sure that they are not dropped */
+	cd_icc_get_description (icc, NULL, NULL);
+	cd_icc_get_copyright (icc, NULL, NULL);
+	cd_icc_get_manufacturer (icc, NULL, NULL);
+	cd_icc_get_model (icc, NULL, NULL);
 
 	/* convert profile kind */
 	for (i = 0; map_profile_kind[i].colord != CD_PROFILE_KIND_LAST; i++) {
@@ -1603,6 +2476,7 @@ cd_icc_save_data (CdIcc *icc,
 		cmsSetProfileVersion (priv->lcms_profile, priv->version);
 
 	/* save metadata */
+	cd_icc_ensure_metadata (icc);
 	if (g_hash_table_size (priv->metadata) != 0) {
 		dict = cmsDictAlloc (priv->context_lcms);
 		md_keys = g_hash_table_get_keys (priv->metadata);
@@ -1713,15 +2587,18 @@ cd_icc_save_data (CdIcc *icc,
 		cmsICCHeader *header;
 		time_t creation_time_timet = priv->creation_time;
 		g_autoptr(GByteArray) mutable_data = NULL;
+		GBytes *data;
 
 		data = cd_icc_serialize_profile (icc, error);
-		if (data == NULL)
+		if (data == NULL) {
+			ret = FALSE;
 			goto out;
+		}
 
 		mutable_data = g_bytes_unref_to_array (data);
-		data = NULL;
 
 		if (!gmtime_r (&creation_time_timet, &creation_time)) {
+			ret = FALSE;
 			g_set_error (error,
 				     CD_ICC_ERROR,
 				     CD_ICC_ERROR_FAILED_TO_SAVE,
@@ -1749,11 +2626,63 @@ cd_icc_save_data (CdIcc *icc,
 				     "failed to compute profile id");
 		goto out;
 	}
-	data = cd_icc_serialize_profile (icc, error);
 out:
 	if (dict != NULL)
 		cmsDictFree (dict);
-	return data;
+	return ret;
+}
+
+/**
+ * cd_icc_save_data:
+ * @icc: a #CdIcc instance.
+ * @flags: a set of #CdIccSaveFlags
+ * @error: A #GError or %NULL
+ *
+ * Saves an ICC profile to an allocated memory location.
+ *
+ * Return vale: A #GBytes structure, or %NULL for error
+ *
+ * Since: 1.0.2
+ **/
+GBytes *
+cd_icc_save_data (CdIcc *icc,
+		  CdIccSaveFlags flags,
+		  GError **error)
+{
+	g_return_val_if_fail (CD_IS_ICC (icc), NULL);
+
+	if (!cd_icc_save_prepare (icc, flags, error))
+		return NULL;
+	return cd_icc_serialize_profile (icc, error);
+}
+
+/**
+ * cd_icc_save_fd:
+ * @icc: a #CdIcc instance.
+ * @fd: a seekable file descriptor opened for writing
+ * @flags: a set of #CdIccSaveFlags
+ * @error: A #GError or %NULL
+ *
+ * Saves an ICC profile to an open file descriptor, starting at the
+ * current offset. The profile is written as it is serialized rather
+ * than being built in memory first.
+ *
+ * Return vale: %TRUE for success.
+ *
+ * Since: 1.4.9
+ **/
+gboolean
+cd_icc_save_fd (CdIcc *icc,
+		gint fd,
+		CdIccSaveFlags flags,
+		GError **error)
+{
+	g_return_val_if_fail (CD_IS_ICC (icc), FALSE);
+	g_return_val_if_fail (fd >= 0, FALSE);
+
+	if (!cd_icc_save_prepare (icc, flags, error))
+		return FALSE;
+	return cd_icc_serialize_profile_to_fd (icc, fd, error);
 }
 
 /**
@@ -1794,6 +2723,62 @@ cd_icc_set_characterization_data (CdIcc *icc, const gchar *data)
 	priv->characterization_data = g_strdup (data);
 }
 
+/* streams the profile to a temporary file which then replaces @filename,
+ * keeping the mode of any existing file */
+static gboolean
+cd_icc_save_file_local (CdIcc *icc,
+			const gchar *filename,
+			CdIccSaveFlags flags,
+			GError **error)
+{
+	GStatBuf stat_buf;
+	gint fd;
+	g_autofree gchar *filename_tmp = NULL;
+
+	filename_tmp = g_strdup_printf ("%s.XXXXXX", filename);
+	fd = g_mkstemp_full (filename_tmp, O_WRONLY, 0666);
+	if (fd < 0) {
+		g_set_error (error,
+			     CD_ICC_ERROR,
+			     CD_ICC_ERROR_FAILED_TO_SAVE,
+			     "failed to save ICC file: %s",
+			     g_strerror (errno));
+		return FALSE;
+	}
+	if (!cd_icc_save_fd (icc, fd, flags, error)) {
+		close (fd);
+		g_unlink (filename_tmp);
+		return FALSE;
+	}
+
+	/* a new file gets 0666 less the umask from g_mkstemp_full() */
+	if (g_stat (filename, &stat_buf) == 0 &&
+	    fchmod (fd, stat_buf.st_mode & 07777) != 0)
+		goto out_errno;
+
+	/* the data has to be on disk before the rename is */
+	if (fsync (fd) != 0)
+		goto out_errno;
+	if (close (fd) != 0) {
+		fd = -1;
+		goto out_errno;
+	}
+	fd = -1;
+	if (g_rename (filename_tmp, filename) != 0)
+		goto out_errno;
+	return TRUE;
+out_errno:
+	g_set_error (error,
+		     CD_ICC_ERROR,
+		     CD_ICC_ERROR_FAILED_TO_SAVE,
+		     "failed to save ICC file: %s",
+		     g_strerror (errno));
+	if (fd >= 0)
+		close (fd);
+	g_unlink (filename_tmp);
+	return FALSE;
+}
+
 /**
  * cd_icc_save_file:
  * @icc: a #CdIcc instance.
@@ -1816,21 +2801,27 @@ cd_icc_save_file (CdIcc *icc,
 		  GError **error)
 {
 	gboolean ret;
+	g_autofree gchar *filename = NULL;
 	g_autoptr(GBytes) data = NULL;
 	g_autoptr(GError) error_local = NULL;
 
 	g_return_val_if_fail (CD_IS_ICC (icc), FALSE);
 	g_return_val_if_fail (G_IS_FILE (file), FALSE);
 
+	/* ensure parent directories exist */
+	if (!cd_icc_save_file_mkdir_parents (file, error))
+		return FALSE;
+
+	/* local files are written without building the profile in memory */
+	filename = g_file_get_path (file);
+	if (filename != NULL)
+		return cd_icc_save_file_local (icc, filename, flags, error);
+
 	/* get data */
 	data = cd_icc_save_data (icc, flags, error);
 	if (data == NULL)
 		return FALSE;
 
-	/* ensure parent directories exist */
-	if (!cd_icc_save_file_mkdir_parents (file, error))
-		return FALSE;
-
 	/* actually write file */
 	ret = g_file_replace_contents (file,
 				       g_bytes_get_data (data, NULL),
@@ -1914,6 +2905,9 @@ cd_icc_set_filename (CdIcc *icc, const gchar *filename)
  *
  * Loads an ICC profile from a local or remote file.
  *
+ * With %CD_ICC_LOAD_FLAGS_MAPPED local files are mapped into memory rather
+ * than being read, and the mapping is kept until @icc is finalized.
+ *
  * Since: 0.1.32
  **/
 gboolean
@@ -1925,32 +2919,47 @@ cd_icc_load_file (CdIcc *icc,
 {
 	CdIccPrivate *priv = GET_PRIVATE (icc);
 	gboolean ret = FALSE;
-	gsize length;
+	g_autofree gchar *path = NULL;
+	g_autoptr(GBytes) bytes = NULL;
 	g_autoptr(GError) error_local = NULL;
-	g_autofree gchar *data = NULL;
 	g_autoptr(GFileInfo) info = NULL;
 
 	g_return_val_if_fail (CD_IS_ICC (icc), FALSE);
 	g_return_val_if_fail (G_IS_FILE (file), FALSE);
 
-	/* load files */
-	ret = g_file_load_contents (file, cancellable, &data, &length,
-				    NULL, &error_local);
-	if (!ret) {
-		g_set_error (error,
-			     CD_ICC_ERROR,
-			     CD_ICC_ERROR_FAILED_TO_OPEN,
-			     "failed to load file: %s",
-			     error_local->message);
-		return FALSE;
+	/* a mapping of a file that is truncated later causes SIGBUS, so
+	 * only map when the caller says this is safe */
+	path = g_file_get_path (file);
+	if (path != NULL && (flags & CD_ICC_LOAD_FLAGS_MAPPED) > 0) {
+		g_autoptr(GMappedFile) mapped_file = NULL;
+		mapped_file = g_mapped_file_new (path, FALSE, &error_local);
+		if (mapped_file == NULL) {
+			g_set_error (error,
+				     CD_ICC_ERROR,
+				     CD_ICC_ERROR_FAILED_TO_OPEN,
+				     "failed to load file: %s",
+				     error_local->message);
+			return FALSE;
+		}
+		bytes = g_mapped_file_get_bytes (mapped_file);
+	} else {
+		gchar *data = NULL;
+		gsize length = 0;
+		ret = g_file_load_contents (file, cancellable, &data, &length,
+					    NULL, &error_local);
+		if (!ret) {
+			g_set_error (error,
+				     CD_ICC_ERROR,
+				     CD_ICC_ERROR_FAILED_TO_OPEN,
+				     "failed to load file: %s",
+				     error_local->message);
+			return FALSE;
+		}
+		bytes = g_bytes_new_take (data, length);
 	}
 
 	/* parse the data */
-	ret = cd_icc_load_data (icc,
-				(const guint8 *) data,
-				length,
-				flags,
-				error);
+	ret = cd_icc_load_bytes (icc, bytes, flags, error);
 	if (!ret)
 		return FALSE;
 
@@ -1972,10 +2981,90 @@ cd_icc_load_file (CdIcc *icc,
 							      G_FILE_ATTRIBUTE_ACCESS_CAN_DELETE);
 
 	/* save filename for later */
-	priv->filename = g_file_get_path (file);
+	g_free (priv->filename);
+	priv->filename = g_steal_pointer (&path);
 	return TRUE;
 }
 
+/* the largest profile we will accept from a pipe */
+#define CD_ICC_LOAD_FD_MAX_SIZE		(64 * 1024 * 1024)
+
+static gboolean
+cd_icc_load_fd_stream (CdIcc *icc,
+		       gint fd,
+		       CdIccLoadFlags flags,
+		       GError **error)
+{
+	CdIccPrivate *priv = GET_PRIVATE (icc);
+	CdHash hash;
+	g_autoptr(GByteArray) buf = g_byte_array_new ();
+	g_autoptr(GBytes) bytes = NULL;
+	g_autoptr(GChecksum) checksum = NULL;
+
+	/* digest each block as it arrives */
+	if ((flags & CD_ICC_LOAD_FLAGS_FALLBACK_MD5) > 0)
+		checksum = g_checksum_new (G_CHECKSUM_MD5);
+	cd_hash_init (&hash);
+	while (TRUE) {
+		gssize len;
+		guint offset = buf->len;
+
+		if (offset + CD_ICC_CHECKSUM_BLOCK_SIZE > CD_ICC_LOAD_FD_MAX_SIZE) {
+			g_set_error_literal (error,
+					     CD_ICC_ERROR,
+					     CD_ICC_ERROR_FAILED_TO_PARSE,
+					     "icc was not valid (file size too large)");
+			return FALSE;
+		}
+		g_byte_array_set_size (buf, offset + CD_ICC_CHECKSUM_BLOCK_SIZE);
+		len = read (fd, buf->data + offset, CD_ICC_CHECKSUM_BLOCK_SIZE);
+		if (len < 0 && errno == EINTR) {
+			g_byte_array_set_size (buf, offset);
+			continue;
+		}
+		if (len < 0) {
+			g_set_error (error,
+				     CD_ICC_ERROR,
+				     CD_ICC_ERROR_FAILED_TO_OPEN,
+				     "failed to read fd %i: %s",
+				     fd, g_strerror (errno));
+			return FALSE;
+		}
+		g_byte_array_set_size (buf, offset + len);
+		if (len == 0)
+			break;
+		if (checksum != NULL)
+			g_checksum_update (checksum, buf->data + offset, len);
+		if ((flags & CD_ICC_LOAD_FLAGS_FAST_CHECKSUM) > 0)
+			cd_hash_update (&hash, buf->data + offset, len);
+	}
+
+	/* parse the data without digesting it again */
+	bytes = g_byte_array_free_to_bytes (g_steal_pointer (&buf));
+	if (!cd_icc_load_bytes (icc, bytes,
+				flags & ~(CD_ICC_LOAD_FLAGS_FALLBACK_MD5 |
+					  CD_ICC_LOAD_FLAGS_FAST_CHECKSUM),
+				error))
+		return FALSE;
+	if (priv->checksum == NULL && checksum != NULL)
+		priv->checksum = g_strdup (g_checksum_get_string (checksum));
+	if ((flags & CD_ICC_LOAD_FLAGS_FAST_CHECKSUM) > 0)
+		priv->fast_checksum = cd_hash_to_string (cd_hash_finish (&hash));
+	return TRUE;
+}
+
+/* a sealed file cannot be truncated under the mapping */
+static gboolean
+cd_icc_fd_is_sealed (gint fd)
+{
+#ifdef F_GET_SEALS
+	gint seals = fcntl (fd, F_GET_SEALS);
+	return seals >= 0 && (seals & F_SEAL_SHRINK) > 0;
+#else
+	return FALSE;
+#endif
+}
+
 /**
  * cd_icc_load_fd:
  * @icc: a #CdIcc instance.
@@ -1985,6 +3074,12 @@ cd_icc_load_file (CdIcc *icc,
  *
  * Loads an ICC profile from an open file descriptor.
  *
+ * The data is read in blocks until the end of the stream. Regular files
+ * are only mapped into memory if %CD_ICC_LOAD_FLAGS_MAPPED is set or the
+ * file has been sealed with %F_SEAL_SHRINK, as otherwise whoever passed
+ * the descriptor could truncate the file while it is in use.
+ * The descriptor is not closed.
+ *
  * Since: 0.1.32
  **/
 gboolean
@@ -1994,34 +3089,44 @@ cd_icc_load_fd (CdIcc *icc,
 		GError **error)
 {
 	CdIccPrivate *priv = GET_PRIVATE (icc);
-	FILE *stream = NULL;
+	struct stat st;
+	g_autoptr(GBytes) bytes = NULL;
+	g_autoptr(GError) error_local = NULL;
+	g_autoptr(GMappedFile) mapped_file = NULL;
 
 	g_return_val_if_fail (CD_IS_ICC (icc), FALSE);
 	g_return_val_if_fail (fd > 0, FALSE);
+	g_return_val_if_fail (priv->lcms_profile == NULL, FALSE);
+	g_return_val_if_fail (priv->data == NULL, FALSE);
 
-	/* convert the file descriptor to a stream */
-	stream = fdopen (fd, "r");
-	if (stream == NULL) {
+	if (fstat (fd, &st) < 0) {
 		g_set_error (error,
 			     CD_ICC_ERROR,
 			     CD_ICC_ERROR_FAILED_TO_OPEN,
-			     "failed to open stream from fd %i",
-			     fd);
+			     "failed to stat fd %i: %s",
+			     fd, g_strerror (errno));
 		return FALSE;
 	}
 
-	/* parse the ICC file */
-	priv->lcms_profile = cmsOpenProfileFromStreamTHR (priv->context_lcms, stream, "r");
-	if (priv->lcms_profile == NULL) {
-		g_set_error_literal (error,
-				     CD_ICC_ERROR,
-				     CD_ICC_ERROR_FAILED_TO_OPEN,
-				     "failed to open stream");
+	/* pipes and sockets have to be read, and so do files that could
+	 * be truncated by another process */
+	if (!S_ISREG (st.st_mode) || st.st_size == 0)
+		return cd_icc_load_fd_stream (icc, fd, flags, error);
+	if ((flags & CD_ICC_LOAD_FLAGS_MAPPED) == 0 && !cd_icc_fd_is_sealed (fd))
+		return cd_icc_load_fd_stream (icc, fd, flags, error);
+
+	/* map the file so pages are only read when lcms needs them */
+	mapped_file = g_mapped_file_new_from_fd (fd, FALSE, &error_local);
+	if (mapped_file == NULL) {
+		g_set_error (error,
+			     CD_ICC_ERROR,
+			     CD_ICC_ERROR_FAILED_TO_OPEN,
+			     "failed to map fd %i: %s",
+			     fd, error_local->message);
 		return FALSE;
 	}
-
-	/* load cached data */
-	return cd_icc_load (icc, flags, error);
+	bytes = g_mapped_file_get_bytes (mapped_file);
+	return cd_icc_load_bytes (icc, bytes, flags, error);
 }
 
 /**
@@ -2032,13 +3137,20 @@ cd_icc_load_fd (CdIcc *icc,
  * are using the profile in a transform.
  *
  * Return value: (transfer none): Do not call cmsCloseProfile() on this value!
+ * This is %NULL if the profile data could not be parsed.
  **/
 gpointer
 cd_icc_get_handle (CdIcc *icc)
 {
-	CdIccPrivate *priv = GET_PRIVATE (icc);
+	cmsHPROFILE lcms_profile;
+	g_autoptr(GError) error = NULL;
+
 	g_return_val_if_fail (CD_IS_ICC (icc), NULL);
-	return priv->lcms_profile;
+
+	lcms_profile = cd_icc_ensure_profile (icc, &error);
+	if (lcms_profile == NULL)
+		g_warning ("%s", error->message);
+	return lcms_profile;
 }
 
 /**
@@ -2096,6 +3208,7 @@ cd_icc_load_handle (CdIcc *icc,
 	g_return_val_if_fail (CD_IS_ICC (icc), FALSE);
 	g_return_val_if_fail (handle != NULL, FALSE);
 	g_return_val_if_fail (priv->lcms_profile == NULL, FALSE);
+	g_return_val_if_fail (priv->data == NULL, FALSE);
 
 	/* check the THR version has been correctly set up */
 	context = cmsGetProfileContextID (handle);
@@ -2109,8 +3222,9 @@ cd_icc_load_handle (CdIcc *icc,
 		return FALSE;
 	}
 
-	/* load profile */
+	/* the caller may still be modifying the handle */
 	priv->lcms_profile = handle;
+	cd_icc_invalidate_generation (icc);
 	return cd_icc_load (icc, flags, error);
 }
 
@@ -2272,6 +3386,7 @@ cd_icc_get_metadata (CdIcc *icc)
 {
 	CdIccPrivate *priv = GET_PRIVATE (icc);
 	g_return_val_if_fail (CD_IS_ICC (icc), NULL);
+	cd_icc_ensure_metadata (icc);
 	return g_hash_table_ref (priv->metadata);
 }
 
@@ -2292,6 +3407,7 @@ cd_icc_get_metadata_item (CdIcc *icc, const gchar *key)
 	CdIccPrivate *priv = GET_PRIVATE (icc);
 	g_return_val_if_fail (CD_IS_ICC (icc), NULL);
 	g_return_val_if_fail (key != NULL, NULL);
+	cd_icc_ensure_metadata (icc);
 	return (const gchar *) g_hash_table_lookup (priv->metadata, key);
 }
 
@@ -2315,6 +3431,7 @@ cd_icc_add_metadata (CdIcc *icc, const gchar *key, const gchar *value)
 	g_return_if_fail (g_utf8_validate (key, -1, NULL));
 	g_return_if_fail (value != NULL);
 	g_return_if_fail (g_utf8_validate (value, -1, NULL));
+	cd_icc_ensure_metadata (icc);
 	g_hash_table_insert (priv->metadata,
 			     g_strdup (key),
 			     g_strdup (value));
@@ -2335,15 +3452,24 @@ cd_icc_remove_metadata (CdIcc *icc, const gchar *key)
 	CdIccPrivate *priv = GET_PRIVATE (icc);
 	g_return_if_fail (CD_IS_ICC (icc));
 	g_return_if_fail (key != NULL);
+	cd_icc_ensure_metadata (icc);
 	g_hash_table_remove (priv->metadata, key);
 }
 
+static CdColorSwatch *
+cd_icc_named_color_to_swatch (const CdIccNamedColor *nc)
+{
+	CdColorSwatch *swatch = cd_color_swatch_new ();
+	cd_color_swatch_set_name (swatch, nc->name);
+	cd_color_swatch_set_value (swatch, &nc->value);
+	return swatch;
+}
+
 static gboolean
 cd_icc_load_named_colors (CdIcc *icc, GError **error)
 {
 	CdIccPrivate *priv = GET_PRIVATE (icc);
-	CdColorLab lab;
-	CdColorSwatch *swatch;
+	CdIccNamedColor nc;
 	cmsNAMEDCOLORLIST *nc2;
 	cmsUInt16Number pcs[3];
 	gboolean ret = TRUE;
@@ -2351,9 +3477,9 @@ cd_icc_load_named_colors (CdIcc *icc, GError **error)
 	gchar prefix[33];
 	gchar suffix[33];
 	GError *error_local = NULL;
-	GString *string;
 	guint j;
 	guint size;
+	g_autoptr(GString) string = NULL;
 
 	/* do any named colors exist? */
 	nc2 = cd_icc_read_tag (icc, cmsSigNamedColor2Type, &error_local);
@@ -2369,8 +3495,18 @@ cd_icc_load_named_colors (CdIcc *icc, GError **error)
 		return FALSE;
 	}
 
-	/* get each NC */
+	/* the names are packed into one string pool rather than having
+	 * a swatch allocated for each of them */
 	size = cmsNamedColorCount (nc2);
+	if (priv->named_color_names == NULL)
+		priv->named_color_names = g_string_chunk_new (size * 16 + 1);
+	g_array_unref (priv->named_color_values);
+	priv->named_color_values = g_array_sized_new (FALSE, FALSE,
+						      sizeof (CdIccNamedColor),
+						      size);
+	string = g_string_new (NULL);
+
+	/* get each NC */
 	for (j = 0; j < size; j++) {
 
 		/* parse title */
@@ -2382,7 +3518,7 @@ cd_icc_load_named_colors (CdIcc *icc, GError **error)
 					 NULL);
 		if (!ret)
 			continue;
-		string = g_string_new ("");
+		g_string_truncate (string, 0);
 		if (prefix[0] != '\0')
 			g_string_append_printf (string, "%s ", prefix);
 		g_string_append (string, name);
@@ -2396,13 +3532,18 @@ cd_icc_load_named_colors (CdIcc *icc, GError **error)
 
 		/* save color if valid */
 		if (ret) {
-			cmsLabEncoded2Float ((cmsCIELab *) &lab, pcs);
-			swatch = cd_color_swatch_new ();
-			cd_color_swatch_set_name (swatch, string->str);
-			cd_color_swatch_set_value (swatch, (const CdColorLab *) &lab);
-			g_ptr_array_add (priv->named_colors, swatch);
+			cmsLabEncoded2Float ((cmsCIELab *) &nc.value, pcs);
+			nc.name = g_string_chunk_insert_const (priv->named_color_names,
+							       string->str);
+			g_array_append_val (priv->named_color_values, nc);
+
+			/* the first color wins if the name is repeated */
+			if (!g_hash_table_contains (priv->named_color_hash, nc.name)) {
+				g_hash_table_insert (priv->named_color_hash,
+						     (gpointer) nc.name,
+						     GUINT_TO_POINTER (priv->named_color_values->len));
+			}
 		}
-		g_string_free (string, TRUE);
 	}
 	return TRUE;
 }
@@ -2423,10 +3564,201 @@ GPtrArray *
 cd_icc_get_named_colors (CdIcc *icc)
 {
 	CdIccPrivate *priv = GET_PRIVATE (icc);
+	guint i;
+
 	g_return_val_if_fail (CD_IS_ICC (icc), NULL);
+
+	/* only create the swatches for callers that want them all */
+	if (priv->named_colors->len != priv->named_color_values->len) {
+		g_ptr_array_set_size (priv->named_colors, 0);
+		for (i = 0; i < priv->named_color_values->len; i++) {
+			CdIccNamedColor *nc = &g_array_index (priv->named_color_values,
+							      CdIccNamedColor, i);
+			g_ptr_array_add (priv->named_colors,
+					 cd_icc_named_color_to_swatch (nc));
+		}
+	}
 	return g_ptr_array_ref (priv->named_colors);
 }
 
+/**
+ * cd_icc_find_named_color:
+ * @icc: a #CdIcc instance.
+ * @name: the full name of the color, including any prefix and suffix
+ *
+ * Finds a named color in the profile using a hash lookup.
+ * This function will only return results if the profile was loaded with the
+ * %CD_ICC_LOAD_FLAGS_NAMED_COLORS flag.
+ *
+ * Return value: (transfer full): A #CdColorSwatch, or %NULL if not found
+ *
+ * Since: 1.4.9
+ **/
+CdColorSwatch *
+cd_icc_find_named_color (CdIcc *icc, const gchar *name)
+{
+	CdIccPrivate *priv = GET_PRIVATE (icc);
+	guint idx;
+
+	g_return_val_if_fail (CD_IS_ICC (icc), NULL);
+	g_return_val_if_fail (name != NULL, NULL);
+
+	idx = GPOINTER_TO_UINT (g_hash_table_lookup (priv->named_color_hash, name));
+	if (idx == 0)
+		return NULL;
+	return cd_icc_named_color_to_swatch (&g_array_index (priv->named_color_values,
+							     CdIccNamedColor,
+							     idx - 1));
+}
+
+static gdouble
+cd_icc_named_color_axis (const CdColorLab *lab, guint axis)
+{
+	if (axis == 0)
+		return lab->L;
+	if (axis == 1)
+		return lab->a;
+	return lab->b;
+}
+
+typedef struct {
+	GArray		*values;
+	guint		 axis;
+} CdIccKdtreeHelper;
+
+static gint
+cd_icc_named_color_kdtree_cmp (gconstpointer a, gconstpointer b, gpointer user_data)
+{
+	CdIccKdtreeHelper *helper = (CdIccKdtreeHelper *) user_data;
+	const CdIccNamedColor *nc_a;
+	const CdIccNamedColor *nc_b;
+	gdouble val_a;
+	gdouble val_b;
+
+	nc_a = &g_array_index (helper->values, CdIccNamedColor, *((const guint *) a));
+	nc_b = &g_array_index (helper->values, CdIccNamedColor, *((const guint *) b));
+	val_a = cd_icc_named_color_axis (&nc_a->value, helper->axis);
+	val_b = cd_icc_named_color_axis (&nc_b->value, helper->axis);
+	if (val_a < val_b)
+		return -1;
+	if (val_a > val_b)
+		return 1;
+	return 0;
+}
+
+/* the tree is implicit: the median of each range is the node and the
+ * halves either side are the children, split on L, a and b in turn */
+static void
+cd_icc_named_color_kdtree_build (GArray *values, guint *idx, guint n, guint depth)
+{
+	CdIccKdtreeHelper helper = { values, depth % 3 };
+	guint mid = n / 2;
+
+	if (n <= 1)
+		return;
+	g_qsort_with_data (idx, n, sizeof (guint),
+			   cd_icc_named_color_kdtree_cmp, &helper);
+	cd_icc_named_color_kdtree_build (values, idx, mid, depth + 1);
+	cd_icc_named_color_kdtree_build (values, idx + mid + 1, n - mid - 1, depth + 1);
+}
+
+static void
+cd_icc_named_color_kdtree_search (GArray *values,
+				  const guint *idx,
+				  guint n,
+				  guint depth,
+				  const CdColorLab *lab,
+				  guint *best,
+				  gdouble *best_dist)
+{
+	const CdIccNamedColor *nc;
+	gdouble diff;
+	gdouble dist;
+	guint mid = n / 2;
+
+	if (n == 0)
+		return;
+
+	/* is this node closer */
+	nc = &g_array_index (values, CdIccNamedColor, idx[mid]);
+	dist = (lab->L - nc->value.L) * (lab->L - nc->value.L) +
+	       (lab->a - nc->value.a) * (lab->a - nc->value.a) +
+	       (lab->b - nc->value.b) * (lab->b - nc->value.b);
+	if (dist < *best_dist) {
+		*best_dist = dist;
+		*best = idx[mid];
+	}
+
+	/* search the near side first, and only search the far side if
+	 * the splitting plane is closer than the best match so far */
+	diff = cd_icc_named_color_axis (lab, depth % 3) -
+	       cd_icc_named_color_axis (&nc->value, depth % 3);
+	if (diff < 0) {
+		cd_icc_named_color_kdtree_search (values, idx, mid, depth + 1,
+						  lab, best, best_dist);
+		if (diff * diff < *best_dist) {
+			cd_icc_named_color_kdtree_search (values, idx + mid + 1,
+							  n - mid - 1, depth + 1,
+							  lab, best, best_dist);
+		}
+	} else {
+		cd_icc_named_color_kdtree_search (values, idx + mid + 1,
+						  n - mid - 1, depth + 1,
+						  lab, best, best_dist);
+		if (diff * diff < *best_dist) {
+			cd_icc_named_color_kdtree_search (values, idx, mid, depth + 1,
+							  lab, best, best_dist);
+		}
+	}
+}
+
+/**
+ * cd_icc_find_nearest_named_color:
+ * @icc: a #CdIcc instance.
+ * @lab: a #CdColorLab
+ *
+ * Finds the named color in the profile with the smallest CIE76 delta E
+ * to @lab. The search index is built the first time this is called.
+ * This function will only return results if the profile was loaded with the
+ * %CD_ICC_LOAD_FLAGS_NAMED_COLORS flag.
+ *
+ * Return value: (transfer full): A #CdColorSwatch, or %NULL if the profile has no named colors
+ *
+ * Since: 1.4.9
+ **/
+CdColorSwatch *
+cd_icc_find_nearest_named_color (CdIcc *icc, const CdColorLab *lab)
+{
+	CdIccPrivate *priv = GET_PRIVATE (icc);
+	gdouble best_dist = G_MAXDOUBLE;
+	guint best = 0;
+	guint i;
+	guint n;
+
+	g_return_val_if_fail (CD_IS_ICC (icc), NULL);
+	g_return_val_if_fail (lab != NULL, NULL);
+
+	n = priv->named_color_values->len;
+	if (n == 0)
+		return NULL;
+
+	/* build the index on first use */
+	if (priv->named_color_kdtree == NULL) {
+		priv->named_color_kdtree = g_new (guint, n);
+		for (i = 0; i < n; i++)
+			priv->named_color_kdtree[i] = i;
+		cd_icc_named_color_kdtree_build (priv->named_color_values,
+						 priv->named_color_kdtree,
+						 n, 0);
+	}
+	cd_icc_named_color_kdtree_search (priv->named_color_values,
+					  priv->named_color_kdtree,
+					  n, 0, lab, &best, &best_dist);
+	return cd_icc_named_color_to_swatch (&g_array_index (priv->named_color_values,
+							     CdIccNamedColor,
+							     best));
+}
+
 /**
  * cd_icc_get_can_delete:
  * @icc: a #CdIcc instance.
@@ -2469,10 +3801,19 @@ cd_icc_get_created (CdIcc *icc)
 	/* If the creation time has been overridden, return that */
 	if (priv->creation_time != (gint64)-1)
 		return g_date_time_new_from_unix_local (priv->creation_time);
+	if (priv->creation_time_summary != (gint64)-1)
+		return g_date_time_new_from_unix_local (priv->creation_time_summary);
 
 	/* get the profile creation time and date */
-	if (!cmsGetHeaderCreationDateTime (priv->lcms_profile, &created_tm))
-		return NULL;
+	if (priv->lcms_profile == NULL) {
+		if (cd_icc_ensure_data (icc, NULL) == NULL)
+			return NULL;
+		if (!cd_icc_header_get_created (priv->data, &created_tm))
+			return NULL;
+	} else {
+		if (!cmsGetHeaderCreationDateTime (priv->lcms_profile, &created_tm))
+			return NULL;
+	}
 
 	created_tm.tm_isdst = -1;
 
@@ -2523,6 +3864,48 @@ cd_icc_get_checksum (CdIcc *icc)
 	return priv->checksum;
 }
 
+/**
+ * cd_icc_get_fast_checksum:
+ * @icc: A valid #CdIcc
+ *
+ * Gets a fast non-cryptographic digest of the profile data. This is only
+ * set if the #CdIcc object was loaded using cd_icc_load_data(),
+ * cd_icc_load_file() or cd_icc_load_fd() and the
+ * %CD_ICC_LOAD_FLAGS_FAST_CHECKSUM flag is used.
+ *
+ * The value is only useful for spotting duplicate data, and
+ * cd_icc_get_checksum() should be used to identify the profile.
+ *
+ * Return value: A 16 character hex string, or %NULL for not set
+ *
+ * Since: 1.4.9
+ **/
+const gchar *
+cd_icc_get_fast_checksum (CdIcc *icc)
+{
+	CdIccPrivate *priv = GET_PRIVATE (icc);
+	g_return_val_if_fail (CD_IS_ICC (icc), NULL);
+	return priv->fast_checksum;
+}
+
+/**
+ * cd_icc_get_generation:
+ * @icc: a #CdIcc instance.
+ *
+ * Gets a number that changes every time the profile is modified. Profiles
+ * that have not been modified since they were loaded from a file return 0,
+ * and any other value is unique in the process.
+ *
+ * Return value: the generation, or 0 if the checksum matches the contents
+ **/
+guint
+cd_icc_get_generation (CdIcc *icc)
+{
+	CdIccPrivate *priv = GET_PRIVATE (icc);
+	g_return_val_if_fail (CD_IS_ICC (icc), 0);
+	return priv->generation;
+}
+
 static gchar *
 cd_icc_get_locale_key (const gchar *locale)
 {
@@ -2593,10 +3976,45 @@ cd_icc_get_mluc_data (CdIcc *icc,
 				     "invalid locale: %s", locale);
 			goto out;
 		}
-	} else {
-		/* lcms maps this to 'default' */
-		language_code = "en";
-		country_code = "US";
+	} else {
+		/* lcms maps this to 'default' */
+		language_code = "en";
+		country_code = "US";
+	}
+
+	/* the default translation can be read without opening the profile */
+	if (locale_key[0] == '\0' &&
+	    priv->lcms_profile == NULL &&
+	    cd_icc_ensure_data (icc, NULL) != NULL) {
+		const guint8 *tag = NULL;
+		guint32 tag_size = 0;
+
+		for (i = 0; sigs[i] != 0; i++) {
+			tag = cd_icc_header_find_tag (priv->data, sigs[i], &tag_size);
+			if (tag != NULL)
+				break;
+		}
+		if (tag == NULL) {
+			g_set_error_literal (error,
+					     CD_ICC_ERROR,
+					     CD_ICC_ERROR_NO_DATA,
+					     "cmsSigProfile*Tag missing");
+			goto out;
+		}
+
+		/* lcms is used for anything unusual */
+		tmp = cd_icc_header_decode_text (tag, tag_size);
+		if (tmp != NULL && tmp[0] == '\0') {
+			g_free (tmp);
+			goto out;
+		}
+		if (tmp != NULL) {
+			g_hash_table_insert (priv->mluc_data[mluc],
+					     g_strdup (locale_key),
+					     tmp);
+			value = tmp;
+			goto out;
+		}
 	}
 
 	/* read each MLU entry in order of preference */
@@ -3064,7 +4482,7 @@ cd_icc_create_default_full (CdIcc *icc,
 	gboolean ret = TRUE;
 
 	/* not loaded */
-	if (priv->lcms_profile != NULL) {
+	if (cd_icc_is_loaded (icc)) {
 		ret = FALSE;
 		g_set_error_literal (error,
 				     CD_ICC_ERROR,
@@ -3132,11 +4550,10 @@ cd_icc_create_default (CdIcc *icc, GError **error)
 gboolean
 cd_icc_create_from_edid_data (CdIcc *icc, CdEdid *edid, GError **error)
 {
-	CdIccPrivate *priv = GET_PRIVATE (icc);
 	const gchar *data;
 
 	/* not loaded */
-	if (priv->lcms_profile != NULL) {
+	if (cd_icc_is_loaded (icc)) {
 		g_set_error_literal (error,
 				     CD_ICC_ERROR,
 				     CD_ICC_ERROR_FAILED_TO_CREATE,
@@ -3211,7 +4628,7 @@ cd_icc_create_from_edid (CdIcc *icc,
 	gboolean ret = FALSE;
 
 	/* not loaded */
-	if (priv->lcms_profile != NULL) {
+	if (cd_icc_is_loaded (icc)) {
 		g_set_error_literal (error,
 				     CD_ICC_ERROR,
 				     CD_ICC_ERROR_FAILED_TO_CREATE,
@@ -3272,6 +4689,27 @@ out:
 	return ret;
 }
 
+/* returns the three curves, or %NULL with @error set */
+static const cmsToneCurve **
+cd_icc_get_vcgt_curves (CdIcc *icc, GError **error)
+{
+	cmsHPROFILE lcms_profile;
+	const cmsToneCurve **vcgt;
+
+	lcms_profile = cd_icc_ensure_profile (icc, error);
+	if (lcms_profile == NULL)
+		return NULL;
+	vcgt = cmsReadTag (lcms_profile, cmsSigVcgtType);
+	if (vcgt == NULL || vcgt[0] == NULL) {
+		g_set_error_literal (error,
+				     CD_ICC_ERROR,
+				     CD_ICC_ERROR_NO_DATA,
+				     "icc does not have any VCGT data");
+		return NULL;
+	}
+	return vcgt;
+}
+
 /**
  * cd_icc_get_vcgt:
  * @icc: A valid #CdIcc
@@ -3287,7 +4725,6 @@ out:
 GPtrArray *
 cd_icc_get_vcgt (CdIcc *icc, guint size, GError **error)
 {
-	CdIccPrivate *priv = GET_PRIVATE (icc);
 	CdColorRGB *tmp;
 	cmsFloat32Number in;
 	const cmsToneCurve **vcgt;
@@ -3295,17 +4732,12 @@ cd_icc_get_vcgt (CdIcc *icc, guint size, GError **error)
 	guint i;
 
 	g_return_val_if_fail (CD_IS_ICC (icc), NULL);
-	g_return_val_if_fail (priv->lcms_profile != NULL, NULL);
+	g_return_val_if_fail (cd_icc_is_loaded (icc), NULL);
 
 	/* get tone curves from icc */
-	vcgt = cmsReadTag (priv->lcms_profile, cmsSigVcgtType);
-	if (vcgt == NULL || vcgt[0] == NULL) {
-		g_set_error_literal (error,
-				     CD_ICC_ERROR,
-				     CD_ICC_ERROR_NO_DATA,
-				     "icc does not have any VCGT data");
+	vcgt = cd_icc_get_vcgt_curves (icc, error);
+	if (vcgt == NULL)
 		goto out;
-	}
 
 	/* create array */
 	array = g_ptr_array_new_with_free_func ((GDestroyNotify) cd_color_rgb_free);
@@ -3323,33 +4755,110 @@ out:
 }
 
 /**
- * cd_icc_get_response:
+ * cd_icc_get_vcgt_u16:
  * @icc: A valid #CdIcc
- * @size: the size of the curve to generate
- * @error: a valid #GError, or %NULL
+ * @size: the desired size of each channel, which must be at least 2
+ * @ramps: (array): a buffer of 3 * @size elements
+ * @error: A #GError or %NULL
  *
- * Generates a response curve of a specified size.
+ * Gets the video card calibration data from the profile as 16 bit gamma
+ * ramps, with all of red, then all of green and then all of blue.
+ * This layout can be passed straight to most gamma control APIs.
  *
- * Return value: (transfer container) (element-type CdColorRGB): response data, or %NULL for error
+ * If the curves in the profile are stored as tables of @size entries
+ * they are copied directly.
  *
- * Since: 0.1.34
+ * Return value: %TRUE for success
+ *
+ * Since: 1.4.9
  **/
-GPtrArray *
-cd_icc_get_response (CdIcc *icc, guint size, GError **error)
+gboolean
+cd_icc_get_vcgt_u16 (CdIcc *icc, guint size, guint16 *ramps, GError **error)
+{
+	const cmsToneCurve **vcgt;
+	guint i;
+	guint j;
+
+	g_return_val_if_fail (CD_IS_ICC (icc), FALSE);
+	g_return_val_if_fail (cd_icc_is_loaded (icc), FALSE);
+	g_return_val_if_fail (size > 1, FALSE);
+	g_return_val_if_fail (ramps != NULL, FALSE);
+
+	vcgt = cd_icc_get_vcgt_curves (icc, error);
+	if (vcgt == NULL)
+		return FALSE;
+	for (j = 0; j < 3; j++) {
+		guint16 *ramp = ramps + j * size;
+
+		/* lcms evaluates 16 bit values using this table anyway */
+		if (cmsGetToneCurveEstimatedTableEntries (vcgt[j]) == size) {
+			memcpy (ramp,
+				cmsGetToneCurveEstimatedTable (vcgt[j]),
+				size * sizeof (guint16));
+			continue;
+		}
+		for (i = 0; i < size; i++) {
+			guint32 in = (i * 0xffff + (size - 1) / 2) / (size - 1);
+			ramp[i] = cmsEvalToneCurve16 (vcgt[j], (cmsUInt16Number) in);
+		}
+	}
+	return TRUE;
+}
+
+/**
+ * cd_icc_get_vcgt_float:
+ * @icc: A valid #CdIcc
+ * @size: the desired size of each channel, which must be at least 2
+ * @ramps: (array): a buffer of 3 * @size elements
+ * @error: A #GError or %NULL
+ *
+ * Gets the video card calibration data from the profile in the range
+ * 0.0 to 1.0, with all of red, then all of green and then all of blue.
+ *
+ * Return value: %TRUE for success
+ *
+ * Since: 1.4.9
+ **/
+gboolean
+cd_icc_get_vcgt_float (CdIcc *icc, guint size, gfloat *ramps, GError **error)
+{
+	const cmsToneCurve **vcgt;
+	guint i;
+	guint j;
+
+	g_return_val_if_fail (CD_IS_ICC (icc), FALSE);
+	g_return_val_if_fail (cd_icc_is_loaded (icc), FALSE);
+	g_return_val_if_fail (size > 1, FALSE);
+	g_return_val_if_fail (ramps != NULL, FALSE);
+
+	vcgt = cd_icc_get_vcgt_curves (icc, error);
+	if (vcgt == NULL)
+		return FALSE;
+	for (j = 0; j < 3; j++) {
+		gfloat *ramp = ramps + j * size;
+		for (i = 0; i < size; i++) {
+			cmsFloat32Number in = (gdouble) i / (gdouble) (size - 1);
+			ramp[i] = cmsEvalToneCurveFloat (vcgt[j], in);
+		}
+	}
+	return TRUE;
+}
+
+/* returns RGB triplets for a ramp of each primary in turn */
+static gdouble *
+cd_icc_eval_response (CdIcc *icc, guint size, GError **error)
 {
 	CdIccPrivate *priv = GET_PRIVATE (icc);
-	CdColorRGB *data;
 	CdColorspace colorspace;
+	cmsHPROFILE lcms_profile;
 	cmsHPROFILE srgb_profile = NULL;
 	cmsHTRANSFORM transform = NULL;
 	const guint component_width = 3;
-	gdouble tmp;
 	gfloat divadd;
 	gfloat divamount;
-	GPtrArray *array = NULL;
 	guint i;
+	gdouble *values_out = NULL;
 	g_autofree gdouble *values_in = NULL;
-	g_autofree gdouble *values_out = NULL;
 
 	/* run through the icc */
 	colorspace = cd_icc_get_colorspace (icc);
@@ -3384,10 +4893,12 @@ cd_icc_get_response (CdIcc *icc, guint size, GError **error)
 	}
 
 	/* create a transform from icc to sRGB */
-	values_out = g_new0 (gdouble, size * 3 * component_width);
+	lcms_profile = cd_icc_ensure_profile (icc, error);
+	if (lcms_profile == NULL)
+		goto out;
 	srgb_profile = cmsCreate_sRGBProfileTHR (priv->context_lcms);
 	transform = cmsCreateTransformTHR (priv->context_lcms,
-					   priv->lcms_profile, TYPE_RGB_DBL,
+					   lcms_profile, TYPE_RGB_DBL,
 					   srgb_profile, TYPE_RGB_DBL,
 					   INTENT_PERCEPTUAL, 0);
 	if (transform == NULL) {
@@ -3397,7 +4908,41 @@ cd_icc_get_response (CdIcc *icc, guint size, GError **error)
 				     "Failed to setup transform");
 		goto out;
 	}
+	values_out = g_new0 (gdouble, size * 3 * component_width);
 	cmsDoTransform (transform, values_in, values_out, size * 3);
+out:
+	if (transform != NULL)
+		cmsDeleteTransform (transform);
+	if (srgb_profile != NULL)
+		cmsCloseProfile (srgb_profile);
+	return values_out;
+}
+
+/**
+ * cd_icc_get_response:
+ * @icc: A valid #CdIcc
+ * @size: the size of the curve to generate
+ * @error: a valid #GError, or %NULL
+ *
+ * Generates a response curve of a specified size.
+ *
+ * Return value: (transfer container) (element-type CdColorRGB): response data, or %NULL for error
+ *
+ * Since: 0.1.34
+ **/
+GPtrArray *
+cd_icc_get_response (CdIcc *icc, guint size, GError **error)
+{
+	CdColorRGB *data;
+	const guint component_width = 3;
+	gdouble tmp;
+	GPtrArray *array;
+	guint i;
+	g_autofree gdouble *values_out = NULL;
+
+	values_out = cd_icc_eval_response (icc, size, error);
+	if (values_out == NULL)
+		return NULL;
 
 	/* create output array */
 	array = cd_color_rgb_array_new ();
@@ -3417,14 +4962,49 @@ cd_icc_get_response (CdIcc *icc, guint size, GError **error)
 			data->B = tmp;
 		g_ptr_array_add (array, data);
 	}
-out:
-	if (transform != NULL)
-		cmsDeleteTransform (transform);
-	if (srgb_profile != NULL)
-		cmsCloseProfile (srgb_profile);
 	return array;
 }
 
+/**
+ * cd_icc_get_response_float:
+ * @icc: A valid #CdIcc
+ * @size: the size of the curve to generate, which must be at least 2
+ * @response: (array): a buffer of 3 * @size elements
+ * @error: a valid #GError, or %NULL
+ *
+ * Generates a response curve of a specified size, with all of red, then
+ * all of green and then all of blue. Negative values are clipped to 0.0.
+ *
+ * Return value: %TRUE for success
+ *
+ * Since: 1.4.9
+ **/
+gboolean
+cd_icc_get_response_float (CdIcc *icc, guint size, gfloat *response, GError **error)
+{
+	const guint component_width = 3;
+	guint i;
+	guint j;
+	g_autofree gdouble *values_out = NULL;
+
+	g_return_val_if_fail (CD_IS_ICC (icc), FALSE);
+	g_return_val_if_fail (size > 1, FALSE);
+	g_return_val_if_fail (response != NULL, FALSE);
+
+	values_out = cd_icc_eval_response (icc, size, error);
+	if (values_out == NULL)
+		return FALSE;
+
+	/* only save curve data if it is positive */
+	for (j = 0; j < 3; j++) {
+		for (i = 0; i < size; i++) {
+			gdouble tmp = values_out[(i * 3 * component_width) + j * 4];
+			response[j * size + i] = tmp > 0.0f ? tmp : 0.0f;
+		}
+	}
+	return TRUE;
+}
+
 /**
  * cd_icc_set_vcgt:
  * @icc: A valid #CdIcc
@@ -3440,8 +5020,8 @@ out:
 gboolean
 cd_icc_set_vcgt (CdIcc *icc, GPtrArray *vcgt, GError **error)
 {
-	CdIccPrivate *priv = GET_PRIVATE (icc);
 	CdColorRGB *tmp;
+	cmsHPROFILE lcms_profile;
 	cmsToneCurve *curve[3];
 	gboolean ret;
 	guint i;
@@ -3450,7 +5030,7 @@ cd_icc_set_vcgt (CdIcc *icc, GPtrArray *vcgt, GError **error)
 	g_autofree guint16 *red = NULL;
 
 	g_return_val_if_fail (CD_IS_ICC (icc), FALSE);
-	g_return_val_if_fail (priv->lcms_profile != NULL, FALSE);
+	g_return_val_if_fail (cd_icc_is_loaded (icc), FALSE);
 
 	/* unwrap data */
 	red = g_new0 (guint16, vcgt->len);
@@ -3473,7 +5053,13 @@ cd_icc_set_vcgt (CdIcc *icc, GPtrArray *vcgt, GError **error)
 		cmsSmoothToneCurve (curve[i], 5);
 
 	/* write the tag */
-	ret = cmsWriteTag (priv->lcms_profile, cmsSigVcgtType, curve);
+	lcms_profile = cd_icc_ensure_profile (icc, error);
+	if (lcms_profile == NULL) {
+		ret = FALSE;
+		goto out;
+	}
+	cd_icc_invalidate_tags (icc);
+	ret = cmsWriteTag (lcms_profile, cmsSigVcgtType, curve);
 	if (!ret) {
 		g_set_error_literal (error,
 				     CD_ICC_ERROR,
@@ -3507,16 +5093,19 @@ cd_icc_check_whitepoint (CdIcc *icc)
 static CdProfileWarning
 cd_icc_check_vcgt (CdIcc *icc)
 {
-	CdIccPrivate *priv = GET_PRIVATE (icc);
 	cmsFloat32Number in;
 	cmsFloat32Number now[3];
 	cmsFloat32Number previous[3] = { -1, -1, -1};
+	cmsHPROFILE lcms_profile = cd_icc_ensure_profile (icc, NULL);
 	const cmsToneCurve **vcgt;
 	const guint size = 32;
 	guint i;
 
+	if (lcms_profile == NULL)
+		return CD_PROFILE_WARNING_NONE;
+
 	/* does profile have monotonic VCGT */
-	vcgt = cmsReadTag (priv->lcms_profile, cmsSigVcgtTag);
+	vcgt = cmsReadTag (lcms_profile, cmsSigVcgtTag);
 	if (vcgt == NULL)
 		return CD_PROFILE_WARNING_NONE;
 	for (i = 0; i < size; i++) {
@@ -3546,15 +5135,19 @@ cd_profile_check_scum_dot (CdIcc *icc)
 	CdIccPrivate *priv = GET_PRIVATE (icc);
 	CdProfileWarning warning = CD_PROFILE_WARNING_NONE;
 	cmsCIELab white;
+	cmsHPROFILE lcms_profile = cd_icc_ensure_profile (icc, NULL);
 	cmsHPROFILE profile_lab;
 	cmsHTRANSFORM transform;
 	guint8 rgb[3] = { 0, 0, 0 };
 
+	if (lcms_profile == NULL)
+		return CD_PROFILE_WARNING_NONE;
+
 	/* do Lab to RGB transform of 100,0,0 */
-	profile_lab = cmsCreateLab2ProfileTHR (priv->context_lcms, cmsD50_xyY ());
+	profile_lab = cd_icc_get_profile_lab (icc);
 	transform = cmsCreateTransformTHR (priv->context_lcms,
 					   profile_lab, TYPE_Lab_DBL,
-					   priv->lcms_profile, TYPE_RGB_8,
+					   lcms_profile, TYPE_RGB_8,
 					   INTENT_RELATIVE_COLORIMETRIC,
 					   cmsFLAGS_NOOPTIMIZE);
 	if (transform == NULL) {
@@ -3570,8 +5163,6 @@ cd_profile_check_scum_dot (CdIcc *icc)
 		goto out;
 	}
 out:
-	if (profile_lab != NULL)
-		cmsCloseProfile (profile_lab);
 	if (transform != NULL)
 		cmsDeleteTransform (transform);
 	return warning;
@@ -3580,9 +5171,12 @@ out:
 static CdProfileWarning
 cd_icc_check_primaries (CdIcc *icc)
 {
-	CdIccPrivate *priv = GET_PRIVATE (icc);
+	cmsHPROFILE lcms_profile = cd_icc_ensure_profile (icc, NULL);
 	cmsCIEXYZ *tmp;
 
+	if (lcms_profile == NULL)
+		return CD_PROFILE_WARNING_NONE;
+
 	/* The values used to check are based on the following ultra-wide
 	 * gamut profile XYZ values:
 	 *
@@ -3598,21 +5192,21 @@ cd_icc_check_primaries (CdIcc *icc)
 	 */
 
 	/* check red */
-	tmp = cmsReadTag (priv->lcms_profile, cmsSigRedColorantTag);
+	tmp = cmsReadTag (lcms_profile, cmsSigRedColorantTag);
 	if (tmp == NULL)
 		return CD_PROFILE_WARNING_NONE;
 	if (tmp->X > 0.85f || tmp->Y < 0.15f || tmp->Z < -0.01)
 		return CD_PROFILE_WARNING_PRIMARIES_INVALID;
 
 	/* check green */
-	tmp = cmsReadTag (priv->lcms_profile, cmsSigGreenColorantTag);
+	tmp = cmsReadTag (lcms_profile, cmsSigGreenColorantTag);
 	if (tmp == NULL)
 		return CD_PROFILE_WARNING_NONE;
 	if (tmp->X < 0.10f || tmp->Y > 0.85f || tmp->Z < -0.01f)
 		return CD_PROFILE_WARNING_PRIMARIES_INVALID;
 
 	/* check blue */
-	tmp = cmsReadTag (priv->lcms_profile, cmsSigBlueColorantTag);
+	tmp = cmsReadTag (lcms_profile, cmsSigBlueColorantTag);
 	if (tmp == NULL)
 		return CD_PROFILE_WARNING_NONE;
 	if (tmp->X < 0.01f || tmp->Y < 0.0f || tmp->Z > 0.87f)
@@ -3625,6 +5219,7 @@ static CdProfileWarning
 cd_icc_check_gray_axis (CdIcc *icc)
 {
 	CdIccPrivate *priv = GET_PRIVATE (icc);
+	cmsHPROFILE lcms_profile = cd_icc_ensure_profile (icc, NULL);
 	CdProfileWarning warning = CD_PROFILE_WARNING_NONE;
 	cmsCIELab gray[16];
 	cmsHPROFILE profile_lab = NULL;
@@ -3636,13 +5231,15 @@ cd_icc_check_gray_axis (CdIcc *icc)
 	guint i;
 
 	/* only do this for display profiles */
-	if (cmsGetDeviceClass (priv->lcms_profile) != cmsSigDisplayClass)
+	if (lcms_profile == NULL)
+		goto out;
+	if (cmsGetDeviceClass (lcms_profile) != cmsSigDisplayClass)
 		goto out;
 
 	/* do Lab to RGB transform of 100,0,0 */
-	profile_lab = cmsCreateLab2ProfileTHR (priv->context_lcms, cmsD50_xyY ());
+	profile_lab = cd_icc_get_profile_lab (icc);
 	transform = cmsCreateTransformTHR (priv->context_lcms,
-					   priv->lcms_profile, TYPE_RGB_8,
+					   lcms_profile, TYPE_RGB_8,
 					   profile_lab, TYPE_Lab_DBL,
 					   INTENT_RELATIVE_COLORIMETRIC,
 					   cmsFLAGS_NOOPTIMIZE);
@@ -3678,8 +5275,6 @@ cd_icc_check_gray_axis (CdIcc *icc)
 		last_l = gray[i].L;
 	}
 out:
-	if (profile_lab != NULL)
-		cmsCloseProfile (profile_lab);
 	if (transform != NULL)
 		cmsDeleteTransform (transform);
 	return warning;
@@ -3703,7 +5298,7 @@ cd_icc_check_d50_whitepoint (CdIcc *icc)
 	guint i;
 
 	/* do Lab to RGB transform to get primaries */
-	profile_lab = cmsCreateXYZProfileTHR (priv->context_lcms);
+	profile_lab = cd_icc_get_profile_xyz (icc);
 	transform = cmsCreateTransformTHR (priv->context_lcms,
 					   priv->lcms_profile, TYPE_RGB_8,
 					   profile_lab, TYPE_XYZ_DBL,
@@ -3779,46 +5374,35 @@ cd_icc_check_d50_whitepoint (CdIcc *icc)
 		goto out;
 	}
 out:
-	if (profile_lab != NULL)
-		cmsCloseProfile (profile_lab);
 	if (transform != NULL)
 		cmsDeleteTransform (transform);
 	return warning;
 }
 
-/**
- * cd_icc_get_warnings:
- * @icc: a #CdIcc instance.
- *
- * Returns any warnings with profiles
- *
- * Return value: (transfer container) (element-type CdProfileWarning): An array of warning values
- *
- * Since: 0.1.34
- **/
-GArray *
-cd_icc_get_warnings (CdIcc *icc)
+static GArray *
+cd_icc_check_warnings (CdIcc *icc)
 {
-	CdIccPrivate *priv = GET_PRIVATE (icc);
+	cmsHPROFILE lcms_profile = cd_icc_ensure_profile (icc, NULL);
+	CdProfileWarning warning;
 	GArray *flags;
 	gboolean ret;
 	gchar ascii_name[1024];
-	CdProfileWarning warning;
-
-	g_return_val_if_fail (CD_IS_ICC (icc), NULL);
-	g_return_val_if_fail (priv->lcms_profile != NULL, NULL);
 
 	flags = g_array_new (FALSE, FALSE, sizeof (CdProfileWarning));
 
+	/* the data cannot be parsed, so there is nothing to check */
+	if (lcms_profile == NULL)
+		return flags;
+
 	/* check that the profile has a description and a copyright */
-	ret = cmsGetProfileInfoASCII (priv->lcms_profile,
+	ret = cmsGetProfileInfoASCII (lcms_profile,
 				      cmsInfoDescription, "en", "US",
 				      ascii_name, 1024);
 	if (!ret || ascii_name[0] == '\0') {
 		warning = CD_PROFILE_WARNING_DESCRIPTION_MISSING;
 		g_array_append_val (flags, warning);
 	}
-	ret = cmsGetProfileInfoASCII (priv->lcms_profile,
+	ret = cmsGetProfileInfoASCII (lcms_profile,
 				      cmsInfoCopyright, "en", "US",
 				      ascii_name, 1024);
 	if (!ret || ascii_name[0] == '\0') {
@@ -3827,8 +5411,8 @@ cd_icc_get_warnings (CdIcc *icc)
 	}
 
 	/* not a RGB space */
-	if (cmsGetColorSpace (priv->lcms_profile) != cmsSigRgbData)
-		goto out;
+	if (cmsGetColorSpace (lcms_profile) != cmsSigRgbData)
+		return flags;
 
 	/* does profile have an unlikely whitepoint */
 	warning = cd_icc_check_whitepoint (icc);
@@ -3860,10 +5444,197 @@ cd_icc_get_warnings (CdIcc *icc)
 	warning = cd_icc_check_d50_whitepoint (icc);
 	if (warning != CD_PROFILE_WARNING_NONE)
 		g_array_append_val (flags, warning);
-out:
 	return flags;
 }
 
+/**
+ * cd_icc_get_warnings:
+ * @icc: a #CdIcc instance.
+ *
+ * Returns any warnings with profiles
+ *
+ * The checks are only run once for each profile checksum, and the
+ * result is reused until the profile is modified.
+ *
+ * Return value: (transfer container) (element-type CdProfileWarning): An array of warning values
+ *
+ * Since: 0.1.34
+ **/
+GArray *
+cd_icc_get_warnings (CdIcc *icc)
+{
+	CdIccPrivate *priv = GET_PRIVATE (icc);
+	GArray *flags;
+
+	g_return_val_if_fail (CD_IS_ICC (icc), NULL);
+	g_return_val_if_fail (cd_icc_is_loaded (icc), NULL);
+
+	/* run the checks if the profile has changed */
+	if (priv->warnings == NULL ||
+	    g_strcmp0 (priv->warnings_checksum, priv->checksum) != 0) {
+		cd_icc_invalidate_warnings (icc);
+		priv->warnings = cd_icc_check_warnings (icc);
+		priv->warnings_checksum = g_strdup (priv->checksum);
+	}
+
+	/* the caller owns the container */
+	flags = g_array_sized_new (FALSE, FALSE, sizeof (CdProfileWarning),
+				   priv->warnings->len);
+	g_array_append_vals (flags, priv->warnings->data, priv->warnings->len);
+	return flags;
+}
+
+/**
+ * cd_icc_get_summary:
+ * @icc: a #CdIcc instance.
+ *
+ * Gets everything needed to register the profile without parsing it again,
+ * running the profile checks if they have not already been run.
+ *
+ * Return value: (transfer full): a floating #GVariant
+ **/
+GVariant *
+cd_icc_get_summary (CdIcc *icc)
+{
+	CdIccPrivate *priv = GET_PRIVATE (icc);
+	const gchar *description;
+	const gchar *empty[] = { NULL };
+	GHashTableIter iter;
+	GVariantBuilder builder_metadata;
+	GVariantBuilder builder_warnings;
+	gpointer key;
+	gpointer value;
+	guint i;
+	g_autoptr(GArray) warnings = NULL;
+	g_autoptr(GDateTime) created = NULL;
+	g_autoptr(GHashTable) metadata = NULL;
+	g_auto(GStrv) tags = NULL;
+
+	g_return_val_if_fail (CD_IS_ICC (icc), NULL);
+	g_return_val_if_fail (cd_icc_is_loaded (icc), NULL);
+
+	description = cd_icc_get_description (icc, NULL, NULL);
+	created = cd_icc_get_created (icc);
+	tags = cd_icc_get_tags (icc, NULL);
+
+	metadata = cd_icc_get_metadata (icc);
+	g_variant_builder_init (&builder_metadata, G_VARIANT_TYPE ("a{ss}"));
+	g_hash_table_iter_init (&iter, metadata);
+	while (g_hash_table_iter_next (&iter, &key, &value))
+		g_variant_builder_add (&builder_metadata, "{ss}", key, value);
+
+	warnings = cd_icc_get_warnings (icc);
+	g_variant_builder_init (&builder_warnings, G_VARIANT_TYPE ("au"));
+	for (i = 0; i < warnings->len; i++) {
+		g_variant_builder_add (&builder_warnings, "u",
+				       g_array_index (warnings, CdProfileWarning, i));
+	}
+
+	return g_variant_new (CD_ICC_SUMMARY_FORMAT_BUILD,
+			      priv->checksum != NULL ? priv->checksum : "",
+			      priv->kind,
+			      priv->colorspace,
+			      priv->version,
+			      created != NULL ? g_date_time_to_unix (created) : (gint64) -1,
+			      description != NULL ? description : "",
+			      &builder_metadata,
+			      tags != NULL ? (const gchar * const *) tags : empty,
+			      &builder_warnings,
+			      priv->can_delete);
+}
+
+/**
+ * cd_icc_load_summary:
+ * @icc: a #CdIcc instance.
+ * @filename: the file the summary was made from
+ * @size: the size of @filename in bytes
+ * @mtime: the modification time of @filename in microseconds
+ * @summary: a #GVariant from cd_icc_get_summary()
+ * @error: A #GError or %NULL
+ *
+ * Sets up the profile from a summary without opening @filename, which is
+ * only read if something is needed that the summary does not contain, and
+ * if it still has the same size and modification time.
+ *
+ * Return value: %TRUE for success
+ **/
+gboolean
+cd_icc_load_summary (CdIcc *icc,
+		     const gchar *filename,
+		     guint32 size,
+		     gint64 mtime,
+		     GVariant *summary,
+		     GError **error)
+{
+	CdIccPrivate *priv = GET_PRIVATE (icc);
+	CdProfileWarning warning;
+	GVariantIter *iter_metadata = NULL;
+	GVariantIter *iter_warnings = NULL;
+	const gchar *checksum;
+	const gchar *description;
+	const gchar *key;
+	const gchar *value;
+	gboolean can_delete;
+	gint64 created;
+	guint32 colorspace;
+	guint32 kind;
+
+	g_return_val_if_fail (CD_IS_ICC (icc), FALSE);
+	g_return_val_if_fail (filename != NULL, FALSE);
+	g_return_val_if_fail (!cd_icc_is_loaded (icc), FALSE);
+
+	if (!g_variant_is_of_type (summary, G_VARIANT_TYPE (CD_ICC_SUMMARY_FORMAT))) {
+		g_set_error (error,
+			     CD_ICC_ERROR,
+			     CD_ICC_ERROR_FAILED_TO_PARSE,
+			     "invalid summary type %s",
+			     g_variant_get_type_string (summary));
+		return FALSE;
+	}
+	g_variant_get (summary, CD_ICC_SUMMARY_FORMAT_PARSE,
+		       &checksum,
+		       &kind,
+		       &colorspace,
+		       &priv->version,
+		       &created,
+		       &description,
+		       &iter_metadata,
+		       &priv->tags,
+		       &iter_warnings,
+		       &can_delete);
+
+	if (checksum[0] != '\0')
+		priv->checksum = g_strdup (checksum);
+	priv->kind = kind;
+	priv->colorspace = colorspace;
+	priv->creation_time_summary = created;
+	if (description[0] != '\0') {
+		g_hash_table_insert (priv->mluc_data[CD_MLUC_DESCRIPTION],
+				     g_strdup (""),
+				     g_strdup (description));
+	}
+	while (g_variant_iter_next (iter_metadata, "{&s&s}", &key, &value)) {
+		g_hash_table_insert (priv->metadata,
+				     g_strdup (key),
+				     g_strdup (value));
+	}
+	priv->warnings = g_array_new (FALSE, FALSE, sizeof (CdProfileWarning));
+	while (g_variant_iter_next (iter_warnings, "u", &warning))
+		g_array_append_val (priv->warnings, warning);
+	priv->warnings_checksum = g_strdup (priv->checksum);
+	priv->can_delete = can_delete;
+	g_variant_iter_free (iter_metadata);
+	g_variant_iter_free (iter_warnings);
+
+	/* the data is read if required */
+	g_free (priv->filename);
+	priv->filename = g_strdup (filename);
+	priv->size = size;
+	priv->data_mtime = mtime;
+	priv->data_deferred = TRUE;
+	return TRUE;
+}
+
 static void
 cd_icc_get_property (GObject *object, guint prop_id, GValue *value, GParamSpec *pspec)
 {
@@ -4050,11 +5821,14 @@ cd_icc_init (CdIcc *icc)
 	priv->kind = CD_PROFILE_KIND_UNKNOWN;
 	priv->colorspace = CD_COLORSPACE_UNKNOWN;
 	priv->named_colors = g_ptr_array_new_with_free_func ((GDestroyNotify) cd_color_swatch_free);
+	priv->named_color_values = g_array_new (FALSE, FALSE, sizeof (CdIccNamedColor));
+	priv->named_color_hash = g_hash_table_new (g_str_hash, g_str_equal);
 	priv->metadata = g_hash_table_new_full (g_str_hash,
 						     g_str_equal,
 						     g_free,
 						     g_free);
 	priv->creation_time = -1;
+	priv->creation_time_summary = -1;
 	for (i = 0; i < CD_MLUC_LAST; i++) {
 		priv->mluc_data[i] = g_hash_table_new_full (g_str_hash,
 								 g_str_equal,
@@ -4076,11 +5850,27 @@ cd_icc_finalize (GObject *object)
 
 	g_free (priv->filename);
 	g_free (priv->checksum);
+	g_free (priv->fast_checksum);
+	g_strfreev (priv->tags);
 	g_free (priv->characterization_data);
 	g_ptr_array_unref (priv->named_colors);
+	g_array_unref (priv->named_color_values);
+	g_hash_table_unref (priv->named_color_hash);
+	g_free (priv->named_color_kdtree);
+	if (priv->named_color_names != NULL)
+		g_string_chunk_free (priv->named_color_names);
 	g_hash_table_destroy (priv->metadata);
+	if (priv->data != NULL)
+		g_bytes_unref (priv->data);
 	for (i = 0; i < CD_MLUC_LAST; i++)
 		g_hash_table_destroy (priv->mluc_data[i]);
+	if (priv->warnings != NULL)
+		g_array_unref (priv->warnings);
+	g_free (priv->warnings_checksum);
+	if (priv->profile_lab != NULL)
+		cmsCloseProfile (priv->profile_lab);
+	if (priv->profile_xyz != NULL)
+		cmsCloseProfile (priv->profile_xyz);
 	if (priv->lcms_profile != NULL)
 		cmsCloseProfile (priv->lcms_profile);
 	cd_context_lcms_free (priv->context_lcms);
@@ -95,6 +95,15 @@ struct _CdIccClass
  * 					ID was not supplied in the profile.
  * @CD_ICC_LOAD_FLAGS_PRIMARIES:	Parse the primaries in the profile.
  * @CD_ICC_LOAD_FLAGS_CHARACTERIZATION:	Load the characterization data from the profile
+ * @CD_ICC_LOAD_FLAGS_FAST_CHECKSUM:	Calculate a fast digest of the profile data.
+ * @CD_ICC_LOAD_FLAGS_HEADER_ONLY:	Only parse the header and tag table, deferring
+ * 					the full parse until the profile data is needed.
+ * 					This is not included in %CD_ICC_LOAD_FLAGS_ALL.
+ * @CD_ICC_LOAD_FLAGS_MAPPED:		Map a local file rather than reading it into
+ * 					memory. The file must not be truncated or rewritten
+ * 					in place while the profile exists, so this should
+ * 					only be used by short-lived tools.
+ * 					This is not included in %CD_ICC_LOAD_FLAGS_ALL.
  *
  * Flags used when loading an ICC profile.
  *
@@ -108,8 +117,11 @@ typedef enum {
 	CD_ICC_LOAD_FLAGS_FALLBACK_MD5	= (1 << 3),	/* Since: 0.1.32 */
 	CD_ICC_LOAD_FLAGS_PRIMARIES	= (1 << 4),	/* Since: 0.1.32 */
 	CD_ICC_LOAD_FLAGS_CHARACTERIZATION = (1 << 5),	/* Since: 1.1.1 */
+	CD_ICC_LOAD_FLAGS_FAST_CHECKSUM	= (1 << 6),	/* Since: 1.4.9 */
 	/* new entries go here: */
 	CD_ICC_LOAD_FLAGS_ALL		= 0xff,		/* Since: 0.1.32 */
+	CD_ICC_LOAD_FLAGS_HEADER_ONLY	= (1 << 8),	/* Since: 1.4.9 */
+	CD_ICC_LOAD_FLAGS_MAPPED	= (1 << 9),	/* Since: 1.4.9 */
 	/*< private >*/
 	CD_ICC_LOAD_FLAGS_LAST
 } CdIccLoadFlags;
@@ -157,6 +169,11 @@ GBytes		*cd_icc_save_data			(CdIcc		*icc,
 							 CdIccSaveFlags	 flags,
 							 GError		**error)
 							 G_GNUC_WARN_UNUSED_RESULT;
+gboolean	 cd_icc_save_fd				(CdIcc		*icc,
+							 gint		 fd,
+							 CdIccSaveFlags	 flags,
+							 GError		**error)
+							 G_GNUC_WARN_UNUSED_RESULT;
 gboolean	 cd_icc_save_file			(CdIcc		*icc,
 							 GFile		*file,
 							 CdIccSaveFlags	 flags,
@@ -194,11 +211,16 @@ void		 cd_icc_add_metadata			(CdIcc		*icc,
 void		 cd_icc_remove_metadata			(CdIcc		*icc,
 							 const gchar	*key);
 GPtrArray	*cd_icc_get_named_colors		(CdIcc		*icc);
+CdColorSwatch	*cd_icc_find_named_color		(CdIcc		*icc,
+							 const gchar	*name);
+CdColorSwatch	*cd_icc_find_nearest_named_color	(CdIcc		*icc,
+							 const CdColorLab *lab);
 gboolean	 cd_icc_get_can_delete			(CdIcc		*icc);
 GDateTime	*cd_icc_get_created			(CdIcc		*icc);
 void		 cd_icc_set_created			(CdIcc		*icc,
 							 GDateTime	*creation_time);
 const gchar	*cd_icc_get_checksum			(CdIcc		*icc);
+const gchar	*cd_icc_get_fast_checksum		(CdIcc		*icc);
 const gchar	*cd_icc_get_description			(CdIcc		*icc,
 							 const gchar	*locale,
 							 GError		**error);
@@ -264,6 +286,16 @@ GPtrArray	*cd_icc_get_vcgt			(CdIcc		*icc,
 							 guint		 size,
 							 GError		**error)
 							 G_GNUC_WARN_UNUSED_RESULT;
+gboolean	 cd_icc_get_vcgt_u16			(CdIcc		*icc,
+							 guint		 size,
+							 guint16	*ramps,
+							 GError		**error)
+							 G_GNUC_WARN_UNUSED_RESULT;
+gboolean	 cd_icc_get_vcgt_float			(CdIcc		*icc,
+							 guint		 size,
+							 gfloat		*ramps,
+							 GError		**error)
+							 G_GNUC_WARN_UNUSED_RESULT;
 gboolean	 cd_icc_set_vcgt			(CdIcc		*icc,
 							 GPtrArray	*vcgt,
 							 GError		**error)
@@ -272,6 +304,11 @@ GPtrArray	*cd_icc_get_response			(CdIcc		*icc,
 							 guint		 size,
 							 GError		**error)
 							 G_GNUC_WARN_UNUSED_RESULT;
+gboolean	 cd_icc_get_response_float		(CdIcc		*icc,
+							 guint		 size,
+							 gfloat		*response,
+							 GError		**error)
+							 G_GNUC_WARN_UNUSED_RESULT;
 gchar		**cd_icc_get_tags			(CdIcc		*icc,
 							 GError		**error);
 GBytes		*cd_icc_get_tag_data			(CdIcc		*icc,
@@ -25,6 +25,9 @@
 #include <locale.h>
 #include <string.h>
 #include <fcntl.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/resource.h>
 #include <math.h>
 #include <lcms2.h>
 
@@ -33,8 +36,10 @@
 
 #include "cd-buffer.h"
 #include "cd-color.h"
+#include "cd-cpu.h"
 #include "cd-dom.h"
 #include "cd-edid.h"
+#include "cd-hash.h"
 #include "cd-icc.h"
 #include "cd-icc-store.h"
 #include "cd-icc-utils.h"
@@ -46,6 +51,7 @@
 #include "cd-math.h"
 #include "cd-spectrum.h"
 #include "cd-transform.h"
+#include "cd-transform-stream.h"
 #include "cd-version.h"
 
 #include "cd-test-shared.h"
@@ -1666,6 +1672,7 @@ colord_icc_corrupt_dict_func (void)
 	CdIcc *icc;
 	g_autoptr(GError) error = NULL;
 	gboolean ret;
+	GFile *file;
 	gchar *filename;
 	int fd;
 
@@ -1685,11 +1692,116 @@ colord_icc_corrupt_dict_func (void)
 	ret = g_close (fd, &error);
 	g_assert_no_error (error);
 	g_assert (ret);
+	g_object_unref (icc);
+
+	/* the dict is only decoded on demand, but is still checked */
+	icc = cd_icc_new ();
+	file = g_file_new_for_path (filename);
+	ret = cd_icc_load_file (icc,
+				file,
+				CD_ICC_LOAD_FLAGS_METADATA |
+				 CD_ICC_LOAD_FLAGS_HEADER_ONLY,
+				NULL,
+				&error);
+	g_assert_error (error, CD_ICC_ERROR, CD_ICC_ERROR_CORRUPTION_DETECTED);
+	g_assert (!ret);
+	g_clear_error (&error);
+	g_object_unref (file);
 
 	g_free (filename);
 	g_object_unref (icc);
 }
 
+typedef struct {
+	gint		 fd;
+	const gchar	*data;
+	gsize		 len;
+} CdTestPipeHelper;
+
+static gpointer
+colord_icc_load_fd_write_cb (gpointer user_data)
+{
+	CdTestPipeHelper *helper = (CdTestPipeHelper *) user_data;
+	gsize offset = 0;
+
+	/* dribble the data so the reader sees short reads */
+	while (offset < helper->len) {
+		gssize wrote = write (helper->fd, helper->data + offset,
+				      MIN (helper->len - offset, 1000));
+		g_assert_cmpint (wrote, >, 0);
+		offset += wrote;
+	}
+	close (helper->fd);
+	return NULL;
+}
+
+static void
+colord_icc_load_fd_func (void)
+{
+	CdTestPipeHelper helper;
+	GThread *thread;
+	gboolean ret;
+	gint fd;
+	gint fds[2];
+	gsize len = 0;
+	g_autofree gchar *data = NULL;
+	g_autofree gchar *filename = NULL;
+	g_autoptr(CdIcc) icc_data = NULL;
+	g_autoptr(CdIcc) icc_fd = NULL;
+	g_autoptr(CdIcc) icc_pipe = NULL;
+	g_autoptr(GError) error = NULL;
+
+	/* reference */
+	filename = cd_test_get_filename ("ibm-t61.icc");
+	ret = g_file_get_contents (filename, &data, &len, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	icc_data = cd_icc_new ();
+	ret = cd_icc_load_data (icc_data, (const guint8 *) data, len,
+				CD_ICC_LOAD_FLAGS_FALLBACK_MD5 |
+				CD_ICC_LOAD_FLAGS_FAST_CHECKSUM,
+				&error);
+	g_assert_no_error (error);
+	g_assert (ret);
+
+	/* regular file is mapped */
+	fd = g_open (filename, O_RDONLY, 0);
+	g_assert_cmpint (fd, >, 0);
+	icc_fd = cd_icc_new ();
+	ret = cd_icc_load_fd (icc_fd, fd,
+			      CD_ICC_LOAD_FLAGS_FALLBACK_MD5 |
+			      CD_ICC_LOAD_FLAGS_FAST_CHECKSUM,
+			      &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	ret = g_close (fd, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert_cmpstr (cd_icc_get_checksum (icc_fd), ==, cd_icc_get_checksum (icc_data));
+	g_assert_cmpstr (cd_icc_get_fast_checksum (icc_fd), ==, cd_icc_get_fast_checksum (icc_data));
+	g_assert_cmpint (cd_icc_get_size (icc_fd), ==, len);
+
+	/* pipe is read in blocks */
+	g_assert_cmpint (pipe (fds), ==, 0);
+	helper.fd = fds[1];
+	helper.data = data;
+	helper.len = len;
+	thread = g_thread_new ("colord-test-pipe", colord_icc_load_fd_write_cb, &helper);
+	icc_pipe = cd_icc_new ();
+	ret = cd_icc_load_fd (icc_pipe, fds[0],
+			      CD_ICC_LOAD_FLAGS_FALLBACK_MD5 |
+			      CD_ICC_LOAD_FLAGS_FAST_CHECKSUM,
+			      &error);
+	g_thread_join (thread);
+	close (fds[0]);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert_cmpstr (cd_icc_get_checksum (icc_pipe), ==, cd_icc_get_checksum (icc_data));
+	g_assert_cmpstr (cd_icc_get_fast_checksum (icc_pipe), ==, cd_icc_get_fast_checksum (icc_data));
+	g_assert_cmpint (cd_icc_get_size (icc_pipe), ==, len);
+	g_assert_cmpint (cd_icc_get_kind (icc_pipe), ==, CD_PROFILE_KIND_DISPLAY_DEVICE);
+}
+
 static void
 colord_icc_save_func (void)
 {
@@ -1700,6 +1812,7 @@ colord_icc_save_func (void)
 	gchar *tmpdir;
 	g_autoptr(GError) error = NULL;
 	GFile *file;
+	GStatBuf stat_buf;
 
 	/* load source file */
 	icc = cd_icc_new ();
@@ -1764,6 +1877,20 @@ colord_icc_save_func (void)
 	str = cd_icc_get_characterization_data (icc);
 	g_assert_cmpstr (str, ==, "[TI3]");
 
+	/* saving over the file keeps its mode */
+	filename = g_file_get_path (file);
+	g_assert_cmpint (g_chmod (filename, 0640), ==, 0);
+	ret = cd_icc_save_file (icc,
+				file,
+				CD_ICC_SAVE_FLAGS_NONE,
+				NULL,
+				&error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert_cmpint (g_stat (filename, &stat_buf), ==, 0);
+	g_assert_cmpint (stat_buf.st_mode & 07777, ==, 0640);
+	g_free (filename);
+
 	/* remove temp file */
 	ret = g_file_delete (file, NULL, &error);
 	g_assert_no_error (error);
@@ -1975,95 +2102,1125 @@ colord_transform_func (void)
 	g_object_unref (transform);
 }
 
-#include <glib/gstdio.h>
+static void
+colord_transform_pool_func (void)
+{
+	const struct {
+		guint width;
+		guint height;
+	} sizes[] = {
+		{ 64, 64 },
+		{ 512, 512 },
+		{ 3840, 2160 },
+		{ 0, 0 }
+	};
+	guint i;
+	g_autoptr(CdTransform) transform = NULL;
+	g_autoptr(GArray) counts = NULL;
+	g_autoptr(GTimer) timer = g_timer_new ();
+
+	/* use the default number of threads with a persistent pool */
+	transform = cd_transform_new ();
+	cd_transform_set_rendering_intent (transform, CD_RENDERING_INTENT_PERCEPTUAL);
+	cd_transform_set_input_pixel_format (transform, CD_PIXEL_FORMAT_RGB24);
+	cd_transform_set_output_pixel_format (transform, CD_PIXEL_FORMAT_RGB24);
+	cd_transform_set_max_threads (transform, 0);
+
+	for (i = 0; sizes[i].width != 0; i++) {
+		gboolean ret;
+		guint calls = 0;
+		gsize len = sizes[i].width * sizes[i].height * 3;
+		g_autofree guint8 *img_data = g_new0 (guint8, len);
+		g_autoptr(GError) error = NULL;
+
+		/* only run for a fixed amount of time when benchmarking */
+		g_timer_reset (timer);
+		do {
+			ret = cd_transform_process (transform,
+						    img_data,
+						    img_data,
+						    sizes[i].width,
+						    sizes[i].height,
+						    sizes[i].width,
+						    NULL,
+						    &error);
+			g_assert_no_error (error);
+			g_assert (ret);
+			calls++;
+		} while (g_test_perf () && g_timer_elapsed (timer, NULL) < 0.2);
+		if (g_test_perf ()) {
+			g_test_minimized_result (calls / g_timer_elapsed (timer, NULL),
+						 "%ux%u = %.0f calls/sec",
+						 sizes[i].width, sizes[i].height,
+						 calls / g_timer_elapsed (timer, NULL));
+		}
+	}
+
+	/* show how the tiles of the last image were shared out */
+	counts = cd_transform_get_tile_counts (transform);
+	g_assert_cmpint (counts->len, <=, cd_transform_get_max_threads (transform));
+	for (i = 0; i < counts->len; i++)
+		g_test_message ("thread %u = %u tiles", i, g_array_index (counts, guint, i));
+}
 
 static void
-_copy_files (const gchar *src, const gchar *dest)
+colord_transform_native_func (void)
 {
+	const guint height = 1080;
+	const guint repeats = g_test_perf () ? 10 : 1;
+	const guint width = 1920;
+	cmsHPROFILE profile_in;
+	cmsHTRANSFORM lcms_transform;
 	gboolean ret;
-	g_autofree gchar *data = NULL;
+	gdouble elapsed_lcms;
+	gdouble elapsed_native;
+	guint i;
+	g_autofree gchar *filename = NULL;
+	g_autofree guint8 *img_data_in = NULL;
+	g_autofree guint8 *img_data_out = NULL;
+	g_autofree guint8 *img_data_check = NULL;
+	g_autoptr(CdIcc) icc = cd_icc_new ();
+	g_autoptr(CdTransform) transform = cd_transform_new ();
 	g_autoptr(GError) error = NULL;
-	gsize len;
+	g_autoptr(GFile) file = NULL;
+	g_autoptr(GTimer) timer = g_timer_new ();
 
-	ret = g_file_get_contents (src, &data, &len, &error);
+	/* sRGB to a matrix-shaper display profile */
+	filename = cd_test_get_filename ("ibm-t61.icc");
+	file = g_file_new_for_path (filename);
+	ret = cd_icc_load_file (icc, file, CD_ICC_LOAD_FLAGS_NONE, NULL, &error);
+	g_assert_no_error (error);
 	g_assert (ret);
+	cd_transform_set_rendering_intent (transform, CD_RENDERING_INTENT_PERCEPTUAL);
+	cd_transform_set_input_pixel_format (transform, CD_PIXEL_FORMAT_RGB24);
+	cd_transform_set_output_pixel_format (transform, CD_PIXEL_FORMAT_RGB24);
+	cd_transform_set_output_icc (transform, icc);
+	cd_transform_set_max_threads (transform, 1);
+
+	img_data_in = g_new0 (guint8, height * width * 3);
+	img_data_out = g_new0 (guint8, height * width * 3);
+	img_data_check = g_new0 (guint8, height * width * 3);
+	for (i = 0; i < height * width * 3; i++)
+		img_data_in[i] = i % 0xff;
+
+	/* get the reference result directly from lcms */
+	profile_in = cmsCreate_sRGBProfile ();
+	lcms_transform = cmsCreateTransform (profile_in, TYPE_RGB_8,
+					     cd_icc_get_handle (icc), TYPE_RGB_8,
+					     INTENT_PERCEPTUAL, 0);
+	g_assert (lcms_transform != NULL);
+	g_timer_reset (timer);
+	for (i = 0; i < repeats; i++)
+		cmsDoTransform (lcms_transform, img_data_in, img_data_check, width * height);
+	elapsed_lcms = g_timer_elapsed (timer, NULL) * 1000 / repeats;
+	cmsDeleteTransform (lcms_transform);
+	cmsCloseProfile (profile_in);
+
+	/* use CdTransform, which may not use lcms at all */
+	g_timer_reset (timer);
+	for (i = 0; i < repeats; i++) {
+		ret = cd_transform_process (transform,
+					    img_data_in,
+					    img_data_out,
+					    width,
+					    height,
+					    width,
+					    NULL,
+					    &error);
+		g_assert_no_error (error);
+		g_assert (ret);
+	}
+	elapsed_native = g_timer_elapsed (timer, NULL) * 1000 / repeats;
+	for (i = 0; i < height * width * 3; i++)
+		g_assert_cmpint (ABS ((gint) img_data_out[i] - (gint) img_data_check[i]), <=, 1);
+	if (g_test_perf ()) {
+		g_test_maximized_result (elapsed_lcms / elapsed_native,
+					 "lcms = %.2fms, CdTransform = %.2fms",
+					 elapsed_lcms, elapsed_native);
+	}
+}
+
+static void
+colord_transform_formats_func (void)
+{
+	cmsHPROFILE profile_in;
+	cmsHTRANSFORM lcms_transform;
+	gboolean ret;
+	gfloat data_float[3] = { 2.f, 0.5f, 0.25f };
+	guint i;
+	g_autofree gchar *filename = NULL;
+	g_autofree gfloat *img_data_check = NULL;
+	g_autofree guint16 *img_data = NULL;
+	g_autoptr(CdIcc) icc = cd_icc_new ();
+	g_autoptr(CdTransform) transform = cd_transform_new ();
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GFile) file = NULL;
+
+	filename = cd_test_get_filename ("ibm-t61.icc");
+	file = g_file_new_for_path (filename);
+	ret = cd_icc_load_file (icc, file, CD_ICC_LOAD_FLAGS_NONE, NULL, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+
+	/* check the new formats round trip */
+	g_assert_cmpint (cd_pixel_format_from_string ("rgba64-half"), ==, CD_PIXEL_FORMAT_RGBA64_HALF);
+	g_assert_cmpstr (cd_pixel_format_to_string (CD_PIXEL_FORMAT_RGB96_FLOAT), ==, "rgb96-float");
+
+	/* 16 bit in-place, checked against the lcms float pipeline */
+	img_data = g_new0 (guint16, 0x10000 * 3);
+	img_data_check = g_new0 (gfloat, 0x10000 * 3);
+	for (i = 0; i < 0x10000 * 3; i++) {
+		img_data[i] = (guint16) ((i * 257) & 0xffff);
+		img_data_check[i] = (gfloat) img_data[i] / 0xffff;
+	}
+	profile_in = cmsCreate_sRGBProfile ();
+	lcms_transform = cmsCreateTransform (profile_in, TYPE_RGB_FLT,
+					     cd_icc_get_handle (icc), TYPE_RGB_FLT,
+					     INTENT_PERCEPTUAL, 0);
+	g_assert (lcms_transform != NULL);
+	cmsDoTransform (lcms_transform, img_data_check, img_data_check, 0x10000);
+	cmsDeleteTransform (lcms_transform);
+	cmsCloseProfile (profile_in);
+
+	cd_transform_set_rendering_intent (transform, CD_RENDERING_INTENT_PERCEPTUAL);
+	cd_transform_set_input_pixel_format (transform, CD_PIXEL_FORMAT_RGB48);
+	cd_transform_set_output_pixel_format (transform, CD_PIXEL_FORMAT_RGB48);
+	cd_transform_set_output_icc (transform, icc);
+	cd_transform_set_max_threads (transform, 1);
+	ret = cd_transform_process (transform,
+				    img_data,
+				    img_data,
+				    0x100, 0x100, 0x100,
+				    NULL,
+				    &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	for (i = 0; i < 0x10000 * 3; i++) {
+		gdouble expected = CLAMP (img_data_check[i], 0.f, 1.f) * 0xffff;
+		g_assert_cmpfloat (ABS (img_data[i] - expected), <=, 4);
+	}
+
+	/* float does not clip values brighter than white */
+	cd_transform_set_output_icc (transform, NULL);
+	cd_transform_set_input_pixel_format (transform, CD_PIXEL_FORMAT_RGB96_FLOAT);
+	cd_transform_set_output_pixel_format (transform, CD_PIXEL_FORMAT_RGB96_FLOAT);
+	ret = cd_transform_process (transform,
+				    data_float,
+				    data_float,
+				    1, 1, 1,
+				    NULL,
+				    &error);
 	g_assert_no_error (error);
-	ret = g_file_set_contents (dest, data, len, &error);
 	g_assert (ret);
+	g_assert_cmpfloat (data_float[0], >, 1.f);
+	g_assert_cmpfloat (ABS (data_float[1] - 0.5f), <, 0.01f);
+}
+
+static gpointer
+colord_transform_cache_thread_cb (gpointer user_data)
+{
+	CdIcc *icc = CD_ICC (user_data);
+	gboolean ret;
+	guint8 data[3] = { 127, 32, 64 };
+	g_autoptr(CdTransform) transform = cd_transform_new ();
+	g_autoptr(GError) error = NULL;
+
+	cd_transform_set_rendering_intent (transform, CD_RENDERING_INTENT_ABSOLUTE_COLORIMETRIC);
+	cd_transform_set_input_pixel_format (transform, CD_PIXEL_FORMAT_RGB24);
+	cd_transform_set_output_pixel_format (transform, CD_PIXEL_FORMAT_RGB24);
+	cd_transform_set_output_icc (transform, icc);
+	ret = cd_transform_process (transform, data, data, 1, 1, 1, NULL, &error);
 	g_assert_no_error (error);
+	g_assert (ret);
+	return NULL;
 }
 
 static void
-colord_icc_store_added_cb (CdIccStore *store, CdIcc *icc, guint *cnt)
+colord_transform_cache_func (void)
 {
-	g_debug ("Got ::added(%s)", cd_icc_get_checksum (icc));
-	(*cnt)++;
-	cd_test_loop_quit ();
+	GThread *threads[4];
+	gboolean ret;
+	guint i;
+	guint8 data_in[3] = { 127, 32, 64 };
+	guint8 data_out[3][3];
+	g_autofree gchar *filename = NULL;
+	g_autoptr(CdIcc) icc = cd_icc_new ();
+	g_autoptr(GBytes) tag = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GFile) file = NULL;
+
+	filename = cd_test_get_filename ("ibm-t61.icc");
+	file = g_file_new_for_path (filename);
+	ret = cd_icc_load_file (icc, file, CD_ICC_LOAD_FLAGS_NONE, NULL, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+
+	/* the second transform reuses the first, and the third is for a
+	 * modified profile; absolute colorimetric is not done natively */
+	cd_transform_cache_clear ();
+	g_assert_cmpint (cd_transform_cache_get_max_size (), >, 0);
+	for (i = 0; i < 3; i++) {
+		g_autoptr(CdTransform) transform = cd_transform_new ();
+		if (i == 2) {
+			tag = cd_icc_get_tag_data (icc, "desc", &error);
+			g_assert_no_error (error);
+			g_assert (tag != NULL);
+			ret = cd_icc_set_tag_data (icc, "desc", tag, &error);
+			g_assert_no_error (error);
+			g_assert (ret);
+		}
+		cd_transform_set_rendering_intent (transform, CD_RENDERING_INTENT_ABSOLUTE_COLORIMETRIC);
+		cd_transform_set_input_pixel_format (transform, CD_PIXEL_FORMAT_RGB24);
+		cd_transform_set_output_pixel_format (transform, CD_PIXEL_FORMAT_RGB24);
+		cd_transform_set_output_icc (transform, icc);
+		ret = cd_transform_process (transform,
+					    data_in,
+					    data_out[i],
+					    1, 1, 1,
+					    NULL,
+					    &error);
+		g_assert_no_error (error);
+		g_assert (ret);
+	}
+	g_assert_cmpint (cd_transform_cache_get_misses (), ==, 2);
+	g_assert_cmpint (cd_transform_cache_get_hits (), ==, 1);
+	g_assert_cmpint (cd_transform_cache_get_size (), >, 0);
+	g_assert_cmpint (memcmp (data_out[0], data_out[1], 3), ==, 0);
+	g_assert_cmpint (memcmp (data_out[0], data_out[2], 3), ==, 0);
+
+	/* anything bigger than the limit is evicted */
+	cd_transform_cache_set_max_size (1);
+	g_assert_cmpint (cd_transform_cache_get_size (), ==, 0);
+	cd_transform_cache_set_max_size (0);
+	g_assert_cmpint (cd_transform_cache_get_max_size (), ==, 0);
+	cd_transform_cache_set_max_size (16 * 1024 * 1024);
+	cd_transform_cache_clear ();
+	g_assert_cmpint (cd_transform_cache_get_misses (), ==, 0);
+
+	/* threads asking for the same transform at once only build it once */
+	for (i = 0; i < G_N_ELEMENTS (threads); i++) {
+		threads[i] = g_thread_new ("colord-test-cache",
+					   colord_transform_cache_thread_cb,
+					   icc);
+	}
+	for (i = 0; i < G_N_ELEMENTS (threads); i++)
+		g_thread_join (threads[i]);
+	g_assert_cmpint (cd_transform_cache_get_misses (), ==, 1);
+	g_assert_cmpint (cd_transform_cache_get_hits (), ==, G_N_ELEMENTS (threads) - 1);
+	g_assert_cmpint (cd_transform_cache_get_size (), >, 0);
+	cd_transform_cache_clear ();
 }
 
+#include <glib/gstdio.h>
+
 static void
-colord_icc_store_removed_cb (CdIccStore *store, CdIcc *icc, guint *cnt)
+colord_transform_async_cb (GObject *source, GAsyncResult *res, gpointer user_data)
 {
-	g_debug ("Got ::removed(%s)", cd_icc_get_checksum (icc));
-	(*cnt)++;
+	GError **error = (GError **) user_data;
+	gboolean ret;
+
+	ret = cd_transform_process_finish (CD_TRANSFORM (source), res, error);
+	g_assert (ret == (*error == NULL));
 	cd_test_loop_quit ();
 }
 
 static void
-colord_icc_store_func (void)
+colord_transform_async_func (void)
 {
-	CdIccStore *store;
-	CdIcc *icc;
+	const guint height = 1080;
+	const guint width = 1920;
 	gboolean ret;
-	gchar *file1;
-	gchar *file1_dup;
-	gchar *file2;
-	gchar *filename1;
-	gchar *filename2;
-	gchar *newroot;
-	gchar *root;
+	g_autofree guint8 *img_data = g_new0 (guint8, height * width * 3);
+	g_autoptr(CdTransform) transform = cd_transform_new ();
+	g_autoptr(GCancellable) cancellable = g_cancellable_new ();
 	g_autoptr(GError) error = NULL;
-	GPtrArray *array;
-	guint added = 0;
-	guint removed = 0;
 
-	store = cd_icc_store_new ();
-	g_signal_connect (store, "added",
-			  G_CALLBACK (colord_icc_store_added_cb),
-			  &added);
-	g_signal_connect (store, "removed",
-			  G_CALLBACK (colord_icc_store_removed_cb),
-			  &removed);
-	cd_icc_store_set_load_flags (store, CD_ICC_LOAD_FLAGS_NONE);
-
-	filename1 = cd_test_get_filename ("ibm-t61.icc");
-	g_assert (filename1 != NULL);
-	filename2 = cd_test_get_filename ("crayons.icc");
-	g_assert (filename2 != NULL);
+	cd_transform_set_rendering_intent (transform, CD_RENDERING_INTENT_PERCEPTUAL);
+	cd_transform_set_input_pixel_format (transform, CD_PIXEL_FORMAT_RGB24);
+	cd_transform_set_output_pixel_format (transform, CD_PIXEL_FORMAT_RGB24);
+	cd_transform_set_max_threads (transform, 2);
 
-	/* create test directory */
-	root = g_dir_make_tmp("colord-XXXXXX", &error);
+	/* convert the whole image in a worker thread */
+	cd_transform_process_async (transform,
+				    img_data,
+				    img_data,
+				    width,
+				    height,
+				    width,
+				    cancellable,
+				    colord_transform_async_cb,
+				    &error);
+	cd_test_loop_run_with_timeout (5000);
 	g_assert_no_error (error);
-	g_assert (root != NULL);
+	g_assert_cmpfloat (cd_transform_get_progress (transform), ==, 1.f);
 
-	file1 = g_build_filename (root, "already-exists.icc", NULL);
-	_copy_files (filename1, file1);
+	/* nothing is converted once cancelled */
+	g_cancellable_cancel (cancellable);
+	cd_transform_process_async (transform,
+				    img_data,
+				    img_data,
+				    width,
+				    height,
+				    width,
+				    cancellable,
+				    colord_transform_async_cb,
+				    &error);
+	cd_test_loop_run_with_timeout (5000);
+	g_assert_error (error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+	g_assert_cmpfloat (cd_transform_get_progress (transform), ==, 0.f);
+	g_clear_error (&error);
 
-	g_assert_cmpint (added, ==, 0);
-	g_assert_cmpint (removed, ==, 0);
+	/* and the same for the sync version */
+	cd_transform_set_max_threads (transform, 1);
+	ret = cd_transform_process (transform,
+				    img_data,
+				    img_data,
+				    width,
+				    height,
+				    width,
+				    cancellable,
+				    &error);
+	g_assert_error (error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+	g_assert (!ret);
+}
 
-	/* this is done sync */
-	ret = cd_icc_store_search_location (store, root,
-					    CD_ICC_STORE_SEARCH_FLAGS_CREATE_LOCATION,
-					    NULL, &error);
-	g_assert (ret);
+static void
+colord_transform_planar_func (void)
+{
+	gboolean ret;
+	gpointer planes_in[3];
+	gpointer planes_out[1];
+	gsize strides_in[3] = { 67, 67, 67 };
+	gsize strides_out[1] = { 64 * 3 + 5 };
+	guint i;
+	guint x;
+	guint y;
+	g_autofree gchar *filename = NULL;
+	g_autofree guint8 *data_in = NULL;
+	g_autofree guint8 *data_out = NULL;
+	g_autofree guint8 *data_check = NULL;
+	g_autoptr(CdIcc) icc = cd_icc_new ();
+	g_autoptr(CdTransform) transform = cd_transform_new ();
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GFile) file = NULL;
+
+	filename = cd_test_get_filename ("ibm-t61.icc");
+	file = g_file_new_for_path (filename);
+	ret = cd_icc_load_file (icc, file, CD_ICC_LOAD_FLAGS_NONE, NULL, &error);
 	g_assert_no_error (error);
+	g_assert (ret);
 
-	g_assert_cmpint (added, ==, 1);
-	g_assert_cmpint (removed, ==, 0);
+	/* three padded planes as written by an image decoder */
+	data_in = g_new0 (guint8, 67 * 64 * 3);
+	data_check = g_new0 (guint8, 64 * 64 * 3);
+	for (y = 0; y < 64; y++) {
+		for (x = 0; x < 64; x++) {
+			for (i = 0; i < 3; i++) {
+				guint8 tmp = (guint8) ((x * 4 + y * (i + 1) * 3) & 0xff);
+				data_in[i * 67 * 64 + y * 67 + x] = tmp;
+				data_check[(y * 64 + x) * 3 + i] = tmp;
+			}
+		}
+	}
+	for (i = 0; i < 3; i++)
+		planes_in[i] = data_in + i * 67 * 64;
+	data_out = g_new0 (guint8, strides_out[0] * 64);
+	planes_out[0] = data_out;
 
-	/* find an icc by filename */
-	icc = cd_icc_store_find_by_filename (store, file1);
+	cd_transform_set_rendering_intent (transform, CD_RENDERING_INTENT_PERCEPTUAL);
+	cd_transform_set_input_pixel_format (transform, CD_PIXEL_FORMAT_RGB24_PLANAR);
+	cd_transform_set_output_pixel_format (transform, CD_PIXEL_FORMAT_RGB24);
+	cd_transform_set_output_icc (transform, icc);
+	cd_transform_set_max_threads (transform, 4);
+	ret = cd_transform_process_planes (transform,
+					   planes_in, strides_in,
+					   planes_out, strides_out,
+					   64, 64,
+					   NULL,
+					   &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+
+	/* the same pixels interleaved give the same result */
+	cd_transform_set_input_pixel_format (transform, CD_PIXEL_FORMAT_RGB24);
+	ret = cd_transform_process (transform,
+				    data_check,
+				    data_check,
+				    64, 64, 64,
+				    NULL,
+				    &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	for (y = 0; y < 64; y++) {
+		g_assert_cmpint (memcmp (data_out + y * strides_out[0],
+					 data_check + y * 64 * 3,
+					 64 * 3), ==, 0);
+	}
+	g_assert_cmpstr (cd_pixel_format_to_string (CD_PIXEL_FORMAT_RGBA64_PLANAR), ==, "rgba64-planar");
+}
+
+static void
+colord_transform_cpu_func (void)
+{
+	gboolean ret;
+	guint i;
+	gsize len = 256 * 256 * 3;
+	g_autofree guint8 *img_data = g_new0 (guint8, len);
+	g_autofree guint8 *img_check = g_new0 (guint8, len);
+	g_autoptr(CdTransform) transform = cd_transform_new ();
+	g_autoptr(GError) error = NULL;
+
+	/* the topology is probed once and honours the affinity mask */
+	g_assert_cmpint (cd_cpu_get_n_threads (), >=, 1);
+	g_assert_cmpint (cd_cpu_get_n_threads (), <=, g_get_num_processors ());
+	g_assert_cmpint (cd_cpu_get_n_nodes (), >=, 1);
+	g_test_message ("%u threads over %u nodes",
+			cd_cpu_get_n_threads (), cd_cpu_get_n_nodes ());
+
+	/* NUMA placement does not change the result */
+	for (i = 0; i < len; i++)
+		img_data[i] = img_check[i] = (guint8) (i % 251);
+	cd_transform_set_rendering_intent (transform, CD_RENDERING_INTENT_PERCEPTUAL);
+	cd_transform_set_input_pixel_format (transform, CD_PIXEL_FORMAT_RGB24);
+	cd_transform_set_output_pixel_format (transform, CD_PIXEL_FORMAT_RGB24);
+	cd_transform_set_max_threads (transform, 0);
+	ret = cd_transform_process (transform, img_check, img_check,
+				    256, 256, 256, NULL, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert_cmpint (cd_transform_get_max_threads (transform), ==, cd_cpu_get_n_threads ());
+	cd_transform_set_numa_aware (transform, TRUE);
+	g_assert (cd_transform_get_numa_aware (transform));
+	ret = cd_transform_process (transform, img_data, img_data,
+				    256, 256, 256, NULL, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert_cmpint (memcmp (img_data, img_check, len), ==, 0);
+}
+
+static void
+colord_transform_stream_cb (CdTransformStream *stream,
+			    gconstpointer data,
+			    guint row,
+			    guint n_rows,
+			    gsize rowstride,
+			    gpointer user_data)
+{
+	guint8 *img_out = (guint8 *) user_data;
+	memcpy (img_out + row * rowstride, data, n_rows * rowstride);
+}
+
+static void
+colord_transform_stream_func (void)
+{
+	const guint height = 301;
+	const guint width = 97;
+	gboolean ret;
+	guint i;
+	gsize len = width * height * 3;
+	g_autofree guint8 *img_check = g_new0 (guint8, len);
+	g_autofree guint8 *img_data = g_new0 (guint8, len);
+	g_autofree guint8 *img_out = g_new0 (guint8, len);
+	g_autoptr(CdTransform) transform = cd_transform_new ();
+	g_autoptr(CdTransformStream) stream = NULL;
+	g_autoptr(GError) error = NULL;
+
+	for (i = 0; i < len; i++)
+		img_data[i] = img_check[i] = (guint8) (i % 253);
+	cd_transform_set_rendering_intent (transform, CD_RENDERING_INTENT_PERCEPTUAL);
+	cd_transform_set_input_pixel_format (transform, CD_PIXEL_FORMAT_RGB24);
+	cd_transform_set_output_pixel_format (transform, CD_PIXEL_FORMAT_RGB24);
+	ret = cd_transform_process (transform, img_check, img_check,
+				    width, height, width, NULL, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+
+	/* feed a few scanlines at a time like a decoder would */
+	stream = cd_transform_stream_new (transform, width,
+					  colord_transform_stream_cb,
+					  img_out, NULL);
+	cd_transform_stream_set_batch_rows (stream, 16);
+	for (i = 0; i < height; i += 3) {
+		ret = cd_transform_stream_write (stream,
+						 img_data + i * width * 3,
+						 MIN (3, height - i),
+						 width * 3,
+						 NULL,
+						 &error);
+		g_assert_no_error (error);
+		g_assert (ret);
+	}
+	g_assert_cmpint (cd_transform_stream_get_rows_written (stream), ==, height);
+	g_assert_cmpint (cd_transform_stream_get_rows_delivered (stream), ==, height - height % 16);
+	ret = cd_transform_stream_flush (stream, NULL, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert_cmpint (cd_transform_stream_get_rows_delivered (stream), ==, height);
+	g_assert_cmpint (memcmp (img_out, img_check, len), ==, 0);
+
+	/* whole batches are converted without copying */
+	g_clear_object (&stream);
+	memset (img_out, 0, len);
+	stream = cd_transform_stream_new (transform, width,
+					  colord_transform_stream_cb,
+					  img_out, NULL);
+	ret = cd_transform_stream_write (stream, img_data, height, width * 3, NULL, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert_cmpint (cd_transform_stream_get_batch_rows (stream), >, 0);
+	ret = cd_transform_stream_flush (stream, NULL, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert_cmpint (memcmp (img_out, img_check, len), ==, 0);
+}
+
+static void
+colord_transform_devicelink_func (void)
+{
+	const gchar *basename;
+	gboolean ret;
+	guint i;
+	guint8 data_in[3] = { 127, 32, 64 };
+	guint8 data_out[2][3];
+	g_autofree gchar *devicelink_fn = NULL;
+	g_autofree gchar *filename = NULL;
+	g_autofree gchar *tmpdir = NULL;
+	g_autoptr(CdIcc) devicelink = NULL;
+	g_autoptr(CdIcc) icc = cd_icc_new ();
+	g_autoptr(CdTransform) transform_link = NULL;
+	g_autoptr(GBytes) data = NULL;
+	g_autoptr(GDir) dir = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GFile) file = NULL;
+
+	filename = cd_test_get_filename ("ibm-t61.icc");
+	file = g_file_new_for_path (filename);
+	ret = cd_icc_load_file (icc, file, CD_ICC_LOAD_FLAGS_NONE, NULL, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	tmpdir = g_dir_make_tmp ("colord-XXXXXX", &error);
+	g_assert_no_error (error);
+	g_assert (tmpdir != NULL);
+
+	/* the first transform saves the devicelink, the second loads it */
+	for (i = 0; i < 2; i++) {
+		g_autoptr(CdTransform) transform = cd_transform_new ();
+		cd_transform_cache_clear ();
+		cd_transform_set_rendering_intent (transform, CD_RENDERING_INTENT_ABSOLUTE_COLORIMETRIC);
+		cd_transform_set_input_pixel_format (transform, CD_PIXEL_FORMAT_RGB24);
+		cd_transform_set_output_pixel_format (transform, CD_PIXEL_FORMAT_RGB24);
+		cd_transform_set_output_icc (transform, icc);
+		cd_transform_set_devicelink_dir (transform, tmpdir);
+		g_assert_cmpstr (cd_transform_get_devicelink_dir (transform), ==, tmpdir);
+		ret = cd_transform_process (transform,
+					    data_in,
+					    data_out[i],
+					    1, 1, 1,
+					    NULL,
+					    &error);
+		g_assert_no_error (error);
+		g_assert (ret);
+
+		/* export it directly too */
+		if (i == 0) {
+			devicelink = cd_transform_get_devicelink (transform, &error);
+			g_assert_no_error (error);
+			g_assert (devicelink != NULL);
+		}
+	}
+	for (i = 0; i < 3; i++)
+		g_assert_cmpint (ABS (data_out[0][i] - data_out[1][i]), <=, 2);
+	g_assert_cmpint (cd_icc_get_kind (devicelink), ==, CD_PROFILE_KIND_DEVICELINK);
+
+	/* the devicelink is the whole chain when used as the input */
+	transform_link = cd_transform_new ();
+	cd_transform_set_rendering_intent (transform_link, CD_RENDERING_INTENT_ABSOLUTE_COLORIMETRIC);
+	cd_transform_set_input_pixel_format (transform_link, CD_PIXEL_FORMAT_RGB24);
+	cd_transform_set_output_pixel_format (transform_link, CD_PIXEL_FORMAT_RGB24);
+	cd_transform_set_input_icc (transform_link, devicelink);
+	ret = cd_transform_process (transform_link,
+				    data_in,
+				    data_out[1],
+				    1, 1, 1,
+				    NULL,
+				    &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	for (i = 0; i < 3; i++)
+		g_assert_cmpint (ABS (data_out[0][i] - data_out[1][i]), <=, 2);
+	data = cd_icc_save_data (devicelink, CD_ICC_SAVE_FLAGS_NONE, &error);
+	g_assert_no_error (error);
+	g_assert (data != NULL);
+
+	/* remove the single cached file */
+	dir = g_dir_open (tmpdir, 0, &error);
+	g_assert_no_error (error);
+	basename = g_dir_read_name (dir);
+	g_assert (basename != NULL);
+	g_assert (g_str_has_suffix (basename, ".icc"));
+	devicelink_fn = g_build_filename (tmpdir, basename, NULL);
+	g_assert (g_dir_read_name (dir) == NULL);
+	ret = g_remove (devicelink_fn);
+	g_assert (!ret);
+	ret = g_remove (tmpdir);
+	g_assert (!ret);
+}
+
+static void
+_copy_files (const gchar *src, const gchar *dest)
+{
+	gboolean ret;
+	g_autofree gchar *data = NULL;
+	g_autoptr(GError) error = NULL;
+	gsize len;
+
+	ret = g_file_get_contents (src, &data, &len, &error);
+	g_assert (ret);
+	g_assert_no_error (error);
+	ret = g_file_set_contents (dest, data, len, &error);
+	g_assert (ret);
+	g_assert_no_error (error);
+}
+
+static gchar *
+_make_tmpdir (void)
+{
+	gchar *root;
+	g_autoptr(GError) error = NULL;
+
+	root = g_dir_make_tmp ("colord-XXXXXX", &error);
+	g_assert_no_error (error);
+	g_assert (root != NULL);
+	return root;
+}
+
+/* even copies go in @root and odd copies in @subdir, if set */
+static gchar *
+_get_copy_filename (const gchar *root, const gchar *subdir, guint idx)
+{
+	if (subdir != NULL && idx % 2 != 0)
+		root = subdir;
+	return g_strdup_printf ("%s/profile-%03u.icc", root, idx);
+}
+
+/* copies of two different profiles, so only two should be added */
+static void
+_copy_profiles (const gchar *root, const gchar *subdir, guint n_copies)
+{
+	guint i;
+	g_autofree gchar *filename1 = cd_test_get_filename ("ibm-t61.icc");
+	g_autofree gchar *filename2 = cd_test_get_filename ("crayons.icc");
+
+	for (i = 0; i < n_copies; i++) {
+		g_autofree gchar *dest = _get_copy_filename (root, subdir, i);
+		_copy_files (i % 2 == 0 ? filename1 : filename2, dest);
+	}
+}
+
+static void
+_remove_profiles (const gchar *root, const gchar *subdir, guint n_copies)
+{
+	guint i;
+
+	for (i = 0; i < n_copies; i++) {
+		g_autofree gchar *dest = _get_copy_filename (root, subdir, i);
+		g_assert_cmpint (g_unlink (dest), ==, 0);
+	}
+}
+
+static void
+colord_icc_store_added_cb (CdIccStore *store, CdIcc *icc, guint *cnt)
+{
+	g_debug ("Got ::added(%s)", cd_icc_get_checksum (icc));
+	(*cnt)++;
+	cd_test_loop_quit ();
+}
+
+static void
+colord_icc_store_removed_cb (CdIccStore *store, CdIcc *icc, guint *cnt)
+{
+	g_debug ("Got ::removed(%s)", cd_icc_get_checksum (icc));
+	(*cnt)++;
+	cd_test_loop_quit ();
+}
+
+static void
+colord_icc_header_only_func (void)
+{
+	const gchar *profiles[] = { "ibm-t61.icc", "crayons.icc", NULL };
+	guint i;
+	guint j;
+
+	for (i = 0; profiles[i] != NULL; i++) {
+		GHashTable *md_full;
+		GHashTable *md_hdr;
+		gboolean ret;
+		g_autofree gchar *filename = NULL;
+		g_autoptr(CdIcc) icc_full = cd_icc_new ();
+		g_autoptr(CdIcc) icc_hdr = cd_icc_new ();
+		g_autoptr(GDateTime) created_full = NULL;
+		g_autoptr(GDateTime) created_hdr = NULL;
+		g_autoptr(GError) error = NULL;
+		g_autoptr(GFile) file = NULL;
+		g_auto(GStrv) tags_full = NULL;
+		g_auto(GStrv) tags_hdr = NULL;
+
+		filename = cd_test_get_filename (profiles[i]);
+		file = g_file_new_for_path (filename);
+		ret = cd_icc_load_file (icc_full, file,
+					CD_ICC_LOAD_FLAGS_METADATA |
+					CD_ICC_LOAD_FLAGS_FALLBACK_MD5,
+					NULL, &error);
+		g_assert_no_error (error);
+		g_assert (ret);
+		ret = cd_icc_load_file (icc_hdr, file,
+					CD_ICC_LOAD_FLAGS_METADATA |
+					CD_ICC_LOAD_FLAGS_FALLBACK_MD5 |
+					CD_ICC_LOAD_FLAGS_HEADER_ONLY,
+					NULL, &error);
+		g_assert_no_error (error);
+		g_assert (ret);
+
+		/* everything the daemon needs comes from the header */
+		g_assert_cmpint (cd_icc_get_kind (icc_hdr), ==, cd_icc_get_kind (icc_full));
+		g_assert_cmpint (cd_icc_get_colorspace (icc_hdr), ==, cd_icc_get_colorspace (icc_full));
+		g_assert_cmpfloat (cd_icc_get_version (icc_hdr), ==, cd_icc_get_version (icc_full));
+		g_assert_cmpstr (cd_icc_get_checksum (icc_hdr), ==, cd_icc_get_checksum (icc_full));
+		g_assert_cmpstr (cd_icc_get_description (icc_hdr, NULL, NULL), ==,
+				 cd_icc_get_description (icc_full, NULL, NULL));
+		created_full = cd_icc_get_created (icc_full);
+		created_hdr = cd_icc_get_created (icc_hdr);
+		g_assert (created_hdr != NULL);
+		g_assert_cmpint (g_date_time_to_unix (created_hdr), ==,
+				 g_date_time_to_unix (created_full));
+		md_full = cd_icc_get_metadata (icc_full);
+		md_hdr = cd_icc_get_metadata (icc_hdr);
+		g_assert_cmpint (g_hash_table_size (md_hdr), ==, g_hash_table_size (md_full));
+		g_assert_cmpstr (cd_icc_get_metadata_item (icc_hdr, "DATA_source"), ==,
+				 cd_icc_get_metadata_item (icc_full, "DATA_source"));
+		g_hash_table_unref (md_full);
+		g_hash_table_unref (md_hdr);
+		tags_full = cd_icc_get_tags (icc_full, &error);
+		g_assert_no_error (error);
+		tags_hdr = cd_icc_get_tags (icc_hdr, &error);
+		g_assert_no_error (error);
+		g_assert_cmpint (g_strv_length (tags_hdr), ==, g_strv_length (tags_full));
+		for (j = 0; tags_full[j] != NULL; j++)
+			g_assert_cmpstr (tags_hdr[j], ==, tags_full[j]);
+
+		/* the lcms profile is opened on demand */
+		g_assert (cd_icc_get_handle (icc_hdr) != NULL);
+		g_assert_cmpstr (cd_icc_get_copyright (icc_hdr, NULL, NULL), ==,
+				 cd_icc_get_copyright (icc_full, NULL, NULL));
+	}
+}
+
+static void
+colord_icc_header_only_invalid_func (void)
+{
+	gboolean ret;
+	gsize data_len = 0;
+	g_autofree gchar *data = NULL;
+	g_autofree gchar *filename = NULL;
+	g_autoptr(CdIcc) icc = cd_icc_new ();
+	g_autoptr(GError) error = NULL;
+
+	/* a tag count lcms would refuse has to fail at load time */
+	filename = cd_test_get_filename ("ibm-t61.icc");
+	ret = g_file_get_contents (filename, &data, &data_len, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	data[128] = (gchar) 0xff;
+	ret = cd_icc_load_data (icc, (const guint8 *) data, data_len,
+				CD_ICC_LOAD_FLAGS_HEADER_ONLY, &error);
+	g_assert_error (error, CD_ICC_ERROR, CD_ICC_ERROR_FAILED_TO_PARSE);
+	g_assert (!ret);
+}
+
+static void
+colord_icc_named_colors_func (void)
+{
+	cmsHPROFILE lcms_profile;
+	cmsNAMEDCOLORLIST *nc2;
+	cmsUInt32Number data_len = 0;
+	gboolean ret;
+	guint i;
+	g_autofree guint8 *data = NULL;
+	g_autoptr(CdColorSwatch) swatch = NULL;
+	g_autoptr(CdIcc) icc = cd_icc_new ();
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GPtrArray) array = NULL;
+
+	/* create a named color profile with a grid of swatches */
+	lcms_profile = cmsCreateLab4Profile (NULL);
+	cmsSetDeviceClass (lcms_profile, cmsSigNamedColorClass);
+	nc2 = cmsAllocNamedColorList (NULL, 1000, 0, "CD", "C");
+	for (i = 0; i < 1000; i++) {
+		cmsCIELab lab;
+		cmsUInt16Number pcs[3];
+		g_autofree gchar *name = g_strdup_printf ("%u", i);
+
+		lab.L = (i / 100) * 10.f;
+		lab.a = ((i / 10) % 10) * 20.f - 100.f;
+		lab.b = (i % 10) * 20.f - 100.f;
+		cmsFloat2LabEncoded (pcs, &lab);
+		g_assert (cmsAppendNamedColor (nc2, name, pcs, NULL));
+	}
+	g_assert (cmsWriteTag (lcms_profile, cmsSigNamedColor2Tag, nc2));
+	cmsFreeNamedColorList (nc2);
+	g_assert (cmsSaveProfileToMem (lcms_profile, NULL, &data_len));
+	data = g_malloc (data_len);
+	g_assert (cmsSaveProfileToMem (lcms_profile, data, &data_len));
+	cmsCloseProfile (lcms_profile);
+
+	/* load it */
+	ret = cd_icc_load_data (icc, data, data_len,
+				CD_ICC_LOAD_FLAGS_NAMED_COLORS, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	array = cd_icc_get_named_colors (icc);
+	g_assert_cmpint (array->len, ==, 1000);
+	g_assert_cmpstr (cd_color_swatch_get_name (g_ptr_array_index (array, 42)), ==, "CD 42 C");
+
+	/* find by name */
+	swatch = cd_icc_find_named_color (icc, "CD 123 C");
+	g_assert (swatch != NULL);
+	g_assert_cmpstr (cd_color_swatch_get_name (swatch), ==, "CD 123 C");
+	g_assert_cmpfloat (ABS (cd_color_swatch_get_value (swatch)->L - 10.f), <, 0.01);
+	g_assert_cmpfloat (ABS (cd_color_swatch_get_value (swatch)->a - -60.f), <, 0.01);
+	g_clear_pointer (&swatch, cd_color_swatch_free);
+	g_assert (cd_icc_find_named_color (icc, "CD 1000 C") == NULL);
+
+	/* find the closest, comparing against a linear scan */
+	for (i = 0; i < 200; i++) {
+		CdColorLab lab;
+		gdouble best_dist = G_MAXDOUBLE;
+		guint j;
+		const gchar *best_name = NULL;
+
+		lab.L = g_random_double_range (0.f, 100.f);
+		lab.a = g_random_double_range (-110.f, 110.f);
+		lab.b = g_random_double_range (-110.f, 110.f);
+		for (j = 0; j < array->len; j++) {
+			CdColorSwatch *tmp = g_ptr_array_index (array, j);
+			const CdColorLab *val = cd_color_swatch_get_value (tmp);
+			gdouble dist = (lab.L - val->L) * (lab.L - val->L) +
+				       (lab.a - val->a) * (lab.a - val->a) +
+				       (lab.b - val->b) * (lab.b - val->b);
+			if (dist < best_dist) {
+				best_dist = dist;
+				best_name = cd_color_swatch_get_name (tmp);
+			}
+		}
+		swatch = cd_icc_find_nearest_named_color (icc, &lab);
+		g_assert (swatch != NULL);
+		g_assert_cmpstr (cd_color_swatch_get_name (swatch), ==, best_name);
+		g_clear_pointer (&swatch, cd_color_swatch_free);
+	}
+}
+
+static void
+colord_icc_vcgt_flat_func (void)
+{
+	gboolean ret;
+	guint i;
+	g_autofree gchar *filename = NULL;
+	g_autofree gfloat *ramps_float = NULL;
+	g_autofree gfloat *response_float = NULL;
+	g_autofree guint16 *ramps_u16 = NULL;
+	g_autoptr(CdIcc) icc = cd_icc_new ();
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GFile) file = NULL;
+	g_autoptr(GPtrArray) array = NULL;
+	g_autoptr(GPtrArray) response = NULL;
+
+	filename = cd_test_get_filename ("ibm-t61.icc");
+	file = g_file_new_for_path (filename);
+	ret = cd_icc_load_file (icc, file, CD_ICC_LOAD_FLAGS_NONE, NULL, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+
+	/* the flat buffers match the swatch arrays */
+	array = cd_icc_get_vcgt (icc, 256, &error);
+	g_assert_no_error (error);
+	g_assert (array != NULL);
+	ramps_float = g_new (gfloat, 256 * 3);
+	ret = cd_icc_get_vcgt_float (icc, 256, ramps_float, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	ramps_u16 = g_new (guint16, 256 * 3);
+	ret = cd_icc_get_vcgt_u16 (icc, 256, ramps_u16, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	for (i = 0; i < 256; i++) {
+		CdColorRGB *rgb = g_ptr_array_index (array, i);
+		g_assert_cmpfloat (ABS (ramps_float[i] - rgb->R), <, 0.0001);
+		g_assert_cmpfloat (ABS (ramps_float[256 + i] - rgb->G), <, 0.0001);
+		g_assert_cmpfloat (ABS (ramps_float[512 + i] - rgb->B), <, 0.0001);
+		g_assert_cmpfloat (ABS (ramps_u16[i] / 65535.f - rgb->R), <, 0.001);
+		g_assert_cmpfloat (ABS (ramps_u16[256 + i] / 65535.f - rgb->G), <, 0.001);
+		g_assert_cmpfloat (ABS (ramps_u16[512 + i] / 65535.f - rgb->B), <, 0.001);
+	}
+
+	/* same for the response */
+	response = cd_icc_get_response (icc, 32, &error);
+	g_assert_no_error (error);
+	g_assert (response != NULL);
+	response_float = g_new (gfloat, 32 * 3);
+	ret = cd_icc_get_response_float (icc, 32, response_float, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	for (i = 0; i < 32; i++) {
+		CdColorRGB *rgb = g_ptr_array_index (response, i);
+		g_assert_cmpfloat (ABS (response_float[i] - rgb->R), <, 0.0001);
+		g_assert_cmpfloat (ABS (response_float[32 + i] - rgb->G), <, 0.0001);
+		g_assert_cmpfloat (ABS (response_float[64 + i] - rgb->B), <, 0.0001);
+	}
+}
+
+static void
+colord_icc_save_fd_func (void)
+{
+	gboolean ret;
+	gint fd;
+	gsize len = 0;
+	g_autofree gchar *data_fd = NULL;
+	g_autofree gchar *filename = NULL;
+	g_autofree gchar *filename_tmp = NULL;
+	g_autoptr(CdIcc) icc = cd_icc_new ();
+	g_autoptr(GBytes) data = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GFile) file = NULL;
+
+	filename = cd_test_get_filename ("ibm-t61.icc");
+	file = g_file_new_for_path (filename);
+	ret = cd_icc_load_file (icc, file, CD_ICC_LOAD_FLAGS_ALL, NULL, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+
+	/* stream to a file, leaving the offset at the end */
+	fd = g_file_open_tmp ("colord-XXXXXX.icc", &filename_tmp, &error);
+	g_assert_no_error (error);
+	g_assert_cmpint (fd, >=, 0);
+	ret = cd_icc_save_fd (icc, fd, CD_ICC_SAVE_FLAGS_NONE, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	data = cd_icc_save_data (icc, CD_ICC_SAVE_FLAGS_NONE, &error);
+	g_assert_no_error (error);
+	g_assert (data != NULL);
+	g_assert_cmpint (lseek (fd, 0, SEEK_CUR), ==, g_bytes_get_size (data));
+	ret = g_close (fd, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+
+	/* this is the same as the data that was built in memory */
+	ret = g_file_get_contents (filename_tmp, &data_fd, &len, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert_cmpint (len, ==, g_bytes_get_size (data));
+	g_assert (memcmp (data_fd, g_bytes_get_data (data, NULL), len) == 0);
+	g_unlink (filename_tmp);
+}
+
+static void
+colord_icc_warnings_func (void)
+{
+	gboolean ret;
+	guint i;
+	g_autofree gchar *filename = NULL;
+	g_autoptr(CdIcc) icc = cd_icc_new ();
+	g_autoptr(GArray) warnings1 = NULL;
+	g_autoptr(GArray) warnings2 = NULL;
+	g_autoptr(GArray) warnings3 = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GFile) file = NULL;
+	g_autoptr(GPtrArray) vcgt = NULL;
+
+	filename = cd_test_get_filename ("ibm-t61.icc");
+	file = g_file_new_for_path (filename);
+	ret = cd_icc_load_file (icc, file, CD_ICC_LOAD_FLAGS_FALLBACK_MD5, NULL, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+
+	/* the cached result is returned as a new container */
+	warnings1 = cd_icc_get_warnings (icc);
+	g_assert_cmpint (warnings1->len, ==, 0);
+	warnings2 = cd_icc_get_warnings (icc);
+	g_assert (warnings1 != warnings2);
+	g_assert_cmpint (warnings2->len, ==, 0);
+
+	/* modifying the profile invalidates the cache */
+	vcgt = cd_color_rgb_array_new ();
+	for (i = 0; i < 32; i++) {
+		gdouble val = 1.f - (gdouble) i / 31.f;
+		CdColorRGB *rgb = cd_color_rgb_new ();
+		cd_color_rgb_set (rgb, val, val, val);
+		g_ptr_array_add (vcgt, rgb);
+	}
+	ret = cd_icc_set_vcgt (icc, vcgt, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	warnings3 = cd_icc_get_warnings (icc);
+	g_assert_cmpint (warnings3->len, ==, 1);
+	g_assert_cmpint (g_array_index (warnings3, CdProfileWarning, 0), ==,
+			 CD_PROFILE_WARNING_VCGT_NON_MONOTONIC);
+}
+
+static void
+colord_icc_store_func (void)
+{
+	CdIccStore *store;
+	CdIcc *icc;
+	gboolean ret;
+	gchar *file1;
+	gchar *file1_dup;
+	gchar *file2;
+	gchar *filename1;
+	gchar *filename2;
+	gchar *newroot;
+	gchar *root;
+	g_autoptr(GError) error = NULL;
+	GPtrArray *array;
+	guint added = 0;
+	guint removed = 0;
+
+	store = cd_icc_store_new ();
+	g_signal_connect (store, "added",
+			  G_CALLBACK (colord_icc_store_added_cb),
+			  &added);
+	g_signal_connect (store, "removed",
+			  G_CALLBACK (colord_icc_store_removed_cb),
+			  &removed);
+	cd_icc_store_set_load_flags (store, CD_ICC_LOAD_FLAGS_NONE);
+
+	filename1 = cd_test_get_filename ("ibm-t61.icc");
+	g_assert (filename1 != NULL);
+	filename2 = cd_test_get_filename ("crayons.icc");
+	g_assert (filename2 != NULL);
+
+	/* create test directory */
+	root = g_dir_make_tmp("colord-XXXXXX", &error);
+	g_assert_no_error (error);
+	g_assert (root != NULL);
+
+	file1 = g_build_filename (root, "already-exists.icc", NULL);
+	_copy_files (filename1, file1);
+
+	g_assert_cmpint (added, ==, 0);
+	g_assert_cmpint (removed, ==, 0);
+
+	/* this is done sync */
+	ret = cd_icc_store_search_location (store, root,
+					    CD_ICC_STORE_SEARCH_FLAGS_CREATE_LOCATION,
+					    NULL, &error);
+	g_assert (ret);
+	g_assert_no_error (error);
+
+	g_assert_cmpint (added, ==, 1);
+	g_assert_cmpint (removed, ==, 0);
+
+	/* find an icc by filename */
+	icc = cd_icc_store_find_by_filename (store, file1);
 	g_assert (icc != NULL);
 	g_assert_cmpstr (cd_icc_get_checksum (icc), ==, "9ace8cce8baac8d492a93a2a232d7702");
 	g_object_unref (icc);
@@ -2148,6 +3305,403 @@ colord_icc_store_func (void)
 	g_object_unref (store);
 }
 
+static void
+colord_icc_store_scan_func (void)
+{
+	const guint n_copies = 100;
+	gboolean ret;
+	gdouble elapsed;
+	struct rusage usage;
+	g_autofree gchar *root = NULL;
+	g_autofree gchar *tmp = NULL;
+	g_autofree gchar *tmp_copy = NULL;
+	g_autoptr(CdIcc) icc = cd_icc_new ();
+	g_autoptr(CdIcc) icc_copy = cd_icc_new ();
+	g_autoptr(CdIccStore) store = cd_icc_store_new ();
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GFile) file = NULL;
+	g_autoptr(GFile) file_copy = NULL;
+	g_autoptr(GPtrArray) array = NULL;
+	g_autoptr(GTimer) timer = NULL;
+
+	root = _make_tmpdir ();
+	_copy_profiles (root, NULL, n_copies);
+
+	/* time how long it takes to load a directory of profiles */
+	timer = g_timer_new ();
+	cd_icc_store_set_load_flags (store, CD_ICC_LOAD_FLAGS_NONE);
+	ret = cd_icc_store_search_location (store, root,
+					    CD_ICC_STORE_SEARCH_FLAGS_NONE,
+					    NULL, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	elapsed = g_timer_elapsed (timer, NULL);
+	array = cd_icc_store_get_all (store);
+	g_assert_cmpint (array->len, ==, 2);
+	getrusage (RUSAGE_SELF, &usage);
+	g_test_message ("scanned %u profiles in %.1fms, max RSS %likB",
+			n_copies, elapsed * 1000, usage.ru_maxrss);
+
+	/* the mapping is kept alive after the file is deleted */
+	tmp = g_strdup_printf ("%s/profile-000.icc", root);
+	file = g_file_new_for_path (tmp);
+	ret = cd_icc_load_file (icc, file,
+				CD_ICC_LOAD_FLAGS_FALLBACK_MD5 |
+				CD_ICC_LOAD_FLAGS_MAPPED,
+				NULL, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+
+	/* without a mapping the file can be truncated under the profile */
+	tmp_copy = g_strdup_printf ("%s/profile-002.icc", root);
+	file_copy = g_file_new_for_path (tmp_copy);
+	ret = cd_icc_load_file (icc_copy, file_copy, CD_ICC_LOAD_FLAGS_HEADER_ONLY, NULL, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert_cmpint (truncate (tmp_copy, 0), ==, 0);
+	g_assert (cmsReadTag (cd_icc_get_handle (icc_copy), cmsSigMediaWhitePointTag) != NULL);
+	_remove_profiles (root, NULL, n_copies);
+	g_assert_cmpint (g_rmdir (root), ==, 0);
+	g_assert (cmsReadTag (cd_icc_get_handle (icc), cmsSigMediaWhitePointTag) != NULL);
+	g_assert_cmpstr (cd_icc_get_checksum (icc), ==, "9ace8cce8baac8d492a93a2a232d7702");
+}
+
+static void
+colord_icc_store_search_async_cb (GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	gboolean *done = (gboolean *) user_data;
+	gboolean ret;
+	g_autoptr(GError) error = NULL;
+
+	ret = cd_icc_store_search_location_finish (CD_ICC_STORE (source), res, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	*done = TRUE;
+	cd_test_loop_quit ();
+}
+
+static void
+colord_icc_store_search_async_func (void)
+{
+	const guint n_copies = 100;
+	gboolean done = FALSE;
+	guint added = 0;
+	guint i;
+	g_autofree gchar *root = NULL;
+	g_autofree gchar *subdir = NULL;
+	g_autoptr(CdIccStore) store = cd_icc_store_new ();
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GPtrArray) array = NULL;
+
+	root = _make_tmpdir ();
+	subdir = g_build_filename (root, "vendor", NULL);
+	g_assert_cmpint (g_mkdir (subdir, 0700), ==, 0);
+	_copy_profiles (root, subdir, n_copies);
+
+	/* nothing is added until the main context runs */
+	g_signal_connect (store, "added",
+			  G_CALLBACK (colord_icc_store_added_cb),
+			  &added);
+	cd_icc_store_set_load_flags (store, CD_ICC_LOAD_FLAGS_NONE);
+	cd_icc_store_search_location_async (store, root,
+					    CD_ICC_STORE_SEARCH_FLAGS_NONE,
+					    NULL,
+					    colord_icc_store_search_async_cb,
+					    &done);
+	g_assert_cmpint (added, ==, 0);
+	for (i = 0; !done && i < 10; i++)
+		cd_test_loop_run_with_timeout (5000);
+	g_assert (done);
+	g_assert_cmpint (added, ==, 2);
+	array = cd_icc_store_get_all (store);
+	g_assert_cmpint (array->len, ==, 2);
+
+	/* both profiles can be found, but none of the duplicates */
+	for (i = 0; i < array->len; i++) {
+		CdIcc *tmp = g_ptr_array_index (array, i);
+		g_autoptr(CdIcc) icc_checksum = NULL;
+		g_autoptr(CdIcc) icc_filename = NULL;
+		icc_checksum = cd_icc_store_find_by_checksum (store, cd_icc_get_checksum (tmp));
+		g_assert (icc_checksum == tmp);
+		icc_filename = cd_icc_store_find_by_filename (store, cd_icc_get_filename (tmp));
+		g_assert (icc_filename == tmp);
+	}
+	for (i = 0; i < n_copies; i++) {
+		g_autofree gchar *dest = NULL;
+		g_autoptr(CdIcc) icc = NULL;
+		dest = _get_copy_filename (root, subdir, i);
+		icc = cd_icc_store_find_by_filename (store, dest);
+		if (icc != NULL)
+			added--;
+	}
+	g_assert_cmpint (added, ==, 0);
+
+	_remove_profiles (root, subdir, n_copies);
+	g_assert_cmpint (g_rmdir (subdir), ==, 0);
+	g_assert_cmpint (g_rmdir (root), ==, 0);
+}
+
+static void
+colord_icc_store_index_func (void)
+{
+	const struct utimbuf times_old = { 1500000000, 1500000000 };
+	const struct utimbuf times_new = { 1600000000, 1600000000 };
+	gboolean ret;
+	gint fd;
+	gsize len = 0;
+	g_autofree gchar *checksum = NULL;
+	g_autofree gchar *data = NULL;
+	g_autofree gchar *description = NULL;
+	g_autofree gchar *dest = NULL;
+	g_autofree gchar *filename = NULL;
+	g_autofree gchar *index = NULL;
+	g_autofree gchar *root = NULL;
+	g_autoptr(CdIcc) icc = NULL;
+	g_autoptr(CdIccStore) store = NULL;
+	g_autoptr(GBytes) tag = NULL;
+	g_autoptr(GError) error = NULL;
+
+	filename = cd_test_get_filename ("ibm-t61.icc");
+	root = _make_tmpdir ();
+	dest = g_build_filename (root, "profile.icc", NULL);
+	index = g_build_filename (root, "index.gvariant", NULL);
+	_copy_files (filename, dest);
+	g_assert_cmpint (g_utime (dest, (struct utimbuf *) &times_old), ==, 0);
+
+	/* the first search parses the profile and writes the index */
+	store = cd_icc_store_new ();
+	cd_icc_store_set_index_filename (store, index);
+	ret = cd_icc_store_search_location (store, root,
+					    CD_ICC_STORE_SEARCH_FLAGS_NONE,
+					    NULL, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert (g_file_test (index, G_FILE_TEST_EXISTS));
+	icc = cd_icc_store_find_by_filename (store, dest);
+	g_assert (icc != NULL);
+	checksum = g_strdup (cd_icc_get_checksum (icc));
+	description = g_strdup (cd_icc_get_description (icc, NULL, &error));
+	g_assert_no_error (error);
+	g_assert (description != NULL);
+	g_clear_object (&icc);
+	g_clear_object (&store);
+
+	/* overwrite the profile in place keeping the size and mtime, so
+	 * that it can only be added if the file is not opened */
+	ret = g_file_get_contents (dest, &data, &len, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	memset (data, 0, len);
+	fd = g_open (dest, O_WRONLY, 0);
+	g_assert_cmpint (fd, >=, 0);
+	g_assert_cmpint (write (fd, data, len), ==, (gssize) len);
+	g_assert_cmpint (close (fd), ==, 0);
+	g_assert_cmpint (g_utime (dest, (struct utimbuf *) &times_old), ==, 0);
+
+	/* the second search uses the index */
+	store = cd_icc_store_new ();
+	cd_icc_store_set_index_filename (store, index);
+	ret = cd_icc_store_search_location (store, root,
+					    CD_ICC_STORE_SEARCH_FLAGS_NONE,
+					    NULL, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	icc = cd_icc_store_find_by_filename (store, dest);
+	g_assert (icc != NULL);
+	g_assert_cmpstr (cd_icc_get_checksum (icc), ==, checksum);
+	g_assert_cmpstr (cd_icc_get_description (icc, NULL, NULL), ==, description);
+	g_assert_cmpint (cd_icc_get_size (icc), ==, len);
+	g_assert_cmpint (cd_icc_get_kind (icc), ==, CD_PROFILE_KIND_DISPLAY_DEVICE);
+	g_assert_cmpint (cd_icc_get_colorspace (icc), ==, CD_COLORSPACE_RGB);
+
+	/* the file is not read if it has changed since being added */
+	g_assert_cmpint (g_utime (dest, (struct utimbuf *) &times_new), ==, 0);
+	tag = cd_icc_get_tag_data (icc, "desc", &error);
+	g_assert_error (error, CD_ICC_ERROR, CD_ICC_ERROR_FAILED_TO_OPEN);
+	g_assert (tag == NULL);
+	g_clear_error (&error);
+	g_clear_object (&icc);
+	g_clear_object (&store);
+
+	/* a changed mtime means the file is parsed again */
+	g_assert_cmpint (g_utime (dest, (struct utimbuf *) &times_new), ==, 0);
+	store = cd_icc_store_new ();
+	cd_icc_store_set_index_filename (store, index);
+	ret = cd_icc_store_search_location (store, root,
+					    CD_ICC_STORE_SEARCH_FLAGS_NONE,
+					    NULL, &error);
+	g_assert (error != NULL);
+	g_assert (!ret);
+	g_clear_error (&error);
+	g_clear_object (&store);
+
+	g_assert_cmpint (g_unlink (dest), ==, 0);
+	g_assert_cmpint (g_unlink (index), ==, 0);
+	g_assert_cmpint (g_rmdir (root), ==, 0);
+}
+
+static void
+colord_icc_store_signature_func (void)
+{
+	gboolean ret;
+	g_autofree gchar *filename = NULL;
+	g_autofree gchar *fake = NULL;
+	g_autofree gchar *profile = NULL;
+	g_autofree gchar *root = NULL;
+	g_autoptr(CdIcc) icc = NULL;
+	g_autoptr(CdIccStore) store = cd_icc_store_new ();
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GPtrArray) array = NULL;
+	g_autoptr(GString) str = g_string_new (NULL);
+
+	root = _make_tmpdir ();
+
+	/* a profile with an extension the MIME database does not know */
+	filename = cd_test_get_filename ("ibm-t61.icc");
+	profile = g_build_filename (root, "display.dat", NULL);
+	_copy_files (filename, profile);
+
+	/* something that is not a profile, whatever the extension */
+	while (str->len < 256)
+		g_string_append (str, "not a profile ");
+	fake = g_build_filename (root, "fake.icc", NULL);
+	ret = g_file_set_contents (fake, str->str, str->len, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+
+	cd_icc_store_set_load_flags (store, CD_ICC_LOAD_FLAGS_NONE);
+	ret = cd_icc_store_search_location (store, root,
+					    CD_ICC_STORE_SEARCH_FLAGS_NONE,
+					    NULL, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	array = cd_icc_store_get_all (store);
+	g_assert_cmpint (array->len, ==, 1);
+	icc = cd_icc_store_find_by_filename (store, profile);
+	g_assert (icc != NULL);
+
+	g_assert_cmpint (g_unlink (profile), ==, 0);
+	g_assert_cmpint (g_unlink (fake), ==, 0);
+	g_assert_cmpint (g_rmdir (root), ==, 0);
+}
+
+static void
+colord_icc_store_changed_cb (CdIccStore *store, guint *cnt)
+{
+	(*cnt)++;
+	cd_test_loop_quit ();
+}
+
+static void
+colord_icc_store_count_cb (CdIccStore *store, CdIcc *icc, guint *cnt)
+{
+	(*cnt)++;
+}
+
+static void
+colord_icc_store_monitor_batch_func (void)
+{
+	const guint n_copies = 20;
+	gboolean ret;
+	guint added = 0;
+	guint changed = 0;
+	guint removed = 0;
+	g_autofree gchar *root = NULL;
+	g_autoptr(CdIccStore) store = cd_icc_store_new ();
+	g_autoptr(GError) error = NULL;
+
+	root = _make_tmpdir ();
+	g_signal_connect (store, "added",
+			  G_CALLBACK (colord_icc_store_count_cb),
+			  &added);
+	g_signal_connect (store, "removed",
+			  G_CALLBACK (colord_icc_store_count_cb),
+			  &removed);
+	g_signal_connect (store, "changed",
+			  G_CALLBACK (colord_icc_store_changed_cb),
+			  &changed);
+	cd_icc_store_set_load_flags (store, CD_ICC_LOAD_FLAGS_NONE);
+	cd_icc_store_set_monitor_delay (store, 500);
+	ret = cd_icc_store_search_location (store, root,
+					    CD_ICC_STORE_SEARCH_FLAGS_NONE,
+					    NULL, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+
+	/* lots of files arriving at once are processed together */
+	_copy_profiles (root, NULL, n_copies);
+	cd_test_loop_run_with_timeout (5000);
+	g_assert_cmpint (changed, ==, 1);
+	g_assert_cmpint (added, ==, 2);
+	g_assert_cmpint (removed, ==, 0);
+
+	/* and so are lots of files being deleted */
+	_remove_profiles (root, NULL, n_copies);
+	cd_test_loop_run_with_timeout (5000);
+	g_assert_cmpint (changed, ==, 2);
+	g_assert_cmpint (removed, ==, 2);
+	g_assert_cmpint (g_rmdir (root), ==, 0);
+}
+
+static void
+colord_icc_fast_checksum_func (void)
+{
+	CdHash hash;
+	const gchar *str = "The quick brown fox jumps over the lazy dog";
+	gboolean ret;
+	gchar *data = NULL;
+	gsize len = 0;
+	guint i;
+	g_autofree gchar *checksum = NULL;
+	g_autofree gchar *filename = NULL;
+	g_autofree gchar *tmp = NULL;
+	g_autoptr(CdIcc) icc = NULL;
+	g_autoptr(GError) error = NULL;
+
+	/* reference XXH64 values */
+	tmp = cd_hash_compute_for_data ((const guint8 *) "", 0);
+	g_assert_cmpstr (tmp, ==, "ef46db3751d8e999");
+	g_clear_pointer (&tmp, g_free);
+	tmp = cd_hash_compute_for_data ((const guint8 *) "abc", 3);
+	g_assert_cmpstr (tmp, ==, "44bc2cf5ad770999");
+	g_clear_pointer (&tmp, g_free);
+
+	/* feeding a byte at a time gives the same result */
+	cd_hash_init (&hash);
+	for (i = 0; str[i] != '\0'; i++)
+		cd_hash_update (&hash, (const guint8 *) str + i, 1);
+	tmp = cd_hash_to_string (cd_hash_finish (&hash));
+	checksum = cd_hash_compute_for_data ((const guint8 *) str, strlen (str));
+	g_assert_cmpstr (tmp, ==, checksum);
+	g_clear_pointer (&checksum, g_free);
+
+	/* only set when asked for */
+	filename = cd_test_get_filename ("ibm-t61.icc");
+	ret = g_file_get_contents (filename, &data, &len, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	icc = cd_icc_new ();
+	ret = cd_icc_load_data (icc, (const guint8 *) data, len,
+				CD_ICC_LOAD_FLAGS_NONE, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert_cmpstr (cd_icc_get_fast_checksum (icc), ==, NULL);
+	g_object_unref (icc);
+
+	/* matches the whole file */
+	icc = cd_icc_new ();
+	ret = cd_icc_load_data (icc, (const guint8 *) data, len,
+				CD_ICC_LOAD_FLAGS_FAST_CHECKSUM |
+				CD_ICC_LOAD_FLAGS_FALLBACK_MD5,
+				&error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	checksum = cd_hash_compute_for_data ((const guint8 *) data, len);
+	g_assert_cmpstr (cd_icc_get_fast_checksum (icc), ==, checksum);
+	g_assert (cd_icc_get_checksum (icc) != NULL);
+	g_free (data);
+}
+
 static void
 colord_icc_util_func (void)
 {
@@ -2181,6 +3735,67 @@ colord_icc_util_func (void)
 	g_object_unref (icc_measured);
 }
 
+static void
+colord_icc_util_coverage_func (void)
+{
+	gboolean ret;
+	gdouble coverage = 0;
+	gdouble coverage_cached = 0;
+	gdouble coverage_fast = 0;
+	g_autofree gchar *filename = NULL;
+	g_autoptr(CdIcc) icc = NULL;
+	g_autoptr(CdIcc) icc_default = NULL;
+	g_autoptr(CdIcc) icc_reference = NULL;
+	g_autoptr(GBytes) data = NULL;
+	g_autoptr(GError) error = NULL;
+	g_autoptr(GFile) file = NULL;
+
+	/* load a real display profile */
+	icc = cd_icc_new ();
+	filename = cd_test_get_filename ("ibm-t61.icc");
+	file = g_file_new_for_path (filename);
+	ret = cd_icc_load_file (icc, file, CD_ICC_LOAD_FLAGS_FALLBACK_MD5, NULL, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+
+	/* round-trip sRGB so that it has a checksum */
+	icc_default = cd_icc_new ();
+	ret = cd_icc_create_default (icc_default, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	data = cd_icc_save_data (icc_default, CD_ICC_SAVE_FLAGS_NONE, &error);
+	g_assert_no_error (error);
+	g_assert (data != NULL);
+	icc_reference = cd_icc_new ();
+	ret = cd_icc_load_data (icc_reference,
+				g_bytes_get_data (data, NULL),
+				g_bytes_get_size (data),
+				CD_ICC_LOAD_FLAGS_FALLBACK_MD5,
+				&error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert (cd_icc_get_checksum (icc_reference) != NULL);
+
+	/* full cube */
+	ret = cd_icc_utils_get_coverage (icc, icc_reference, &coverage, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert_cmpfloat (coverage, >, 0.0);
+
+	/* cached result is identical */
+	ret = cd_icc_utils_get_coverage (icc, icc_reference, &coverage_cached, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert_cmpfloat (coverage_cached, ==, coverage);
+
+	/* coarse lattice stays close */
+	ret = cd_icc_utils_get_coverage_full (icc, icc_reference, 0.01,
+					      &coverage_fast, &error);
+	g_assert_no_error (error);
+	g_assert (ret);
+	g_assert_cmpfloat (ABS (coverage_fast - coverage), <, 0.05);
+}
+
 static void
 colord_edid_func (void)
 {
@@ -2403,17 +4018,40 @@ main (int argc, char **argv)
 	g_test_add_func ("/colord/spectrum{cx}", colord_spect_cx_func);
 	g_test_add_func ("/colord/edid", colord_edid_func);
 	g_test_add_func ("/colord/transform", colord_transform_func);
+	g_test_add_func ("/colord/transform{pool}", colord_transform_pool_func);
+	g_test_add_func ("/colord/transform{native}", colord_transform_native_func);
+	g_test_add_func ("/colord/transform{formats}", colord_transform_formats_func);
+	g_test_add_func ("/colord/transform{cache}", colord_transform_cache_func);
+	g_test_add_func ("/colord/transform{devicelink}", colord_transform_devicelink_func);
+	g_test_add_func ("/colord/transform{async}", colord_transform_async_func);
+	g_test_add_func ("/colord/transform{planar}", colord_transform_planar_func);
+	g_test_add_func ("/colord/transform{cpu}", colord_transform_cpu_func);
+	g_test_add_func ("/colord/transform{stream}", colord_transform_stream_func);
 	g_test_add_func ("/colord/icc", colord_icc_func);
 	g_test_add_func ("/colord/icc{util}", colord_icc_util_func);
+	g_test_add_func ("/colord/icc{util-coverage}", colord_icc_util_coverage_func);
 	g_test_add_func ("/colord/icc{localized}", colord_icc_localized_func);
 	g_test_add_func ("/colord/icc{edid}", colord_icc_edid_func);
 	g_test_add_func ("/colord/icc{characterization}", colord_icc_characterization_func);
 	g_test_add_func ("/colord/icc{save}", colord_icc_save_func);
+	g_test_add_func ("/colord/icc{save-fd}", colord_icc_save_fd_func);
 	g_test_add_func ("/colord/icc{empty}", colord_icc_empty_func);
 	g_test_add_func ("/colord/icc{corrupt-dict}", colord_icc_corrupt_dict_func);
 	g_test_add_func ("/colord/icc{clear}", colord_icc_clear_func);
 	g_test_add_func ("/colord/icc{tags}", colord_icc_tags_func);
+	g_test_add_func ("/colord/icc{header-only}", colord_icc_header_only_func);
+	g_test_add_func ("/colord/icc{header-only-invalid}", colord_icc_header_only_invalid_func);
+	g_test_add_func ("/colord/icc{named-colors}", colord_icc_named_colors_func);
+	g_test_add_func ("/colord/icc{vcgt-flat}", colord_icc_vcgt_flat_func);
+	g_test_add_func ("/colord/icc{warnings}", colord_icc_warnings_func);
+	g_test_add_func ("/colord/icc{fast-checksum}", colord_icc_fast_checksum_func);
+	g_test_add_func ("/colord/icc{load-fd}", colord_icc_load_fd_func);
 	g_test_add_func ("/colord/icc-store", colord_icc_store_func);
+	g_test_add_func ("/colord/icc-store{scan}", colord_icc_store_scan_func);
+	g_test_add_func ("/colord/icc-store{search-async}", colord_icc_store_search_async_func);
+	g_test_add_func ("/colord/icc-store{index}", colord_icc_store_index_func);
+	g_test_add_func ("/colord/icc-store{signature}", colord_icc_store_signature_func);
+	g_test_add_func ("/colord/icc-store{monitor-batch}", colord_icc_store_monitor_batch_func);
 	g_test_add_func ("/colord/buffer", colord_buffer_func);
 	g_test_add_func ("/colord/enum", colord_enum_func);
 	g_test_add_func ("/colord/dom", colord_dom_func);
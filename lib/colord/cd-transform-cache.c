@@ -0,0 +1,420 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2026 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/**
+ * SECTION:cd-transform-cache
+ * @short_description: A process-wide cache of lcms transforms
+ *
+ * Creating a transform can take tens of milliseconds, so identical
+ * transforms are shared between all #CdTransform instances in the process.
+ * Each transform is built in its own lcms context without holding the cache
+ * lock, and its size is measured by the memory handler on that context.
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <lcms2.h>
+#include <lcms2_plugin.h>
+
+#include "cd-context-lcms.h"
+#include "cd-transform.h"
+#include "cd-transform-cache.h"
+
+/* used when cd_transform_cache_set_max_size() has not been called */
+#define CD_TRANSFORM_CACHE_MAX_SIZE_DEFAULT	(16 * 1024 * 1024)
+
+/* keeps the payload aligned for any type lcms stores */
+#define CD_TRANSFORM_CACHE_HEADER_SIZE		16
+
+/* the size and the counter it was added to are stored before the payload */
+typedef struct {
+	gsize			 size;
+	gsize			*allocated;
+} CdTransformCacheHeader;
+
+G_STATIC_ASSERT (sizeof (CdTransformCacheHeader) <= CD_TRANSFORM_CACHE_HEADER_SIZE);
+
+struct _CdTransformCacheItem {
+	guint			 refcount;	/* protected by the cache lock */
+	gchar			*key;
+	cmsContext		 context;
+	cmsHTRANSFORM		 handle;	/* %NULL while being built */
+	gboolean		 building;	/* protected by the cache lock */
+	gsize			 allocated;	/* live bytes in context */
+	gsize			 size;
+	GList			*link;		/* in lru, or %NULL if evicted */
+};
+
+static GMutex		 cache_mutex;
+static GCond		 cache_cond;		/* signalled when a build finishes */
+static GHashTable	*cache_hash = NULL;	/* key:item, including items being built */
+static GQueue		 cache_lru = G_QUEUE_INIT; /* most recently used first */
+static gsize		 cache_size = 0;
+static gsize		 cache_max_size = CD_TRANSFORM_CACHE_MAX_SIZE_DEFAULT;
+static guint64		 cache_hits = 0;
+static guint64		 cache_misses = 0;
+
+/* the counter of the transform being built by this thread, if any */
+static GPrivate		 cache_allocated;
+
+static void *
+cd_transform_cache_malloc_cb (cmsContext context_id, cmsUInt32Number size)
+{
+	CdTransformCacheHeader *hdr;
+	guint8 *ptr = g_try_malloc (size + CD_TRANSFORM_CACHE_HEADER_SIZE);
+	if (ptr == NULL)
+		return NULL;
+	hdr = (CdTransformCacheHeader *) ptr;
+	hdr->size = size;
+	hdr->allocated = g_private_get (&cache_allocated);
+	if (hdr->allocated != NULL)
+		g_atomic_pointer_add (hdr->allocated, (gssize) size);
+	return ptr + CD_TRANSFORM_CACHE_HEADER_SIZE;
+}
+
+static void
+cd_transform_cache_free_cb (cmsContext context_id, void *data)
+{
+	CdTransformCacheHeader *hdr;
+	if (data == NULL)
+		return;
+	hdr = (CdTransformCacheHeader *) ((guint8 *) data - CD_TRANSFORM_CACHE_HEADER_SIZE);
+	if (hdr->allocated != NULL)
+		g_atomic_pointer_add (hdr->allocated, -((gssize) hdr->size));
+	g_free (hdr);
+}
+
+static void *
+cd_transform_cache_realloc_cb (cmsContext context_id, void *data, cmsUInt32Number size)
+{
+	CdTransformCacheHeader *hdr;
+	gsize size_old;
+
+	if (data == NULL)
+		return cd_transform_cache_malloc_cb (context_id, size);
+	hdr = (CdTransformCacheHeader *) ((guint8 *) data - CD_TRANSFORM_CACHE_HEADER_SIZE);
+	size_old = hdr->size;
+	hdr = g_try_realloc (hdr, size + CD_TRANSFORM_CACHE_HEADER_SIZE);
+	if (hdr == NULL)
+		return NULL;
+	hdr->size = size;
+	if (hdr->allocated != NULL)
+		g_atomic_pointer_add (hdr->allocated, (gssize) size - (gssize) size_old);
+	return (guint8 *) hdr + CD_TRANSFORM_CACHE_HEADER_SIZE;
+}
+
+static cmsPluginMemHandler cd_transform_cache_mem_plugin = {
+	{ cmsPluginMagicNumber,			/* 'acpp' */
+	  2000,					/* minimum version */
+	  cmsPluginMemHandlerSig,		/* type */
+	  NULL },				/* no more plugins */
+	cd_transform_cache_malloc_cb,
+	cd_transform_cache_free_cb,
+	cd_transform_cache_realloc_cb,
+	NULL,					/* use malloc */
+	NULL,					/* use malloc */
+	NULL					/* use malloc */
+};
+
+/* must be called with the cache lock held */
+static void
+cd_transform_cache_item_unref_locked (CdTransformCacheItem *item)
+{
+	if (--item->refcount > 0)
+		return;
+	if (item->handle != NULL)
+		cmsDeleteTransform (item->handle);
+	cd_context_lcms_free (item->context);
+	g_free (item->key);
+	g_free (item);
+}
+
+/* must be called with the cache lock held */
+static void
+cd_transform_cache_evict_locked (CdTransformCacheItem *item)
+{
+	g_hash_table_remove (cache_hash, item->key);
+	g_queue_delete_link (&cache_lru, item->link);
+	item->link = NULL;
+	cache_size -= item->size;
+	cd_transform_cache_item_unref_locked (item);
+}
+
+/* must be called with the cache lock held */
+static void
+cd_transform_cache_trim_locked (gsize max_size)
+{
+	while (cache_size > max_size && cache_lru.tail != NULL)
+		cd_transform_cache_evict_locked (cache_lru.tail->data);
+}
+
+/* must be called with the cache lock held */
+static void
+cd_transform_cache_ensure_locked (void)
+{
+	if (cache_hash != NULL)
+		return;
+	cache_hash = g_hash_table_new (g_str_hash, g_str_equal);
+}
+
+/* called without the cache lock held, as this can take a long time */
+static gboolean
+cd_transform_cache_item_build (CdTransformCacheItem *item,
+			       cmsHPROFILE *profiles,
+			       guint nprofiles,
+			       CdPixelFormat format_in,
+			       CdPixelFormat format_out,
+			       gint lcms_intent,
+			       cmsUInt32Number lcms_flags,
+			       GError **error)
+{
+	item->context = cd_context_lcms_new_full (&cd_transform_cache_mem_plugin);
+	g_private_set (&cache_allocated, &item->allocated);
+	item->handle = cmsCreateMultiprofileTransformTHR (item->context,
+							  profiles,
+							  nprofiles,
+							  format_in,
+							  format_out,
+							  lcms_intent,
+							  lcms_flags);
+	g_private_set (&cache_allocated, NULL);
+	if (item->handle == NULL) {
+		if (cd_context_lcms_error_check (item->context, error)) {
+			g_set_error_literal (error,
+					     CD_TRANSFORM_ERROR,
+					     CD_TRANSFORM_ERROR_FAILED_TO_SETUP_TRANSFORM,
+					     "failed to setup transform, unspecified error");
+		}
+		return FALSE;
+	}
+	item->size = (gsize) g_atomic_pointer_get (&item->allocated);
+	return TRUE;
+}
+
+/**
+ * cd_transform_cache_lookup:
+ * @key: a string made from all the inputs to the transform
+ *
+ * Gets a shared transform from the cache, creating it if required.
+ * Only one thread builds the transform for each key, and any other
+ * thread asking for the same key waits for it to finish.
+ *
+ * Return value: (transfer full): a cache item, or %NULL for error
+ **/
+CdTransformCacheItem *
+cd_transform_cache_lookup (const gchar *key,
+			   cmsHPROFILE *profiles,
+			   guint nprofiles,
+			   CdPixelFormat format_in,
+			   CdPixelFormat format_out,
+			   gint lcms_intent,
+			   cmsUInt32Number lcms_flags,
+			   GError **error)
+{
+	CdTransformCacheItem *item;
+	gboolean ret;
+
+	g_mutex_lock (&cache_mutex);
+	cd_transform_cache_ensure_locked ();
+	for (;;) {
+		item = g_hash_table_lookup (cache_hash, key);
+		if (item == NULL)
+			break;
+
+		/* wait for another thread to finish building it */
+		if (item->building) {
+			item->refcount++;
+			while (item->building)
+				g_cond_wait (&cache_cond, &cache_mutex);
+			if (item->handle == NULL) {
+				/* failed, so try again to get the error */
+				cd_transform_cache_item_unref_locked (item);
+				continue;
+			}
+			item->refcount--;
+		}
+
+		/* move the existing transform to the front */
+		cache_hits++;
+		if (item->link != NULL) {
+			g_queue_unlink (&cache_lru, item->link);
+			g_queue_push_head_link (&cache_lru, item->link);
+		}
+		item->refcount++;
+		g_mutex_unlock (&cache_mutex);
+		return item;
+	}
+
+	/* other lookups for this key wait on the placeholder */
+	cache_misses++;
+	item = g_new0 (CdTransformCacheItem, 1);
+	item->refcount = 1;
+	item->key = g_strdup (key);
+	item->building = TRUE;
+	g_hash_table_insert (cache_hash, item->key, item);
+	g_mutex_unlock (&cache_mutex);
+
+	ret = cd_transform_cache_item_build (item, profiles, nprofiles,
+					     format_in, format_out,
+					     lcms_intent, lcms_flags,
+					     error);
+
+	g_mutex_lock (&cache_mutex);
+	item->building = FALSE;
+	g_cond_broadcast (&cache_cond);
+	if (!ret) {
+		g_hash_table_remove (cache_hash, item->key);
+		cd_transform_cache_item_unref_locked (item);
+		g_mutex_unlock (&cache_mutex);
+		return NULL;
+	}
+
+	/* the cache holds one reference and the caller the other */
+	item->refcount++;
+	g_queue_push_head (&cache_lru, item);
+	item->link = cache_lru.head;
+	cache_size += item->size;
+	g_debug ("added %s to transform cache using %" G_GSIZE_FORMAT " bytes",
+		 key, item->size);
+	cd_transform_cache_trim_locked (cache_max_size);
+	g_mutex_unlock (&cache_mutex);
+	return item;
+}
+
+/**
+ * cd_transform_cache_item_get_handle:
+ *
+ * Return value: the lcms transform, which can be used from any thread
+ **/
+cmsHTRANSFORM
+cd_transform_cache_item_get_handle (CdTransformCacheItem *item)
+{
+	return item->handle;
+}
+
+/**
+ * cd_transform_cache_item_unref:
+ **/
+void
+cd_transform_cache_item_unref (CdTransformCacheItem *item)
+{
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&cache_mutex);
+	cd_transform_cache_item_unref_locked (item);
+}
+
+/**
+ * cd_transform_cache_set_max_size:
+ * @max_size: the maximum size in bytes, or 0 to disable the cache
+ *
+ * Sets the maximum amount of memory used by the process-wide cache of
+ * transforms. Transforms that are still in use by a #CdTransform are only
+ * freed when the #CdTransform no longer needs them.
+ *
+ * Since: 1.4.9
+ **/
+void
+cd_transform_cache_set_max_size (gsize max_size)
+{
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&cache_mutex);
+	cache_max_size = max_size;
+	cd_transform_cache_trim_locked (cache_max_size);
+}
+
+/**
+ * cd_transform_cache_get_max_size:
+ *
+ * Gets the maximum amount of memory used by the transform cache.
+ *
+ * Return value: the size in bytes, where 0 means disabled
+ *
+ * Since: 1.4.9
+ **/
+gsize
+cd_transform_cache_get_max_size (void)
+{
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&cache_mutex);
+	return cache_max_size;
+}
+
+/**
+ * cd_transform_cache_get_size:
+ *
+ * Gets the amount of memory currently used by the transform cache.
+ *
+ * Return value: the size in bytes
+ *
+ * Since: 1.4.9
+ **/
+gsize
+cd_transform_cache_get_size (void)
+{
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&cache_mutex);
+	return cache_size;
+}
+
+/**
+ * cd_transform_cache_get_hits:
+ *
+ * Gets the number of times a transform was found in the cache.
+ *
+ * Return value: an integer
+ *
+ * Since: 1.4.9
+ **/
+guint64
+cd_transform_cache_get_hits (void)
+{
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&cache_mutex);
+	return cache_hits;
+}
+
+/**
+ * cd_transform_cache_get_misses:
+ *
+ * Gets the number of times a transform had to be created.
+ *
+ * Return value: an integer
+ *
+ * Since: 1.4.9
+ **/
+guint64
+cd_transform_cache_get_misses (void)
+{
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&cache_mutex);
+	return cache_misses;
+}
+
+/**
+ * cd_transform_cache_clear:
+ *
+ * Removes all the transforms from the cache and resets the counters.
+ *
+ * Since: 1.4.9
+ **/
+void
+cd_transform_cache_clear (void)
+{
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&cache_mutex);
+	cd_transform_cache_trim_locked (0);
+	cache_hits = 0;
+	cache_misses = 0;
+}
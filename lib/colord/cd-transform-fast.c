@@ -0,0 +1,696 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2013 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/*
+ * A native pipeline for matrix/TRC RGB to matrix/TRC RGB transforms.
+ *
+ * For 8 bit data this uses the same 1.14 fixed point arithmetic and tables as
+ * the lcms2 matrix-shaper optimization so the output is identical, but avoids
+ * the per-pixel formatter and pipeline dispatch, and evaluates the matrix on a
+ * block of pixels at a time using SSE2 or AVX2 where available.
+ *
+ * For 16 bit data the curves are interpolated from tables and the matrix is
+ * done in single precision float. The output curve is tabulated against the
+ * square root of the linear value so there is enough precision near black.
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <lcms2.h>
+#include <math.h>
+
+#include "cd-math.h"
+#include "cd-transform-fast.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CD_TRANSFORM_FAST_X86
+#include <immintrin.h>
+#endif
+
+/* number of pixels unpacked into the planar scratch buffers at once */
+#define CD_TRANSFORM_FAST_BLOCK		64
+
+/* size of the output shaper table, indexed by 1.14 fixed point values */
+#define CD_TRANSFORM_FAST_SHAPER2_SIZE	16385
+
+/* number of intervals in the interpolated 16 bit shaper tables */
+#define CD_TRANSFORM_FAST_SHAPER16_SIZE	4096
+
+typedef void (*CdTransformFastMatrixFunc)	(const CdTransformFast	*fast,
+						 gint16			*in[3],
+						 gint16			*out[3],
+						 guint			 n);
+typedef void (*CdTransformFastMatrixFloatFunc)	(const CdTransformFast	*fast,
+						 gfloat			*in[3],
+						 gfloat			*out[3],
+						 guint			 n);
+
+struct _CdTransformFast {
+	gint16				 shaper1[3][256];
+	guint8				 shaper2[3][CD_TRANSFORM_FAST_SHAPER2_SIZE];
+	gint32				 mat[3][3];
+	gfloat				 shaper1_16[3][CD_TRANSFORM_FAST_SHAPER16_SIZE + 1];
+	gfloat				 shaper2_16[3][CD_TRANSFORM_FAST_SHAPER16_SIZE + 1];
+	gfloat				 matf[3][3];
+	guint				 offsets_in[3];
+	guint				 offsets_out[3];
+	guint				 channels_in;
+	guint				 channels_out;
+	guint				 bytes;
+	CdTransformFastMatrixFunc	 matrix_func;
+	CdTransformFastMatrixFloatFunc	 matrix_float_func;
+};
+
+/* same rounding as DOUBLE_TO_1FIXED14() in lcms2 */
+static gint32
+cd_transform_fast_to_fixed14 (gdouble value)
+{
+	return (gint32) floor (value * 16384.0 + 0.5);
+}
+
+/* same rounding as _cmsQuickSaturateWord() then FROM_16_TO_8() in lcms2 */
+static guint8
+cd_transform_fast_to_byte (gdouble value)
+{
+	guint32 w;
+
+	value = value * 65535.0 + 0.5;
+	if (value <= 0)
+		w = 0;
+	else if (value >= 65535.0)
+		w = 0xffff;
+	else
+		w = (guint32) floor (value);
+	return (guint8) (((w * 65281U + 8388608U) >> 24) & 0xff);
+}
+
+static gboolean
+cd_transform_fast_get_layout (CdPixelFormat format,
+			      guint offsets[3],
+			      guint *channels,
+			      guint *bytes)
+{
+	switch (format) {
+	case CD_PIXEL_FORMAT_RGB24:
+	case CD_PIXEL_FORMAT_RGB48:
+		offsets[0] = 0;
+		offsets[1] = 1;
+		offsets[2] = 2;
+		*channels = 3;
+		break;
+	case CD_PIXEL_FORMAT_RGBA32:
+	case CD_PIXEL_FORMAT_RGBA64:
+		offsets[0] = 0;
+		offsets[1] = 1;
+		offsets[2] = 2;
+		*channels = 4;
+		break;
+	case CD_PIXEL_FORMAT_BGRA32:
+		offsets[0] = 2;
+		offsets[1] = 1;
+		offsets[2] = 0;
+		*channels = 4;
+		break;
+	case CD_PIXEL_FORMAT_ARGB32:
+		offsets[0] = 1;
+		offsets[1] = 2;
+		offsets[2] = 3;
+		*channels = 4;
+		break;
+	default:
+		/* float and half float are left to lcms so that values
+		 * outside of 0.0 to 1.0 are not clipped */
+		return FALSE;
+	}
+	*bytes = T_BYTES (format);
+	return TRUE;
+}
+
+static gboolean
+cd_transform_fast_is_matrix_shaper (cmsHPROFILE profile, gint lcms_intent, gint direction)
+{
+	if (cmsGetColorSpace (profile) != cmsSigRgbData)
+		return FALSE;
+	if (cmsGetPCS (profile) != cmsSigXYZData)
+		return FALSE;
+	if (!cmsIsMatrixShaper (profile))
+		return FALSE;
+
+	/* a LUT-based profile uses the CLUT for this intent if present */
+	if (cmsIsCLUT (profile, lcms_intent, direction))
+		return FALSE;
+	return TRUE;
+}
+
+static gboolean
+cd_transform_fast_get_colorants (cmsHPROFILE profile, CdMat3x3 *mat)
+{
+	const cmsCIEXYZ *red;
+	const cmsCIEXYZ *green;
+	const cmsCIEXYZ *blue;
+
+	red = cmsReadTag (profile, cmsSigRedColorantTag);
+	green = cmsReadTag (profile, cmsSigGreenColorantTag);
+	blue = cmsReadTag (profile, cmsSigBlueColorantTag);
+	if (red == NULL || green == NULL || blue == NULL)
+		return FALSE;
+	cd_mat33_init (mat,
+		       red->X, green->X, blue->X,
+		       red->Y, green->Y, blue->Y,
+		       red->Z, green->Z, blue->Z);
+	return TRUE;
+}
+
+static gboolean
+cd_transform_fast_needs_bpc (cmsHPROFILE profile_in,
+			     cmsHPROFILE profile_out,
+			     gint lcms_intent,
+			     cmsUInt32Number lcms_flags)
+{
+	cmsCIEXYZ black_in;
+	cmsCIEXYZ black_out;
+
+	/* lcms forces BPC for v4 profiles in perceptual and saturation */
+	if ((lcms_flags & cmsFLAGS_BLACKPOINTCOMPENSATION) == 0) {
+		if (lcms_intent != INTENT_PERCEPTUAL &&
+		    lcms_intent != INTENT_SATURATION)
+			return FALSE;
+		if (cmsGetEncodedICCversion (profile_in) < 0x4000000 &&
+		    cmsGetEncodedICCversion (profile_out) < 0x4000000)
+			return FALSE;
+	}
+
+	/* BPC is a no-op if the black points are identical */
+	if (!cmsDetectBlackPoint (&black_in, profile_in, lcms_intent, 0))
+		return TRUE;
+	if (!cmsDetectDestinationBlackPoint (&black_out, profile_out, lcms_intent, 0))
+		return TRUE;
+	return black_in.X != black_out.X ||
+	       black_in.Y != black_out.Y ||
+	       black_in.Z != black_out.Z;
+}
+
+static void
+cd_transform_fast_matrix_scalar (const CdTransformFast *fast,
+				 gint16 *in[3],
+				 gint16 *out[3],
+				 guint n)
+{
+	guint c;
+	guint i;
+
+	for (i = 0; i < n; i++) {
+		for (c = 0; c < 3; c++) {
+			gint32 l = (fast->mat[c][0] * in[0][i] +
+				    fast->mat[c][1] * in[1][i] +
+				    fast->mat[c][2] * in[2][i] + 0x2000) >> 14;
+			out[c][i] = (gint16) CLAMP (l, 0, 16384);
+		}
+	}
+}
+
+/* converts to linear light, then to the output shaper index */
+static void
+cd_transform_fast_matrix_float_scalar (const CdTransformFast *fast,
+				       gfloat *in[3],
+				       gfloat *out[3],
+				       guint n)
+{
+	guint c;
+	guint i;
+
+	for (i = 0; i < n; i++) {
+		for (c = 0; c < 3; c++) {
+			gfloat l = fast->matf[c][0] * in[0][i] +
+				   fast->matf[c][1] * in[1][i] +
+				   fast->matf[c][2] * in[2][i];
+			out[c][i] = sqrtf (CLAMP (l, 0.f, 1.f)) * CD_TRANSFORM_FAST_SHAPER16_SIZE;
+		}
+	}
+}
+
+#ifdef CD_TRANSFORM_FAST_X86
+
+__attribute__((target("sse2"))) static void
+cd_transform_fast_matrix_float_sse2 (const CdTransformFast *fast,
+				     gfloat *in[3],
+				     gfloat *out[3],
+				     guint n)
+{
+	guint c;
+	guint i;
+	__m128 zero = _mm_setzero_ps ();
+	__m128 one = _mm_set1_ps (1.f);
+	__m128 scale = _mm_set1_ps (CD_TRANSFORM_FAST_SHAPER16_SIZE);
+	__m128 m[3][3];
+
+	for (c = 0; c < 3; c++) {
+		m[c][0] = _mm_set1_ps (fast->matf[c][0]);
+		m[c][1] = _mm_set1_ps (fast->matf[c][1]);
+		m[c][2] = _mm_set1_ps (fast->matf[c][2]);
+	}
+	for (i = 0; i + 4 <= n; i += 4) {
+		__m128 r = _mm_loadu_ps (&in[0][i]);
+		__m128 g = _mm_loadu_ps (&in[1][i]);
+		__m128 b = _mm_loadu_ps (&in[2][i]);
+		for (c = 0; c < 3; c++) {
+			__m128 v = _mm_add_ps (_mm_add_ps (_mm_mul_ps (m[c][0], r),
+							   _mm_mul_ps (m[c][1], g)),
+					       _mm_mul_ps (m[c][2], b));
+			v = _mm_min_ps (_mm_max_ps (v, zero), one);
+			_mm_storeu_ps (&out[c][i], _mm_mul_ps (_mm_sqrt_ps (v), scale));
+		}
+	}
+
+	/* do the remainder */
+	if (i < n) {
+		gfloat *in_tail[3] = { in[0] + i, in[1] + i, in[2] + i };
+		gfloat *out_tail[3] = { out[0] + i, out[1] + i, out[2] + i };
+		cd_transform_fast_matrix_float_scalar (fast, in_tail, out_tail, n - i);
+	}
+}
+
+/* packs two 1.14 coefficients for use with pmaddwd */
+static gint32
+cd_transform_fast_pair (gint32 lo, gint32 hi)
+{
+	return (gint32) (((guint32) (guint16) hi << 16) | (guint16) lo);
+}
+
+__attribute__((target("sse2"))) static void
+cd_transform_fast_matrix_sse2 (const CdTransformFast *fast,
+			       gint16 *in[3],
+			       gint16 *out[3],
+			       guint n)
+{
+	guint c;
+	guint i;
+	__m128i ones = _mm_set1_epi16 (1);
+	__m128i zero = _mm_setzero_si128 ();
+	__m128i max = _mm_set1_epi16 (16384);
+	__m128i m_rg[3];
+	__m128i m_b1[3];
+
+	for (c = 0; c < 3; c++) {
+		m_rg[c] = _mm_set1_epi32 (cd_transform_fast_pair (fast->mat[c][0], fast->mat[c][1]));
+		m_b1[c] = _mm_set1_epi32 (cd_transform_fast_pair (fast->mat[c][2], 0x2000));
+	}
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m128i r = _mm_loadu_si128 ((const __m128i *) &in[0][i]);
+		__m128i g = _mm_loadu_si128 ((const __m128i *) &in[1][i]);
+		__m128i b = _mm_loadu_si128 ((const __m128i *) &in[2][i]);
+		__m128i rg_lo = _mm_unpacklo_epi16 (r, g);
+		__m128i rg_hi = _mm_unpackhi_epi16 (r, g);
+		__m128i b1_lo = _mm_unpacklo_epi16 (b, ones);
+		__m128i b1_hi = _mm_unpackhi_epi16 (b, ones);
+		for (c = 0; c < 3; c++) {
+			__m128i lo = _mm_add_epi32 (_mm_madd_epi16 (rg_lo, m_rg[c]),
+						    _mm_madd_epi16 (b1_lo, m_b1[c]));
+			__m128i hi = _mm_add_epi32 (_mm_madd_epi16 (rg_hi, m_rg[c]),
+						    _mm_madd_epi16 (b1_hi, m_b1[c]));
+			__m128i v = _mm_packs_epi32 (_mm_srai_epi32 (lo, 14),
+						     _mm_srai_epi32 (hi, 14));
+			v = _mm_min_epi16 (_mm_max_epi16 (v, zero), max);
+			_mm_storeu_si128 ((__m128i *) &out[c][i], v);
+		}
+	}
+
+	/* do the remainder */
+	if (i < n) {
+		gint16 *in_tail[3] = { in[0] + i, in[1] + i, in[2] + i };
+		gint16 *out_tail[3] = { out[0] + i, out[1] + i, out[2] + i };
+		cd_transform_fast_matrix_scalar (fast, in_tail, out_tail, n - i);
+	}
+}
+
+__attribute__((target("avx2"))) static void
+cd_transform_fast_matrix_avx2 (const CdTransformFast *fast,
+			       gint16 *in[3],
+			       gint16 *out[3],
+			       guint n)
+{
+	guint c;
+	guint i;
+	__m256i ones = _mm256_set1_epi16 (1);
+	__m256i zero = _mm256_setzero_si256 ();
+	__m256i max = _mm256_set1_epi16 (16384);
+	__m256i m_rg[3];
+	__m256i m_b1[3];
+
+	for (c = 0; c < 3; c++) {
+		m_rg[c] = _mm256_set1_epi32 (cd_transform_fast_pair (fast->mat[c][0], fast->mat[c][1]));
+		m_b1[c] = _mm256_set1_epi32 (cd_transform_fast_pair (fast->mat[c][2], 0x2000));
+	}
+
+	/* the unpack and pack are both per-lane so the order is preserved */
+	for (i = 0; i + 16 <= n; i += 16) {
+		__m256i r = _mm256_loadu_si256 ((const __m256i *) &in[0][i]);
+		__m256i g = _mm256_loadu_si256 ((const __m256i *) &in[1][i]);
+		__m256i b = _mm256_loadu_si256 ((const __m256i *) &in[2][i]);
+		__m256i rg_lo = _mm256_unpacklo_epi16 (r, g);
+		__m256i rg_hi = _mm256_unpackhi_epi16 (r, g);
+		__m256i b1_lo = _mm256_unpacklo_epi16 (b, ones);
+		__m256i b1_hi = _mm256_unpackhi_epi16 (b, ones);
+		for (c = 0; c < 3; c++) {
+			__m256i lo = _mm256_add_epi32 (_mm256_madd_epi16 (rg_lo, m_rg[c]),
+						       _mm256_madd_epi16 (b1_lo, m_b1[c]));
+			__m256i hi = _mm256_add_epi32 (_mm256_madd_epi16 (rg_hi, m_rg[c]),
+						       _mm256_madd_epi16 (b1_hi, m_b1[c]));
+			__m256i v = _mm256_packs_epi32 (_mm256_srai_epi32 (lo, 14),
+							_mm256_srai_epi32 (hi, 14));
+			v = _mm256_min_epi16 (_mm256_max_epi16 (v, zero), max);
+			_mm256_storeu_si256 ((__m256i *) &out[c][i], v);
+		}
+	}
+
+	/* do the remainder */
+	if (i < n) {
+		gint16 *in_tail[3] = { in[0] + i, in[1] + i, in[2] + i };
+		gint16 *out_tail[3] = { out[0] + i, out[1] + i, out[2] + i };
+		cd_transform_fast_matrix_sse2 (fast, in_tail, out_tail, n - i);
+	}
+}
+#endif
+
+static CdTransformFastMatrixFunc
+cd_transform_fast_get_matrix_func (const CdTransformFast *fast)
+{
+#ifdef CD_TRANSFORM_FAST_X86
+	guint c;
+	guint j;
+
+	/* pmaddwd needs all the coefficients to fit in 16 bits */
+	for (c = 0; c < 3; c++) {
+		for (j = 0; j < 3; j++) {
+			if (fast->mat[c][j] < G_MININT16 || fast->mat[c][j] > G_MAXINT16)
+				return cd_transform_fast_matrix_scalar;
+		}
+	}
+	__builtin_cpu_init ();
+	if (__builtin_cpu_supports ("avx2"))
+		return cd_transform_fast_matrix_avx2;
+	if (__builtin_cpu_supports ("sse2"))
+		return cd_transform_fast_matrix_sse2;
+#endif
+	return cd_transform_fast_matrix_scalar;
+}
+
+static CdTransformFastMatrixFloatFunc
+cd_transform_fast_get_matrix_float_func (void)
+{
+#ifdef CD_TRANSFORM_FAST_X86
+	__builtin_cpu_init ();
+	if (__builtin_cpu_supports ("sse2"))
+		return cd_transform_fast_matrix_float_sse2;
+#endif
+	return cd_transform_fast_matrix_float_scalar;
+}
+
+/* linearize into 1.14 fixed point, and re-encode from the same */
+static gboolean
+cd_transform_fast_setup_shapers8 (CdTransformFast *fast,
+				  guint c,
+				  cmsToneCurve *curve_in,
+				  cmsToneCurve *curve_out_inv)
+{
+	guint i;
+
+	for (i = 0; i < 256; i++) {
+		gfloat y = cmsEvalToneCurveFloat (curve_in, (gfloat) (i / 255.0));
+		gint32 tmp = cd_transform_fast_to_fixed14 (y);
+
+		/* the SIMD matrix works on 16 bit values */
+		if (tmp < 0 || tmp > G_MAXINT16)
+			return FALSE;
+		fast->shaper1[c][i] = (gint16) tmp;
+	}
+	for (i = 0; i < CD_TRANSFORM_FAST_SHAPER2_SIZE; i++) {
+		gfloat y = cmsEvalToneCurveFloat (curve_out_inv, (gfloat) (i / 16384.0));
+		fast->shaper2[c][i] = cd_transform_fast_to_byte (CLAMP (y, 0.f, 1.f));
+	}
+	return TRUE;
+}
+
+/* linearize into float, and re-encode from the square root of the same */
+static gboolean
+cd_transform_fast_setup_shapers16 (CdTransformFast *fast,
+				   guint c,
+				   cmsToneCurve *curve_in,
+				   cmsToneCurve *curve_out_inv)
+{
+	guint i;
+
+	for (i = 0; i <= CD_TRANSFORM_FAST_SHAPER16_SIZE; i++) {
+		gfloat x = (gfloat) i / CD_TRANSFORM_FAST_SHAPER16_SIZE;
+		fast->shaper1_16[c][i] = cmsEvalToneCurveFloat (curve_in, x);
+	}
+	for (i = 0; i <= CD_TRANSFORM_FAST_SHAPER16_SIZE; i++) {
+		gfloat x = (gfloat) i / CD_TRANSFORM_FAST_SHAPER16_SIZE;
+		gfloat y = cmsEvalToneCurveFloat (curve_out_inv, x * x);
+		fast->shaper2_16[c][i] = CLAMP (y, 0.f, 1.f) * 65535.f;
+	}
+	return TRUE;
+}
+
+/**
+ * cd_transform_fast_new:
+ *
+ * Return value: a native transform, or %NULL if the profiles or pixel
+ * formats are not suitable and lcms should be used instead.
+ **/
+CdTransformFast *
+cd_transform_fast_new (cmsHPROFILE profile_in,
+		       CdPixelFormat format_in,
+		       cmsHPROFILE profile_out,
+		       CdPixelFormat format_out,
+		       gint lcms_intent,
+		       cmsUInt32Number lcms_flags)
+{
+	CdMat3x3 mat_in;
+	CdMat3x3 mat_out;
+	CdMat3x3 mat_out_inv;
+	CdMat3x3 mat;
+	const gdouble *data;
+	guint bytes_out;
+	guint c;
+	guint i;
+	g_autofree CdTransformFast *fast = g_new0 (CdTransformFast, 1);
+
+	/* only 8 and 16 bit RGB pixel layouts of the same depth */
+	if (!cd_transform_fast_get_layout (format_in,
+					   fast->offsets_in,
+					   &fast->channels_in,
+					   &fast->bytes))
+		return NULL;
+	if (!cd_transform_fast_get_layout (format_out,
+					   fast->offsets_out,
+					   &fast->channels_out,
+					   &bytes_out))
+		return NULL;
+	if (fast->bytes != bytes_out)
+		return NULL;
+
+	/* absolute colorimetric needs an extra white point scaling */
+	if (lcms_intent == INTENT_ABSOLUTE_COLORIMETRIC)
+		return NULL;
+	if (!cd_transform_fast_is_matrix_shaper (profile_in, lcms_intent, LCMS_USED_AS_INPUT))
+		return NULL;
+	if (!cd_transform_fast_is_matrix_shaper (profile_out, lcms_intent, LCMS_USED_AS_OUTPUT))
+		return NULL;
+	if (cd_transform_fast_needs_bpc (profile_in, profile_out, lcms_intent, lcms_flags))
+		return NULL;
+
+	/* combine both matrices into one, going via PCSXYZ */
+	if (!cd_transform_fast_get_colorants (profile_in, &mat_in))
+		return NULL;
+	if (!cd_transform_fast_get_colorants (profile_out, &mat_out))
+		return NULL;
+	if (!cd_mat33_reciprocal (&mat_out, &mat_out_inv))
+		return NULL;
+	cd_mat33_matrix_multiply (&mat_out_inv, &mat_in, &mat);
+	data = cd_mat33_get_data (&mat);
+	for (c = 0; c < 3; c++) {
+		for (i = 0; i < 3; i++) {
+			fast->mat[c][i] = cd_transform_fast_to_fixed14 (data[c * 3 + i]);
+			fast->matf[c][i] = (gfloat) data[c * 3 + i];
+		}
+	}
+
+	/* build the per-channel curves */
+	for (c = 0; c < 3; c++) {
+		const cmsTagSignature trc[] = { cmsSigRedTRCTag,
+						cmsSigGreenTRCTag,
+						cmsSigBlueTRCTag };
+		cmsToneCurve *curve_in;
+		cmsToneCurve *curve_out;
+		cmsToneCurve *curve_out_inv;
+		gboolean ret;
+
+		curve_in = cmsReadTag (profile_in, trc[c]);
+		curve_out = cmsReadTag (profile_out, trc[c]);
+		if (curve_in == NULL || curve_out == NULL)
+			return NULL;
+		curve_out_inv = cmsReverseToneCurve (curve_out);
+		if (curve_out_inv == NULL)
+			return NULL;
+		if (fast->bytes == 1)
+			ret = cd_transform_fast_setup_shapers8 (fast, c, curve_in, curve_out_inv);
+		else
+			ret = cd_transform_fast_setup_shapers16 (fast, c, curve_in, curve_out_inv);
+		cmsFreeToneCurve (curve_out_inv);
+		if (!ret)
+			return NULL;
+	}
+
+	fast->matrix_func = cd_transform_fast_get_matrix_func (fast);
+	fast->matrix_float_func = cd_transform_fast_get_matrix_float_func ();
+	return g_steal_pointer (&fast);
+}
+
+static void
+cd_transform_fast_process8 (CdTransformFast *fast,
+			    const guint8 *p_in,
+			    guint8 *p_out,
+			    guint width)
+{
+	gint16 in_r[CD_TRANSFORM_FAST_BLOCK];
+	gint16 in_g[CD_TRANSFORM_FAST_BLOCK];
+	gint16 in_b[CD_TRANSFORM_FAST_BLOCK];
+	gint16 out_r[CD_TRANSFORM_FAST_BLOCK];
+	gint16 out_g[CD_TRANSFORM_FAST_BLOCK];
+	gint16 out_b[CD_TRANSFORM_FAST_BLOCK];
+	gint16 *in[3] = { in_r, in_g, in_b };
+	gint16 *out[3] = { out_r, out_g, out_b };
+	guint x;
+
+	for (x = 0; x < width; x += CD_TRANSFORM_FAST_BLOCK) {
+		guint i;
+		guint n = MIN (width - x, CD_TRANSFORM_FAST_BLOCK);
+
+		/* unpack and linearize */
+		for (i = 0; i < n; i++) {
+			in_r[i] = fast->shaper1[0][p_in[fast->offsets_in[0]]];
+			in_g[i] = fast->shaper1[1][p_in[fast->offsets_in[1]]];
+			in_b[i] = fast->shaper1[2][p_in[fast->offsets_in[2]]];
+			p_in += fast->channels_in;
+		}
+
+		fast->matrix_func (fast, in, out, n);
+
+		/* re-encode and pack; this is safe to do in-place */
+		for (i = 0; i < n; i++) {
+			p_out[fast->offsets_out[0]] = fast->shaper2[0][out_r[i]];
+			p_out[fast->offsets_out[1]] = fast->shaper2[1][out_g[i]];
+			p_out[fast->offsets_out[2]] = fast->shaper2[2][out_b[i]];
+			p_out += fast->channels_out;
+		}
+	}
+}
+
+/* 0xffff has to land exactly on the last table entry */
+static gfloat
+cd_transform_fast_shaper1_16 (const gfloat *table, guint16 value)
+{
+	gfloat pos = (gfloat) value * ((gfloat) CD_TRANSFORM_FAST_SHAPER16_SIZE / 65535.f);
+	guint idx = MIN ((guint) pos, CD_TRANSFORM_FAST_SHAPER16_SIZE - 1);
+	gfloat frac = pos - (gfloat) idx;
+	return table[idx] + (table[idx + 1] - table[idx]) * frac;
+}
+
+static guint16
+cd_transform_fast_shaper2_16 (const gfloat *table, gfloat value)
+{
+	guint idx = MIN ((guint) value, CD_TRANSFORM_FAST_SHAPER16_SIZE - 1);
+	gfloat frac = value - (gfloat) idx;
+	return (guint16) (table[idx] + (table[idx + 1] - table[idx]) * frac + 0.5f);
+}
+
+static void
+cd_transform_fast_process16 (CdTransformFast *fast,
+			     const guint16 *p_in,
+			     guint16 *p_out,
+			     guint width)
+{
+	gfloat in_r[CD_TRANSFORM_FAST_BLOCK];
+	gfloat in_g[CD_TRANSFORM_FAST_BLOCK];
+	gfloat in_b[CD_TRANSFORM_FAST_BLOCK];
+	gfloat out_r[CD_TRANSFORM_FAST_BLOCK];
+	gfloat out_g[CD_TRANSFORM_FAST_BLOCK];
+	gfloat out_b[CD_TRANSFORM_FAST_BLOCK];
+	gfloat *in[3] = { in_r, in_g, in_b };
+	gfloat *out[3] = { out_r, out_g, out_b };
+	guint x;
+
+	for (x = 0; x < width; x += CD_TRANSFORM_FAST_BLOCK) {
+		guint i;
+		guint n = MIN (width - x, CD_TRANSFORM_FAST_BLOCK);
+
+		/* unpack and linearize */
+		for (i = 0; i < n; i++) {
+			in_r[i] = cd_transform_fast_shaper1_16 (fast->shaper1_16[0], p_in[fast->offsets_in[0]]);
+			in_g[i] = cd_transform_fast_shaper1_16 (fast->shaper1_16[1], p_in[fast->offsets_in[1]]);
+			in_b[i] = cd_transform_fast_shaper1_16 (fast->shaper1_16[2], p_in[fast->offsets_in[2]]);
+			p_in += fast->channels_in;
+		}
+
+		fast->matrix_float_func (fast, in, out, n);
+
+		/* re-encode and pack; this is safe to do in-place */
+		for (i = 0; i < n; i++) {
+			p_out[fast->offsets_out[0]] = cd_transform_fast_shaper2_16 (fast->shaper2_16[0], out_r[i]);
+			p_out[fast->offsets_out[1]] = cd_transform_fast_shaper2_16 (fast->shaper2_16[1], out_g[i]);
+			p_out[fast->offsets_out[2]] = cd_transform_fast_shaper2_16 (fast->shaper2_16[2], out_b[i]);
+			p_out += fast->channels_out;
+		}
+	}
+}
+
+/**
+ * cd_transform_fast_process:
+ *
+ * Converts one row of pixels. The alpha channel in the output is not written,
+ * which matches lcms when not using cmsFLAGS_COPY_ALPHA.
+ **/
+void
+cd_transform_fast_process (CdTransformFast *fast,
+			   const guint8 *p_in,
+			   guint8 *p_out,
+			   guint width)
+{
+	if (fast->bytes == 1) {
+		cd_transform_fast_process8 (fast, p_in, p_out, width);
+		return;
+	}
+	cd_transform_fast_process16 (fast,
+				     (const guint16 *) p_in,
+				     (guint16 *) p_out,
+				     width);
+}
+
+/**
+ * cd_transform_fast_free:
+ **/
+void
+cd_transform_fast_free (CdTransformFast *fast)
+{
+	g_free (fast);
+}
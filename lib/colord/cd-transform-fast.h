@@ -0,0 +1,52 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2013 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#if !defined (CD_COMPILATION)
+#error "You cannot include this file externaly"
+#endif
+
+#ifndef __CD_TRANSFORM_FAST_H
+#define __CD_TRANSFORM_FAST_H
+
+#include <glib.h>
+#include <lcms2.h>
+
+#include "cd-enum.h"
+
+G_BEGIN_DECLS
+
+typedef struct _CdTransformFast CdTransformFast;
+
+CdTransformFast	*cd_transform_fast_new		(cmsHPROFILE	 profile_in,
+						 CdPixelFormat	 format_in,
+						 cmsHPROFILE	 profile_out,
+						 CdPixelFormat	 format_out,
+						 gint		 lcms_intent,
+						 cmsUInt32Number lcms_flags);
+void		 cd_transform_fast_process	(CdTransformFast *fast,
+						 const guint8	*p_in,
+						 guint8		*p_out,
+						 guint		 width);
+void		 cd_transform_fast_free		(CdTransformFast *fast);
+
+G_END_DECLS
+
+#endif /* __CD_TRANSFORM_FAST_H */
@@ -0,0 +1,431 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2026 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/**
+ * SECTION:cd-transform-stream
+ * @short_description: Convert an image a few rows at a time
+ *
+ * Image decoders usually produce a handful of scanlines at a time, and
+ * calling cd_transform_process() for each of them has a large overhead.
+ * This object collects rows until there is enough work for all the worker
+ * threads, and then delivers the converted rows using a callback.
+ *
+ * Only a couple of batches of rows are ever allocated, so huge images can
+ * be converted without holding the whole frame in memory.
+ *
+ * See also: #CdTransform
+ */
+
+#include "config.h"
+
+#include <glib-object.h>
+#include <string.h>
+
+#include "cd-cpu.h"
+#include "cd-transform.h"
+#include "cd-transform-private.h"
+#include "cd-transform-stream.h"
+
+static void	cd_transform_stream_class_init	(CdTransformStreamClass	*klass);
+static void	cd_transform_stream_init	(CdTransformStream	*stream);
+static void	cd_transform_stream_finalize	(GObject		*object);
+
+#define GET_PRIVATE(o) (cd_transform_stream_get_instance_private (o))
+
+/**
+ * CdTransformStreamPrivate:
+ *
+ * Private #CdTransformStream data
+ **/
+typedef struct
+{
+	CdTransform		*transform;
+	CdTransformStreamFunc	 func;
+	gpointer		 user_data;
+	GDestroyNotify		 user_data_free;
+	guint			 width;
+	guint			 batch_rows;	/* 0 for automatic */
+	guint			 rows_pending;
+	guint			 rows_written;
+	guint			 rows_delivered;
+	gsize			 stride_in;	/* in bytes, 0 until set up */
+	gsize			 stride_out;
+	guint8			*buf_in;
+	guint8			*buf_out;
+} CdTransformStreamPrivate;
+
+G_DEFINE_TYPE_WITH_PRIVATE (CdTransformStream, cd_transform_stream, G_TYPE_OBJECT)
+
+/* allocate the batch buffers the first time that rows are written */
+static gboolean
+cd_transform_stream_setup (CdTransformStream *stream, GError **error)
+{
+	CdTransformStreamPrivate *priv = GET_PRIVATE (stream);
+	CdPixelFormat format_in;
+	CdPixelFormat format_out;
+	guint bpp_in;
+	guint bpp_out;
+
+	if (priv->stride_in != 0)
+		return TRUE;
+
+	/* rows are passed interleaved */
+	format_in = cd_transform_get_input_pixel_format (priv->transform);
+	format_out = cd_transform_get_output_pixel_format (priv->transform);
+	bpp_in = cd_transform_get_bpp (format_in);
+	bpp_out = cd_transform_get_bpp (format_out);
+	if (bpp_in == 0 || bpp_out == 0) {
+		g_set_error_literal (error,
+				     CD_TRANSFORM_ERROR,
+				     CD_TRANSFORM_ERROR_FAILED_TO_SETUP_TRANSFORM,
+				     "pixel format not set");
+		return FALSE;
+	}
+	if (cd_transform_get_planes (format_in) > 1 ||
+	    cd_transform_get_planes (format_out) > 1) {
+		g_set_error_literal (error,
+				     CD_TRANSFORM_ERROR,
+				     CD_TRANSFORM_ERROR_FAILED_TO_SETUP_TRANSFORM,
+				     "planar pixel formats cannot be streamed");
+		return FALSE;
+	}
+
+	/* enough cache-sized tiles to keep every worker busy */
+	if (priv->batch_rows == 0) {
+		guint max_threads = cd_transform_get_max_threads (priv->transform);
+		gsize tile_rows;
+
+		if (max_threads == 0)
+			max_threads = cd_cpu_get_n_threads ();
+		tile_rows = cd_transform_get_tile_size () / ((gsize) priv->width * bpp_in);
+		priv->batch_rows = (guint) MAX (tile_rows, 1) * max_threads;
+	}
+
+	priv->stride_in = (gsize) priv->width * bpp_in;
+	priv->stride_out = (gsize) priv->width * bpp_out;
+	priv->buf_in = g_new (guint8, priv->stride_in * priv->batch_rows);
+	priv->buf_out = g_new (guint8, priv->stride_out * priv->batch_rows);
+	return TRUE;
+}
+
+static gboolean
+cd_transform_stream_process (CdTransformStream *stream,
+			     const guint8 *data,
+			     gsize rowstride,
+			     guint n_rows,
+			     GCancellable *cancellable,
+			     GError **error)
+{
+	CdTransformStreamPrivate *priv = GET_PRIVATE (stream);
+	gpointer planes_in[] = { (gpointer) data };
+	gpointer planes_out[] = { priv->buf_out };
+	gsize strides_in[] = { rowstride };
+	gsize strides_out[] = { priv->stride_out };
+
+	if (!cd_transform_process_planes (priv->transform,
+					  planes_in,
+					  strides_in,
+					  planes_out,
+					  strides_out,
+					  priv->width,
+					  n_rows,
+					  cancellable,
+					  error))
+		return FALSE;
+	priv->func (stream,
+		    priv->buf_out,
+		    priv->rows_delivered,
+		    n_rows,
+		    priv->stride_out,
+		    priv->user_data);
+	priv->rows_delivered += n_rows;
+	return TRUE;
+}
+
+/**
+ * cd_transform_stream_write:
+ * @stream: a #CdTransformStream instance.
+ * @data: the rows to convert, which are not modified
+ * @n_rows: the number of rows in @data
+ * @rowstride: the size of each row in @data, in bytes
+ * @cancellable: A %GCancellable, or %NULL
+ * @error: A %GError, or %NULL
+ *
+ * Adds rows of pixels to the stream. Rows are copied into an internal
+ * buffer until there are enough for a batch, which is converted using all
+ * the worker threads and passed to the callback. Complete batches are
+ * converted straight from @data without being copied.
+ *
+ * The pixel formats of the transform must not be changed after the first
+ * rows have been written.
+ *
+ * Return value: %TRUE if the rows were accepted.
+ *
+ * Since: 1.4.9
+ **/
+gboolean
+cd_transform_stream_write (CdTransformStream *stream,
+			   gconstpointer data,
+			   guint n_rows,
+			   gsize rowstride,
+			   GCancellable *cancellable,
+			   GError **error)
+{
+	CdTransformStreamPrivate *priv = GET_PRIVATE (stream);
+	const guint8 *tmp = data;
+
+	g_return_val_if_fail (CD_IS_TRANSFORM_STREAM (stream), FALSE);
+	g_return_val_if_fail (data != NULL || n_rows == 0, FALSE);
+
+	if (!cd_transform_stream_setup (stream, error))
+		return FALSE;
+	g_return_val_if_fail (rowstride >= priv->stride_in, FALSE);
+
+	while (n_rows > 0) {
+		guint i;
+		guint n;
+
+		/* nothing is pending so convert straight from the caller */
+		if (priv->rows_pending == 0 && n_rows >= priv->batch_rows) {
+			n = priv->batch_rows;
+			if (!cd_transform_stream_process (stream,
+							  tmp,
+							  rowstride,
+							  n,
+							  cancellable,
+							  error))
+				return FALSE;
+		} else {
+			n = MIN (n_rows, priv->batch_rows - priv->rows_pending);
+			for (i = 0; i < n; i++) {
+				memcpy (priv->buf_in + (priv->rows_pending + i) * priv->stride_in,
+					tmp + i * rowstride,
+					priv->stride_in);
+			}
+			priv->rows_pending += n;
+			if (priv->rows_pending == priv->batch_rows) {
+				if (!cd_transform_stream_flush (stream, cancellable, error))
+					return FALSE;
+			}
+		}
+		tmp += n * rowstride;
+		n_rows -= n;
+		priv->rows_written += n;
+	}
+	return TRUE;
+}
+
+/**
+ * cd_transform_stream_flush:
+ * @stream: a #CdTransformStream instance.
+ * @cancellable: A %GCancellable, or %NULL
+ * @error: A %GError, or %NULL
+ *
+ * Converts and delivers any rows that do not yet make up a whole batch.
+ * This should be called once the last rows of the image have been written.
+ *
+ * Return value: %TRUE if the pending rows were converted.
+ *
+ * Since: 1.4.9
+ **/
+gboolean
+cd_transform_stream_flush (CdTransformStream *stream,
+			   GCancellable *cancellable,
+			   GError **error)
+{
+	CdTransformStreamPrivate *priv = GET_PRIVATE (stream);
+	guint n_rows;
+
+	g_return_val_if_fail (CD_IS_TRANSFORM_STREAM (stream), FALSE);
+
+	if (priv->rows_pending == 0)
+		return TRUE;
+
+	/* drop the rows on error rather than delivering them twice */
+	n_rows = priv->rows_pending;
+	priv->rows_pending = 0;
+	return cd_transform_stream_process (stream,
+					    priv->buf_in,
+					    priv->stride_in,
+					    n_rows,
+					    cancellable,
+					    error);
+}
+
+/**
+ * cd_transform_stream_set_batch_rows:
+ * @stream: a #CdTransformStream instance.
+ * @batch_rows: the number of rows, or 0 for automatic
+ *
+ * Sets the number of rows that are converted together. By default this
+ * is enough rows for a cache-sized tile for each worker thread.
+ *
+ * This can only be changed before any rows have been written.
+ *
+ * Since: 1.4.9
+ **/
+void
+cd_transform_stream_set_batch_rows (CdTransformStream *stream, guint batch_rows)
+{
+	CdTransformStreamPrivate *priv = GET_PRIVATE (stream);
+	g_return_if_fail (CD_IS_TRANSFORM_STREAM (stream));
+	g_return_if_fail (priv->stride_in == 0);
+	priv->batch_rows = batch_rows;
+}
+
+/**
+ * cd_transform_stream_get_batch_rows:
+ * @stream: a #CdTransformStream instance.
+ *
+ * Gets the number of rows that are converted together.
+ *
+ * Return value: the number of rows, or 0 if not yet known
+ *
+ * Since: 1.4.9
+ **/
+guint
+cd_transform_stream_get_batch_rows (CdTransformStream *stream)
+{
+	CdTransformStreamPrivate *priv = GET_PRIVATE (stream);
+	g_return_val_if_fail (CD_IS_TRANSFORM_STREAM (stream), 0);
+	return priv->batch_rows;
+}
+
+/**
+ * cd_transform_stream_get_rows_written:
+ * @stream: a #CdTransformStream instance.
+ *
+ * Gets the number of rows that have been written to the stream.
+ *
+ * Return value: the number of rows
+ *
+ * Since: 1.4.9
+ **/
+guint
+cd_transform_stream_get_rows_written (CdTransformStream *stream)
+{
+	CdTransformStreamPrivate *priv = GET_PRIVATE (stream);
+	g_return_val_if_fail (CD_IS_TRANSFORM_STREAM (stream), 0);
+	return priv->rows_written;
+}
+
+/**
+ * cd_transform_stream_get_rows_delivered:
+ * @stream: a #CdTransformStream instance.
+ *
+ * Gets the number of converted rows that have been passed to the callback.
+ *
+ * Return value: the number of rows
+ *
+ * Since: 1.4.9
+ **/
+guint
+cd_transform_stream_get_rows_delivered (CdTransformStream *stream)
+{
+	CdTransformStreamPrivate *priv = GET_PRIVATE (stream);
+	g_return_val_if_fail (CD_IS_TRANSFORM_STREAM (stream), 0);
+	return priv->rows_delivered;
+}
+
+/**
+ * cd_transform_stream_get_transform:
+ * @stream: a #CdTransformStream instance.
+ *
+ * Gets the transform used to convert the rows.
+ *
+ * Return value: (transfer none): a #CdTransform
+ *
+ * Since: 1.4.9
+ **/
+CdTransform *
+cd_transform_stream_get_transform (CdTransformStream *stream)
+{
+	CdTransformStreamPrivate *priv = GET_PRIVATE (stream);
+	g_return_val_if_fail (CD_IS_TRANSFORM_STREAM (stream), NULL);
+	return priv->transform;
+}
+
+static void
+cd_transform_stream_class_init (CdTransformStreamClass *klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+	object_class->finalize = cd_transform_stream_finalize;
+}
+
+static void
+cd_transform_stream_init (CdTransformStream *stream)
+{
+}
+
+static void
+cd_transform_stream_finalize (GObject *object)
+{
+	CdTransformStream *stream = CD_TRANSFORM_STREAM (object);
+	CdTransformStreamPrivate *priv = GET_PRIVATE (stream);
+
+	if (priv->rows_pending > 0)
+		g_warning ("%u rows were never flushed", priv->rows_pending);
+	if (priv->user_data_free != NULL)
+		priv->user_data_free (priv->user_data);
+	g_clear_object (&priv->transform);
+	g_free (priv->buf_in);
+	g_free (priv->buf_out);
+
+	G_OBJECT_CLASS (cd_transform_stream_parent_class)->finalize (object);
+}
+
+/**
+ * cd_transform_stream_new:
+ * @transform: a #CdTransform
+ * @width: the width of the image in pixels
+ * @func: (scope notified): the function called with converted rows
+ * @user_data: user data for @func
+ * @user_data_free: (nullable): a function to free @user_data, or %NULL
+ *
+ * Creates a new stream that converts rows using @transform.
+ *
+ * Return value: a new #CdTransformStream object.
+ *
+ * Since: 1.4.9
+ **/
+CdTransformStream *
+cd_transform_stream_new (CdTransform *transform,
+			 guint width,
+			 CdTransformStreamFunc func,
+			 gpointer user_data,
+			 GDestroyNotify user_data_free)
+{
+	CdTransformStream *stream;
+	CdTransformStreamPrivate *priv;
+
+	g_return_val_if_fail (CD_IS_TRANSFORM (transform), NULL);
+	g_return_val_if_fail (width != 0, NULL);
+	g_return_val_if_fail (func != NULL, NULL);
+
+	stream = g_object_new (CD_TYPE_TRANSFORM_STREAM, NULL);
+	priv = GET_PRIVATE (stream);
+	priv->transform = g_object_ref (transform);
+	priv->width = width;
+	priv->func = func;
+	priv->user_data = user_data;
+	priv->user_data_free = user_data_free;
+	return CD_TRANSFORM_STREAM (stream);
+}
@@ -0,0 +1,99 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: t; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2026 Richard Hughes <richard@hughsie.com>
+ *
+ * Licensed under the GNU Lesser General Public License Version 2.1
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#if !defined (__COLORD_H_INSIDE__) && !defined (CD_COMPILATION)
+#error "Only <colord.h> can be included directly."
+#endif
+
+#ifndef __CD_TRANSFORM_STREAM_H
+#define __CD_TRANSFORM_STREAM_H
+
+#include <glib-object.h>
+#include <gio/gio.h>
+
+#include "cd-transform.h"
+
+G_BEGIN_DECLS
+
+#define CD_TYPE_TRANSFORM_STREAM (cd_transform_stream_get_type ())
+G_DECLARE_DERIVABLE_TYPE (CdTransformStream, cd_transform_stream, CD, TRANSFORM_STREAM, GObject)
+
+struct _CdTransformStreamClass
+{
+	GObjectClass		 parent_class;
+	/*< private >*/
+	/* Padding for future expansion */
+	void (*_cd_transform_stream_reserved1) (void);
+	void (*_cd_transform_stream_reserved2) (void);
+	void (*_cd_transform_stream_reserved3) (void);
+	void (*_cd_transform_stream_reserved4) (void);
+	void (*_cd_transform_stream_reserved5) (void);
+	void (*_cd_transform_stream_reserved6) (void);
+	void (*_cd_transform_stream_reserved7) (void);
+	void (*_cd_transform_stream_reserved8) (void);
+};
+
+/**
+ * CdTransformStreamFunc:
+ * @stream: a #CdTransformStream
+ * @data: the converted rows, only valid for the duration of the callback
+ * @row: the index of the first row in @data
+ * @n_rows: the number of rows in @data
+ * @rowstride: the size of each row in @data, in bytes
+ * @user_data: user data passed to cd_transform_stream_new()
+ *
+ * The callback used to deliver converted rows.
+ *
+ * Since: 1.4.9
+ **/
+typedef void (*CdTransformStreamFunc)		(CdTransformStream *stream,
+						 gconstpointer	 data,
+						 guint		 row,
+						 guint		 n_rows,
+						 gsize		 rowstride,
+						 gpointer	 user_data);
+
+CdTransformStream *cd_transform_stream_new	(CdTransform	*transform,
+						 guint		 width,
+						 CdTransformStreamFunc func,
+						 gpointer	 user_data,
+						 GDestroyNotify	 user_data_free);
+gboolean	 cd_transform_stream_write	(CdTransformStream *stream,
+						 gconstpointer	 data,
+						 guint		 n_rows,
+						 gsize		 rowstride,
+						 GCancellable	*cancellable,
+						 GError		**error)
+						 G_GNUC_WARN_UNUSED_RESULT;
+gboolean	 cd_transform_stream_flush	(CdTransformStream *stream,
+						 GCancellable	*cancellable,
+						 GError		**error)
+						 G_GNUC_WARN_UNUSED_RESULT;
+void		 cd_transform_stream_set_batch_rows (CdTransformStream *stream,
+						 guint		 batch_rows);
+guint		 cd_transform_stream_get_batch_rows (CdTransformStream *stream);
+guint		 cd_transform_stream_get_rows_written (CdTransformStream *stream);
+guint		 cd_transform_stream_get_rows_delivered (CdTransformStream *stream);
+CdTransform	*cd_transform_stream_get_transform (CdTransformStream *stream);
+
+G_END_DECLS
+
+#endif /* __CD_TRANSFORM_STREAM_H */
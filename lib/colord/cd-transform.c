@@ -32,11 +32,19 @@
 
 #include "config.h"
 
+#include <errno.h>
 #include <glib.h>
 #include <lcms2.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "cd-context-lcms.h"
+#include "cd-cpu.h"
+#include "cd-icc-private.h"
 #include "cd-transform.h"
+#include "cd-transform-cache.h"
+#include "cd-transform-fast.h"
+#include "cd-transform-private.h"
 
 static void	cd_transform_class_init		(CdTransformClass	*klass);
 static void	cd_transform_init		(CdTransform		*transform);
@@ -44,6 +52,43 @@ static void	cd_transform_finalize		(GObject		*object);
 
 #define GET_PRIVATE(o) (cd_transform_get_instance_private (o))
 
+/* used when the L2 cache size cannot be queried */
+#define CD_TRANSFORM_TILE_SIZE_DEFAULT		(256 * 1024)
+
+/* RGBA is the most planes any supported format has */
+#define CD_TRANSFORM_PLANES_MAX			4
+
+typedef struct {
+	guint8	*planes[CD_TRANSFORM_PLANES_MAX];
+	gsize	 strides[CD_TRANSFORM_PLANES_MAX];	/* in bytes */
+} CdTransformBuffer;
+
+typedef struct {
+	CdTransformBuffer in;
+	CdTransformBuffer out;
+	guint	 width;
+	guint	 height;
+	guint	 tile_rows;
+	guint	 tile_first;
+	guint	 tile_end;
+	gint	*tiles_next;
+	gint	 node;		/* NUMA node to bind to, or -1 */
+	guint	 tiles_processed;
+	GCancellable *cancellable;
+	guint8	*scratch_in;	/* kept between calls for planar formats */
+	guint8	*scratch_out;
+	gsize	 scratch_in_size;
+	gsize	 scratch_out_size;
+} CdTransformJob;
+
+typedef struct {
+	gpointer	 data_in;
+	gpointer	 data_out;
+	guint		 width;
+	guint		 height;
+	guint		 rowstride;
+} CdTransformHelper;
+
 /**
  * CdTransformPrivate:
  *
@@ -60,10 +105,30 @@ typedef struct
 	cmsContext		 context_lcms;
 	cmsHPROFILE		 srgb;
 	cmsHTRANSFORM		 lcms_transform;
+	CdTransformCacheItem	*cache_item;	/* owns lcms_transform if set */
+	CdTransformFast		*fast;
 	gboolean		 bpc;
+	gchar			*devicelink_dir;
 	guint			 max_threads;
 	guint			 bpp_input;
 	guint			 bpp_output;
+	guint			 planes_input;
+	guint			 planes_output;
+	guint			 colors_output;
+	GThreadPool		*pool;
+	GMutex			 pool_mutex;	/* serializes threaded callers */
+	GMutex			 jobs_mutex;
+	GCond			 jobs_cond;
+	guint			 jobs_pending;
+	guint			 jobs_size;
+	guint			 jobs_used;
+	gint			*tiles_next;	/* one per NUMA node */
+	gboolean		 numa_aware;
+	CdTransformJob		*jobs;
+	GMutex			 setup_mutex;	/* protects the settings */
+	GRWLock			 state_lock;	/* held for reading while processing */
+	gint			 progress_done;	/* atomic */
+	gint			 progress_total;	/* atomic */
 } CdTransformPrivate;
 
 G_DEFINE_TYPE_WITH_PRIVATE (CdTransform, cd_transform, G_TYPE_OBJECT)
@@ -97,12 +162,28 @@ cd_transform_error_quark (void)
 }
 
 static void
-cd_transform_invalidate (CdTransform *transform)
+cd_transform_clear_state (CdTransform *transform)
 {
 	CdTransformPrivate *priv = GET_PRIVATE (transform);
-	if (priv->lcms_transform != NULL)
+	if (priv->cache_item != NULL)
+		cd_transform_cache_item_unref (priv->cache_item);
+	else if (priv->lcms_transform != NULL)
 		cmsDeleteTransform (priv->lcms_transform);
+	priv->cache_item = NULL;
 	priv->lcms_transform = NULL;
+	if (priv->fast != NULL)
+		cd_transform_fast_free (priv->fast);
+	priv->fast = NULL;
+}
+
+/* called with setup_mutex held; waits for any running process to finish */
+static void
+cd_transform_invalidate (CdTransform *transform)
+{
+	CdTransformPrivate *priv = GET_PRIVATE (transform);
+	g_rw_lock_writer_lock (&priv->state_lock);
+	cd_transform_clear_state (transform);
+	g_rw_lock_writer_unlock (&priv->state_lock);
 }
 
 /**
@@ -118,9 +199,11 @@ void
 cd_transform_set_input_icc (CdTransform *transform, CdIcc *icc)
 {
 	CdTransformPrivate *priv = GET_PRIVATE (transform);
+	g_autoptr(GMutexLocker) locker = NULL;
 
 	g_return_if_fail (CD_IS_TRANSFORM (transform));
 	g_return_if_fail (icc == NULL || CD_IS_ICC (icc));
+	locker = g_mutex_locker_new (&priv->setup_mutex);
 
 	/* no change */
 	if (priv->input_icc == icc)
@@ -164,9 +247,11 @@ void
 cd_transform_set_output_icc (CdTransform *transform, CdIcc *icc)
 {
 	CdTransformPrivate *priv = GET_PRIVATE (transform);
+	g_autoptr(GMutexLocker) locker = NULL;
 
 	g_return_if_fail (CD_IS_TRANSFORM (transform));
 	g_return_if_fail (icc == NULL || CD_IS_ICC (icc));
+	locker = g_mutex_locker_new (&priv->setup_mutex);
 
 	/* no change */
 	if (priv->output_icc == icc)
@@ -211,9 +296,11 @@ void
 cd_transform_set_abstract_icc (CdTransform *transform, CdIcc *icc)
 {
 	CdTransformPrivate *priv = GET_PRIVATE (transform);
+	g_autoptr(GMutexLocker) locker = NULL;
 
 	g_return_if_fail (CD_IS_TRANSFORM (transform));
 	g_return_if_fail (icc == NULL || CD_IS_ICC (icc));
+	locker = g_mutex_locker_new (&priv->setup_mutex);
 
 	/* no change */
 	if (priv->abstract_icc == icc)
@@ -257,9 +344,11 @@ void
 cd_transform_set_input_pixel_format (CdTransform *transform, CdPixelFormat pixel_format)
 {
 	CdTransformPrivate *priv = GET_PRIVATE (transform);
+	g_autoptr(GMutexLocker) locker = NULL;
 
 	g_return_if_fail (CD_IS_TRANSFORM (transform));
 	g_return_if_fail (pixel_format != CD_PIXEL_FORMAT_UNKNOWN);
+	locker = g_mutex_locker_new (&priv->setup_mutex);
 
 	priv->input_pixel_format = pixel_format;
 	cd_transform_invalidate (transform);
@@ -296,9 +385,11 @@ void
 cd_transform_set_output_pixel_format (CdTransform *transform, CdPixelFormat pixel_format)
 {
 	CdTransformPrivate *priv = GET_PRIVATE (transform);
+	g_autoptr(GMutexLocker) locker = NULL;
 
 	g_return_if_fail (CD_IS_TRANSFORM (transform));
 	g_return_if_fail (pixel_format != CD_PIXEL_FORMAT_UNKNOWN);
+	locker = g_mutex_locker_new (&priv->setup_mutex);
 
 	priv->output_pixel_format = pixel_format;
 	cd_transform_invalidate (transform);
@@ -335,9 +426,11 @@ void
 cd_transform_set_rendering_intent (CdTransform *transform, CdRenderingIntent rendering_intent)
 {
 	CdTransformPrivate *priv = GET_PRIVATE (transform);
+	g_autoptr(GMutexLocker) locker = NULL;
 
 	g_return_if_fail (CD_IS_TRANSFORM (transform));
 	g_return_if_fail (rendering_intent != CD_RENDERING_INTENT_UNKNOWN);
+	locker = g_mutex_locker_new (&priv->setup_mutex);
 
 	priv->rendering_intent = rendering_intent;
 	cd_transform_invalidate (transform);
@@ -374,8 +467,10 @@ void
 cd_transform_set_bpc (CdTransform *transform, gboolean bpc)
 {
 	CdTransformPrivate *priv = GET_PRIVATE (transform);
+	g_autoptr(GMutexLocker) locker = NULL;
 
 	g_return_if_fail (CD_IS_TRANSFORM (transform));
+	locker = g_mutex_locker_new (&priv->setup_mutex);
 
 	priv->bpc = bpc;
 	cd_transform_invalidate (transform);
@@ -406,6 +501,9 @@ cd_transform_get_bpc (CdTransform *transform)
  *
  * Sets the maximum number of threads to be used for the transform.
  *
+ * The default only counts physical cores the process is allowed to run
+ * on, and is limited by any cgroup CPU quota.
+ *
  * Since: 1.1.1
  **/
 void
@@ -434,6 +532,133 @@ cd_transform_get_max_threads (CdTransform *transform)
 	return priv->max_threads;
 }
 
+/**
+ * cd_transform_set_numa_aware:
+ * @transform: a #CdTransform instance.
+ * @numa_aware: %TRUE to bind the worker threads to NUMA nodes
+ *
+ * Sets if the image should be split into one band for each NUMA node the
+ * process can run on, with the worker threads for each band bound to the
+ * CPUs of that node.
+ *
+ * This only helps on multi-socket machines where the pixel data is large
+ * and has been written by threads bound in the same way.
+ *
+ * Since: 1.4.9
+ **/
+void
+cd_transform_set_numa_aware (CdTransform *transform, gboolean numa_aware)
+{
+	CdTransformPrivate *priv = GET_PRIVATE (transform);
+	g_autoptr(GMutexLocker) locker = NULL;
+
+	g_return_if_fail (CD_IS_TRANSFORM (transform));
+
+	if (priv->numa_aware == numa_aware)
+		return;
+	priv->numa_aware = numa_aware;
+
+	/* threads that were bound cannot easily be unbound */
+	locker = g_mutex_locker_new (&priv->pool_mutex);
+	if (priv->pool != NULL) {
+		g_thread_pool_free (priv->pool, FALSE, TRUE);
+		priv->pool = NULL;
+	}
+}
+
+/**
+ * cd_transform_get_numa_aware:
+ * @transform: a #CdTransform instance.
+ *
+ * Gets if the worker threads are bound to NUMA nodes.
+ *
+ * Return value: %TRUE if NUMA-aware placement is enabled
+ *
+ * Since: 1.4.9
+ **/
+gboolean
+cd_transform_get_numa_aware (CdTransform *transform)
+{
+	CdTransformPrivate *priv = GET_PRIVATE (transform);
+	g_return_val_if_fail (CD_IS_TRANSFORM (transform), FALSE);
+	return priv->numa_aware;
+}
+
+/**
+ * cd_transform_set_devicelink_dir:
+ * @transform: a #CdTransform instance.
+ * @devicelink_dir: (nullable): a directory, or %NULL to disable
+ *
+ * Sets a directory used to store precompiled devicelink profiles.
+ *
+ * When set, the whole chain of profiles is saved as a devicelink the first
+ * time the transform is set up, and later setups in any process load the
+ * devicelink rather than linking the input, abstract and output profiles.
+ * The files are named using the checksums of the profiles, so profiles
+ * without a checksum are not saved.
+ *
+ * Since: 1.4.9
+ **/
+void
+cd_transform_set_devicelink_dir (CdTransform *transform, const gchar *devicelink_dir)
+{
+	CdTransformPrivate *priv = GET_PRIVATE (transform);
+	g_autoptr(GMutexLocker) locker = NULL;
+	g_return_if_fail (CD_IS_TRANSFORM (transform));
+	locker = g_mutex_locker_new (&priv->setup_mutex);
+
+	g_free (priv->devicelink_dir);
+	priv->devicelink_dir = g_strdup (devicelink_dir);
+	cd_transform_invalidate (transform);
+}
+
+/**
+ * cd_transform_get_devicelink_dir:
+ * @transform: a #CdTransform instance.
+ *
+ * Gets the directory used to store precompiled devicelink profiles.
+ *
+ * Return value: a directory, or %NULL if unset
+ *
+ * Since: 1.4.9
+ **/
+const gchar *
+cd_transform_get_devicelink_dir (CdTransform *transform)
+{
+	CdTransformPrivate *priv = GET_PRIVATE (transform);
+	g_return_val_if_fail (CD_IS_TRANSFORM (transform), NULL);
+	return priv->devicelink_dir;
+}
+
+/**
+ * cd_transform_get_tile_counts:
+ * @transform: a #CdTransform instance.
+ *
+ * Gets the number of tiles each worker thread processed during the last
+ * threaded call to cd_transform_process(). This can be used to check how
+ * evenly the work was shared between the threads.
+ *
+ * Return value: (transfer container) (element-type guint): tile counts
+ *
+ * Since: 1.4.9
+ **/
+GArray *
+cd_transform_get_tile_counts (CdTransform *transform)
+{
+	CdTransformPrivate *priv = GET_PRIVATE (transform);
+	GArray *array;
+	guint i;
+	g_autoptr(GMutexLocker) locker = NULL;
+
+	g_return_val_if_fail (CD_IS_TRANSFORM (transform), NULL);
+
+	locker = g_mutex_locker_new (&priv->pool_mutex);
+	array = g_array_sized_new (FALSE, FALSE, sizeof (guint), priv->jobs_used);
+	for (i = 0; i < priv->jobs_used; i++)
+		g_array_append_val (array, priv->jobs[i].tiles_processed);
+	return array;
+}
+
 /* map lcms intent to colord type */
 const struct {
 	gint					lcms;
@@ -446,10 +671,19 @@ const struct {
 	{ 0,				CD_RENDERING_INTENT_LAST }
 };
 
-static guint
+guint
+cd_transform_get_planes (CdPixelFormat format)
+{
+	if (!T_PLANAR (format))
+		return 1;
+	return T_CHANNELS (format) + T_EXTRA (format);
+}
+
+guint
 cd_transform_get_bpp (CdPixelFormat format)
 {
-	switch (format) {
+	/* planar formats have the same sample size as interleaved */
+	switch (format & ~PLANAR_SH (1)) {
 	case CD_PIXEL_FORMAT_RGB24:
 		return 3;
 	case CD_PIXEL_FORMAT_ARGB32:
@@ -457,97 +691,407 @@ cd_transform_get_bpp (CdPixelFormat format)
 	case CD_PIXEL_FORMAT_BGRA32:
 	case CD_PIXEL_FORMAT_RGBA32:
 		return 4;
+	case CD_PIXEL_FORMAT_RGB48:
+	case CD_PIXEL_FORMAT_RGB48_HALF:
+		return 6;
+	case CD_PIXEL_FORMAT_RGBA64:
+	case CD_PIXEL_FORMAT_RGBA64_HALF:
+		return 8;
+	case CD_PIXEL_FORMAT_RGB96_FLOAT:
+		return 12;
+	case CD_PIXEL_FORMAT_RGBA128_FLOAT:
+		return 16;
 	case CD_PIXEL_FORMAT_UNKNOWN:
 	default:
 		return 0;
 	}
 }
 
+static const gchar *
+cd_transform_get_checksum (CdIcc *icc, const gchar *fallback)
+{
+	if (icc == NULL)
+		return fallback;
+	return cd_icc_get_checksum (icc);
+}
+
+/* the checksum does not change when the profile is modified in memory */
+static gchar *
+cd_transform_get_icc_key (CdIcc *icc, const gchar *fallback)
+{
+	const gchar *checksum = cd_transform_get_checksum (icc, fallback);
+	if (checksum == NULL)
+		return NULL;
+	if (icc != NULL && cd_icc_get_generation (icc) > 0)
+		return g_strdup_printf ("%s#%u", checksum, cd_icc_get_generation (icc));
+	return g_strdup (checksum);
+}
+
+static gchar *
+cd_transform_get_cache_key (CdTransform *transform)
+{
+	CdTransformPrivate *priv = GET_PRIVATE (transform);
+	g_autofree gchar *checksum_in = NULL;
+	g_autofree gchar *checksum_out = NULL;
+	g_autofree gchar *checksum_abstract = NULL;
+
+	/* profiles created in memory have no checksum */
+	checksum_in = cd_transform_get_icc_key (priv->input_icc, "srgb");
+	checksum_out = cd_transform_get_icc_key (priv->output_icc, "srgb");
+	checksum_abstract = cd_transform_get_icc_key (priv->abstract_icc, "none");
+	if (checksum_in == NULL || checksum_out == NULL || checksum_abstract == NULL)
+		return NULL;
+	return g_strdup_printf ("%s:%s:%s:%08x:%08x:%i:%i",
+				checksum_in,
+				checksum_out,
+				checksum_abstract,
+				priv->input_pixel_format & ~PLANAR_SH (1),
+				priv->output_pixel_format & ~PLANAR_SH (1),
+				priv->rendering_intent,
+				priv->bpc);
+}
+
+/* a profile loaded with CD_ICC_LOAD_FLAGS_HEADER_ONLY may fail to parse */
 static gboolean
-cd_transform_setup (CdTransform *transform, GError **error)
+cd_transform_add_icc (cmsHPROFILE *profiles,
+		      guint *nprofiles,
+		      CdIcc *icc,
+		      GError **error)
+{
+	cmsHPROFILE lcms_profile = cd_icc_get_handle (icc);
+	if (lcms_profile == NULL) {
+		g_set_error (error,
+			     CD_TRANSFORM_ERROR,
+			     CD_TRANSFORM_ERROR_FAILED_TO_SETUP_TRANSFORM,
+			     "failed to load %s",
+			     cd_icc_get_filename (icc));
+		return FALSE;
+	}
+	profiles[(*nprofiles)++] = lcms_profile;
+	return TRUE;
+}
+
+/* gets the chain of profiles and the lcms parameters for the transform */
+static gboolean
+cd_transform_get_chain (CdTransform *transform,
+			cmsHPROFILE *profiles,
+			guint *nprofiles,
+			gint *lcms_intent,
+			cmsUInt32Number *lcms_flags,
+			GError **error)
 {
 	CdTransformPrivate *priv = GET_PRIVATE (transform);
-	cmsHPROFILE profile_in;
-	cmsHPROFILE profile_out;
-	cmsUInt32Number lcms_flags = 0;
-	gboolean ret = TRUE;
-	gint lcms_intent = -1;
 	guint i;
-	g_autoptr(GError) error_local = NULL;
 
 	/* find native rendering intent */
+	*lcms_intent = -1;
 	for (i = 0; map_rendering_intent[i].colord != CD_RENDERING_INTENT_LAST; i++) {
 		if (map_rendering_intent[i].colord == priv->rendering_intent) {
-			lcms_intent = map_rendering_intent[i].lcms;
+			*lcms_intent = map_rendering_intent[i].lcms;
 			break;
 		}
 	}
-	g_assert (lcms_intent != -1);
+	g_assert (*lcms_intent != -1);
+
+	/* get flags */
+	*lcms_flags = 0;
+	if (priv->bpc)
+		*lcms_flags |= cmsFLAGS_BLACKPOINTCOMPENSATION;
 
 	/* get input profile */
+	*nprofiles = 0;
 	if (priv->input_icc != NULL) {
 		g_debug ("using input profile of %s",
 			 cd_icc_get_filename (priv->input_icc));
-		profile_in = cd_icc_get_handle (priv->input_icc);
+		if (!cd_transform_add_icc (profiles, nprofiles, priv->input_icc, error))
+			return FALSE;
+
+		/* a devicelink already goes all the way to the device */
+		if (cd_icc_get_kind (priv->input_icc) == CD_PROFILE_KIND_DEVICELINK &&
+		    priv->abstract_icc == NULL &&
+		    priv->output_icc == NULL) {
+			g_debug ("using devicelink as the whole chain");
+			return TRUE;
+		}
 	} else {
 		g_debug ("no input profile, assume sRGB");
-		profile_in = priv->srgb;
+		profiles[(*nprofiles)++] = priv->srgb;
+	}
+
+	/* get abstract profile */
+	if (priv->abstract_icc != NULL) {
+		if (cd_icc_get_colorspace (priv->abstract_icc) != CD_COLORSPACE_LAB) {
+			g_set_error_literal (error,
+					     CD_TRANSFORM_ERROR,
+					     CD_TRANSFORM_ERROR_INVALID_COLORSPACE,
+					     "abstract colorspace has to be Lab");
+			return FALSE;
+		}
+		if (!cd_transform_add_icc (profiles, nprofiles, priv->abstract_icc, error))
+			return FALSE;
 	}
 
 	/* get output profile */
 	if (priv->output_icc != NULL) {
 		g_debug ("using output profile of %s",
 			 cd_icc_get_filename (priv->output_icc));
-		profile_out = cd_icc_get_handle (priv->output_icc);
+		if (!cd_transform_add_icc (profiles, nprofiles, priv->output_icc, error))
+			return FALSE;
 	} else {
 		g_debug ("no output profile, assume sRGB");
-		profile_out = priv->srgb;
+		profiles[(*nprofiles)++] = priv->srgb;
 	}
+	return TRUE;
+}
 
-	/* get flags */
-	if (priv->bpc)
-		lcms_flags |= cmsFLAGS_BLACKPOINTCOMPENSATION;
+static CdIcc *
+cd_transform_create_devicelink (cmsHPROFILE *profiles,
+				guint nprofiles,
+				gint lcms_intent,
+				cmsUInt32Number lcms_flags,
+				GError **error)
+{
+	cmsContext context_lcms;
+	cmsHPROFILE devicelink;
+	cmsHTRANSFORM lcms_transform;
+	g_autoptr(CdIcc) icc = cd_icc_new ();
+	g_autoptr(GError) error_local = NULL;
 
-	/* get abstract profile */
-	if (priv->abstract_icc != NULL) {
-		cmsHPROFILE profiles[3];
+	/* use 16 bit so the pipeline is sampled at full precision */
+	context_lcms = cd_icc_get_context (icc);
+	lcms_transform = cmsCreateMultiprofileTransformTHR (context_lcms,
+							    profiles,
+							    nprofiles,
+							    cmsFormatterForColorspaceOfProfile (profiles[0], 2, FALSE),
+							    cmsFormatterForColorspaceOfProfile (profiles[nprofiles - 1], 2, FALSE),
+							    lcms_intent,
+							    lcms_flags);
+	if (lcms_transform == NULL) {
+		if (!cd_context_lcms_error_check (context_lcms, &error_local)) {
+			g_set_error_literal (error,
+					     CD_TRANSFORM_ERROR,
+					     CD_TRANSFORM_ERROR_FAILED_TO_SETUP_TRANSFORM,
+					     error_local->message);
+			return NULL;
+		}
+		g_set_error_literal (error,
+				     CD_TRANSFORM_ERROR,
+				     CD_TRANSFORM_ERROR_FAILED_TO_SETUP_TRANSFORM,
+				     "failed to setup transform, unspecified error");
+		return NULL;
+	}
+	devicelink = cmsTransform2DeviceLink (lcms_transform, 4.3, 0);
+	cmsDeleteTransform (lcms_transform);
+	if (devicelink == NULL) {
+		g_set_error_literal (error,
+				     CD_TRANSFORM_ERROR,
+				     CD_TRANSFORM_ERROR_FAILED_TO_SETUP_TRANSFORM,
+				     "failed to create devicelink");
+		return NULL;
+	}
+	if (!cd_icc_load_handle (icc, devicelink, CD_ICC_LOAD_FLAGS_NONE, error))
+		return NULL;
+	return g_steal_pointer (&icc);
+}
 
-		if (cd_icc_get_colorspace (priv->abstract_icc) != CD_COLORSPACE_LAB) {
+static gchar *
+cd_transform_get_devicelink_filename (CdTransform *transform)
+{
+	CdTransformPrivate *priv = GET_PRIVATE (transform);
+	const gchar *checksum_in;
+	const gchar *checksum_out;
+	const gchar *checksum_abstract;
+	g_autofree gchar *basename = NULL;
+	g_autofree gchar *key = NULL;
+
+	/* profiles modified in memory cannot be found again next time */
+	if ((priv->input_icc != NULL && cd_icc_get_generation (priv->input_icc) > 0) ||
+	    (priv->output_icc != NULL && cd_icc_get_generation (priv->output_icc) > 0) ||
+	    (priv->abstract_icc != NULL && cd_icc_get_generation (priv->abstract_icc) > 0))
+		return NULL;
+
+	/* the devicelink does not depend on the pixel formats */
+	checksum_in = cd_transform_get_checksum (priv->input_icc, "srgb");
+	checksum_out = cd_transform_get_checksum (priv->output_icc, "srgb");
+	checksum_abstract = cd_transform_get_checksum (priv->abstract_icc, "none");
+	if (checksum_in == NULL || checksum_out == NULL || checksum_abstract == NULL)
+		return NULL;
+	key = g_strdup_printf ("%s:%s:%s:%i:%i",
+			       checksum_in,
+			       checksum_out,
+			       checksum_abstract,
+			       priv->rendering_intent,
+			       priv->bpc);
+	basename = g_compute_checksum_for_string (G_CHECKSUM_SHA1, key, -1);
+	return g_strdup_printf ("%s/%s.icc", priv->devicelink_dir, basename);
+}
+
+/* returns the devicelink so that the chain is only compiled once */
+static CdIcc *
+cd_transform_save_devicelink (const gchar *filename,
+			      cmsHPROFILE *profiles,
+			      guint nprofiles,
+			      gint lcms_intent,
+			      cmsUInt32Number lcms_flags,
+			      GError **error)
+{
+	g_autofree gchar *dirname = g_path_get_dirname (filename);
+	g_autoptr(CdIcc) icc = NULL;
+	g_autoptr(GBytes) data = NULL;
+
+	icc = cd_transform_create_devicelink (profiles,
+					      nprofiles,
+					      lcms_intent,
+					      lcms_flags,
+					      error);
+	if (icc == NULL)
+		return NULL;
+	data = cd_icc_save_data (icc, CD_ICC_SAVE_FLAGS_NONE, error);
+	if (data == NULL)
+		return NULL;
+	if (g_mkdir_with_parents (dirname, 0700) < 0) {
+		g_set_error (error,
+			     G_IO_ERROR,
+			     g_io_error_from_errno (errno),
+			     "failed to create %s", dirname);
+		return NULL;
+	}
+	if (!g_file_set_contents (filename,
+				  g_bytes_get_data (data, NULL),
+				  (gssize) g_bytes_get_size (data),
+				  error))
+		return NULL;
+	return g_steal_pointer (&icc);
+}
+
+static gboolean
+cd_transform_setup (CdTransform *transform, GError **error)
+{
+	CdTransformPrivate *priv = GET_PRIVATE (transform);
+	CdPixelFormat format_in;
+	CdPixelFormat format_out;
+	cmsHPROFILE devicelink = NULL;
+	cmsHPROFILE profiles[3];
+	cmsHPROFILE profile_in;
+	cmsHPROFILE profile_out;
+	cmsUInt32Number lcms_flags = 0;
+	gboolean ret = TRUE;
+	gint lcms_intent = -1;
+	guint nprofiles = 0;
+	g_autofree gchar *cache_key = NULL;
+	g_autofree gchar *devicelink_fn = NULL;
+	g_autoptr(CdIcc) devicelink_icc = NULL;
+	g_autoptr(GError) error_local = NULL;
+
+	ret = cd_transform_get_chain (transform,
+				      profiles,
+				      &nprofiles,
+				      &lcms_intent,
+				      &lcms_flags,
+				      error);
+	if (!ret)
+		goto out;
+	profile_in = profiles[0];
+	profile_out = profiles[nprofiles - 1];
+
+	/* planes are interleaved a row at a time before calling lcms */
+	format_in = priv->input_pixel_format & ~PLANAR_SH (1);
+	format_out = priv->output_pixel_format & ~PLANAR_SH (1);
+
+	/* find the bpp value */
+	priv->bpp_input = cd_transform_get_bpp (priv->input_pixel_format);
+	priv->bpp_output = cd_transform_get_bpp (priv->output_pixel_format);
+	priv->planes_input = cd_transform_get_planes (priv->input_pixel_format);
+	priv->planes_output = cd_transform_get_planes (priv->output_pixel_format);
+	priv->colors_output = T_CHANNELS (priv->output_pixel_format);
+
+	/* matrix/TRC to matrix/TRC can skip the lcms pipeline entirely */
+	if (priv->abstract_icc == NULL) {
+		priv->fast = cd_transform_fast_new (profile_in,
+						    format_in,
+						    profile_out,
+						    format_out,
+						    lcms_intent,
+						    lcms_flags);
+		if (priv->fast != NULL) {
+			g_debug ("using native matrix-shaper transform");
+			goto out;
+		}
+	}
+
+	/* use a precompiled devicelink if one exists */
+	if (priv->devicelink_dir != NULL)
+		devicelink_fn = cd_transform_get_devicelink_filename (transform);
+	if (devicelink_fn != NULL) {
+		gsize len = 0;
+		g_autofree gchar *data = NULL;
+		if (g_file_get_contents (devicelink_fn, &data, &len, NULL)) {
+			devicelink = cmsOpenProfileFromMemTHR (priv->context_lcms,
+							       data, len);
+			if (devicelink == NULL) {
+				g_warning ("failed to load devicelink %s", devicelink_fn);
+				cd_context_lcms_error_clear (priv->context_lcms);
+			}
+		}
+	}
+
+	/* otherwise compile one now, and use it straight away */
+	if (devicelink == NULL && devicelink_fn != NULL) {
+		devicelink_icc = cd_transform_save_devicelink (devicelink_fn,
+							       profiles,
+							       nprofiles,
+							       lcms_intent,
+							       lcms_flags,
+							       &error_local);
+		if (devicelink_icc == NULL) {
+			g_warning ("failed to save devicelink: %s",
+				   error_local->message);
+			g_clear_error (&error_local);
+		}
+	}
+
+	/* a devicelink replaces the whole chain */
+	if (devicelink != NULL) {
+		g_debug ("using devicelink %s", devicelink_fn);
+		profiles[0] = devicelink;
+		nprofiles = 1;
+	} else if (devicelink_icc != NULL) {
+		g_debug ("using new devicelink %s", devicelink_fn);
+		profiles[0] = cd_icc_get_handle (devicelink_icc);
+		nprofiles = 1;
+	}
+
+	/* share an identical transform with other instances if possible */
+	if (cd_transform_cache_get_max_size () > 0)
+		cache_key = cd_transform_get_cache_key (transform);
+	if (cache_key != NULL) {
+		priv->cache_item = cd_transform_cache_lookup (cache_key,
+							      profiles,
+							      nprofiles,
+							      format_in,
+							      format_out,
+							      lcms_intent,
+							      lcms_flags,
+							      &error_local);
+		if (priv->cache_item == NULL) {
 			ret = FALSE;
 			g_set_error_literal (error,
 					     CD_TRANSFORM_ERROR,
-					     CD_TRANSFORM_ERROR_INVALID_COLORSPACE,
-					     "abstract colorspace has to be Lab");
+					     CD_TRANSFORM_ERROR_FAILED_TO_SETUP_TRANSFORM,
+					     error_local->message);
 			goto out;
 		}
-
-		/* generate a devicelink */
-		profiles[0] = profile_in;
-		profiles[1] = cd_icc_get_handle (priv->abstract_icc);
-		profiles[2] = profile_out;
+		priv->lcms_transform = cd_transform_cache_item_get_handle (priv->cache_item);
+	} else {
 		priv->lcms_transform = cmsCreateMultiprofileTransformTHR (priv->context_lcms,
 									  profiles,
-									  3,
-									  priv->input_pixel_format,
-									  priv->output_pixel_format,
+									  nprofiles,
+									  format_in,
+									  format_out,
 									  lcms_intent,
 									  lcms_flags);
-
-	} else {
-		/* create basic transform */
-		priv->lcms_transform = cmsCreateTransformTHR (priv->context_lcms,
-							      profile_in,
-							      priv->input_pixel_format,
-							      profile_out,
-							      priv->output_pixel_format,
-							      lcms_intent,
-							      lcms_flags);
 	}
 
-	/* find the bpp value */
-	priv->bpp_input = cd_transform_get_bpp (priv->input_pixel_format);
-	priv->bpp_output = cd_transform_get_bpp (priv->input_pixel_format);
-
 	/* failed? */
 	if (priv->lcms_transform == NULL) {
 		ret = cd_context_lcms_error_check (priv->context_lcms, &error_local);
@@ -566,16 +1110,200 @@ cd_transform_setup (CdTransform *transform, GError **error)
 		goto out;
 	}
 out:
+	if (!ret)
+		cd_transform_clear_state (transform);
+	if (devicelink != NULL)
+		cmsCloseProfile (devicelink);
 	return ret;
 }
 
-typedef struct {
-	guint8	*p_in;
-	guint8	*p_out;
-	guint	 width;
-	guint	 rowstride;
-	guint	 rows_to_process;
-} CdTransformJob;
+/**
+ * cd_transform_get_devicelink:
+ * @transform: a #CdTransform instance.
+ * @error: A #GError, or %NULL
+ *
+ * Exports the input, abstract and output profiles as a single devicelink
+ * profile, which can be saved using cd_icc_save_data() and used later as
+ * the input profile of a transform with no abstract or output profile.
+ * In that case the devicelink is used on its own rather than being
+ * followed by sRGB.
+ *
+ * Return value: (transfer full): a #CdIcc, or %NULL for error
+ *
+ * Since: 1.4.9
+ **/
+CdIcc *
+cd_transform_get_devicelink (CdTransform *transform, GError **error)
+{
+	CdTransformPrivate *priv = GET_PRIVATE (transform);
+	cmsHPROFILE profiles[3];
+	cmsUInt32Number lcms_flags;
+	gint lcms_intent;
+	guint nprofiles;
+	g_autoptr(GMutexLocker) locker = NULL;
+
+	g_return_val_if_fail (CD_IS_TRANSFORM (transform), NULL);
+
+	locker = g_mutex_locker_new (&priv->setup_mutex);
+	if (priv->rendering_intent == CD_RENDERING_INTENT_UNKNOWN) {
+		g_set_error_literal (error,
+				     CD_TRANSFORM_ERROR,
+				     CD_TRANSFORM_ERROR_FAILED_TO_SETUP_TRANSFORM,
+				     "rendering intent not set");
+		return NULL;
+	}
+	if (!cd_transform_get_chain (transform,
+				     profiles,
+				     &nprofiles,
+				     &lcms_intent,
+				     &lcms_flags,
+				     error))
+		return NULL;
+	return cd_transform_create_devicelink (profiles,
+					       nprofiles,
+					       lcms_intent,
+					       lcms_flags,
+					       error);
+}
+
+gsize
+cd_transform_get_tile_size (void)
+{
+	static gsize tile_size = 0;
+
+	/* aim for the input and output rows of a tile to fit in L2 */
+	if (g_once_init_enter (&tile_size)) {
+		glong l2_size = -1;
+#ifdef _SC_LEVEL2_CACHE_SIZE
+		l2_size = sysconf (_SC_LEVEL2_CACHE_SIZE);
+#endif
+		if (l2_size <= 0)
+			l2_size = CD_TRANSFORM_TILE_SIZE_DEFAULT;
+		g_once_init_leave (&tile_size, (gsize) l2_size / 2);
+	}
+	return tile_size;
+}
+
+/* gathers one row of separate planes into interleaved pixels */
+static void
+cd_transform_interleave_row (const CdTransformBuffer *buf,
+			     guint row,
+			     guint8 *dest,
+			     guint width,
+			     guint planes,
+			     guint sample_size)
+{
+	guint p;
+	guint x;
+
+	for (p = 0; p < planes; p++) {
+		const guint8 *src = buf->planes[p] + (gsize) row * buf->strides[p];
+		guint8 *tmp = dest + p * sample_size;
+		for (x = 0; x < width; x++) {
+			memcpy (tmp, src, sample_size);
+			src += sample_size;
+			tmp += planes * sample_size;
+		}
+	}
+}
+
+/* scatters one row of interleaved pixels into separate planes */
+static void
+cd_transform_deinterleave_row (const guint8 *src,
+			       const CdTransformBuffer *buf,
+			       guint row,
+			       guint width,
+			       guint planes,
+			       guint colors,
+			       guint sample_size)
+{
+	guint p;
+	guint x;
+
+	/* like lcms, the alpha plane is not written */
+	for (p = 0; p < colors; p++) {
+		const guint8 *tmp = src + p * sample_size;
+		guint8 *dest = buf->planes[p] + (gsize) row * buf->strides[p];
+		for (x = 0; x < width; x++) {
+			memcpy (dest, tmp, sample_size);
+			dest += sample_size;
+			tmp += planes * sample_size;
+		}
+	}
+}
+
+/* returns %NULL for interleaved formats, which need no scratch row */
+static guint8 *
+cd_transform_ensure_scratch (guint8 **scratch,
+			     gsize *scratch_size,
+			     guint planes,
+			     guint bpp,
+			     guint width)
+{
+	gsize size = (gsize) width * bpp;
+	if (planes <= 1)
+		return NULL;
+	if (*scratch_size < size) {
+		g_free (*scratch);
+		*scratch = g_new (guint8, size);
+		*scratch_size = size;
+	}
+	return *scratch;
+}
+
+/* planar data goes through the interleaved scratch rows a row at a time */
+static void
+cd_transform_process_rows (CdTransform *transform,
+			   const CdTransformBuffer *in,
+			   const CdTransformBuffer *out,
+			   guint8 *scratch_in,
+			   guint8 *scratch_out,
+			   guint width,
+			   guint row,
+			   guint rows)
+{
+	CdTransformPrivate *priv = GET_PRIVATE (transform);
+	guint i;
+
+	for (i = row; i < row + rows; i++) {
+		guint8 *p_in;
+		guint8 *p_out;
+
+		if (scratch_in != NULL) {
+			cd_transform_interleave_row (in, i, scratch_in, width,
+						     priv->planes_input,
+						     priv->bpp_input / priv->planes_input);
+			p_in = scratch_in;
+		} else {
+			p_in = in->planes[0] + (gsize) i * in->strides[0];
+		}
+		if (scratch_out != NULL)
+			p_out = scratch_out;
+		else
+			p_out = out->planes[0] + (gsize) i * out->strides[0];
+		if (priv->fast != NULL)
+			cd_transform_fast_process (priv->fast, p_in, p_out, width);
+		else
+			cmsDoTransform (priv->lcms_transform, p_in, p_out, width);
+		if (scratch_out != NULL) {
+			cd_transform_deinterleave_row (scratch_out, out, i, width,
+						       priv->planes_output,
+						       priv->colors_output,
+						       priv->bpp_output / priv->planes_output);
+		}
+	}
+}
+
+/* cut the image into cache-sized tiles of whole rows */
+static guint
+cd_transform_get_tile_rows (CdTransform *transform, guint width, guint height)
+{
+	CdTransformPrivate *priv = GET_PRIVATE (transform);
+	gsize tile_rows;
+
+	tile_rows = cd_transform_get_tile_size () / ((gsize) width * MAX (priv->bpp_input, 1));
+	return CLAMP (tile_rows, 1, height);
+}
 
 static void
 cd_transform_process_func (gpointer data, gpointer user_data)
@@ -583,43 +1311,310 @@ cd_transform_process_func (gpointer data, gpointer user_data)
 	CdTransformJob *job = (CdTransformJob *) data;
 	CdTransform *transform = CD_TRANSFORM (user_data);
 	CdTransformPrivate *priv = GET_PRIVATE (transform);
+	guint8 *scratch_in;
+	guint8 *scratch_out;
+
+	/* the pool threads are exclusive, so can stay bound afterwards */
+	if (job->node >= 0) {
+		g_autoptr(GError) error = NULL;
+		if (!cd_cpu_bind_to_node ((guint) job->node, &error))
+			g_debug ("%s", error->message);
+	}
+
+	/* allocated after binding so the rows are local to the node */
+	scratch_in = cd_transform_ensure_scratch (&job->scratch_in,
+						  &job->scratch_in_size,
+						  priv->planes_input,
+						  priv->bpp_input,
+						  job->width);
+	scratch_out = cd_transform_ensure_scratch (&job->scratch_out,
+						   &job->scratch_out_size,
+						   priv->planes_output,
+						   priv->bpp_output,
+						   job->width);
+
+	/* keep taking the next unclaimed tile until there are none left */
+	while (TRUE) {
+		guint row;
+		guint tile;
+
+		/* abandon the remaining tiles */
+		if (g_cancellable_is_cancelled (job->cancellable))
+			break;
+		tile = job->tile_first + (guint) g_atomic_int_add (job->tiles_next, 1);
+		if (tile >= job->tile_end)
+			break;
+		row = tile * job->tile_rows;
+		cd_transform_process_rows (transform,
+					   &job->in,
+					   &job->out,
+					   scratch_in,
+					   scratch_out,
+					   job->width,
+					   row,
+					   MIN (job->tile_rows, job->height - row));
+		job->tiles_processed++;
+		g_atomic_int_inc (&priv->progress_done);
+	}
+
+	/* wake up the caller when the last worker is done */
+	g_mutex_lock (&priv->jobs_mutex);
+	if (--priv->jobs_pending == 0)
+		g_cond_signal (&priv->jobs_cond);
+	g_mutex_unlock (&priv->jobs_mutex);
+}
+
+static gboolean
+cd_transform_ensure_pool (CdTransform *transform, GError **error)
+{
+	CdTransformPrivate *priv = GET_PRIVATE (transform);
+
+	/* the pool and its threads are kept for the lifetime of the object */
+	if (priv->pool == NULL) {
+		priv->pool = g_thread_pool_new (cd_transform_process_func,
+						transform,
+						(gint) priv->max_threads,
+						TRUE,
+						error);
+		if (priv->pool == NULL)
+			return FALSE;
+	} else if (g_thread_pool_get_max_threads (priv->pool) != (gint) priv->max_threads) {
+		if (!g_thread_pool_set_max_threads (priv->pool,
+						    (gint) priv->max_threads,
+						    error))
+			return FALSE;
+	}
+
+	/* claimed tiles are counted separately for each node */
+	if (priv->tiles_next == NULL)
+		priv->tiles_next = g_new0 (gint, cd_cpu_get_n_nodes ());
+
+	/* the job descriptors and their scratch rows are reused for every call */
+	if (priv->jobs_size < priv->max_threads) {
+		priv->jobs = g_renew (CdTransformJob, priv->jobs, priv->max_threads);
+		memset (priv->jobs + priv->jobs_size, 0,
+			(priv->max_threads - priv->jobs_size) * sizeof (CdTransformJob));
+		priv->jobs_size = priv->max_threads;
+	}
+	return TRUE;
+}
+
+static gboolean
+cd_transform_process_threaded (CdTransform *transform,
+			       const CdTransformBuffer *in,
+			       const CdTransformBuffer *out,
+			       guint width,
+			       guint height,
+			       GCancellable *cancellable,
+			       GError **error)
+{
+	CdTransformPrivate *priv = GET_PRIVATE (transform);
+	gboolean ret = TRUE;
 	guint i;
+	guint jobs_to_push;
+	guint n_nodes = 1;
+	guint tile_rows;
+	guint tiles_total;
+	g_autoptr(GMutexLocker) locker = g_mutex_locker_new (&priv->pool_mutex);
+
+	if (!cd_transform_ensure_pool (transform, error))
+		return FALSE;
+
+	tile_rows = cd_transform_get_tile_rows (transform, width, height);
+	tiles_total = (height + tile_rows - 1) / tile_rows;
+	g_atomic_int_set (&priv->progress_done, 0);
+	g_atomic_int_set (&priv->progress_total, (gint) tiles_total);
+
+	/* each worker claims tiles from the shared counter as it goes */
+	jobs_to_push = MIN (priv->max_threads, tiles_total);
+
+	/* give each node a contiguous band of the image */
+	if (priv->numa_aware)
+		n_nodes = MIN (cd_cpu_get_n_nodes (), jobs_to_push);
+	for (i = 0; i < n_nodes; i++)
+		priv->tiles_next[i] = 0;
+	for (i = 0; i < jobs_to_push; i++) {
+		CdTransformJob *job = &priv->jobs[i];
+		guint node = i % n_nodes;
+		job->in = *in;
+		job->out = *out;
+		job->width = width;
+		job->height = height;
+		job->tile_rows = tile_rows;
+		job->tile_first = node * tiles_total / n_nodes;
+		job->tile_end = (node + 1) * tiles_total / n_nodes;
+		job->tiles_next = &priv->tiles_next[node];
+		job->node = n_nodes > 1 ? (gint) node : -1;
+		job->tiles_processed = 0;
+		job->cancellable = cancellable;
+	}
+	priv->jobs_used = jobs_to_push;
 
-	for (i = 0; i < job->rows_to_process; i++) {
-		cmsDoTransformStride (priv->lcms_transform,
-				      job->p_in,
-				      job->p_out,
-				      job->width,
-				      job->rowstride);
-		job->p_in += job->rowstride;
-		job->p_out += job->rowstride;
+	/* queue all the jobs, then wait for them to complete */
+	priv->jobs_pending = jobs_to_push;
+	for (i = 0; i < jobs_to_push; i++) {
+		ret = g_thread_pool_push (priv->pool, &priv->jobs[i], error);
+		if (!ret) {
+			g_mutex_lock (&priv->jobs_mutex);
+			priv->jobs_pending -= jobs_to_push - i;
+			g_mutex_unlock (&priv->jobs_mutex);
+			break;
+		}
+	}
+	g_mutex_lock (&priv->jobs_mutex);
+	while (priv->jobs_pending > 0)
+		g_cond_wait (&priv->jobs_cond, &priv->jobs_mutex);
+	g_mutex_unlock (&priv->jobs_mutex);
+	return ret;
+}
+
+static void
+cd_transform_process_unthreaded (CdTransform *transform,
+				 const CdTransformBuffer *in,
+				 const CdTransformBuffer *out,
+				 guint width,
+				 guint height,
+				 GCancellable *cancellable)
+{
+	CdTransformPrivate *priv = GET_PRIVATE (transform);
+	gsize scratch_in_size = 0;
+	gsize scratch_out_size = 0;
+	guint row;
+	guint tile_rows = cd_transform_get_tile_rows (transform, width, height);
+	g_autofree guint8 *scratch_in = NULL;
+	g_autofree guint8 *scratch_out = NULL;
+
+	/* concurrent callers can get here, so the rows are not shared */
+	cd_transform_ensure_scratch (&scratch_in, &scratch_in_size,
+				     priv->planes_input, priv->bpp_input, width);
+	cd_transform_ensure_scratch (&scratch_out, &scratch_out_size,
+				     priv->planes_output, priv->bpp_output, width);
+
+	g_atomic_int_set (&priv->progress_done, 0);
+	g_atomic_int_set (&priv->progress_total, (gint) ((height + tile_rows - 1) / tile_rows));
+	for (row = 0; row < height; row += tile_rows) {
+		if (g_cancellable_is_cancelled (cancellable))
+			return;
+		cd_transform_process_rows (transform,
+					   in,
+					   out,
+					   scratch_in,
+					   scratch_out,
+					   width,
+					   row,
+					   MIN (tile_rows, height - row));
+		g_atomic_int_inc (&priv->progress_done);
 	}
-	g_slice_free (CdTransformJob, job);
 }
 
 static gboolean
 cd_transform_set_max_threads_default (CdTransform *transform, GError **error)
 {
 	CdTransformPrivate *priv = GET_PRIVATE (transform);
-	gchar *tmp;
-	g_autofree gchar *data = NULL;
 
-	/* use "cpu cores" to work out best number of threads */
-	if (!g_file_get_contents ("/proc/cpuinfo", &data, NULL, error))
-		return FALSE;
-	tmp = g_strstr_len (data, -1, "cpu cores\t: ");
-	if (tmp == NULL) {
-		/* some processors do not provide this info */
-		priv->max_threads = 1;
-		return TRUE;
+	/* this is probed only once per process */
+	priv->max_threads = cd_cpu_get_n_threads ();
+	return TRUE;
+}
+
+/* planes are stored one after the other for the single buffer API */
+static void
+cd_transform_buffer_init (CdTransformBuffer *buf,
+			  guint8 *data,
+			  guint rowstride,
+			  guint height,
+			  CdPixelFormat format)
+{
+	guint i;
+	guint planes = cd_transform_get_planes (format);
+	gsize sample_size = cd_transform_get_bpp (format) / planes;
+
+	for (i = 0; i < planes; i++) {
+		buf->planes[i] = data + i * (gsize) rowstride * height * sample_size;
+		buf->strides[i] = (gsize) rowstride * sample_size;
 	}
-	priv->max_threads = g_ascii_strtoull (tmp + 12, NULL, 10);
+}
+
+static gboolean
+cd_transform_process_buffers (CdTransform *transform,
+			      const CdTransformBuffer *in,
+			      const CdTransformBuffer *out,
+			      guint width,
+			      guint height,
+			      GCancellable *cancellable,
+			      GError **error)
+{
+	CdTransformPrivate *priv = GET_PRIVATE (transform);
+	gboolean ret = TRUE;
+	g_autoptr(GMutexLocker) locker = NULL;
+
+	/* this might be called from several threads using the async API */
+	locker = g_mutex_locker_new (&priv->setup_mutex);
+
+	/* get the best number of threads */
 	if (priv->max_threads == 0) {
-		priv->max_threads = 1;
+		ret = cd_transform_set_max_threads_default (transform, error);
+		if (!ret)
+			goto out;
+	}
+
+	/* setup the transform if required */
+	if (priv->lcms_transform == NULL && priv->fast == NULL) {
+		ret = cd_transform_setup (transform, error);
+		if (!ret)
+			goto out;
+	}
+
+	/* any setter now waits until the transform is no longer in use */
+	g_rw_lock_reader_lock (&priv->state_lock);
+	g_clear_pointer (&locker, g_mutex_locker_free);
+
+	/* non-threaded conversion */
+	if (priv->max_threads == 1) {
+		cd_transform_process_unthreaded (transform,
+						 in,
+						 out,
+						 width,
+						 height,
+						 cancellable);
+	} else {
+		/* split the image across the worker pool */
+		ret = cd_transform_process_threaded (transform,
+						     in,
+						     out,
+						     width,
+						     height,
+						     cancellable,
+						     error);
+	}
+
+	/* some tiles may have been skipped */
+	if (ret && g_cancellable_set_error_if_cancelled (cancellable, error))
+		ret = FALSE;
+	g_rw_lock_reader_unlock (&priv->state_lock);
+out:
+	return ret;
+}
+
+static gboolean
+cd_transform_check_formats (CdTransform *transform, GError **error)
+{
+	CdTransformPrivate *priv = GET_PRIVATE (transform);
+
+	/* check stuff that should have been set */
+	if (priv->rendering_intent == CD_RENDERING_INTENT_UNKNOWN) {
+		g_set_error_literal (error,
+				     CD_TRANSFORM_ERROR,
+				     CD_TRANSFORM_ERROR_FAILED_TO_SETUP_TRANSFORM,
+				     "rendering intent not set");
+		return FALSE;
+	}
+	if (priv->input_pixel_format == CD_PIXEL_FORMAT_UNKNOWN ||
+	    priv->output_pixel_format == CD_PIXEL_FORMAT_UNKNOWN) {
 		g_set_error_literal (error,
 				     CD_TRANSFORM_ERROR,
-				     CD_TRANSFORM_ERROR_LAST,
-				     "Failed to parse number of cores");
+				     CD_TRANSFORM_ERROR_FAILED_TO_SETUP_TRANSFORM,
+				     "pixel format not set");
 		return FALSE;
 	}
 	return TRUE;
@@ -633,13 +1628,22 @@ cd_transform_set_max_threads_default (CdTransform *transform, GError **error)
  * @width: the width of @data_in
  * @height: the height of @data_in
  * @rowstride: the rowstride of @data_in, typically the same as @width
- * @cancellable: A %GError, or %NULL
- * @error: A %GCancellable, or %NULL
+ * @cancellable: A %GCancellable, or %NULL
+ * @error: A %GError, or %NULL
  *
  * Processes a block of data through the transform.
  * Once the transform has been setup it is cached and only re-created if any
  * of the formats, input, output or abstract profiles are changed.
  *
+ * The @rowstride is in pixels and is used for both @data_in and @data_out.
+ * For planar pixel formats the planes are stored one after the other, each
+ * being @rowstride multiplied by @height samples in size. Use
+ * cd_transform_process_planes() for planes in separate buffers.
+ *
+ * If @cancellable is cancelled then the remaining tiles are not processed
+ * and %G_IO_ERROR_CANCELLED is returned, leaving @data_out partially
+ * converted.
+ *
  * Return value: %TRUE if the pixels were successfully transformed.
  *
  * Since: 0.1.34
@@ -654,14 +1658,9 @@ cd_transform_process (CdTransform *transform,
 		      GCancellable *cancellable,
 		      GError **error)
 {
-	CdTransformJob *job;
 	CdTransformPrivate *priv = GET_PRIVATE (transform);
-	gboolean ret = TRUE;
-	GThreadPool *pool = NULL;
-	guint8 *p_in;
-	guint8 *p_out;
-	guint i;
-	guint rows_to_process;
+	CdTransformBuffer in;
+	CdTransformBuffer out;
 
 	g_return_val_if_fail (CD_IS_TRANSFORM (transform), FALSE);
 	g_return_val_if_fail (data_in != NULL, FALSE);
@@ -670,88 +1669,211 @@ cd_transform_process (CdTransform *transform,
 	g_return_val_if_fail (height != 0, FALSE);
 	g_return_val_if_fail (rowstride != 0, FALSE);
 
-	/* check stuff that should have been set */
-	if (priv->rendering_intent == CD_RENDERING_INTENT_UNKNOWN) {
-		ret = FALSE;
-		g_set_error_literal (error,
-				     CD_TRANSFORM_ERROR,
-				     CD_TRANSFORM_ERROR_FAILED_TO_SETUP_TRANSFORM,
-				     "rendering intent not set");
-		goto out;
+	if (!cd_transform_check_formats (transform, error))
+		return FALSE;
+	cd_transform_buffer_init (&in, data_in, rowstride, height,
+				  priv->input_pixel_format);
+	cd_transform_buffer_init (&out, data_out, rowstride, height,
+				  priv->output_pixel_format);
+	return cd_transform_process_buffers (transform,
+					     &in,
+					     &out,
+					     width,
+					     height,
+					     cancellable,
+					     error);
+}
+
+/**
+ * cd_transform_process_planes:
+ * @transform: a #CdTransform instance.
+ * @planes_in: (array): the data buffers to convert, one per plane
+ * @strides_in: (array): the size of each row in @planes_in, in bytes
+ * @planes_out: (array): the data buffers to return, one per plane
+ * @strides_out: (array): the size of each row in @planes_out, in bytes
+ * @width: the width of the image
+ * @height: the height of the image
+ * @cancellable: A %GCancellable, or %NULL
+ * @error: A %GError, or %NULL
+ *
+ * Processes an image through the transform where the input and output can
+ * be in different layouts, for instance from separate planes written by a
+ * decoder to a single interleaved buffer with padded rows.
+ *
+ * For planar pixel formats each of the arrays has an entry for every
+ * channel including alpha, and for interleaved formats just one entry.
+ * The output alpha plane is not written.
+ *
+ * Return value: %TRUE if the pixels were successfully transformed.
+ *
+ * Since: 1.4.9
+ **/
+gboolean
+cd_transform_process_planes (CdTransform *transform,
+			     gpointer *planes_in,
+			     const gsize *strides_in,
+			     gpointer *planes_out,
+			     const gsize *strides_out,
+			     guint width,
+			     guint height,
+			     GCancellable *cancellable,
+			     GError **error)
+{
+	CdTransformPrivate *priv = GET_PRIVATE (transform);
+	CdTransformBuffer in = { { NULL }, { 0 } };
+	CdTransformBuffer out = { { NULL }, { 0 } };
+	guint i;
+
+	g_return_val_if_fail (CD_IS_TRANSFORM (transform), FALSE);
+	g_return_val_if_fail (planes_in != NULL, FALSE);
+	g_return_val_if_fail (strides_in != NULL, FALSE);
+	g_return_val_if_fail (planes_out != NULL, FALSE);
+	g_return_val_if_fail (strides_out != NULL, FALSE);
+	g_return_val_if_fail (width != 0, FALSE);
+	g_return_val_if_fail (height != 0, FALSE);
+
+	if (!cd_transform_check_formats (transform, error))
+		return FALSE;
+	for (i = 0; i < cd_transform_get_planes (priv->input_pixel_format); i++) {
+		g_return_val_if_fail (planes_in[i] != NULL, FALSE);
+		in.planes[i] = planes_in[i];
+		in.strides[i] = strides_in[i];
 	}
-	if (priv->input_pixel_format == CD_PIXEL_FORMAT_UNKNOWN ||
-	    priv->output_pixel_format == CD_PIXEL_FORMAT_UNKNOWN) {
-		ret = FALSE;
-		g_set_error_literal (error,
-				     CD_TRANSFORM_ERROR,
-				     CD_TRANSFORM_ERROR_FAILED_TO_SETUP_TRANSFORM,
-				     "pixel format not set");
-		goto out;
+	for (i = 0; i < cd_transform_get_planes (priv->output_pixel_format); i++) {
+		g_return_val_if_fail (planes_out[i] != NULL, FALSE);
+		out.planes[i] = planes_out[i];
+		out.strides[i] = strides_out[i];
 	}
+	return cd_transform_process_buffers (transform,
+					     &in,
+					     &out,
+					     width,
+					     height,
+					     cancellable,
+					     error);
+}
 
-	/* get the best number of threads */
-	if (priv->max_threads == 0) {
-		ret = cd_transform_set_max_threads_default (transform, error);
-		if (!ret)
-			goto out;
+static void
+cd_transform_process_thread_cb (GTask *task,
+				gpointer source_object,
+				gpointer task_data,
+				GCancellable *cancellable)
+{
+	CdTransform *transform = CD_TRANSFORM (source_object);
+	CdTransformHelper *helper = (CdTransformHelper *) task_data;
+	GError *error = NULL;
+
+	if (!cd_transform_process (transform,
+				   helper->data_in,
+				   helper->data_out,
+				   helper->width,
+				   helper->height,
+				   helper->rowstride,
+				   cancellable,
+				   &error)) {
+		g_task_return_error (task, error);
+		return;
 	}
+	g_task_return_boolean (task, TRUE);
+}
 
-	/* setup the transform if required */
-	if (priv->lcms_transform == NULL) {
-		ret = cd_transform_setup (transform, error);
-		if (!ret)
-			goto out;
-	}
+/**
+ * cd_transform_process_async:
+ * @transform: a #CdTransform instance.
+ * @data_in: the data buffer to convert
+ * @data_out: the data buffer to return, which can be the same as @data_in
+ * @width: the width of @data_in
+ * @height: the height of @data_in
+ * @rowstride: the rowstride of @data_in, typically the same as @width
+ * @cancellable: A %GCancellable, or %NULL
+ * @callback: the function to run on completion
+ * @user_data: the data to pass to @callback
+ *
+ * Processes a block of data through the transform in a worker thread.
+ * The buffers must remain valid until @callback has been called, even if
+ * @cancellable is cancelled. Use cd_transform_get_progress() to find out
+ * how much of the image has been converted so far.
+ *
+ * Changing any of the profiles, formats or other settings of @transform
+ * while this is running blocks until the image has been converted.
+ *
+ * Since: 1.4.9
+ **/
+void
+cd_transform_process_async (CdTransform *transform,
+			    gpointer data_in,
+			    gpointer data_out,
+			    guint width,
+			    guint height,
+			    guint rowstride,
+			    GCancellable *cancellable,
+			    GAsyncReadyCallback callback,
+			    gpointer user_data)
+{
+	CdTransformHelper *helper;
+	g_autoptr(GTask) task = NULL;
 
-	/* non-threaded conversion */
-	if (priv->max_threads == 1) {
-		p_in = data_in;
-		p_out = data_out;
-		for (i = 0; i < height; i++) {
-			cmsDoTransformStride (priv->lcms_transform,
-					      p_in,
-					      p_out,
-					      width,
-					      rowstride);
-			p_in += rowstride * priv->bpp_input;
-			p_out += rowstride * priv->bpp_output;
-		}
-		goto out;
-	}
+	g_return_if_fail (CD_IS_TRANSFORM (transform));
+	g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+
+	helper = g_new0 (CdTransformHelper, 1);
+	helper->data_in = data_in;
+	helper->data_out = data_out;
+	helper->width = width;
+	helper->height = height;
+	helper->rowstride = rowstride;
+	task = g_task_new (G_OBJECT (transform), cancellable, callback, user_data);
+	g_task_set_task_data (task, helper, g_free);
+	g_task_run_in_thread (task, cd_transform_process_thread_cb);
+}
 
-	/* create a threadpool for each line of the image */
-	pool = g_thread_pool_new (cd_transform_process_func,
-				  transform,
-				  priv->max_threads,
-				  TRUE,
-				  error);
-	if (pool == NULL)
-		goto out;
+/**
+ * cd_transform_process_finish:
+ * @transform: a #CdTransform instance.
+ * @res: the #GAsyncResult
+ * @error: A #GError or %NULL
+ *
+ * Gets the result from the asynchronous function.
+ *
+ * Return value: %TRUE if the pixels were successfully transformed.
+ *
+ * Since: 1.4.9
+ **/
+gboolean
+cd_transform_process_finish (CdTransform *transform,
+			     GAsyncResult *res,
+			     GError **error)
+{
+	g_return_val_if_fail (g_task_is_valid (res, transform), FALSE);
+	return g_task_propagate_boolean (G_TASK (res), error);
+}
 
-	/* do conversion */
-	p_in = data_in;
-	p_out = data_out;
-	rows_to_process = height / priv->max_threads;
-	for (i = 0; i < height; i += rows_to_process) {
-		job = g_slice_new (CdTransformJob);
-		job->p_in = p_in;
-		job->p_out = p_out;
-		job->width = width;
-		job->rowstride = rowstride;
-		if (i + rows_to_process > height)
-			job->rows_to_process = height - i;
-		else
-			job->rows_to_process = rows_to_process;
-		ret = g_thread_pool_push (pool, job, error);
-		if (!ret)
-			goto out;
-		p_in += rowstride * rows_to_process * priv->bpp_input;
-		p_out += rowstride * rows_to_process * priv->bpp_output;
-	}
-out:
-	if (pool != NULL)
-		g_thread_pool_free (pool, FALSE, TRUE);
-	return ret;
+/**
+ * cd_transform_get_progress:
+ * @transform: a #CdTransform instance.
+ *
+ * Gets how much of the image passed to the last call to
+ * cd_transform_process() or cd_transform_process_async() has been converted.
+ * This can be called from any thread.
+ *
+ * Return value: a fraction from 0.0 to 1.0
+ *
+ * Since: 1.4.9
+ **/
+gdouble
+cd_transform_get_progress (CdTransform *transform)
+{
+	CdTransformPrivate *priv = GET_PRIVATE (transform);
+	gint done;
+	gint total;
+
+	g_return_val_if_fail (CD_IS_TRANSFORM (transform), 0.f);
+
+	total = g_atomic_int_get (&priv->progress_total);
+	if (total == 0)
+		return 0.f;
+	done = g_atomic_int_get (&priv->progress_done);
+	return (gdouble) MIN (done, total) / (gdouble) total;
 }
 
 static void
@@ -897,6 +2019,11 @@ cd_transform_init (CdTransform *transform)
 	priv->output_pixel_format = CD_PIXEL_FORMAT_UNKNOWN;
 	priv->srgb = cmsCreate_sRGBProfileTHR (priv->context_lcms);
 	priv->max_threads = 1;
+	g_mutex_init (&priv->pool_mutex);
+	g_mutex_init (&priv->setup_mutex);
+	g_rw_lock_init (&priv->state_lock);
+	g_mutex_init (&priv->jobs_mutex);
+	g_cond_init (&priv->jobs_cond);
 }
 
 static void
@@ -904,6 +2031,7 @@ cd_transform_finalize (GObject *object)
 {
 	CdTransform *transform = CD_TRANSFORM (object);
 	CdTransformPrivate *priv = GET_PRIVATE (transform);
+	guint i;
 
 	cmsCloseProfile (priv->srgb);
 	if (priv->input_icc != NULL)
@@ -912,8 +2040,21 @@ cd_transform_finalize (GObject *object)
 		g_object_unref (priv->output_icc);
 	if (priv->abstract_icc != NULL)
 		g_object_unref (priv->abstract_icc);
-	if (priv->lcms_transform != NULL)
-		cmsDeleteTransform (priv->lcms_transform);
+	if (priv->pool != NULL)
+		g_thread_pool_free (priv->pool, TRUE, TRUE);
+	for (i = 0; i < priv->jobs_size; i++) {
+		g_free (priv->jobs[i].scratch_in);
+		g_free (priv->jobs[i].scratch_out);
+	}
+	g_free (priv->jobs);
+	g_free (priv->tiles_next);
+	g_free (priv->devicelink_dir);
+	g_mutex_clear (&priv->pool_mutex);
+	g_mutex_clear (&priv->setup_mutex);
+	g_rw_lock_clear (&priv->state_lock);
+	g_mutex_clear (&priv->jobs_mutex);
+	g_cond_clear (&priv->jobs_cond);
+	cd_transform_clear_state (transform);
 	cd_context_lcms_free (priv->context_lcms);
 
 	G_OBJECT_CLASS (cd_transform_parent_class)->finalize (object);
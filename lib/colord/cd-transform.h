@@ -99,6 +99,22 @@ gboolean	 cd_transform_get_bpc			(CdTransform	*transform);
 void		 cd_transform_set_max_threads		(CdTransform	*transform,
 							 guint		 max_threads);
 guint		 cd_transform_get_max_threads		(CdTransform	*transform);
+void		 cd_transform_set_numa_aware		(CdTransform	*transform,
+							 gboolean	 numa_aware);
+gboolean	 cd_transform_get_numa_aware		(CdTransform	*transform);
+GArray		*cd_transform_get_tile_counts		(CdTransform	*transform);
+void		 cd_transform_set_devicelink_dir	(CdTransform	*transform,
+							 const gchar	*devicelink_dir);
+const gchar	*cd_transform_get_devicelink_dir	(CdTransform	*transform);
+CdIcc		*cd_transform_get_devicelink		(CdTransform	*transform,
+							 GError		**error);
+
+void		 cd_transform_cache_set_max_size	(gsize		 max_size);
+gsize		 cd_transform_cache_get_max_size	(void);
+gsize		 cd_transform_cache_get_size		(void);
+guint64		 cd_transform_cache_get_hits		(void);
+guint64		 cd_transform_cache_get_misses		(void);
+void		 cd_transform_cache_clear		(void);
 gboolean	 cd_transform_process			(CdTransform	*transform,
 							 gpointer	 data_in,
 							 gpointer	 data_out,
@@ -108,6 +124,30 @@ gboolean	 cd_transform_process			(CdTransform	*transform,
 							 GCancellable	*cancellable,
 							 GError		**error)
 							 G_GNUC_WARN_UNUSED_RESULT;
+gboolean	 cd_transform_process_planes		(CdTransform	*transform,
+							 gpointer	*planes_in,
+							 const gsize	*strides_in,
+							 gpointer	*planes_out,
+							 const gsize	*strides_out,
+							 guint		 width,
+							 guint		 height,
+							 GCancellable	*cancellable,
+							 GError		**error)
+							 G_GNUC_WARN_UNUSED_RESULT;
+void		 cd_transform_process_async		(CdTransform	*transform,
+							 gpointer	 data_in,
+							 gpointer	 data_out,
+							 guint		 width,
+							 guint		 height,
+							 guint		 rowstride,
+							 GCancellable	*cancellable,
+							 GAsyncReadyCallback callback,
+							 gpointer	 user_data);
+gboolean	 cd_transform_process_finish		(CdTransform	*transform,
+							 GAsyncResult	*res,
+							 GError		**error)
+							 G_GNUC_WARN_UNUSED_RESULT;
+gdouble		 cd_transform_get_progress		(CdTransform	*transform);
 
 G_END_DECLS
 
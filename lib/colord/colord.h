@@ -59,6 +59,7 @@
 #include <colord/cd-sensor-sync.h>
 #include <colord/cd-spectrum.h>
 #include <colord/cd-transform.h>
+#include <colord/cd-transform-stream.h>
 #include <colord/cd-version.h>
 
 #undef __COLORD_H_INSIDE__
@@ -1648,6 +1648,10 @@ cd_main_icc_store_added_cb (CdIccStore *icc_store,
 		return;
 	}
 
+	/* devices may already exist as profiles are found in the background */
+	cd_main_profile_auto_add_from_db (priv, profile);
+	cd_main_profile_auto_add_from_md (priv, profile);
+
 	/* register on bus */
 	ret = cd_main_profile_register_on_bus (priv,
 					       profile,
@@ -1677,6 +1681,24 @@ cd_main_icc_store_removed_cb (CdIccStore *icc_store,
 	cd_profile_array_remove (priv->profiles_array, profile);
 }
 
+static void
+cd_main_icc_store_changed_cb (CdIccStore *icc_store, gpointer user_data)
+{
+	CdMainPrivate *priv = (CdMainPrivate *) user_data;
+
+	/* one signal for each batch of profiles installed or removed; the
+	 * per-profile ProfileAdded and ProfileRemoved are still emitted
+	 * before this for existing clients */
+	g_debug ("CdMain: Emitting Changed()");
+	g_dbus_connection_emit_signal (priv->connection,
+				       NULL,
+				       COLORD_DBUS_PATH,
+				       COLORD_DBUS_INTERFACE,
+				       "Changed",
+				       NULL,
+				       NULL);
+}
+
 static void
 cd_main_add_disk_device (CdMainPrivate *priv, const gchar *device_id)
 {
@@ -1845,6 +1867,22 @@ cd_main_plugin_phase (CdMainPrivate *priv, CdPluginPhase phase)
 	}
 }
 
+static void
+cd_main_icc_store_search_cb (GObject *source,
+			     GAsyncResult *res,
+			     gpointer user_data)
+{
+	const gchar *kind = (const gchar *) user_data;
+	g_autoptr(GError) error = NULL;
+
+	if (!cd_icc_store_search_kind_finish (CD_ICC_STORE (source), res, &error)) {
+		g_warning ("CdMain: failed to search %s directories: %s",
+			   kind, error->message);
+		return;
+	}
+	g_debug ("CdMain: finished searching %s directories", kind);
+}
+
 static void
 cd_main_on_name_acquired_cb (GDBusConnection *connection,
 			     const gchar *name,
@@ -1862,36 +1900,35 @@ cd_main_on_name_acquired_cb (GDBusConnection *connection,
 
 	/* add system profiles */
 	priv->icc_store = cd_icc_store_new ();
-	cd_icc_store_set_load_flags (priv->icc_store, CD_ICC_LOAD_FLAGS_FALLBACK_MD5);
+	cd_icc_store_set_load_flags (priv->icc_store,
+				     CD_ICC_LOAD_FLAGS_FALLBACK_MD5 |
+				     CD_ICC_LOAD_FLAGS_HEADER_ONLY);
 	cd_icc_store_set_cache (priv->icc_store, cd_get_resource ());
+	cd_icc_store_set_index_filename (priv->icc_store,
+					 LOCALSTATEDIR "/lib/colord/profile-index.gvariant");
 	g_signal_connect (priv->icc_store, "added",
 			  G_CALLBACK (cd_main_icc_store_added_cb),
 			  user_data);
 	g_signal_connect (priv->icc_store, "removed",
 			  G_CALLBACK (cd_main_icc_store_removed_cb),
 			  user_data);
+	g_signal_connect (priv->icc_store, "changed",
+			  G_CALLBACK (cd_main_icc_store_changed_cb),
+			  user_data);
 
-	/* search locations for ICC profiles */
-	ret = cd_icc_store_search_kind (priv->icc_store,
+	/* search locations for ICC profiles, which are added as they are found */
+	cd_icc_store_search_kind_async (priv->icc_store,
 					CD_ICC_STORE_SEARCH_KIND_SYSTEM,
 					CD_ICC_STORE_SEARCH_FLAGS_NONE,
 					NULL,
-					&error);
-	if (!ret) {
-		g_warning ("CdMain: failed to search system directories: %s",
-			    error->message);
-		return;
-	}
-	ret = cd_icc_store_search_kind (priv->icc_store,
+					cd_main_icc_store_search_cb,
+					(gpointer) "system");
+	cd_icc_store_search_kind_async (priv->icc_store,
 					CD_ICC_STORE_SEARCH_KIND_MACHINE,
 					CD_ICC_STORE_SEARCH_FLAGS_NONE,
 					NULL,
-					&error);
-	if (!ret) {
-		g_warning ("CdMain: failed to search machine directories: %s",
-			    error->message);
-		return;
-	}
+					cd_main_icc_store_search_cb,
+					(gpointer) "machine");
 
 	/* add disk devices */
 	array_devices = cd_device_db_get_devices (priv->device_db, &error);
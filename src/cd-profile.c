@@ -817,15 +817,14 @@ cd_profile_set_from_profile (CdProfile *profile, CdIcc *icc, GError **error)
 	CdProfilePrivate *priv = GET_PRIVATE (profile);
 	CdProfileWarning warning;
 	GList *l;
-	cmsHPROFILE lcms_profile;
 	const gchar *key;
 	const gchar *value;
-	gboolean ret = FALSE;
 	guint i;
-	struct tm created;
 	g_autoptr(GArray) flags = NULL;
+	g_autoptr(GDateTime) created = NULL;
 	g_autoptr(GHashTable) metadata = NULL;
 	g_autoptr(GList) keys = NULL;
+	g_auto(GStrv) tags = NULL;
 
 	/* get the description as the title */
 	value = cd_icc_get_description (icc, NULL, error);
@@ -869,18 +868,17 @@ cd_profile_set_from_profile (CdProfile *profile, CdIcc *icc, GError **error)
 	}
 
 	/* get the profile created time and date */
-	lcms_profile = cd_icc_get_handle (icc);
-	ret = cmsGetHeaderCreationDateTime (lcms_profile, &created);
-	if (ret) {
-		created.tm_isdst = -1;
-		priv->created = mktime (&created);
+	created = cd_icc_get_created (icc);
+	if (created != NULL) {
+		priv->created = g_date_time_to_unix (created);
 	} else {
 		g_warning ("failed to get created time");
 		priv->created = 0;
 	}
 
 	/* do we have vcgt */
-	priv->has_vcgt = cmsIsTag (lcms_profile, cmsSigVcgtTag);
+	tags = cd_icc_get_tags (icc, NULL);
+	priv->has_vcgt = tags != NULL && g_strv_contains ((const gchar * const *) tags, "vcgt");
 
 	/* get the checksum for the profile if we can */
 	priv->checksum = g_strdup (cd_icc_get_checksum (icc));